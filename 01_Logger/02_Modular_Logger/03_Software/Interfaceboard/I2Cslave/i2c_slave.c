@@ -15,23 +15,50 @@
 void (*TI_receive_callback)(unsigned char receive);
 void (*TI_transmit_callback)(unsigned char volatile *send_next);
 void (*TI_start_callback)(void);
+void (*TI_group_callback)(unsigned char receive);
+
+/* own address 1: every interface board, own addresses 2 and 3: groups (0 = not used) */
+static void setOwnAddresses(unsigned char slave_address, const unsigned char *group_addresses)
+{
+    UCB0I2COA0 = slave_address | UCOAEN; // Own Address is $address
+    UCB0I2COA1 = GROUP_ADDRESS_BASE | UCOAEN;
+    UCB0I2COA2 = group_addresses[0] ? (group_addresses[0] | UCOAEN) : 0;
+    UCB0I2COA3 = group_addresses[1] ? (group_addresses[1] | UCOAEN) : 0;
+}
+
+static unsigned char own_address = 0;
 
 void I2C_slaveInit(void (*SCallback)(),
                    void (*TCallback)(unsigned char volatile *value),
                    void (*RCallback)(unsigned char value),
-                   unsigned char slave_address)
+                   void (*GCallback)(unsigned char value),
+                   unsigned char slave_address,
+                   const unsigned char *group_addresses)
 {
     UCB0CTLW0 = UCSWRST; // put eUSCI_B in reset state
     UCB0CTLW0 |= UCMODE_3 | UCSYNC;
     ;                                    // I2C Slave, synchronous mode
-    UCB0I2COA0 = slave_address | UCOAEN; // Own Address is $address
+    own_address = slave_address;
+    setOwnAddresses(slave_address, group_addresses);
 
     UCB0CTLW0 &= ~UCSWRST;                          // eUSCI_B in operational state
     UCB0IE |= UCSTTIE | UCTXIE0 | UCSTPIE | UCRXIE; // UCSTTIE + UCTXIE + UCRXIE;       // enable TX&RX-interrupt
+    UCB0IE |= UCRXIE1 | UCRXIE2 | UCRXIE3 | UCTXIE1 | UCTXIE2 | UCTXIE3; // group addresses
 
     TI_start_callback = SCallback;
     TI_receive_callback = RCallback;
     TI_transmit_callback = TCallback;
+    TI_group_callback = GCallback;
+}
+
+/* call only while the bus is idle (after the stop condition) */
+void I2C_slaveSetGroups(const unsigned char *group_addresses)
+{
+    UCB0CTLW0 |= UCSWRST; // own addresses are changed in reset state
+    setOwnAddresses(own_address, group_addresses);
+    UCB0CTLW0 &= ~UCSWRST;
+    UCB0IE |= UCSTTIE | UCTXIE0 | UCSTPIE | UCRXIE;
+    UCB0IE |= UCRXIE1 | UCRXIE2 | UCRXIE3 | UCTXIE1 | UCTXIE2 | UCTXIE3;
 }
 
 #if defined(__TI_COMPILER_VERSION__) || defined(__IAR_SYSTEMS_ICC__)
@@ -60,17 +87,15 @@ void __attribute__((interrupt(USCI_B0_VECTOR))) USCIB0_ISR(void)
         UCB0IFG &= ~UCSTPIFG; // clear stop bit flag
         LPM0_EXIT;            // Exit active CPU
         break;
-    case USCI_I2C_UCRXIFG3: // Vector 10: RXIFG3
+    case USCI_I2C_UCRXIFG3: // Vector 10: RXIFG3 group address
+    case USCI_I2C_UCRXIFG2: // Vector 14: RXIFG2 group address
+    case USCI_I2C_UCRXIFG1: // Vector 18: RXIFG1 every interface board
+        TI_group_callback(UCB0RXBUF);
         break;
     case USCI_I2C_UCTXIFG3: // Vector 12: TXIFG3
-        break;
-    case USCI_I2C_UCRXIFG2: // Vector 14: RXIFG2
-        break;
     case USCI_I2C_UCTXIFG2: // Vector 16: TXIFG2
-        break;
-    case USCI_I2C_UCRXIFG1: // Vector 18: RXIFG1
-        break;
     case USCI_I2C_UCTXIFG1: // Vector 20: TXIFG1
+        UCB0TXBUF = RES_ERROR; // group addresses are not read
         break;
     case USCI_I2C_UCRXIFG0: // Vector 22: RXIFG0 Data received
         TI_receive_callback(UCB0RXBUF);
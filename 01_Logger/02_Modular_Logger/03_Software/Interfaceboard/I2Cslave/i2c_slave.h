@@ -34,6 +34,11 @@ enum CMD_LIST
   CMD_GET_FW_VERSION = 0x20,
   CMD_SOFTWARE_RESET = 0x21,
   CMD_GET_EXTERNPARAMETER = 0x22,
+  CMD_GET_SAMPLE1 = 0x23, // ready, sequence, error, value 1 and raw value 1 in one frame
+  CMD_GET_SAMPLE2 = 0x24, // the same for value 2
+  CMD_SET_GROUPS = 0x25,  // 2 bytes: cmd, group bits (bit n: group address GROUP_ADDRESS_BASE + n)
+  CMD_CONVERT_SAMPLE1 = 0x26, // sample frame of the last conversion, starts the next one
+  CMD_CONVERT_SAMPLE2 = 0x27, // the same for value 2
   CMD_PING = 0xAA, // master wants a answer byte (seems to be unnecessary, because of getver)
 
   CMD_1ByteDummyTest = 0xFE,
@@ -49,6 +54,37 @@ enum RES_LIST
   RES_ERROR = 0xFF,
 };
 
+// Sample frame of CMD_GET_SAMPLE1/2, in the order it is sent:
+// ready (like CMD_GET_RDY), sequence number of the conversion, error bits,
+// value (4 byte), raw value (4 byte), CRC-8 (polynomial 0x07) over the bytes before.
+// Sequence, error and values are taken from the last finished conversion,
+// a conversion in progress writes the other of two buffers.
+#define SAMPLE_FRAME_SIZE 12
+
+// Error bits of the sample frame
+enum SAMPLE_ERROR_LIST
+{
+  SAMPLE_ERROR_CONVERSION = 0x01,  // startConversion() failed
+  SAMPLE_ERROR_RAW = 0x02,         // getRAWValue() failed
+  SAMPLE_ERROR_CALCULATION = 0x04, // getCalculatedValue() failed
+};
+
+// Feature bits, second byte of CMD_GET_FW_VERSION (bit 7 is always 0,
+// an interface board without feature byte sends RES_ERROR)
+enum FEATURE_LIST
+{
+  FEATURE_SAMPLE_FRAME = 0x01, // CMD_GET_SAMPLE1/2
+  FEATURE_GROUPS = 0x02,       // group addresses, CMD_SET_GROUPS
+  FEATURE_CONVERT_SAMPLE = 0x04, // CMD_CONVERT_SAMPLE1/2
+};
+
+// Group addresses, above the addresses of the dip switches (0x00..0x1F).
+// CMD_CONVERT, CMD_SENSOR_WAKEUP and CMD_SENSOR_SLEEP written to a group
+// address reach every board of the group in the same transaction. The
+// general call address is not used, 0x00 is also the address of a board.
+#define GROUP_ADDRESS_BASE 0x70 // group 0: every interface board
+#define GROUP_SLOTS 2           // groups 1..7 a board can be in at the same time
+
 // Parameter list
 enum PAR_LIST
 {
@@ -60,6 +96,10 @@ enum PAR_LIST
 void I2C_slaveInit(void (*SCallback)(),
                    void (*TCallback)(unsigned char volatile *value),
                    void (*RCallback)(unsigned char value),
-                   unsigned char slave_address);
+                   void (*GCallback)(unsigned char value),
+                   unsigned char slave_address,
+                   const unsigned char *group_addresses);
+
+void I2C_slaveSetGroups(const unsigned char *group_addresses);
 
 #endif /* I2CSLAVE_I2C_SLAVE_H_ */
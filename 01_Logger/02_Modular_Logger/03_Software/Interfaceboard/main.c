@@ -36,26 +36,43 @@ void receive_cb(unsigned char receive);
 /* callback to transmit bytes */
 void transmit_cb(unsigned char volatile *byte);
 
+/* callback for bytes received on a group address */
+void group_receive_cb(unsigned char receive);
+
 /* last command */
 volatile uint8_t cmd = CMD_UNKNOWN;
 
 /* last parameter */
 volatile uint8_t par[5] = {PAR_UNKNOWN, PAR_UNKNOWN, PAR_UNKNOWN, PAR_UNKNOWN, PAR_UNKNOWN};
 
-/* response to send out on read req. */
-volatile uint8_t res[8] = {RES_ERROR, RES_ERROR, RES_ERROR, RES_ERROR, RES_ERROR, RES_ERROR, RES_ERROR, RES_ERROR};
+/* response to send out on read req., sent from the last byte to the first */
+volatile uint8_t res[SAMPLE_FRAME_SIZE] = {RES_ERROR, RES_ERROR, RES_ERROR, RES_ERROR, RES_ERROR, RES_ERROR, RES_ERROR, RES_ERROR, RES_ERROR, RES_ERROR, RES_ERROR, RES_ERROR};
 
 volatile uint8_t byteCount = 0;
 uint8_t FW_VERSION = 0;
 uint32_t version = 0x0;
 uint8_t parameter = 0xFF;
 uint8_t externparameter = 0xFF;
-volatile int64_t values[2] = {0, 0};
-volatile int64_t rawValues[2] = {0, 0};
-volatile uint8_t startConversion = 1; // used as command flag and readyflag and errorflag
+volatile uint8_t startConversion = 1; // used as readyflag and errorflag
                                       // 0: conversion in progress
                                       // 1: nothing happening / ready
                                       // 2: fault in conversion
+volatile bool convertRequest = false; // CMD_CONVERT received, also during a conversion
+
+/* result of one conversion */
+typedef struct
+{
+    int64_t values[2];
+    int64_t rawValues[2];
+    uint8_t sequence; // counts the finished conversions
+    uint8_t error;    // SAMPLE_ERROR_LIST bits
+} sample_t;
+
+/* the main loop converts into samples[publishedSample ^ 1], the i2c
+ * interrupt reads samples[publishedSample] only. Swapping the index is a
+ * single byte write, a read never sees half of a conversion. */
+volatile sample_t samples[2] = {{{0, 0}, {0, 0}, 0, 0}, {{0, 0}, {0, 0}, 0, 0}};
+volatile uint8_t publishedSample = 0;
 volatile int32_t lastTemperature = -2999; // last Temperature in centigrad
 volatile bool setTemperature = false;
 volatile bool setCalib = false;
@@ -65,12 +82,74 @@ volatile bool wakeUp = false;
 volatile bool sleepOrWarmup = false;
 volatile uint8_t calibToSet = 0;
 volatile float floatToSet = 0.0;
+volatile bool setGroups = false;
+volatile uint8_t groupsToSet = 0;
+
+// Group addresses (CMD_SET_GROUPS), kept in FRAM over resets and power cycles
+#if defined(__TI_COMPILER_VERSION__)
+#pragma PERSISTENT(groupAddresses)
+uint8_t groupAddresses[GROUP_SLOTS] = {0, 0};
+#else
+uint8_t __attribute__((persistent)) groupAddresses[GROUP_SLOTS] = {0, 0};
+#endif
 
 // Sensor WakeUp Time
 uint16_t sensorWakeUpTime = 0;
 
+/* CRC-8 of the sample frame, polynomial 0x07 */
+uint8_t crc8(const uint8_t *data, uint8_t length)
+{
+    uint8_t crc = 0;
+    uint8_t i, bit;
+    for (i = 0; i < length; i++)
+    {
+        crc ^= data[i];
+        for (bit = 0; bit < 8; bit++)
+        {
+            if (crc & 0x80)
+                crc = (crc << 1) ^ 0x07;
+            else
+                crc <<= 1;
+        }
+    }
+    return crc;
+}
+
+/* ready, values and error of the last conversion in one response (SAMPLE_FRAME_SIZE bytes) */
+void set_sample_frame(uint8_t valueNo)
+{
+    const volatile sample_t *sample = &samples[publishedSample];
+    uint8_t frame[SAMPLE_FRAME_SIZE];
+    uint32_t value = (uint32_t)sample->values[valueNo];
+    uint32_t rawValue = (uint32_t)sample->rawValues[valueNo];
+    uint8_t i;
+
+    // the logger uses the lower 4 bytes only: the float of the value and the raw value of the ADC
+    if (setCalib || setTemperature || sleepOrWarmup)
+        frame[0] = 0;
+    else
+        frame[0] = startConversion;
+    frame[1] = sample->sequence;
+    frame[2] = sample->error;
+    frame[3] = (value >> 24) & 0xFF;
+    frame[4] = (value >> 16) & 0xFF;
+    frame[5] = (value >> 8) & 0xFF;
+    frame[6] = value & 0xFF;
+    frame[7] = (rawValue >> 24) & 0xFF;
+    frame[8] = (rawValue >> 16) & 0xFF;
+    frame[9] = (rawValue >> 8) & 0xFF;
+    frame[10] = rawValue & 0xFF;
+    frame[11] = crc8(frame, SAMPLE_FRAME_SIZE - 1);
+
+    // transmit_cb sends res[byteCount - 1] first
+    byteCount = SAMPLE_FRAME_SIZE;
+    for (i = 0; i < SAMPLE_FRAME_SIZE; i++)
+        res[SAMPLE_FRAME_SIZE - 1 - i] = frame[i];
+}
+
 void process_cmd(unsigned char cmd, unsigned char *par0)
 {
+    const volatile sample_t *sample = &samples[publishedSample];
     res[0] = RES_ERROR;
 
     union
@@ -131,59 +210,78 @@ void process_cmd(unsigned char cmd, unsigned char *par0)
         break;
 
     case CMD_GET_FW_VERSION:
-        byteCount = 1;
-        res[0] = FW_VERSION;
+        // a master that reads one byte gets the FW version only
+        byteCount = 2;
+        res[1] = FW_VERSION;
+        res[0] = FEATURE_SAMPLE_FRAME | FEATURE_GROUPS | FEATURE_CONVERT_SAMPLE;
+        break;
+
+    case CMD_GET_SAMPLE1:
+        set_sample_frame(0);
+        break;
+
+    case CMD_GET_SAMPLE2:
+        set_sample_frame(1);
+        break;
+
+    case CMD_CONVERT_SAMPLE1:
+    case CMD_CONVERT_SAMPLE2:
+        // the master reads sample N while the board converts sample N+1
+        set_sample_frame(cmd == CMD_CONVERT_SAMPLE2 ? 1 : 0);
+        convertRequest = true;
+        startConversion = 0;
         break;
 
     case CMD_GETVALUE1:
         byteCount = 8;
-        res[0] = values[0] & 0xFF;
-        res[1] = (values[0] & 0xFF00) >> 8;
-        res[2] = (values[0] & 0xFF0000) >> 16;
-        res[3] = (values[0] & 0xFF000000) >> 24;
-        res[4] = (values[0] & 0xFF00000000) >> 32;
-        res[5] = (values[0] & 0xFF0000000000) >> 40;
-        res[6] = (values[0] & 0xFF000000000000) >> 48;
-        res[7] = (values[0] & 0xFF00000000000000) >> 56;
+        res[0] = sample->values[0] & 0xFF;
+        res[1] = (sample->values[0] & 0xFF00) >> 8;
+        res[2] = (sample->values[0] & 0xFF0000) >> 16;
+        res[3] = (sample->values[0] & 0xFF000000) >> 24;
+        res[4] = (sample->values[0] & 0xFF00000000) >> 32;
+        res[5] = (sample->values[0] & 0xFF0000000000) >> 40;
+        res[6] = (sample->values[0] & 0xFF000000000000) >> 48;
+        res[7] = (sample->values[0] & 0xFF00000000000000) >> 56;
         break;
 
     case CMD_GETVALUE2:
         byteCount = 8;
-        res[0] = values[1] & 0xFF;
-        res[1] = (values[1] & 0xFF00) >> 8;
-        res[2] = (values[1] & 0xFF0000) >> 16;
-        res[3] = (values[1] & 0xFF000000) >> 24;
-        res[4] = (values[1] & 0xFF00000000) >> 32;
-        res[5] = (values[1] & 0xFF0000000000) >> 40;
-        res[6] = (values[1] & 0xFF000000000000) >> 48;
-        res[7] = (values[1] & 0xFF00000000000000) >> 56;
+        res[0] = sample->values[1] & 0xFF;
+        res[1] = (sample->values[1] & 0xFF00) >> 8;
+        res[2] = (sample->values[1] & 0xFF0000) >> 16;
+        res[3] = (sample->values[1] & 0xFF000000) >> 24;
+        res[4] = (sample->values[1] & 0xFF00000000) >> 32;
+        res[5] = (sample->values[1] & 0xFF0000000000) >> 40;
+        res[6] = (sample->values[1] & 0xFF000000000000) >> 48;
+        res[7] = (sample->values[1] & 0xFF00000000000000) >> 56;
         break;
 
     case CMD_GETRAWVALUE1:
         byteCount = 8;
-        res[0] = rawValues[0] & 0xFF;
-        res[1] = (rawValues[0] & 0xFF00) >> 8;
-        res[2] = (rawValues[0] & 0xFF0000) >> 16;
-        res[3] = (rawValues[0] & 0xFF000000) >> 24;
-        res[4] = (rawValues[0] & 0xFF00000000) >> 32;
-        res[5] = (rawValues[0] & 0xFF0000000000) >> 40;
-        res[6] = (rawValues[0] & 0xFF000000000000) >> 48;
-        res[7] = (rawValues[0] & 0xFF00000000000000) >> 56;
+        res[0] = sample->rawValues[0] & 0xFF;
+        res[1] = (sample->rawValues[0] & 0xFF00) >> 8;
+        res[2] = (sample->rawValues[0] & 0xFF0000) >> 16;
+        res[3] = (sample->rawValues[0] & 0xFF000000) >> 24;
+        res[4] = (sample->rawValues[0] & 0xFF00000000) >> 32;
+        res[5] = (sample->rawValues[0] & 0xFF0000000000) >> 40;
+        res[6] = (sample->rawValues[0] & 0xFF000000000000) >> 48;
+        res[7] = (sample->rawValues[0] & 0xFF00000000000000) >> 56;
         break;
 
     case CMD_GETRAWVALUE2:
         byteCount = 8;
-        res[0] = rawValues[1] & 0xFF;
-        res[1] = (rawValues[1] & 0xFF00) >> 8;
-        res[2] = (rawValues[1] & 0xFF0000) >> 16;
-        res[3] = (rawValues[1] & 0xFF000000) >> 24;
-        res[4] = (rawValues[1] & 0xFF00000000) >> 32;
-        res[5] = (rawValues[1] & 0xFF0000000000) >> 40;
-        res[6] = (rawValues[1] & 0xFF000000000000) >> 48;
-        res[7] = (rawValues[1] & 0xFF00000000000000) >> 56;
+        res[0] = sample->rawValues[1] & 0xFF;
+        res[1] = (sample->rawValues[1] & 0xFF00) >> 8;
+        res[2] = (sample->rawValues[1] & 0xFF0000) >> 16;
+        res[3] = (sample->rawValues[1] & 0xFF000000) >> 24;
+        res[4] = (sample->rawValues[1] & 0xFF00000000) >> 32;
+        res[5] = (sample->rawValues[1] & 0xFF0000000000) >> 40;
+        res[6] = (sample->rawValues[1] & 0xFF000000000000) >> 48;
+        res[7] = (sample->rawValues[1] & 0xFF00000000000000) >> 56;
         break;
 
     case CMD_CONVERT:
+        convertRequest = true;
         startConversion = 0;
         break;
 
@@ -206,6 +304,11 @@ void process_cmd(unsigned char cmd, unsigned char *par0)
         setCalib = true;
         break;
 
+    case CMD_SET_GROUPS:
+        groupsToSet = par[0];
+        setGroups = true;
+        break;
+
     case CMD_SENSOR_WAKEUP:
         wakeUp = true;
         res[0] = RES_PONG;
@@ -282,6 +385,10 @@ void receive_cb(unsigned char receive)
             cmd == CMD_GET_CALIBRATED ||
             cmd == CMD_GET_SENSOR_WAKEUP_TIME ||
             cmd == CMD_GET_FW_VERSION ||
+            cmd == CMD_GET_SAMPLE1 ||
+            cmd == CMD_GET_SAMPLE2 ||
+            cmd == CMD_CONVERT_SAMPLE1 ||
+            cmd == CMD_CONVERT_SAMPLE2 ||
             cmd == CMD_SOFTWARE_RESET)
         {
             process_cmd(cmd, (uint8_t *)par);
@@ -293,7 +400,7 @@ void receive_cb(unsigned char receive)
         byteCount++;
         // byte is a parameter of the command
         // process 2 byte commands (1 byte command, 1 byte parameter)
-        if (cmd == CMD_1ByteDummyTest)
+        if (cmd == CMD_1ByteDummyTest || cmd == CMD_SET_GROUPS)
         {
             par[0] = receive;
             process_cmd(cmd, (uint8_t *)par);
@@ -343,6 +450,43 @@ void receive_cb(unsigned char receive)
     }
 }
 
+void group_receive_cb(unsigned char receive)
+{
+    // one byte commands without answer only, every board of the group gets them at the same time
+    if (cmd != CMD_UNKNOWN)
+        return;
+    cmd = receive;
+    if (cmd == CMD_CONVERT ||
+        cmd == CMD_SENSOR_WAKEUP ||
+        cmd == CMD_SENSOR_SLEEP)
+    {
+        process_cmd(cmd, (uint8_t *)par);
+    }
+}
+
+/* group addresses of the first GROUP_SLOTS group bits (group 1..7), saved in FRAM */
+void apply_groups(uint8_t groups)
+{
+    uint8_t addresses[GROUP_SLOTS] = {0, 0};
+    uint8_t slot = 0;
+    uint8_t group;
+
+    for (group = 1; group < 8 && slot < GROUP_SLOTS; group++)
+    {
+        if (groups & (1 << group))
+            addresses[slot++] = GROUP_ADDRESS_BASE + group;
+    }
+
+    if (addresses[0] != groupAddresses[0] || addresses[1] != groupAddresses[1])
+    {
+        SYSCFG0 = FRWPPW | DFWP; // program FRAM write enable
+        groupAddresses[0] = addresses[0];
+        groupAddresses[1] = addresses[1];
+        SYSCFG0 = FRWPPW | PFWP | DFWP; // program FRAM write protected
+    }
+    I2C_slaveSetGroups(groupAddresses);
+}
+
 void transmit_cb(unsigned char volatile *byte)
 {
     if (byteCount > 0)
@@ -359,7 +503,7 @@ int main(void)
     WDTCTL = WDTPW | WDTHOLD; // stop watchdog timer
     setPins();                // set input and output Pins
     // init slave interface with set i2c address (dip switches)
-    I2C_slaveInit(start_cb, transmit_cb, receive_cb, getOwnI2CAddress());
+    I2C_slaveInit(start_cb, transmit_cb, receive_cb, group_receive_cb, getOwnI2CAddress(), groupAddresses);
     __bis_SR_register(GIE);
 
     // Select Sensor via SELECTED_SENSOR in sesnor_config.h
@@ -414,7 +558,11 @@ int main(void)
 
     while (1) // endless loop waiting for i2c command
     {
-        LPM0; // Wait for stop bit in LPM0
+        // Wait for stop bit in LPM0, not if a CMD_CONVERT came during the last conversion
+        __disable_interrupt();
+        if (!convertRequest)
+            __bis_SR_register(LPM0_bits | GIE);
+        __enable_interrupt();
         while (UCB0CTL1 & UCTXSTP)
             ; // Ensure stop condition exists
         // check I2C command
@@ -446,6 +594,11 @@ int main(void)
             sleepOrWarmup = false;
             wakeUp = false;
         }
+        if (setGroups)
+        {
+            apply_groups(groupsToSet);
+            setGroups = false;
+        }
         if (setTemperature)
         {
             sensor.setTemperature(lastTemperature);
@@ -457,30 +610,45 @@ int main(void)
             calibrated = sensor.getCalibrated();
             setCalib = false;
         }
-        if (startConversion == 0)
+        if (convertRequest)
         {
+            uint8_t back = publishedSample ^ 1;
+            volatile sample_t *next = &samples[back];
+            uint8_t error = 0;
+
+            convertRequest = false;
+            // the back buffer still holds an older conversion, start from the published values
+            next->values[0] = samples[publishedSample].values[0];
+            next->values[1] = samples[publishedSample].values[1];
+            next->rawValues[0] = samples[publishedSample].rawValues[0];
+            next->rawValues[1] = samples[publishedSample].rawValues[1];
 
             if (!sensor.startConversion())
             {
-                startConversion = 2;
+                error |= SAMPLE_ERROR_CONVERSION;
                 // sensor.init();
                 // WDTCTL = 0xDEAD;
             }
 
-            if (!sensor.getRAWValue((int64_t *)rawValues)) // first get raw value, some drivers get value when this is called
+            if (!sensor.getRAWValue((int64_t *)next->rawValues)) // first get raw value, some drivers get value when this is called
             {
-                startConversion = 2;
+                error |= SAMPLE_ERROR_RAW;
             }
 
-            if (!sensor.getCalculatedValue((int64_t *)values)) // get calculated (calibrated) value
+            if (!sensor.getCalculatedValue((int64_t *)next->values)) // get calculated (calibrated) value
             {
-                startConversion = 2;
+                error |= SAMPLE_ERROR_CALCULATION;
             }
 
-            if (startConversion == 0) // if all was good, we set to 1, -> values are ready
-            {
-                startConversion = 1;
-            }
+            next->error = error;
+            next->sequence = samples[publishedSample].sequence + 1;
+
+            // publish the sample, a CMD_CONVERT since the start keeps the board in progress
+            __disable_interrupt();
+            publishedSample = back;
+            if (!convertRequest)
+                startConversion = error ? 2 : 1; // if all was good, we set to 1, -> values are ready
+            __enable_interrupt();
         }
     }
     // return 0;
@@ -33,6 +33,11 @@ enum CMD_LIST
   CMD_GET_SENSOR_WAKEUP_TIME = 0x19,
   CMD_GET_FW_VERSION = 0x20,
   CMD_SOFTWARE_RESET = 0x21,
+  CMD_GET_SAMPLE1 = 0x23, // ready, sequence, error, value 1 and raw value 1 in one frame
+  CMD_GET_SAMPLE2 = 0x24, // the same for value 2
+  CMD_SET_GROUPS = 0x25,  // 2 bytes: cmd, group bits (bit n: group address GROUP_ADDRESS_BASE + n)
+  CMD_CONVERT_SAMPLE1 = 0x26, // sample frame of the last conversion, starts the next one
+  CMD_CONVERT_SAMPLE2 = 0x27, // the same for value 2
   CMD_PING = 0xAA,      // master wants a answer byte (seems to be unnecessary, because of getver)
 
   CMD_1ByteDummyTest = 0xFE,
@@ -69,3 +74,29 @@ enum CMD_LIST
 // 0x04 Conductivity
 // 0x05 Turbidity
 // 0x06 tbd...
+
+//* CMD_GET_FW_VERSION
+// 1st byte: FW version, 2nd byte: feature bits (bit 7 is always 0, 0xFF from an interface board without feature byte)
+// 0x01 CMD_GET_SAMPLE1/2 (FEATURE_SAMPLE_FRAME)
+// 0x02 group addresses, CMD_SET_GROUPS (FEATURE_GROUPS)
+// 0x04 CMD_CONVERT_SAMPLE1/2 (FEATURE_CONVERT_SAMPLE)
+
+//* CMD_SET_GROUPS
+// Group addresses GROUP_ADDRESS_BASE + n, above the addresses of the dip switches (0x00..0x1F).
+// Group 0 is every interface board, a board is in up to 2 of the groups 1..7 (kept in its FRAM).
+// CMD_CONVERT, CMD_SENSOR_WAKEUP and CMD_SENSOR_SLEEP written to a group address reach every board of the group at once.
+
+//* CMD_GET_SAMPLE1 / CMD_GET_SAMPLE2
+// ready (like CMD_GET_RDY), sequence number of the conversion, error bits,
+// value (4 byte), raw value (4 byte), CRC-8 (polynomial 0x07) over the bytes before (SAMPLE_FRAME_SIZE)
+// error bits
+// 0x01 startConversion() failed
+// 0x02 getRAWValue() failed
+// 0x04 getCalculatedValue() failed
+// Sequence, error and values are those of the last finished conversion, the interface board
+// converts into a second buffer and swaps the buffers at the end of the conversion.
+
+//* CMD_CONVERT_SAMPLE1 / CMD_CONVERT_SAMPLE2
+// Answers the sample frame like CMD_GET_SAMPLE1/2 and starts the next conversion like CMD_CONVERT.
+// The master reads sample N and triggers sample N+1 in one transaction, the ready byte is the state
+// before the trigger. A CMD_CONVERT during a conversion starts one more conversion after it.
@@ -124,6 +124,101 @@ uint8_t I2C_Master::getFwVersion(uint8_t address)
   return fwVersion;
 }
 
+/**
+ * @brief Asks the interface board for its feature bits.
+ * @param address Bus address of the interface board.
+ * @return uint8_t FEATURE_ bits, 0 from an interface board without feature byte.
+ */
+uint8_t I2C_Master::getFeatures(uint8_t address)
+{
+  uint8_t answer[2];
+
+  if (this->WriteRead(CMD_GET_FW_VERSION, address, answer, 2) != 0 || answer[1] == 0xFF)
+  {
+    return 0;
+  }
+  return answer[1];
+}
+
+/**
+ * @brief Calculates the CRC-8 of a sample frame (polynomial 0x07).
+ * @param data The frame without CRC.
+ * @param length Number of bytes.
+ * @return uint8_t CRC-8.
+ */
+static uint8_t sampleFrameCrc(const uint8_t *data, uint8_t length)
+{
+  uint8_t crc = 0;
+  for (uint8_t i = 0; i < length; i++)
+  {
+    crc ^= data[i];
+    for (uint8_t bit = 0; bit < 8; bit++)
+    {
+      crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+/**
+ * @brief Sends a command that answers a sample frame and checks the frame.
+ * @param command CMD_GET_SAMPLE1/2 or CMD_CONVERT_SAMPLE1/2.
+ * @param address Bus address of the interface board.
+ * @param sample The answer.
+ * @return false if no frame with a valid CRC was received, the command is retried.
+ */
+bool I2C_Master::ReadSampleFrame(uint8_t command, uint8_t address, InterfaceSample &sample)
+{
+  uint8_t frame[SAMPLE_FRAME_SIZE];
+
+  const int MAX_RETRIES = 3;
+  for (int retry = 0; retry < MAX_RETRIES; retry++)
+  {
+    if (this->WriteRead(command, address, frame, SAMPLE_FRAME_SIZE) == 0 && sampleFrameCrc(frame, SAMPLE_FRAME_SIZE - 1) == frame[SAMPLE_FRAME_SIZE - 1])
+    {
+      sample.ready = frame[0];
+      sample.sequence = frame[1];
+      sample.error = frame[2];
+      sample.value = ((uint32_t)frame[3] << 24) | ((uint32_t)frame[4] << 16) | ((uint32_t)frame[5] << 8) | frame[6];
+      sample.rawValue = (int32_t)(((uint32_t)frame[7] << 24) | ((uint32_t)frame[8] << 16) | ((uint32_t)frame[9] << 8) | frame[10]);
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief Reads ready status, value, raw value, sequence number and error of a sensor in one transaction.
+ *
+ * Replaces getRDY() and the reads of value and raw value, needs FEATURE_SAMPLE_FRAME.
+ *
+ * @param address Bus address of the interface board.
+ * @param valueNr Value 1 or 2 of the sensor.
+ * @param sample The answer.
+ * @return false if no frame with a valid CRC was received.
+ */
+bool I2C_Master::getSample(uint8_t address, uint8_t valueNr, InterfaceSample &sample)
+{
+  return this->ReadSampleFrame(valueNr == 2 ? CMD_GET_SAMPLE2 : CMD_GET_SAMPLE1, address, sample);
+}
+
+/**
+ * @brief Reads the last finished sample of a sensor and starts the next conversion in one transaction.
+ *
+ * The sample is the one of the previous trigger, its sequence number tells
+ * whether it is new. A retry after a CRC error starts one more conversion,
+ * the interface board runs it after the current one. Needs FEATURE_CONVERT_SAMPLE.
+ *
+ * @param address Bus address of the interface board.
+ * @param valueNr Value 1 or 2 of the sensor.
+ * @param sample The answer, ready is the state before the trigger.
+ * @return false if no frame with a valid CRC was received.
+ */
+bool I2C_Master::getSampleAndConvert(uint8_t address, uint8_t valueNr, InterfaceSample &sample)
+{
+  return this->ReadSampleFrame(valueNr == 2 ? CMD_CONVERT_SAMPLE2 : CMD_CONVERT_SAMPLE1, address, sample);
+}
+
 uint16_t I2C_Master::getSensorWakeupTime(uint8_t address)
 {
   uint8_t buffer[2];
@@ -261,6 +356,27 @@ void I2C_Master::startConversion(uint8_t address)
   this->Write(CMD_CONVERT, address);
 }
 
+/**
+ * @brief Starts the conversion of every interface board of a group in one transaction.
+ * @param group Group 0..7, 0 is every board with FEATURE_GROUPS.
+ * @return uint8_t 0 if at least one board acknowledged, like endTransmission().
+ */
+uint8_t I2C_Master::startConversionGroup(uint8_t group)
+{
+  return this->Write(CMD_CONVERT, GROUP_ADDRESS_BASE + group);
+}
+
+/**
+ * @brief Sets the groups of an interface board, replaces its groups before.
+ * @param address Bus address of the interface board.
+ * @param groups Group bits, bit n for group n (1..7), at most 2 groups.
+ * @return uint8_t 0 on success, like endTransmission().
+ */
+uint8_t I2C_Master::setGroups(uint8_t address, uint8_t groups)
+{
+  return this->WriteNByte(CMD_SET_GROUPS, &groups, 1, address);
+}
+
 void I2C_Master::sensorSleep(uint8_t address)
 {
   ;
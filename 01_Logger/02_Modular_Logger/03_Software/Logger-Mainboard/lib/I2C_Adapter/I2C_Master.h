@@ -14,6 +14,26 @@
 
 #include <Wire.h>
 
+// Feature bits of CMD_GET_FW_VERSION, see Device_CMD.cpp
+#define FEATURE_SAMPLE_FRAME 0x01
+#define FEATURE_GROUPS 0x02
+#define FEATURE_CONVERT_SAMPLE 0x04
+
+// Group n of interface boards is addressed as GROUP_ADDRESS_BASE + n, group 0 is every board
+#define GROUP_ADDRESS_BASE 0x70
+
+// Answer of CMD_GET_SAMPLE1/2
+#define SAMPLE_FRAME_SIZE 12
+
+struct InterfaceSample
+{
+  uint8_t ready;     // like getRDY(): 0 in progress, 1 ready, 2 error
+  uint8_t sequence;  // counts the conversions of the interface board
+  uint8_t error;     // error bits of the conversion
+  uint32_t value;    // float of the calculated value
+  int32_t rawValue;
+};
+
 class I2C_Master
 {
 public:
@@ -30,6 +50,9 @@ public:
   uint8_t getParameter(uint8_t address);
   uint8_t getRDY(uint8_t address);
   uint8_t getFwVersion(uint8_t address);
+  uint8_t getFeatures(uint8_t address);
+  bool getSample(uint8_t address, uint8_t valueNr, InterfaceSample &sample);
+  bool getSampleAndConvert(uint8_t address, uint8_t valueNr, InterfaceSample &sample);
   uint8_t getCalibrated(uint8_t address);
   uint16_t getSensorWakeupTime(uint8_t address);
   int64_t getSensorValue_1_Calc(uint8_t address);
@@ -37,6 +60,8 @@ public:
   int64_t getSensorValue_2_Calc(uint8_t address);
   int64_t getSensorValue_2_Calc_RAW(uint8_t address);
   void startConversion(uint8_t address);
+  uint8_t startConversionGroup(uint8_t group);
+  uint8_t setGroups(uint8_t address, uint8_t groups);
   void sensorSleep(uint8_t address);
   void interfaceSoftwareReset(uint8_t address);
   void sensorWakeup(uint8_t address);
@@ -50,6 +75,7 @@ private:
   uint8_t WriteNByte(uint8_t command, const uint8_t *data, size_t quantity, uint8_t address);
   void Read(uint8_t address, uint8_t *answer, uint8_t length);
   uint8_t WriteRead(uint8_t command, uint8_t address, uint8_t *answer, uint8_t length);
+  bool ReadSampleFrame(uint8_t command, uint8_t address, InterfaceSample &sample);
 
   int64_t getValue(uint8_t command, uint8_t address);
   TwoWire *_i2cPort;
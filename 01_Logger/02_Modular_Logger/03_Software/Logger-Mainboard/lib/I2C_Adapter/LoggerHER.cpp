@@ -171,6 +171,21 @@ void LoggerHER::getFwVersion(uint8_t address)
   this->AdapterSensorRawValue[address] = this->AdapterBus.getFwVersion(address);
 }
 
+void LoggerHER::getInterfaceFeatures(uint8_t address)
+{
+  this->AdapterSensorRawValue[address] = this->AdapterBus.getFeatures(address);
+}
+
+bool LoggerHER::MeasureSample(uint8_t address, uint8_t Value_Nr, InterfaceSample &sample)
+{
+  return this->AdapterBus.getSample(address, Value_Nr, sample);
+}
+
+bool LoggerHER::MeasureSampleAndConvert(uint8_t address, uint8_t Value_Nr, InterfaceSample &sample)
+{
+  return this->AdapterBus.getSampleAndConvert(address, Value_Nr, sample);
+}
+
 void LoggerHER::startConversionAll(uint8_t address)
 {
   this->AdapterBus.startConversion(address);
@@ -192,6 +207,16 @@ void LoggerHER::startConversion(uint8_t address)
   delay(100);
 }
 
+bool LoggerHER::startConversionGroup(uint8_t group)
+{
+  return this->AdapterBus.startConversionGroup(group) == 0;
+}
+
+bool LoggerHER::setInterfaceGroups(uint8_t address, uint8_t groups)
+{
+  return this->AdapterBus.setGroups(address, groups) == 0;
+}
+
 void LoggerHER::sensorSleep(uint8_t address)
 {
   this->AdapterBus.sensorSleep(address);
@@ -56,9 +56,14 @@ public:
   void getCalibrated(uint8_t address);
   void getSensorWakeupTime(uint8_t address);
   void getFwVersion(uint8_t address);
+  void getInterfaceFeatures(uint8_t address);
+  bool MeasureSample(uint8_t address, uint8_t Value_Nr, InterfaceSample &sample);
+  bool MeasureSampleAndConvert(uint8_t address, uint8_t Value_Nr, InterfaceSample &sample);
   void startConversion32();
   void startConversionAll(uint8_t address);
   void startConversion(uint8_t address);
+  bool startConversionGroup(uint8_t group);
+  bool setInterfaceGroups(uint8_t address, uint8_t groups);
   void sensorSleep(uint8_t address);
   void interfaceSoftwareReset(uint8_t address);
   void sensorWakeup(uint8_t address);
@@ -0,0 +1,202 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Transfer of whole files as QoS 0 chunks with selective retransmission
+ *
+ * The logger describes the file on hyfive/bulkQuery (QoS 1, JSON with size,
+ * chunk size and SHA-256). The deck box answers on hyfive/bulkStatus with a
+ * bitmap of the chunks it is still missing, all of them for a new transfer.
+ * The logger sends the missing chunks on hyfive/bulkChunk with QoS 0 and
+ * queries again. Once the deck box has all chunks and the SHA-256 of the
+ * assembled file matches, it forwards the records to the existing flows and
+ * answers with the complete state. Only then is the file moved to the backup.
+ * The deck box keeps the chunks of an interrupted transfer, so the next
+ * attempt only sends the chunks that are still missing.
+ */
+
+#include "BulkTransfer.h"
+#include "DebuggingSDLog.h"
+#include "Utility.h"
+#include "loggerConfig.h"
+
+#define BULK_STATE_INCOMPLETE 0
+#define BULK_STATE_COMPLETE 1
+
+// Queries of one transfer, each followed by the chunks still missing
+#define BULK_MAX_ROUNDS 8
+
+// Time to wait for the status of the deck box (ms)
+#define BULK_STATUS_TIMEOUT 3000
+
+static uint8_t bulkChunk[BULK_CHUNK_HEADER_SIZE + BULK_MAX_CHUNK_SIZE];
+static uint8_t bulkMissing[BULK_MAX_CHUNKS / 8];
+static bool bulkStatusReceived = false;
+static uint16_t bulkTransfer = 0;
+static uint8_t bulkState = BULK_STATE_INCOMPLETE;
+static uint16_t bulkStatusChunks = 0;
+
+/**
+ * @brief Checks whether a file can be sent with the bulk transfer.
+ * @param fileSize Size of the file in bytes.
+ * @param chunkSize Payload size of a chunk.
+ * @return true if the bitmap of the chunks fits into a status message.
+ */
+bool bulkTransferFits(uint32_t fileSize, size_t chunkSize)
+{
+  return chunkSize > 0 && (fileSize + chunkSize - 1) / chunkSize <= BULK_MAX_CHUNKS;
+}
+
+/**
+ * @brief Takes the status of the current transfer from a received message.
+ * @param topic Topic of the received message.
+ * @param payload The received message.
+ * @param length Length of the received message.
+ * @return true if the message belongs to the bulk transfer, also for other loggers.
+ */
+bool handleBulkStatusMessage(const char *topic, const uint8_t *payload, int length)
+{
+  if (strcmp(topic, BULK_STATUS_TOPIC) != 0)
+  {
+    return false;
+  }
+  if (length < BULK_STATUS_HEADER_SIZE)
+  {
+    return true;
+  }
+
+  uint16_t loggerId = (payload[0] << 8) | payload[1];
+  uint16_t transfer = (payload[2] << 8) | payload[3];
+  if (loggerId != configRTC.logger_id || transfer != bulkTransfer)
+  {
+    return true;
+  }
+
+  bulkState = payload[4];
+  bulkStatusChunks = (payload[5] << 8) | payload[6];
+  size_t bitmapLength = min((size_t)length - BULK_STATUS_HEADER_SIZE, sizeof(bulkMissing));
+  memset(bulkMissing, 0, sizeof(bulkMissing));
+  memcpy(bulkMissing, payload + BULK_STATUS_HEADER_SIZE, bitmapLength);
+  bulkStatusReceived = bulkState == BULK_STATE_COMPLETE || bitmapLength >= (bulkStatusChunks + 7u) / 8;
+  return true;
+}
+
+/**
+ * @brief Publishes the description of the file and waits for the status of the deck box.
+ * @param client The connected MQTT client.
+ * @param query The description of the file (JSON).
+ * @return true if a status has been received.
+ */
+static bool queryBulkStatus(MQTTClient &client, const char *query)
+{
+  bulkStatusReceived = false;
+  if (!client.publish(BULK_QUERY_TOPIC, query, false, 1))
+  {
+    return false;
+  }
+
+  unsigned long start = millis();
+  while (!bulkStatusReceived && millis() - start < BULK_STATUS_TIMEOUT)
+  {
+    client.loop();
+    delay(10);
+  }
+  return bulkStatusReceived;
+}
+
+/**
+ * @brief Publishes one chunk with QoS 0.
+ * @param client The connected MQTT client.
+ * @param file The file being sent.
+ * @param index Index of the chunk.
+ * @param chunkSize Payload size of a chunk.
+ * @return true if the chunk has been written to the connection.
+ */
+static bool sendBulkChunk(MQTTClient &client, File &file, uint16_t index, size_t chunkSize)
+{
+  if (!file.seek((uint32_t)index * chunkSize))
+  {
+    return false;
+  }
+  size_t length = file.read(bulkChunk + BULK_CHUNK_HEADER_SIZE, chunkSize);
+  if (length == 0)
+  {
+    return false;
+  }
+
+  bulkChunk[0] = configRTC.logger_id >> 8;
+  bulkChunk[1] = configRTC.logger_id & 0xFF;
+  bulkChunk[2] = bulkTransfer >> 8;
+  bulkChunk[3] = bulkTransfer & 0xFF;
+  bulkChunk[4] = index >> 8;
+  bulkChunk[5] = index & 0xFF;
+  return client.publish(BULK_CHUNK_TOPIC, (const char *)bulkChunk, BULK_CHUNK_HEADER_SIZE + length, false, 0);
+}
+
+/**
+ * @brief Sends a file as chunks until the deck box confirms the SHA-256 of the whole file.
+ * @param client The connected MQTT client.
+ * @param file The file to send, see bulkTransferFits().
+ * @param channelName Upload channel of the file (header, data or log).
+ * @param chunkSize Payload size of a chunk, at most BULK_MAX_CHUNK_SIZE.
+ * @return true if the deck box has confirmed the file.
+ */
+bool transmitFileBulk(MQTTClient &client, File &file, const char *channelName, size_t chunkSize)
+{
+  chunkSize = min(chunkSize, (size_t)BULK_MAX_CHUNK_SIZE);
+  uint32_t fileSize = file.size();
+  uint16_t chunks = (fileSize + chunkSize - 1) / chunkSize;
+
+  char sha256[65];
+  if (!calculateFileSha256(file, sha256))
+  {
+    Log(LogCategoryMQTT, LogLevelERROR, "Bulk transfer: file could not be read: ", String(file.name()));
+    return false;
+  }
+  // Chunks of an older transfer of the logger are ignored by the deck box
+  bulkTransfer = strtoul(String(sha256).substring(0, 4).c_str(), nullptr, 16);
+
+  char query[256];
+  snprintf(query, sizeof(query), "{\"logger_id\":%u,\"channel\":\"%s\",\"file\":\"%s\",\"size\":%lu,\"chunk_size\":%u,\"chunks\":%u,\"transfer\":%u,\"sha256\":\"%s\"}",
+           configRTC.logger_id, channelName, file.name(), (unsigned long)fileSize, (unsigned)chunkSize, chunks, bulkTransfer, sha256);
+
+  unsigned long startTime = millis();
+  uint32_t chunksSent = 0;
+  for (uint8_t round = 0; round < BULK_MAX_ROUNDS; round++)
+  {
+    if (!queryBulkStatus(client, query))
+    {
+      Log(LogCategoryMQTT, LogLevelWARNING, "Bulk transfer: no status from the deck box for ", String(file.name()));
+      return false;
+    }
+    if (bulkState == BULK_STATE_COMPLETE)
+    {
+      Log(LogCategoryMQTT, LogLevelDEBUG, "Bulk transfer: ", String(file.name()), " | ", String(chunks), " chunks | ", String(chunksSent), " sent | ", String(round), " queries | ", String(millis() - startTime), " ms");
+      return true;
+    }
+    if (bulkStatusChunks != chunks)
+    {
+      Log(LogCategoryMQTT, LogLevelERROR, "Bulk transfer: deck box expects ", String(bulkStatusChunks), " chunks instead of ", String(chunks));
+      return false;
+    }
+
+    for (uint16_t i = 0; i < chunks; i++)
+    {
+      if (bulkMissing[i / 8] & (1 << (i % 8)))
+      {
+        if (!sendBulkChunk(client, file, i, chunkSize))
+        {
+          return false;
+        }
+        chunksSent++;
+      }
+    }
+  }
+
+  Log(LogCategoryMQTT, LogLevelERROR, "Bulk transfer: ", String(file.name()), " incomplete after ", String(BULK_MAX_ROUNDS), " queries");
+  return false;
+}
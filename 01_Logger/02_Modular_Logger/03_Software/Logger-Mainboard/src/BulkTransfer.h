@@ -0,0 +1,40 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Transfer of whole files as QoS 0 chunks with selective retransmission
+ */
+
+#ifndef BULKTRANSFER_H
+#define BULKTRANSFER_H
+
+#include <MQTT.h>
+#include <SD.h>
+
+#include "MQTTManager.h"
+
+#define BULK_QUERY_TOPIC "hyfive/bulkQuery"
+#define BULK_CHUNK_TOPIC "hyfive/bulkChunk"
+#define BULK_STATUS_TOPIC "hyfive/bulkStatus"
+
+// Chunk header: logger_id, transfer, chunk index (uint16_t each, big endian)
+#define BULK_CHUNK_HEADER_SIZE 6
+
+// Largest chunk payload (upload_bulk_chunk_size in Config.json)
+#define BULK_MAX_CHUNK_SIZE (MQTT_BATCH_MAX_PAYLOAD - BULK_CHUNK_HEADER_SIZE)
+
+// Largest number of chunks of one file, the bitmap of missing chunks must fit into the MQTT read buffer
+#define BULK_MAX_CHUNKS 4096
+
+// Status header: logger_id, transfer, state (uint8_t), chunk count, followed by the bitmap of missing chunks
+#define BULK_STATUS_HEADER_SIZE 7
+
+bool bulkTransferFits(uint32_t fileSize, size_t chunkSize);
+bool transmitFileBulk(MQTTClient &client, File &file, const char *channelName, size_t chunkSize);
+bool handleBulkStatusMessage(const char *topic, const uint8_t *payload, int length);
+
+#endif
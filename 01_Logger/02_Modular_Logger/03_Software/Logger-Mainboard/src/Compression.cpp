@@ -0,0 +1,483 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Streaming LZSS compression for backups
+ *
+ * The bit stream follows heatshrink: a 1 bit is followed by a literal byte,
+ * a 0 bit by the distance - 1 (COMPRESSION_WINDOW_BITS) and the length - 3
+ * (COMPRESSION_LENGTH_BITS) of a match. Matches are found through a hash
+ * chain over a sliding window of twice the window size. The encoder needs
+ * about 14 KB of static RAM, the decoder uses the same buffer.
+ *
+ * Tools/hfz.py decompresses the files on the host.
+ */
+
+#include <SD.h>
+#include <esp_rom_crc.h>
+
+#include "Compression.h"
+#include "DebuggingSDLog.h"
+#include "SpaceLedger.h"
+
+#define COMPRESSION_WINDOW_SIZE (1 << COMPRESSION_WINDOW_BITS)
+#define COMPRESSION_MAX_MATCH (COMPRESSION_MIN_MATCH + (1 << COMPRESSION_LENGTH_BITS) - 1)
+#define COMPRESSION_HASH_BITS 10
+#define COMPRESSION_MAX_CHAIN 16
+
+// Compress files moved to /backup, on by default
+bool backupCompressionEnabled = true;
+
+typedef size_t (*CompressionReader)(uint8_t *buffer, size_t length, void *context);
+typedef bool (*CompressionWriter)(const uint8_t *data, size_t length, void *context);
+
+struct CompressionState
+{
+  uint8_t window[2 * COMPRESSION_WINDOW_SIZE];
+  uint16_t head[1 << COMPRESSION_HASH_BITS];
+  uint16_t chain[2 * COMPRESSION_WINDOW_SIZE];
+};
+
+static CompressionState compressionState;
+
+struct BitWriter
+{
+  CompressionWriter write;
+  void *context;
+  uint8_t buffer[256];
+  size_t length;
+  uint32_t bits;
+  uint8_t count;
+  bool failed;
+};
+
+struct BitReader
+{
+  File *file;
+  size_t remaining;
+  uint8_t buffer[256];
+  size_t length;
+  size_t position;
+  uint32_t bits;
+  uint8_t count;
+};
+
+RTC_DATA_ATTR uint64_t compressionInputBytes = 0;
+RTC_DATA_ATTR uint64_t compressionOutputBytes = 0;
+RTC_DATA_ATTR uint64_t compressionMicros = 0;
+
+/**
+ * @brief Writes the collected bytes to the output.
+ * @param writer The bit writer.
+ */
+static void flushBitWriter(BitWriter &writer)
+{
+  if (writer.length > 0 && !writer.failed)
+  {
+    writer.failed = !writer.write(writer.buffer, writer.length, writer.context);
+  }
+  writer.length = 0;
+}
+
+/**
+ * @brief Appends bits to the output, most significant bit first.
+ * @param writer The bit writer.
+ * @param value Bits to write.
+ * @param count Number of bits, at most 16.
+ */
+static void putBits(BitWriter &writer, uint32_t value, uint8_t count)
+{
+  writer.bits = (writer.bits << count) | value;
+  writer.count += count;
+  while (writer.count >= 8)
+  {
+    writer.count -= 8;
+    writer.buffer[writer.length++] = (writer.bits >> writer.count) & 0xFF;
+    if (writer.length == sizeof(writer.buffer))
+    {
+      flushBitWriter(writer);
+    }
+  }
+  writer.bits &= (1 << writer.count) - 1;
+}
+
+/**
+ * @brief Calculates the hash of the three bytes at a position of the window.
+ * @param position Position in the window.
+ * @return uint16_t Index into the hash heads.
+ */
+static uint16_t hashAt(size_t position)
+{
+  const uint8_t *p = compressionState.window + position;
+  uint32_t value = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+  return (value * 2654435761u) >> (32 - COMPRESSION_HASH_BITS);
+}
+
+/**
+ * @brief Encodes a stream.
+ * @param read Function delivering the uncompressed data.
+ * @param readContext Context of the read function.
+ * @param write Function receiving the compressed stream.
+ * @param writeContext Context of the write function.
+ * @param originalSize Number of uncompressed bytes.
+ * @return true if the complete stream was written.
+ */
+static bool encodeStream(CompressionReader read, void *readContext, CompressionWriter write, void *writeContext, uint32_t &originalSize)
+{
+  uint8_t *window = compressionState.window;
+  uint16_t *head = compressionState.head;
+  uint16_t *chain = compressionState.chain;
+
+  BitWriter writer = {};
+  writer.write = write;
+  writer.context = writeContext;
+
+  CompressionHeader header = {COMPRESSION_MAGIC, COMPRESSION_VERSION, COMPRESSION_WINDOW_BITS, COMPRESSION_LENGTH_BITS, 0};
+  if (!write((const uint8_t *)&header, sizeof(header), writeContext))
+  {
+    return false;
+  }
+
+  // Entries hold position + 1, 0 is the end of a chain
+  memset(head, 0, sizeof(compressionState.head));
+
+  uint32_t crc = 0;
+  originalSize = 0;
+  size_t fill = 0;
+  size_t position = 0;
+  bool endOfInput = false;
+
+  while (!writer.failed)
+  {
+    while (!endOfInput && fill < sizeof(compressionState.window))
+    {
+      size_t length = read(window + fill, sizeof(compressionState.window) - fill, readContext);
+      if (length == 0)
+      {
+        endOfInput = true;
+        break;
+      }
+      crc = esp_rom_crc32_le(crc, window + fill, length);
+      originalSize += length;
+      fill += length;
+    }
+
+    while (position < fill && (endOfInput || fill - position >= COMPRESSION_MAX_MATCH) && !writer.failed)
+    {
+      size_t bestLength = 0;
+      size_t bestDistance = 0;
+      size_t maxLength = min((size_t)COMPRESSION_MAX_MATCH, fill - position);
+
+      if (maxLength >= COMPRESSION_MIN_MATCH)
+      {
+        uint16_t candidate = head[hashAt(position)];
+        for (int steps = 0; candidate != 0 && steps < COMPRESSION_MAX_CHAIN; steps++)
+        {
+          size_t start = candidate - 1;
+          size_t distance = position - start;
+          if (distance > COMPRESSION_WINDOW_SIZE)
+          {
+            break;
+          }
+          size_t length = 0;
+          while (length < maxLength && window[start + length] == window[position + length])
+          {
+            length++;
+          }
+          if (length > bestLength)
+          {
+            bestLength = length;
+            bestDistance = distance;
+            if (length == maxLength)
+            {
+              break;
+            }
+          }
+          candidate = chain[start];
+        }
+      }
+
+      size_t advance = 1;
+      if (bestLength >= COMPRESSION_MIN_MATCH)
+      {
+        putBits(writer, 0, 1);
+        putBits(writer, bestDistance - 1, COMPRESSION_WINDOW_BITS);
+        putBits(writer, bestLength - COMPRESSION_MIN_MATCH, COMPRESSION_LENGTH_BITS);
+        advance = bestLength;
+      }
+      else
+      {
+        putBits(writer, 1, 1);
+        putBits(writer, window[position], 8);
+      }
+
+      for (size_t i = 0; i < advance; i++, position++)
+      {
+        if (position + COMPRESSION_MIN_MATCH <= fill)
+        {
+          uint16_t hash = hashAt(position);
+          chain[position] = head[hash];
+          head[hash] = position + 1;
+        }
+      }
+    }
+
+    if (endOfInput && position >= fill)
+    {
+      break;
+    }
+
+    // Slide the window by one half
+    if (position >= COMPRESSION_WINDOW_SIZE)
+    {
+      memmove(window, window + COMPRESSION_WINDOW_SIZE, fill - COMPRESSION_WINDOW_SIZE);
+      for (size_t i = 0; i < (1 << COMPRESSION_HASH_BITS); i++)
+      {
+        head[i] = head[i] > COMPRESSION_WINDOW_SIZE ? head[i] - COMPRESSION_WINDOW_SIZE : 0;
+      }
+      for (size_t i = 0; i + COMPRESSION_WINDOW_SIZE < fill; i++)
+      {
+        uint16_t entry = chain[i + COMPRESSION_WINDOW_SIZE];
+        chain[i] = entry > COMPRESSION_WINDOW_SIZE ? entry - COMPRESSION_WINDOW_SIZE : 0;
+      }
+      fill -= COMPRESSION_WINDOW_SIZE;
+      position -= COMPRESSION_WINDOW_SIZE;
+    }
+  }
+
+  // Pad the last byte with zero bits
+  if (writer.count > 0)
+  {
+    putBits(writer, 0, 8 - writer.count);
+  }
+  flushBitWriter(writer);
+  if (writer.failed)
+  {
+    return false;
+  }
+
+  CompressionTrailer trailer = {originalSize, crc};
+  return write((const uint8_t *)&trailer, sizeof(trailer), writeContext);
+}
+
+/**
+ * @brief Reads bits of a compressed stream, most significant bit first.
+ * @param reader The bit reader.
+ * @param count Number of bits, at most 16.
+ * @param value The bits read.
+ * @return true if enough data was available.
+ */
+static bool getBits(BitReader &reader, uint8_t count, uint32_t &value)
+{
+  while (reader.count < count)
+  {
+    if (reader.position == reader.length)
+    {
+      if (reader.remaining == 0)
+      {
+        return false;
+      }
+      reader.length = min(reader.remaining, sizeof(reader.buffer));
+      if (reader.file->read(reader.buffer, reader.length) != reader.length)
+      {
+        return false;
+      }
+      reader.remaining -= reader.length;
+      reader.position = 0;
+    }
+    reader.bits = (reader.bits << 8) | reader.buffer[reader.position++];
+    reader.count += 8;
+  }
+  reader.count -= count;
+  value = (reader.bits >> reader.count) & ((1 << count) - 1);
+  return true;
+}
+
+/**
+ * @brief Decodes a bit stream and checks it against the trailer.
+ * @param reader Reader positioned at the start of the bit stream.
+ * @param trailer Trailer of the stream.
+ * @return true if size and CRC32 of the decoded data match.
+ */
+static bool decodeStream(BitReader &reader, const CompressionTrailer &trailer)
+{
+  // The decoder only needs the window, the encoder is not running at the same time
+  uint8_t *window = compressionState.window;
+  const size_t mask = COMPRESSION_WINDOW_SIZE - 1;
+
+  uint32_t crc = 0;
+  uint32_t produced = 0;
+
+  while (produced < trailer.originalSize)
+  {
+    uint32_t tag;
+    if (!getBits(reader, 1, tag))
+    {
+      return false;
+    }
+
+    uint32_t distance = 0;
+    uint32_t length = 1;
+    uint32_t literal = 0;
+    if (tag)
+    {
+      if (!getBits(reader, 8, literal))
+      {
+        return false;
+      }
+    }
+    else
+    {
+      if (!getBits(reader, COMPRESSION_WINDOW_BITS, distance) || !getBits(reader, COMPRESSION_LENGTH_BITS, length))
+      {
+        return false;
+      }
+      distance++;
+      length += COMPRESSION_MIN_MATCH;
+      if (distance > produced || produced + length > trailer.originalSize)
+      {
+        return false;
+      }
+    }
+
+    for (uint32_t i = 0; i < length; i++)
+    {
+      window[produced & mask] = tag ? literal : window[(produced - distance) & mask];
+      produced++;
+
+      // The CRC is updated whenever the window is full
+      if ((produced & mask) == 0)
+      {
+        crc = esp_rom_crc32_le(crc, window, COMPRESSION_WINDOW_SIZE);
+      }
+    }
+  }
+  crc = esp_rom_crc32_le(crc, window, produced & mask);
+
+  return crc == trailer.originalCrc;
+}
+
+static size_t readFromFile(uint8_t *buffer, size_t length, void *context)
+{
+  return ((File *)context)->read(buffer, length);
+}
+
+static bool writeToFile(const uint8_t *data, size_t length, void *context)
+{
+  return ((File *)context)->write(data, length) == length;
+}
+
+/**
+ * @brief Adds one compression to the statistics.
+ * @param input Uncompressed bytes.
+ * @param output Compressed bytes.
+ * @param startMicros Start time of the compression.
+ */
+static void addCompressionStatistics(size_t input, size_t output, unsigned long startMicros)
+{
+  compressionInputBytes += input;
+  compressionOutputBytes += output;
+  compressionMicros += micros() - startMicros;
+}
+
+/**
+ * @brief Checks a compressed file by decoding it.
+ * @param path Path of the compressed file.
+ * @return true if the decoded data matches size and CRC32 stored in the file.
+ */
+bool verifyCompressedFile(const String &path)
+{
+  File file = SD.open(path, FILE_READ);
+  if (!file)
+  {
+    return false;
+  }
+
+  size_t fileSize = file.size();
+  CompressionHeader header;
+  CompressionTrailer trailer;
+  bool valid = fileSize >= sizeof(header) + sizeof(trailer) && file.read((uint8_t *)&header, sizeof(header)) == sizeof(header) && header.magic == COMPRESSION_MAGIC && header.version == COMPRESSION_VERSION && header.windowBits == COMPRESSION_WINDOW_BITS && header.lengthBits == COMPRESSION_LENGTH_BITS;
+
+  if (valid)
+  {
+    valid = file.seek(fileSize - sizeof(trailer)) && file.read((uint8_t *)&trailer, sizeof(trailer)) == sizeof(trailer) && file.seek(sizeof(header));
+  }
+
+  if (valid)
+  {
+    BitReader reader = {};
+    reader.file = &file;
+    reader.remaining = fileSize - sizeof(header) - sizeof(trailer);
+    valid = decodeStream(reader, trailer);
+  }
+
+  file.close();
+  return valid;
+}
+
+/**
+ * @brief Compresses a file and verifies the result.
+ *
+ * The source file is not changed. A destination file that fails the
+ * verification is removed.
+ *
+ * @param sourcePath Path of the uncompressed file.
+ * @param destinationPath Path of the compressed file.
+ * @return true if the compressed file was written and verified.
+ */
+bool compressFile(const String &sourcePath, const String &destinationPath)
+{
+  unsigned long startMicros = micros();
+
+  File source = SD.open(sourcePath, FILE_READ);
+  if (!source)
+  {
+    return false;
+  }
+  File destination = SD.open(destinationPath, FILE_WRITE);
+  if (!destination)
+  {
+    source.close();
+    return false;
+  }
+
+  uint32_t originalSize = 0;
+  bool success = encodeStream(readFromFile, &source, writeToFile, &destination, originalSize);
+  size_t compressedSize = destination.size();
+  source.close();
+  destination.close();
+
+  if (!success || !verifyCompressedFile(destinationPath))
+  {
+    Log(LogCategorySDCard, LogLevelERROR, "Compression failed: ", sourcePath);
+    SD.remove(destinationPath);
+    return false;
+  }
+
+  ledgerFileResized(0, compressedSize);
+  addCompressionStatistics(originalSize, compressedSize, startMicros);
+  Log(LogCategorySDCard, LogLevelDEBUG, "Compressed ", sourcePath, ": ", String(originalSize), " -> ", String(compressedSize), " bytes, ratio ", String(compressionRatio(), 2), ", ", String(compressionMillisPerMegabyte()), " ms/MB");
+  return true;
+}
+
+/**
+ * @brief Gets the compression ratio since the last cold boot.
+ * @return float Uncompressed size divided by compressed size, 0 if nothing was compressed.
+ */
+float compressionRatio()
+{
+  return compressionOutputBytes > 0 ? (float)compressionInputBytes / compressionOutputBytes : 0;
+}
+
+/**
+ * @brief Gets the compression time since the last cold boot.
+ * @return uint32_t Milliseconds per MB of uncompressed data, including the SD card access for files.
+ */
+uint32_t compressionMillisPerMegabyte()
+{
+  return compressionInputBytes > 0 ? (uint32_t)(compressionMicros * 1048576 / 1000 / compressionInputBytes) : 0;
+}
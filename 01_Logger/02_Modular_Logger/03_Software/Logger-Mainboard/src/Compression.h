@@ -0,0 +1,53 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Streaming LZSS compression for backups
+ */
+
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <Arduino.h>
+
+// Format identification
+#define COMPRESSION_MAGIC 0x315A4648 // "HFZ1" little endian
+#define COMPRESSION_VERSION 1
+
+// Extension appended to compressed files
+#define COMPRESSED_FILE_EXTENSION ".hfz"
+
+// Window of 2^11 bytes, match lengths of 3 to 3 + 2^4 - 1 bytes
+#define COMPRESSION_WINDOW_BITS 11
+#define COMPRESSION_LENGTH_BITS 4
+#define COMPRESSION_MIN_MATCH 3
+
+// Stream header, followed by the bit stream and the trailer
+typedef struct __attribute__((packed))
+{
+  uint32_t magic;
+  uint8_t version;
+  uint8_t windowBits;
+  uint8_t lengthBits;
+  uint8_t reserved;
+} CompressionHeader;
+
+// Stream trailer, size and CRC32 of the uncompressed data
+typedef struct __attribute__((packed))
+{
+  uint32_t originalSize;
+  uint32_t originalCrc;
+} CompressionTrailer;
+
+extern bool backupCompressionEnabled;
+
+bool compressFile(const String &sourcePath, const String &destinationPath);
+bool verifyCompressedFile(const String &path);
+float compressionRatio();
+uint32_t compressionMillisPerMegabyte();
+
+#endif
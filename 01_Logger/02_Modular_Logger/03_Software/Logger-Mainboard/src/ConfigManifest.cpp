@@ -0,0 +1,325 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Retained manifest of the config and firmware on the deck box
+ *
+ * The deck box publishes a retained message per logger on
+ * hyfive/configManifest/<logger_id>:
+ *
+ *   "<newest config file>:<SHA-256 of the config>:<SHA-256 of the firmware>"
+ *
+ * The broker hands it out with the subscription of every MQTT connection, so
+ * the logger learns about updates during the uploads it makes anyway. The
+ * config and firmware are only requested when the manifest differs from the
+ * logger, the periodic request every config_update_periode is dropped while
+ * manifests arrive. A manifest that has been requested once is not requested
+ * again, so a deck box that has no update for it does not cause a request on
+ * every connection.
+ *
+ * The manifest arrives right after the subscription. The logger waits for it
+ * up to CONFIG_MANIFEST_WAIT, so the config request of this wake is decided
+ * on the current manifest. The wait only happens while the deck box sends
+ * manifests, a deck box without them costs no time.
+ *
+ * The MQTT callback only keeps the manifest and its CRC32. It is compared
+ * with the logger after the wait or when the update is checked, with the
+ * SHA-256 of the config kept in RTC memory since the config was written.
+ */
+
+#include <SD.h>
+#include <esp_rom_crc.h>
+
+#include "ConfigManifest.h"
+#include "DS3231TimeNtp.h"
+#include "DebuggingSDLog.h"
+#include "Utility.h"
+#include "loggerConfig.h"
+
+// Manifest state, kept over deep sleep
+struct ConfigManifestState
+{
+  uint32_t receivedAt;    // RTC time of the last manifest, 0: none
+  uint32_t manifestCrc;   // CRC32 of the last manifest that differed from the logger
+  uint32_t requestedCrc;  // CRC32 of the last manifest that was requested
+  uint32_t checksum;
+};
+
+RTC_DATA_ATTR ConfigManifestState configManifest;
+
+// SHA-256 of the config, RTC_NOINIT keeps it over the restart after a config update
+struct ConfigHashCache
+{
+  char configFile[CONFIG_MANIFEST_NAME_SIZE]; // Config file the hash belongs to, empty: not known
+  char configSha256[65];                      // SHA-256 of the config file as hex string
+  uint32_t checksum;
+};
+
+RTC_NOINIT_ATTR ConfigHashCache configHashCache;
+
+// The manifest of this logger arrived on the current connection
+static volatile bool configManifestArrived = false;
+
+// Manifest taken by the MQTT callback, compared by compareConfigManifest()
+static char pendingManifest[CONFIG_MANIFEST_SIZE];
+static uint32_t pendingManifestCrc = 0;
+static bool manifestPending = false;
+
+/**
+ * @brief Calculates the checksum of the manifest state.
+ * @return uint32_t CRC32 over all fields except the checksum.
+ */
+static uint32_t configManifestChecksum()
+{
+  return esp_rom_crc32_le(0, (const uint8_t *)&configManifest, offsetof(ConfigManifestState, checksum));
+}
+
+/**
+ * @brief Checks the manifest state after a cold boot.
+ */
+static void validateConfigManifest()
+{
+  if (configManifest.checksum != configManifestChecksum())
+  {
+    memset(&configManifest, 0, sizeof(configManifest));
+    configManifest.checksum = configManifestChecksum();
+  }
+}
+
+/**
+ * @brief Calculates the checksum of the config hash cache.
+ * @return uint32_t CRC32 over all fields except the checksum.
+ */
+static uint32_t configHashCacheChecksum()
+{
+  return esp_rom_crc32_le(0, (const uint8_t *)&configHashCache, offsetof(ConfigHashCache, checksum));
+}
+
+/**
+ * @brief Reads the SHA-256 of a file on the SD card.
+ * @param path Path of the file.
+ * @return String The hash as lower case hex string, empty if the file is missing.
+ */
+static String fileSha256(const String &path)
+{
+  File file = SD.open(path);
+  if (!file)
+  {
+    return "";
+  }
+  char hex[65];
+  bool complete = calculateFileSha256(file, hex);
+  file.close();
+  return complete ? String(hex) : "";
+}
+
+/**
+ * @brief Reads the SHA-256 of the installed firmware, saved by the last firmware update.
+ * @return String The hash, empty if the logger has not been updated via MQTT.
+ */
+static String installedFirmwareSha256()
+{
+  File file = SD.open("/updateFW/current_firmware.sha256");
+  if (!file)
+  {
+    return "";
+  }
+  String sha256 = file.readStringUntil('\n');
+  file.close();
+  sha256.trim();
+  return sha256;
+}
+
+/**
+ * @brief Keeps the SHA-256 of a config file in RTC memory.
+ * @param configFile Name of the file in /loggerConfig.
+ */
+static void cacheConfigSha256(const String &configFile)
+{
+  String sha256 = configFile.length() > 0 && configFile.length() < sizeof(configHashCache.configFile) ? fileSha256("/loggerConfig/" + configFile) : "";
+  memset(&configHashCache, 0, sizeof(configHashCache));
+  if (sha256.length() > 0)
+  {
+    strlcpy(configHashCache.configFile, configFile.c_str(), sizeof(configHashCache.configFile));
+    strlcpy(configHashCache.configSha256, sha256.c_str(), sizeof(configHashCache.configSha256));
+  }
+  configHashCache.checksum = configHashCacheChecksum();
+}
+
+/**
+ * @brief Gets the SHA-256 of a config file, calculated only if it is not in RTC memory.
+ * @param configFile Name of the file in /loggerConfig.
+ * @return String The hash as lower case hex string, empty if the file is missing.
+ */
+static String configSha256(const String &configFile)
+{
+  if (configHashCache.checksum != configHashCacheChecksum() || configFile != configHashCache.configFile)
+  {
+    cacheConfigSha256(configFile);
+  }
+  return configHashCache.configFile[0] != '\0' ? String(configHashCache.configSha256) : "";
+}
+
+/**
+ * @brief Compares the manifest taken by the MQTT callback with the config and firmware of the logger.
+ */
+static void compareConfigManifest()
+{
+  if (!manifestPending)
+  {
+    return;
+  }
+  manifestPending = false;
+
+  char message[CONFIG_MANIFEST_SIZE];
+  strlcpy(message, pendingManifest, sizeof(message));
+  char *configHash = strchr(message, ':');
+  char *firmwareHash = configHash != nullptr ? strchr(configHash + 1, ':') : nullptr;
+  if (configHash == nullptr || firmwareHash == nullptr)
+  {
+    Log(LogCategoryConfiguration, LogLevelWARNING, "Config manifest not readable: ", String(message));
+    return;
+  }
+  *configHash++ = '\0';
+  *firmwareHash++ = '\0';
+
+  validateConfigManifest();
+  configManifest.receivedAt = getCurrentTimeFromRTC();
+
+  String configFile = findLatestConfigurationFile("/loggerConfig");
+  bool configCurrent = configFile == message && configSha256(configFile) == configHash;
+  bool firmwareCurrent = strlen(firmwareHash) == 0 || installedFirmwareSha256() == firmwareHash;
+
+  if (configCurrent && firmwareCurrent)
+  {
+    configManifest.manifestCrc = 0;
+  }
+  else
+  {
+    configManifest.manifestCrc = pendingManifestCrc;
+    Log(LogCategoryConfiguration, LogLevelDEBUG, "Config manifest: ", configCurrent ? "" : "config ", firmwareCurrent ? "" : "firmware ", "differs");
+  }
+  configManifest.checksum = configManifestChecksum();
+}
+
+/**
+ * @brief Topic of the manifest of this logger.
+ * @return String hyfive/configManifest/<logger_id>
+ */
+String configManifestTopic()
+{
+  return String(CONFIG_MANIFEST_TOPIC) + String(configRTC.logger_id);
+}
+
+/**
+ * @brief Checks whether the deck box has sent a manifest within CONFIG_MANIFEST_VALID.
+ * @return true while manifests arrive.
+ */
+static bool configManifestActive()
+{
+  compareConfigManifest();
+  validateConfigManifest();
+  uint32_t now = getCurrentTimeFromRTC();
+  return configManifest.receivedAt != 0 && configManifest.receivedAt <= now && now - configManifest.receivedAt < CONFIG_MANIFEST_VALID;
+}
+
+/**
+ * @brief Subscribes to the manifest of this logger and waits for the retained message.
+ * @param client The connected MQTT client, the callback must be set.
+ */
+void subscribeConfigManifest(MQTTClient &client)
+{
+  configManifestArrived = false;
+  client.subscribe(configManifestTopic(), 1);
+  if (!configManifestActive())
+  {
+    return;
+  }
+
+  unsigned long start = millis();
+  while (!configManifestArrived && client.connected() && millis() - start < CONFIG_MANIFEST_WAIT)
+  {
+    client.loop();
+    delay(1);
+  }
+  if (!configManifestArrived)
+  {
+    Log(LogCategoryConfiguration, LogLevelDEBUG, "Config manifest: none within ", String(CONFIG_MANIFEST_WAIT), " ms");
+  }
+  compareConfigManifest();
+}
+
+/**
+ * @brief Takes the manifest of the deck box, called from the MQTT callback.
+ *
+ * The manifest is compared with the logger by subscribeConfigManifest() or
+ * configManifestUpdatePending(), the callback does not access the SD card.
+ *
+ * @param topic Topic of the received message.
+ * @param payload The received message.
+ * @param length Length of the received message.
+ * @return true if the message is the manifest of this logger.
+ */
+bool handleConfigManifestMessage(const char *topic, const uint8_t *payload, int length)
+{
+  if (strncmp(topic, CONFIG_MANIFEST_TOPIC, strlen(CONFIG_MANIFEST_TOPIC)) != 0)
+  {
+    return false;
+  }
+  if (configManifestTopic() != topic)
+  {
+    return true;
+  }
+
+  size_t manifestLength = min((size_t)length, sizeof(pendingManifest) - 1);
+  memcpy(pendingManifest, payload, manifestLength);
+  pendingManifest[manifestLength] = '\0';
+  pendingManifestCrc = esp_rom_crc32_le(0, payload, length);
+  manifestPending = true;
+  configManifestArrived = true;
+  return true;
+}
+
+/**
+ * @brief Checks whether the manifest announced a config or firmware that has not been requested yet.
+ * @return true if the update should be requested.
+ */
+bool configManifestUpdatePending()
+{
+  compareConfigManifest();
+  validateConfigManifest();
+  return configManifest.manifestCrc != 0 && configManifest.manifestCrc != configManifest.requestedCrc;
+}
+
+/**
+ * @brief Marks the current manifest as requested.
+ */
+void configManifestRequested()
+{
+  validateConfigManifest();
+  configManifest.requestedCrc = configManifest.manifestCrc;
+  configManifest.checksum = configManifestChecksum();
+}
+
+/**
+ * @brief Keeps the SHA-256 of a config that was written to /loggerConfig.
+ * @param configFile Name of the file in /loggerConfig.
+ */
+void configManifestConfigWritten(const String &configFile)
+{
+  cacheConfigSha256(configFile);
+}
+
+/**
+ * @brief Period of the config request.
+ * @param config_update_periode Period from Config.json (s).
+ * @return uint32_t config_update_periode, or CONFIG_MANIFEST_VALID while manifests arrive.
+ */
+uint32_t configUpdatePollPeriode(uint32_t config_update_periode)
+{
+  return configManifestActive() ? max(config_update_periode, (uint32_t)CONFIG_MANIFEST_VALID) : config_update_periode;
+}
@@ -0,0 +1,39 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Retained manifest of the config and firmware on the deck box
+ */
+
+#ifndef CONFIGMANIFEST_H
+#define CONFIGMANIFEST_H
+
+#include <Arduino.h>
+#include <MQTT.h>
+
+// Retained, one topic per logger: hyfive/configManifest/<logger_id>
+#define CONFIG_MANIFEST_TOPIC "hyfive/configManifest/"
+
+// Without manifest for this long the logger polls every config_update_periode again (s)
+#define CONFIG_MANIFEST_VALID (7 * 24 * 3600)
+
+// Time to wait for the retained manifest after the subscription (ms), like SESSION_TIMEOUT
+#define CONFIG_MANIFEST_WAIT 500
+
+// Longest manifest kept by the MQTT callback and longest config file name, including the terminating zero
+#define CONFIG_MANIFEST_SIZE 192
+#define CONFIG_MANIFEST_NAME_SIZE 64
+
+String configManifestTopic();
+void subscribeConfigManifest(MQTTClient &client);
+bool handleConfigManifestMessage(const char *topic, const uint8_t *payload, int length);
+bool configManifestUpdatePending();
+void configManifestRequested();
+void configManifestConfigWritten(const String &configFile);
+uint32_t configUpdatePollPeriode(uint32_t config_update_periode);
+
+#endif
@@ -95,9 +95,19 @@ unsigned long getCurrentTimeFromRTC()
  */
 String formatLocalTimeAsISOString()
 {
-  DateTime now = rtcDS3231.now();
+  return formatUnixTimeAsISOString(rtcDS3231.now().unixtime());
+}
+
+/**
+ * @brief Formats a Unix timestamp as an ISO 8601 string.
+ * @param unixTime Seconds since 1970-01-01.
+ * @return String The formatted time string.
+ */
+String formatUnixTimeAsISOString(uint32_t unixTime)
+{
+  DateTime time(unixTime);
   char buffer[30];
-  snprintf(buffer, sizeof(buffer), "%04d-%02d-%02dT%02d:%02d:%02dZ", now.year(), now.month(), now.day(), now.hour(), now.minute(), now.second());
+  snprintf(buffer, sizeof(buffer), "%04d-%02d-%02dT%02d:%02d:%02dZ", time.year(), time.month(), time.day(), time.hour(), time.minute(), time.second());
   return String(buffer);
 }
 
@@ -20,6 +20,7 @@ bool synchronizeTimeWithNTP();
 unsigned long getCurrentTimeFromRTC();
 
 String formatLocalTimeAsISOString();
+String formatUnixTimeAsISOString(uint32_t unixTime);
 String getLocalTimeAsStringBackup();
 String getLocalTimeAsStringLog();
 
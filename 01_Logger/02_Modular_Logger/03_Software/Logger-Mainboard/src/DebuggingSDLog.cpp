@@ -9,7 +9,12 @@
  * Description: Debugging and SD card logging functionality
  */
 
+#include <atomic>
+
 #include "DebuggingSDLog.h"
+#include "FileManifest.h"
+#include "SpaceLedger.h"
+
 // Definiere das Mapping von Log-Kategorien zu Log-Levels
 std::map<LogCategory, LogLevel> logSettings = {
 
@@ -33,4 +38,300 @@ std::map<LogCategory, LogLevel> logSettings = {
     {LogCategoryDebug, LogLevelINFO},
     {LogCategoryMeasurement, LogLevelINFO}
 
-};
\ No newline at end of file
+};
+
+// Flush behavior of the asynchronous log sink
+bool logFlushOnError = true;
+bool logFlushBeforeSleep = true;
+
+// Bounded lock-free queue (multiple producers, one consumer).
+// Each slot carries a sequence number: a producer may fill the slot when
+// sequence == position, the consumer may read it when sequence == position + 1.
+typedef struct
+{
+  std::atomic<uint32_t> sequence;
+  uint16_t length;
+  char text[LOG_SLOT_SIZE];
+} LogSlot;
+
+static LogSlot logSlots[LOG_QUEUE_SLOTS];
+static std::atomic<uint32_t> logEnqueuePosition(0);
+static std::atomic<uint32_t> logDequeuePosition(0);
+static std::atomic<bool> logQueueInitialized(false);
+
+RTC_DATA_ATTR std::atomic<uint32_t> logDroppedCount(0);
+
+static TaskHandle_t logWriterTaskHandle = NULL;
+static SemaphoreHandle_t logWriterMutex = NULL;
+
+// Lines are collected here and written with one SD access
+static char logBatch[4096];
+
+// A flush is running, guarded by logWriterMutex once the writer task is started
+static bool logFlushActive = false;
+
+// Sequence number for closed log segments /log/log_<n>.txt
+RTC_DATA_ATTR uint32_t logSegmentSequence = 0;
+
+/**
+ * @brief Initializes the slot sequence numbers once.
+ */
+static void initializeLogQueue()
+{
+  bool expected = false;
+  if (logQueueInitialized.compare_exchange_strong(expected, true))
+  {
+    for (uint32_t i = 0; i < LOG_QUEUE_SLOTS; i++)
+    {
+      logSlots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+}
+
+/**
+ * @brief Puts a log line into the queue without blocking.
+ *
+ * If the queue is full the line is dropped and counted.
+ *
+ * @param message The formatted log line.
+ * @param length Length of the line.
+ * @param level Log level of the line.
+ */
+void enqueueLogMessage(const char *message, size_t length, LogLevel level)
+{
+  initializeLogQueue();
+
+  uint32_t position = logEnqueuePosition.load(std::memory_order_relaxed);
+  LogSlot *slot;
+  while (true)
+  {
+    slot = &logSlots[position % LOG_QUEUE_SLOTS];
+    uint32_t sequence = slot->sequence.load(std::memory_order_acquire);
+    int32_t difference = (int32_t)(sequence - position);
+    if (difference == 0)
+    {
+      if (logEnqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+      {
+        break;
+      }
+    }
+    else if (difference < 0)
+    {
+      logDroppedCount.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    else
+    {
+      position = logEnqueuePosition.load(std::memory_order_relaxed);
+    }
+  }
+
+  if (length > LOG_SLOT_SIZE)
+  {
+    // Truncated lines keep their line break
+    length = LOG_SLOT_SIZE;
+    memcpy(slot->text, message, length - 1);
+    slot->text[length - 1] = '\n';
+  }
+  else
+  {
+    memcpy(slot->text, message, length);
+  }
+  slot->length = length;
+  slot->sequence.store(position + 1, std::memory_order_release);
+
+  bool queueHalfFull = (position - logDequeuePosition.load(std::memory_order_relaxed)) >= LOG_QUEUE_SLOTS / 2;
+  bool flushNow = logFlushOnError && level == LogLevelERROR;
+  if (logWriterTaskHandle != NULL)
+  {
+    if (queueHalfFull || flushNow)
+    {
+      xTaskNotifyGive(logWriterTaskHandle);
+    }
+  }
+  else if (queueHalfFull || flushNow)
+  {
+    // Before the writer task is started the queue is written by the caller
+    flushLogSink();
+  }
+}
+
+/**
+ * @brief Closes /log/log.txt as numbered segment, the caller holds the writer mutex.
+ */
+static void closeLogSegment()
+{
+  if (!SD.exists("/log/log.txt"))
+  {
+    return;
+  }
+
+  String segmentPath;
+  do
+  {
+    segmentPath = "/log/log_" + String(logSegmentSequence++) + ".txt";
+  } while (SD.exists(segmentPath));
+
+  if (SD.rename("/log/log.txt", segmentPath.c_str()))
+  {
+    manifestFileAdded("/log", segmentPath.substring(5));
+  }
+}
+
+/**
+ * @brief Writes a batch of log lines to the SD card and the serial interface.
+ * @param length Number of bytes in logBatch.
+ */
+static void writeLogBatch(size_t length)
+{
+  Serial.write((const uint8_t *)logBatch, length);
+
+  File file = SD.open("/log/log.txt", FILE_APPEND);
+  if (!file)
+  {
+    Serial.println("Error opening the file /log/log.txt");
+    moveFileToDestination("/log", "log.txt", "/backup/log_error", true);
+    return;
+  }
+
+  // If the number of bytes written does not match the batch length,
+  // an error occurred when writing to the file.
+  size_t bytesWritten = file.write((const uint8_t *)logBatch, length);
+  size_t fileSize = file.size();
+  file.close();
+  ledgerFileResized(fileSize - bytesWritten, fileSize);
+  if (bytesWritten != length)
+  {
+    Serial.println("Error when writing to the file /log/log.txt");
+    moveFileToDestination("/log", "log.txt", "/backup/log_error", true);
+  }
+  else if (fileSize >= LOG_SEGMENT_SIZE)
+  {
+    closeLogSegment();
+  }
+}
+
+/**
+ * @brief Writes all queued log lines.
+ *
+ * Only one consumer drains the queue at a time, producers are never blocked.
+ */
+void flushLogSink()
+{
+  initializeLogQueue();
+
+  // Before the writer task is started, a Log() from writeLogBatch() (moveFileToDestination)
+  // comes back here. The running flush writes those lines, a nested flush would overwrite
+  // logBatch and move logDequeuePosition under it.
+  if (logWriterMutex == NULL && logFlushActive)
+  {
+    return;
+  }
+
+  if (logWriterMutex != NULL)
+  {
+    xSemaphoreTake(logWriterMutex, portMAX_DELAY);
+  }
+  logFlushActive = true;
+
+  size_t batchLength = 0;
+  uint32_t position = logDequeuePosition.load(std::memory_order_relaxed);
+  while (true)
+  {
+    LogSlot *slot = &logSlots[position % LOG_QUEUE_SLOTS];
+    if (slot->sequence.load(std::memory_order_acquire) != position + 1)
+    {
+      break;
+    }
+
+    if (batchLength + slot->length > sizeof(logBatch))
+    {
+      writeLogBatch(batchLength);
+      batchLength = 0;
+    }
+    memcpy(logBatch + batchLength, slot->text, slot->length);
+    batchLength += slot->length;
+
+    slot->sequence.store(position + LOG_QUEUE_SLOTS, std::memory_order_release);
+    position++;
+    logDequeuePosition.store(position, std::memory_order_relaxed);
+  }
+
+  if (batchLength > 0)
+  {
+    writeLogBatch(batchLength);
+  }
+
+  logFlushActive = false;
+  if (logWriterMutex != NULL)
+  {
+    xSemaphoreGive(logWriterMutex);
+  }
+}
+
+/**
+ * @brief Writes the queue and closes /log/log.txt as segment, e.g. before the log upload.
+ */
+void rotateLogSegment()
+{
+  flushLogSink();
+
+  if (logWriterMutex != NULL)
+  {
+    xSemaphoreTake(logWriterMutex, portMAX_DELAY);
+  }
+  closeLogSegment();
+  if (logWriterMutex != NULL)
+  {
+    xSemaphoreGive(logWriterMutex);
+  }
+}
+
+/**
+ * @brief Writes the queue before deep sleep or restart, if configured.
+ */
+void flushLogBeforeSleep()
+{
+  if (logFlushBeforeSleep)
+  {
+    flushLogSink();
+  }
+}
+
+/**
+ * @brief Log writer task, writes the queue in batches.
+ * @param pvParameters Not used.
+ */
+static void logWriterTask(void *pvParameters)
+{
+  while (true)
+  {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(200));
+    flushLogSink();
+  }
+}
+
+/**
+ * @brief Starts the log writer task on the core not used by the main loop.
+ *
+ * Must be called after the SD card is initialized.
+ */
+void startLogWriterTask()
+{
+  if (logWriterTaskHandle != NULL)
+  {
+    return;
+  }
+  logWriterMutex = xSemaphoreCreateMutex();
+  xTaskCreatePinnedToCore(logWriterTask, "logWriterTask", 4096, NULL, 1, &logWriterTaskHandle, 0);
+}
+
+/**
+ * @brief Gets the number of log lines dropped because the queue was full.
+ * @return uint32_t Number of dropped lines since the first boot.
+ */
+uint32_t logSinkDroppedCount()
+{
+  return logDroppedCount.load(std::memory_order_relaxed);
+}
@@ -56,6 +56,29 @@ enum LogCategory
 // External mapping of log categories to log levels
 extern std::map<LogCategory, LogLevel> logSettings;
 
+// Asynchronous log sink
+
+// Number of queued log lines and maximum length of one line
+#define LOG_QUEUE_SLOTS 32
+#define LOG_SLOT_SIZE 256
+
+// Writes the queue immediately when an ERROR is logged
+extern bool logFlushOnError;
+
+// Writes the queue before deep sleep and restart
+extern bool logFlushBeforeSleep;
+
+// Size at which /log/log.txt is closed as segment, and maximum size of /backup/log
+#define LOG_SEGMENT_SIZE (64UL * 1024UL)
+#define LOG_BACKUP_MAX_SIZE (32ULL * 1024ULL * 1024ULL)
+
+void enqueueLogMessage(const char *message, size_t length, LogLevel level);
+void rotateLogSegment();
+void startLogWriterTask();
+void flushLogSink();
+void flushLogBeforeSleep();
+uint32_t logSinkDroppedCount();
+
 // Helper function to convert LogCategory to string
 inline std::string LogCategoryToString(LogCategory category)
 {
@@ -151,28 +174,8 @@ void Log(LogCategory category, LogLevel level, const std::string &message, Args.
 
     std::string logMessage = logStream.str() + "\n";
 
-    File file = SD.open("/log/log.txt", FILE_APPEND);
-    if (!file)
-    {
-      Serial.println("Error opening the file /log/log.txt");
-      moveFileToDestination("/log", "log.txt", "/backup/log_error", true);
-      return;
-    }
-
-    // if (bytesWritten != logMessage.length()): It is checked whether the number of bytes written (bytesWritten)
-    // matches the length of the log message (logMessage.length()).
-    // If the number of bytes written does not match the length of the log message, this means
-    // that an error occurred when writing to the file.
-    size_t bytesWritten = file.print(logMessage.c_str());
-    if (bytesWritten != logMessage.length())
-    {
-      Serial.println("Error when writing to the file /log/log.txt");
-      moveFileToDestination("/log", "log.txt", "/backup/log_error", true);
-    }
-
-    file.close();
-
-    Serial.print(logMessage.c_str());
+    // The SD card and serial output are written by the log writer task
+    enqueueLogMessage(logMessage.c_str(), logMessage.length(), level);
   }
 }
 
@@ -11,6 +11,7 @@
 
 #include <Arduino.h>
 
+#include "DebuggingSDLog.h"
 #include "DeepSleep.h"
 
 #define uS_TO_S_FACTOR 1000000UL
@@ -22,6 +23,7 @@
 void espDeepSleepSec(uint32_t sleepTimeSec)
 {
   esp_sleep_enable_timer_wakeup(sleepTimeSec * uS_TO_S_FACTOR);
+  flushLogBeforeSleep();
   esp_deep_sleep_start();
 }
 
@@ -0,0 +1,336 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Double-buffered writer for firmware and config downloads
+ *
+ * The MQTT callback copies each message of hyfive/updateFW or of a config
+ * file with one memcpy into the buffer it fills, a writer task on the other
+ * core hands the messages of the full buffer to the sink (OTA partition or
+ * SD card). Network and flash/SD access overlap, the callback no longer waits
+ * for a sector erase or an SD write per message.
+ *
+ * A message is kept as its length (uint32_t) followed by the bytes, padded to
+ * 4 bytes so that every message starts aligned. When both buffers are with
+ * the writer the callback waits for a free one: client.loop() does not read
+ * the socket meanwhile, the TCP window closes and the broker holds back the
+ * next messages.
+ *
+ * The sink is only called while downloadSinkMutex is held, and only for the
+ * current download. finishDownloadBuffer() ends the download under that
+ * mutex, also when the writer did not finish in time, so the caller can close
+ * the config file or check the OTA partition afterwards without the writer
+ * still writing to it. Other files on the SD card are opened by the MQTT
+ * callback meanwhile, FatFs locks the volume for each access.
+ *
+ * With DOWNLOAD_BUFFERED 0 the callback hands every message to the sink
+ * itself, like before the buffer, and logs the same throughput line.
+ */
+
+#include <atomic>
+
+#include "DebuggingSDLog.h"
+#include "DownloadBuffer.h"
+
+#define DOWNLOAD_RECORD_HEADER_SIZE 4
+
+struct DownloadBlock
+{
+  uint8_t index;      // buffer with the writer
+  uint8_t generation; // download the buffer belongs to
+  uint16_t length;    // bytes used in the buffer
+};
+
+alignas(4) static uint8_t downloadBuffers[2][DOWNLOAD_BUFFER_SIZE];
+
+static TaskHandle_t downloadWriterTaskHandle = NULL;
+static QueueHandle_t downloadFullQueue = NULL;
+static SemaphoreHandle_t downloadFreeBuffers = NULL; // buffers neither filled nor with the writer
+static SemaphoreHandle_t downloadSinkMutex = NULL;   // held while the sink is called
+
+static DownloadSink downloadSink = nullptr;
+static std::atomic<uint8_t> downloadGeneration(0);
+static uint8_t fillIndex = 0;
+static size_t fillLength = 0;
+static bool fillOwned = false;
+static bool downloadActive = false;
+static bool downloadFailed = false;
+
+static uint32_t downloadBytes = 0;
+static unsigned long downloadStart = 0;
+static unsigned long downloadLast = 0;
+static unsigned long downloadWaited = 0;
+
+#if DOWNLOAD_BUFFERED
+/**
+ * @brief Calculates the space of a message in a buffer.
+ * @param length Length of the message.
+ * @return size_t Bytes including the length and the padding.
+ */
+static size_t downloadRecordSize(size_t length)
+{
+  return (DOWNLOAD_RECORD_HEADER_SIZE + length + 3) & ~(size_t)3;
+}
+
+/**
+ * @brief Task that writes full buffers, one message after the other.
+ * @param pvParameters Unused.
+ */
+static void downloadWriterTask(void *pvParameters)
+{
+  DownloadBlock block;
+  while (true)
+  {
+    if (xQueueReceive(downloadFullQueue, &block, portMAX_DELAY) != pdTRUE)
+    {
+      continue;
+    }
+    const uint8_t *buffer = downloadBuffers[block.index];
+    size_t position = 0;
+    while (position + DOWNLOAD_RECORD_HEADER_SIZE <= block.length)
+    {
+      uint32_t length;
+      memcpy(&length, buffer + position, sizeof(length));
+      // Locked per message, so ending the download waits for one write at most
+      xSemaphoreTake(downloadSinkMutex, portMAX_DELAY);
+      bool current = block.generation == downloadGeneration && downloadSink != nullptr;
+      if (current)
+      {
+        downloadSink(buffer + position + DOWNLOAD_RECORD_HEADER_SIZE, length);
+      }
+      xSemaphoreGive(downloadSinkMutex);
+      if (!current)
+      {
+        // Buffer of a download that has been ended
+        break;
+      }
+      position += downloadRecordSize(length);
+    }
+    xSemaphoreGive(downloadFreeBuffers);
+  }
+}
+
+/**
+ * @brief Takes a free buffer for the MQTT callback, waits while both are with the writer.
+ * @return false if the writer did not free a buffer within DOWNLOAD_WRITER_TIMEOUT.
+ */
+static bool takeFillBuffer()
+{
+  unsigned long start = millis();
+  fillOwned = xSemaphoreTake(downloadFreeBuffers, pdMS_TO_TICKS(DOWNLOAD_WRITER_TIMEOUT)) == pdTRUE;
+  downloadWaited += millis() - start;
+  fillLength = 0;
+  if (!fillOwned)
+  {
+    Log(LogCategoryGeneral, LogLevelERROR, "Download: no free buffer after ", String(DOWNLOAD_WRITER_TIMEOUT), " ms, download stopped");
+    downloadFailed = true;
+  }
+  return fillOwned;
+}
+
+/**
+ * @brief Hands the filled buffer to the writer task.
+ *
+ * With two buffers the next free one is always the other buffer, the writer
+ * works through the buffers in the order they were filled.
+ */
+static void queueFillBuffer()
+{
+  if (!fillOwned)
+  {
+    return;
+  }
+  if (fillLength == 0)
+  {
+    xSemaphoreGive(downloadFreeBuffers);
+  }
+  else
+  {
+    DownloadBlock block = {fillIndex, downloadGeneration, (uint16_t)fillLength};
+    xQueueSend(downloadFullQueue, &block, portMAX_DELAY);
+    fillIndex ^= 1;
+  }
+  fillOwned = false;
+  fillLength = 0;
+}
+
+/**
+ * @brief Waits until the writer task has written all buffers.
+ * @return false if the writer did not finish within DOWNLOAD_WRITER_TIMEOUT.
+ */
+static bool waitForDownloadWriter()
+{
+  queueFillBuffer();
+  unsigned long start = millis();
+  int taken = 0;
+  while (taken < 2 && xSemaphoreTake(downloadFreeBuffers, pdMS_TO_TICKS(DOWNLOAD_WRITER_TIMEOUT)) == pdTRUE)
+  {
+    taken++;
+  }
+  for (int i = 0; i < taken; i++)
+  {
+    xSemaphoreGive(downloadFreeBuffers);
+  }
+  downloadWaited += millis() - start;
+  return taken == 2;
+}
+#endif
+
+/**
+ * @brief Hands one message to the sink of the current download.
+ * @param data The message.
+ * @param length Length of the message.
+ */
+static void writeDownloadSink(const uint8_t *data, size_t length)
+{
+  xSemaphoreTake(downloadSinkMutex, portMAX_DELAY);
+  if (downloadSink != nullptr)
+  {
+    downloadSink(data, length);
+  }
+  xSemaphoreGive(downloadSinkMutex);
+}
+
+/**
+ * @brief Ends the download, the writer drops its remaining buffers and no longer calls the sink.
+ *
+ * Waits while the writer is inside the sink, for one message at most.
+ */
+static void detachDownloadSink()
+{
+  // Before the mutex: the writer could take it again for its next message first
+  downloadGeneration++;
+  xSemaphoreTake(downloadSinkMutex, portMAX_DELAY);
+  downloadSink = nullptr;
+  xSemaphoreGive(downloadSinkMutex);
+}
+
+/**
+ * @brief Starts a download, the writer task is started with the first download.
+ * @param sink Destination of the received messages, called by the writer task.
+ */
+void beginDownloadBuffer(DownloadSink sink)
+{
+  if (downloadSinkMutex == NULL)
+  {
+    downloadSinkMutex = xSemaphoreCreateMutex();
+  }
+#if DOWNLOAD_BUFFERED
+  if (downloadWriterTaskHandle == NULL)
+  {
+    downloadFullQueue = xQueueCreate(2, sizeof(DownloadBlock));
+    downloadFreeBuffers = xSemaphoreCreateCounting(2, 2);
+    xTaskCreatePinnedToCore(downloadWriterTask, "downloadWriterTask", 6144, NULL, 2, &downloadWriterTaskHandle, 0);
+  }
+  // Buffers of a download given up before may still be with the writer, they are dropped
+  if (downloadActive)
+  {
+    queueFillBuffer();
+    detachDownloadSink();
+  }
+  waitForDownloadWriter();
+#endif
+
+  xSemaphoreTake(downloadSinkMutex, portMAX_DELAY);
+  downloadSink = sink;
+  xSemaphoreGive(downloadSinkMutex);
+  downloadActive = true;
+  downloadFailed = false;
+  downloadBytes = 0;
+  downloadStart = millis();
+  downloadLast = downloadStart;
+  downloadWaited = 0;
+#if DOWNLOAD_BUFFERED
+  takeFillBuffer();
+#endif
+}
+
+/**
+ * @brief Adds a received message, called by the MQTT callback.
+ *
+ * Blocks while both buffers are with the writer task (backpressure to the broker).
+ *
+ * @param data The message.
+ * @param length Length of the message.
+ * @return false if the download has been given up, the message is dropped.
+ */
+bool appendDownloadBuffer(const uint8_t *data, size_t length)
+{
+  if (!downloadActive || downloadFailed)
+  {
+    return false;
+  }
+
+#if !DOWNLOAD_BUFFERED
+  writeDownloadSink(data, length);
+  downloadBytes += length;
+  downloadLast = millis();
+  return true;
+#else
+  size_t recordSize = downloadRecordSize(length);
+  if (recordSize > DOWNLOAD_BUFFER_SIZE)
+  {
+    // Larger than a buffer: written directly after the buffered messages
+    if (!waitForDownloadWriter())
+    {
+      downloadFailed = true;
+      return false;
+    }
+    writeDownloadSink(data, length);
+    downloadBytes += length;
+    downloadLast = millis();
+    return takeFillBuffer();
+  }
+
+  if (fillLength + recordSize > DOWNLOAD_BUFFER_SIZE)
+  {
+    queueFillBuffer();
+    if (!takeFillBuffer())
+    {
+      return false;
+    }
+  }
+
+  uint8_t *record = downloadBuffers[fillIndex] + fillLength;
+  uint32_t recordLength = length;
+  memcpy(record, &recordLength, sizeof(recordLength));
+  memcpy(record + DOWNLOAD_RECORD_HEADER_SIZE, data, length);
+  fillLength += recordSize;
+  downloadBytes += length;
+  downloadLast = millis();
+  return true;
+#endif
+}
+
+/**
+ * @brief Writes the rest of the download and waits for the writer task.
+ *
+ * Must be called before the destination is closed or checked. The sink is not
+ * called any more once it returns, also when the writer did not finish in time.
+ *
+ * @return true if every message has been handed to the sink.
+ */
+bool finishDownloadBuffer()
+{
+  if (!downloadActive)
+  {
+    return false;
+  }
+#if DOWNLOAD_BUFFERED
+  bool written = waitForDownloadWriter() && !downloadFailed;
+  const char *path = "buffered";
+#else
+  bool written = !downloadFailed;
+  const char *path = "direct";
+#endif
+  detachDownloadSink();
+  downloadActive = false;
+
+  unsigned long elapsed = max(downloadLast - downloadStart, 1UL);
+  Log(LogCategoryGeneral, LogLevelINFO, "Download: ", String(downloadBytes), " bytes in ", String(elapsed), " ms | ", String(downloadBytes / elapsed), " kB/s | ", path, ", waited for the writer ", String(downloadWaited), " ms");
+  return written;
+}
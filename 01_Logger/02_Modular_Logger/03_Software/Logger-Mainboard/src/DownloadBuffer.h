@@ -0,0 +1,33 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Double-buffered writer for firmware and config downloads
+ */
+
+#ifndef DOWNLOADBUFFER_H
+#define DOWNLOADBUFFER_H
+
+#include <Arduino.h>
+
+// 1: the writer task on core 0 writes the buffered messages, 0: the MQTT callback writes each message itself (for comparison)
+#define DOWNLOAD_BUFFERED 1
+
+// Size of each of the two buffers, holds several messages of the MQTT read buffer (bytes)
+#define DOWNLOAD_BUFFER_SIZE 8192
+
+// Longest wait of the MQTT callback for a free buffer before the download is given up (ms)
+#define DOWNLOAD_WRITER_TIMEOUT 5000
+
+// Writes one received message to its destination, called by the writer task, never after finishDownloadBuffer()
+typedef void (*DownloadSink)(const uint8_t *data, size_t length);
+
+void beginDownloadBuffer(DownloadSink sink);
+bool appendDownloadBuffer(const uint8_t *data, size_t length);
+bool finishDownloadBuffer();
+
+#endif
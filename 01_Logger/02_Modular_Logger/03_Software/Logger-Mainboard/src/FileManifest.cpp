@@ -0,0 +1,321 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Cached manifest of the SD card directories
+ *
+ * The manifest keeps the number of files per tracked directory and the name
+ * of the latest configuration file in RTC memory. The file helpers update it
+ * in place, so no directory has to be enumerated during normal operation.
+ * A full scan is only done when the checksum does not match, e.g. after a
+ * cold boot. The log writer task on core 0 and the main loop on core 1 both
+ * update the manifest, every access holds fileManifestLock.
+ */
+
+#include <SD.h>
+#include <esp_rom_crc.h>
+
+#include "DebuggingSDLog.h"
+#include "FileManifest.h"
+
+#define FILE_MANIFEST_MAGIC 0x4D464E46
+
+struct FileManifest
+{
+  uint32_t magic;
+  uint16_t count[ManifestDirectoryCount];
+  char latestConfig[55];
+  uint32_t checksum;
+};
+
+struct ManifestDirectoryInfo
+{
+  const char *path;
+  const char *extension;
+};
+
+static const ManifestDirectoryInfo manifestDirectories[ManifestDirectoryCount] = {
+    {"/measurements/mqtt_header", ".json"},
+    {"/measurements/mqtt_measurements", ".json"},
+    {"/log", ".txt"},
+    {"/loggerConfig", ".json"},
+    {"/backup/header", ""},
+    {"/backup/measurements", ""},
+    {"/backup/log", ""},
+};
+
+// The log currently written is not a pending segment
+static const char *activeLogFile = "log.txt";
+
+RTC_DATA_ATTR FileManifest fileManifest;
+
+// The log writer task closes log segments on core 0
+static portMUX_TYPE fileManifestLock = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * @brief Calculates the checksum of the manifest.
+ * @return uint32_t CRC32 over all fields except the checksum.
+ */
+static uint32_t calculateManifestChecksum(const FileManifest &manifest)
+{
+  return esp_rom_crc32_le(0, (const uint8_t *)&manifest, offsetof(FileManifest, checksum));
+}
+
+/**
+ * @brief Checks whether a configuration file is newer than another one.
+ * @param fileName Name like logger_<id>_config_<timestamp>.json.
+ * @param latest Name of the latest configuration file so far, may be empty.
+ * @return true if the timestamp of fileName is greater.
+ */
+static bool isNewerConfig(const char *fileName, const char *latest)
+{
+  if (latest[0] == '\0')
+  {
+    return true;
+  }
+  // Compared with the ".json" suffix, '.' sorts before the digits like the end of the timestamp
+  const char *timestamp = strrchr(fileName, '_');
+  const char *latestTimestamp = strrchr(latest, '_');
+  return strcmp(timestamp ? timestamp + 1 : fileName, latestTimestamp ? latestTimestamp + 1 : latest) > 0;
+}
+
+/**
+ * @brief Finds the tracked directory of a path.
+ * @param directory Directory path, a trailing '/' is ignored.
+ * @return int Index of the directory or -1 if not tracked.
+ */
+static int findManifestDirectory(const String &directory)
+{
+  String path = directory;
+  while (path.length() > 1 && path.endsWith("/"))
+  {
+    path.remove(path.length() - 1);
+  }
+  for (int i = 0; i < ManifestDirectoryCount; i++)
+  {
+    if (path == manifestDirectories[i].path)
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/**
+ * @brief Checks whether a file is counted in a tracked directory.
+ * @param index Index of the directory.
+ * @param fileName Name of the file.
+ * @return true if the file is counted.
+ */
+static bool isManifestFile(int index, const String &fileName)
+{
+  if (index == ManifestLogSegments && fileName == activeLogFile)
+  {
+    return false;
+  }
+  return fileName.endsWith(manifestDirectories[index].extension);
+}
+
+/**
+ * @brief Rebuilds the manifest by scanning all tracked directories.
+ */
+static void rebuildFileManifest()
+{
+  unsigned long startTime = millis();
+
+  // Scanned without the lock, changes during the scan are lost and fixed by the next rebuild
+  FileManifest manifest;
+  memset(&manifest, 0, sizeof(manifest));
+  manifest.magic = FILE_MANIFEST_MAGIC;
+
+  for (int i = 0; i < ManifestDirectoryCount; i++)
+  {
+    File dir = SD.open(manifestDirectories[i].path);
+    if (!dir || !dir.isDirectory())
+    {
+      continue;
+    }
+    File file = dir.openNextFile();
+    while (file)
+    {
+      String fileName = file.name();
+      if (!file.isDirectory() && isManifestFile(i, fileName))
+      {
+        manifest.count[i]++;
+        if (i == ManifestLoggerConfig && isNewerConfig(fileName.c_str(), manifest.latestConfig))
+        {
+          strlcpy(manifest.latestConfig, fileName.c_str(), sizeof(manifest.latestConfig));
+        }
+      }
+      file.close();
+      file = dir.openNextFile();
+    }
+    dir.close();
+  }
+
+  manifest.checksum = calculateManifestChecksum(manifest);
+
+  taskENTER_CRITICAL(&fileManifestLock);
+  fileManifest = manifest;
+  taskEXIT_CRITICAL(&fileManifestLock);
+
+  Log(LogCategorySDCard, LogLevelDEBUG, "File manifest rebuilt in ", String(millis() - startTime), " ms");
+}
+
+/**
+ * @brief Checks magic and checksum of the manifest, called with fileManifestLock held.
+ * @return true if the manifest can be used.
+ */
+static bool isFileManifestValid()
+{
+  return fileManifest.magic == FILE_MANIFEST_MAGIC && fileManifest.checksum == calculateManifestChecksum(fileManifest);
+}
+
+/**
+ * @brief Copies the manifest, rebuilds it first if it is invalid.
+ * @param manifest Receives the valid manifest.
+ */
+static void readFileManifest(FileManifest &manifest)
+{
+  taskENTER_CRITICAL(&fileManifestLock);
+  bool valid = isFileManifestValid();
+  taskEXIT_CRITICAL(&fileManifestLock);
+
+  if (!valid)
+  {
+    rebuildFileManifest();
+  }
+
+  taskENTER_CRITICAL(&fileManifestLock);
+  manifest = fileManifest;
+  taskEXIT_CRITICAL(&fileManifestLock);
+}
+
+/**
+ * @brief Forces a rebuild of the manifest on the next access.
+ */
+void invalidateFileManifest()
+{
+  taskENTER_CRITICAL(&fileManifestLock);
+  fileManifest.magic = 0;
+  taskEXIT_CRITICAL(&fileManifestLock);
+}
+
+/**
+ * @brief Records a file that was created in or moved into a directory.
+ * @param directory Directory of the file.
+ * @param fileName Name of the file.
+ */
+void manifestFileAdded(const String &directory, const String &fileName)
+{
+  int index = findManifestDirectory(directory);
+  if (index < 0 || !isManifestFile(index, fileName))
+  {
+    return;
+  }
+
+  taskENTER_CRITICAL(&fileManifestLock);
+  if (!isFileManifestValid())
+  {
+    // An invalid manifest is rebuilt on the next query and then includes the change
+    taskEXIT_CRITICAL(&fileManifestLock);
+    return;
+  }
+
+  fileManifest.count[index]++;
+  if (index == ManifestLoggerConfig && isNewerConfig(fileName.c_str(), fileManifest.latestConfig))
+  {
+    strlcpy(fileManifest.latestConfig, fileName.c_str(), sizeof(fileManifest.latestConfig));
+  }
+  fileManifest.checksum = calculateManifestChecksum(fileManifest);
+  taskEXIT_CRITICAL(&fileManifestLock);
+}
+
+/**
+ * @brief Records a file that was removed from or moved out of a directory.
+ * @param directory Directory of the file.
+ * @param fileName Name of the file.
+ */
+void manifestFileRemoved(const String &directory, const String &fileName)
+{
+  int index = findManifestDirectory(directory);
+  if (index < 0 || !isManifestFile(index, fileName))
+  {
+    return;
+  }
+
+  taskENTER_CRITICAL(&fileManifestLock);
+  if (!isFileManifestValid())
+  {
+    // An invalid manifest is rebuilt on the next query and then includes the change
+    taskEXIT_CRITICAL(&fileManifestLock);
+    return;
+  }
+
+  if (fileManifest.count[index] > 0)
+  {
+    fileManifest.count[index]--;
+  }
+  if (index == ManifestLoggerConfig && strcmp(fileName.c_str(), fileManifest.latestConfig) == 0)
+  {
+    // The next older file is only known after a scan
+    fileManifest.magic = 0;
+  }
+  else
+  {
+    fileManifest.checksum = calculateManifestChecksum(fileManifest);
+  }
+  taskEXIT_CRITICAL(&fileManifestLock);
+}
+
+/**
+ * @brief Records that all files of a directory were removed.
+ * @param directory Directory that was cleared.
+ */
+void manifestDirectoryCleared(const String &directory)
+{
+  int index = findManifestDirectory(directory);
+  if (index < 0)
+  {
+    return;
+  }
+
+  taskENTER_CRITICAL(&fileManifestLock);
+  if (isFileManifestValid())
+  {
+    fileManifest.count[index] = 0;
+    if (index == ManifestLoggerConfig)
+    {
+      fileManifest.latestConfig[0] = '\0';
+    }
+    fileManifest.checksum = calculateManifestChecksum(fileManifest);
+  }
+  taskEXIT_CRITICAL(&fileManifestLock);
+}
+
+/**
+ * @brief Gets the number of files in a tracked directory.
+ * @param directory The tracked directory.
+ * @return uint16_t Number of files.
+ */
+uint16_t manifestFileCount(ManifestDirectory directory)
+{
+  FileManifest manifest;
+  readFileManifest(manifest);
+  return manifest.count[directory];
+}
+
+/**
+ * @brief Gets the name of the latest configuration file in /loggerConfig.
+ * @return String The file name or "" if there is none.
+ */
+String manifestLatestConfigFile()
+{
+  FileManifest manifest;
+  readFileManifest(manifest);
+  return String(manifest.latestConfig);
+}
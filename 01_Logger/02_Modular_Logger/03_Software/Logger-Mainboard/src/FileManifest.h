@@ -0,0 +1,38 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Cached manifest of the SD card directories
+ */
+
+#ifndef FILEMANIFEST_H
+#define FILEMANIFEST_H
+
+#include <Arduino.h>
+
+// Directories tracked by the manifest
+enum ManifestDirectory
+{
+  ManifestMqttHeader = 0,     // /measurements/mqtt_header, *.json
+  ManifestMqttMeasurements,   // /measurements/mqtt_measurements, *.json
+  ManifestLogSegments,        // /log, closed segments *.txt
+  ManifestLoggerConfig,       // /loggerConfig, *.json
+  ManifestBackupHeader,       // /backup/header
+  ManifestBackupMeasurements, // /backup/measurements
+  ManifestBackupLog,          // /backup/log
+  ManifestDirectoryCount
+};
+
+void manifestFileAdded(const String &directory, const String &fileName);
+void manifestFileRemoved(const String &directory, const String &fileName);
+void manifestDirectoryCleared(const String &directory);
+void invalidateFileManifest();
+
+uint16_t manifestFileCount(ManifestDirectory directory);
+String manifestLatestConfigFile();
+
+#endif
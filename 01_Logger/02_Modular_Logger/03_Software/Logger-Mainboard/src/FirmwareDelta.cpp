@@ -0,0 +1,297 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Delta patches of the firmware against the running firmware
+ *
+ * A patch describes the new firmware as bytes copied from the running
+ * firmware and literal bytes. After the header it is a sequence of commands
+ * (varints are unsigned LEB128):
+ *
+ *   zigzag varint seek      moves the read position in the running firmware
+ *   varint copy             bytes copied from the running firmware
+ *   varint insert           literal bytes that follow the command
+ *
+ * The patch is applied while it arrives, in any chunk sizes, only the
+ * position in the patch is kept (FirmwarePatchState). Patches are created by
+ * Tools/firmware_delta.py.
+ */
+
+#include <esp_image_format.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+#include <mbedtls/md.h>
+
+#include "DebuggingSDLog.h"
+#include "FirmwareDelta.h"
+
+#define FIRMWARE_PATCH_COPY_BUFFER 1024
+
+enum FirmwarePatchPhase
+{
+  FirmwarePatchPhaseHeader = 0,
+  FirmwarePatchPhaseSeek,
+  FirmwarePatchPhaseCopy,
+  FirmwarePatchPhaseInsertLength,
+  FirmwarePatchPhaseInsert,
+  FirmwarePatchPhaseDone
+};
+
+static uint8_t copyBuffer[FIRMWARE_PATCH_COPY_BUFFER];
+
+/**
+ * @brief Reads a little endian uint32_t of the patch header.
+ * @param data The first byte.
+ * @return uint32_t The value.
+ */
+static uint32_t readHeaderValue(const uint8_t *data)
+{
+  return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+/**
+ * @brief Converts a SHA-256 of the patch header to a hex string.
+ * @param hash The 32 bytes of the hash.
+ * @return String The hash as lower case hex string.
+ */
+static String headerSha256(const uint8_t *hash)
+{
+  char hex[65];
+  for (int i = 0; i < 32; i++)
+  {
+    sprintf(hex + 2 * i, "%02x", hash[i]);
+  }
+  return String(hex);
+}
+
+/**
+ * @brief Checks whether a download starts with a patch header.
+ * @param data The first bytes of the download.
+ * @param length Number of bytes.
+ * @return true if the download is a patch, false if it is a firmware image.
+ */
+bool isFirmwarePatch(const uint8_t *data, size_t length)
+{
+  return length >= 4 && memcmp(data, FIRMWARE_PATCH_MAGIC, 3) == 0 && data[3] == FIRMWARE_PATCH_VERSION;
+}
+
+/**
+ * @brief SHA-256 of the running firmware, calculated once per wake up.
+ *
+ * The same as the SHA-256 of its firmware.bin, patches are built against it.
+ * esp_partition_get_sha256() leaves out the SHA-256 appended to the image,
+ * so the hash is calculated over the image length from esp_image_verify(),
+ * which includes it.
+ *
+ * @return String The hash as lower case hex string, empty if it cannot be calculated.
+ */
+String runningFirmwareSha256()
+{
+  static String sha256;
+  if (!sha256.isEmpty())
+  {
+    return sha256;
+  }
+  const esp_partition_t *partition = esp_ota_get_running_partition();
+  if (partition == nullptr)
+  {
+    return sha256;
+  }
+  esp_partition_pos_t position = {partition->address, partition->size};
+  esp_image_metadata_t metadata;
+  if (esp_image_verify(ESP_IMAGE_VERIFY_SILENT, &position, &metadata) != ESP_OK || metadata.image_len > partition->size)
+  {
+    Log(LogCategoryGeneral, LogLevelERROR, "Firmware patch: running firmware could not be verified");
+    return sha256;
+  }
+
+  mbedtls_md_context_t ctx;
+  mbedtls_md_init(&ctx);
+  bool ok = mbedtls_md_setup(&ctx, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 0) == 0 && mbedtls_md_starts(&ctx) == 0;
+  for (uint32_t offset = 0; ok && offset < metadata.image_len; offset += sizeof(copyBuffer))
+  {
+    size_t count = min(metadata.image_len - offset, (uint32_t)sizeof(copyBuffer));
+    ok = esp_partition_read(partition, offset, copyBuffer, count) == ESP_OK && mbedtls_md_update(&ctx, copyBuffer, count) == 0;
+  }
+  uint8_t hash[32];
+  if (ok && mbedtls_md_finish(&ctx, hash) == 0)
+  {
+    sha256 = headerSha256(hash);
+  }
+  mbedtls_md_free(&ctx);
+  return sha256;
+}
+
+/**
+ * @brief Checks the header against the running firmware and the expected firmware.
+ * @param state The patch state with the complete header.
+ * @param targetSha256 SHA-256 of the firmware from hyfive/updateFirmwareSHA256.
+ * @param targetCapacity Size of the OTA partition.
+ * @return true if the patch can be applied.
+ */
+static bool checkPatchHeader(const FirmwarePatchState &state, const char *targetSha256, uint32_t targetCapacity)
+{
+  const esp_partition_t *running = esp_ota_get_running_partition();
+  uint32_t baseSize = readHeaderValue(state.header + 4);
+  uint32_t targetSize = readHeaderValue(state.header + 8);
+  String baseSha256 = headerSha256(state.header + 12);
+
+  if (!isFirmwarePatch(state.header, FIRMWARE_PATCH_HEADER_SIZE) || running == nullptr || baseSize > running->size || targetSize == 0 || targetSize > targetCapacity)
+  {
+    Log(LogCategoryGeneral, LogLevelERROR, "Firmware patch: invalid header");
+    return false;
+  }
+  if (baseSha256 != runningFirmwareSha256())
+  {
+    Log(LogCategoryGeneral, LogLevelWARNING, "Firmware patch: built for ", baseSha256, ", running ", runningFirmwareSha256());
+    return false;
+  }
+  if (headerSha256(state.header + 44) != targetSha256)
+  {
+    Log(LogCategoryGeneral, LogLevelWARNING, "Firmware patch: not for firmware ", String(targetSha256));
+    return false;
+  }
+  Log(LogCategoryGeneral, LogLevelINFO, "Firmware patch: ", String(baseSize), " -> ", String(targetSize), " bytes");
+  return true;
+}
+
+/**
+ * @brief Copies bytes of the running firmware to the new firmware.
+ * @param state The patch state, read and write positions are advanced.
+ * @param length Number of bytes.
+ * @param output Receives the bytes.
+ * @return true on success.
+ */
+static bool copyFromRunningFirmware(FirmwarePatchState &state, uint32_t length, FirmwarePatchOutput output)
+{
+  const esp_partition_t *running = esp_ota_get_running_partition();
+  while (length > 0)
+  {
+    size_t count = min(length, (uint32_t)sizeof(copyBuffer));
+    if (esp_partition_read(running, state.basePosition, copyBuffer, count) != ESP_OK || !output(copyBuffer, count))
+    {
+      Log(LogCategoryGeneral, LogLevelERROR, "Firmware patch: copy failed at ", String(state.basePosition));
+      return false;
+    }
+    state.basePosition += count;
+    state.targetPosition += count;
+    length -= count;
+  }
+  return true;
+}
+
+/**
+ * @brief Applies the next bytes of a patch.
+ *
+ * The state starts zeroed for a new patch. Bytes after the end of the new
+ * firmware are ignored.
+ *
+ * @param state Position in the patch.
+ * @param data The next bytes of the patch.
+ * @param length Number of bytes.
+ * @param targetSha256 SHA-256 of the firmware from hyfive/updateFirmwareSHA256.
+ * @param targetCapacity Size of the OTA partition.
+ * @param output Receives the bytes of the new firmware.
+ * @return FirmwarePatchResult Complete once the whole firmware has been written.
+ */
+FirmwarePatchResult applyFirmwarePatch(FirmwarePatchState &state, const uint8_t *data, size_t length, const char *targetSha256, uint32_t targetCapacity, FirmwarePatchOutput output)
+{
+  size_t position = 0;
+  while (position < length && state.phase != FirmwarePatchPhaseDone)
+  {
+    if (state.phase == FirmwarePatchPhaseHeader)
+    {
+      size_t count = min(length - position, (size_t)(FIRMWARE_PATCH_HEADER_SIZE - state.headerLength));
+      memcpy(state.header + state.headerLength, data + position, count);
+      state.headerLength += count;
+      position += count;
+      if (state.headerLength == FIRMWARE_PATCH_HEADER_SIZE)
+      {
+        if (!checkPatchHeader(state, targetSha256, targetCapacity))
+        {
+          return FirmwarePatchRejected;
+        }
+        state.phase = FirmwarePatchPhaseSeek;
+      }
+      continue;
+    }
+
+    if (state.phase == FirmwarePatchPhaseInsert)
+    {
+      size_t count = min(length - position, (size_t)state.remaining);
+      if (!output(data + position, count))
+      {
+        return FirmwarePatchRejected;
+      }
+      state.targetPosition += count;
+      state.remaining -= count;
+      position += count;
+    }
+    else
+    {
+      uint8_t byte = data[position++];
+      if (state.varintShift > 28)
+      {
+        Log(LogCategoryGeneral, LogLevelERROR, "Firmware patch: invalid command");
+        return FirmwarePatchRejected;
+      }
+      state.varint |= (uint32_t)(byte & 0x7F) << state.varintShift;
+      state.varintShift += 7;
+      if (byte & 0x80)
+      {
+        continue;
+      }
+      uint32_t value = state.varint;
+      state.varint = 0;
+      state.varintShift = 0;
+
+      uint32_t baseSize = readHeaderValue(state.header + 4);
+      uint32_t targetSize = readHeaderValue(state.header + 8);
+      if (state.phase == FirmwarePatchPhaseSeek)
+      {
+        int64_t basePosition = (int64_t)state.basePosition + (int32_t)((value >> 1) ^ -(int32_t)(value & 1));
+        if (basePosition < 0 || basePosition > baseSize)
+        {
+          Log(LogCategoryGeneral, LogLevelERROR, "Firmware patch: seek outside the running firmware");
+          return FirmwarePatchRejected;
+        }
+        state.basePosition = basePosition;
+        state.phase = FirmwarePatchPhaseCopy;
+      }
+      else if (state.phase == FirmwarePatchPhaseCopy)
+      {
+        if (value > baseSize - state.basePosition || value > targetSize - state.targetPosition)
+        {
+          Log(LogCategoryGeneral, LogLevelERROR, "Firmware patch: copy outside the firmware");
+          return FirmwarePatchRejected;
+        }
+        if (!copyFromRunningFirmware(state, value, output))
+        {
+          return FirmwarePatchRejected;
+        }
+        state.phase = FirmwarePatchPhaseInsertLength;
+      }
+      else
+      {
+        if (value > targetSize - state.targetPosition)
+        {
+          Log(LogCategoryGeneral, LogLevelERROR, "Firmware patch: insert outside the firmware");
+          return FirmwarePatchRejected;
+        }
+        state.remaining = value;
+        state.phase = FirmwarePatchPhaseInsert;
+      }
+    }
+
+    // A command ends after its literal bytes
+    if (state.phase == FirmwarePatchPhaseInsert && state.remaining == 0)
+    {
+      state.phase = state.targetPosition == readHeaderValue(state.header + 8) ? FirmwarePatchPhaseDone : FirmwarePatchPhaseSeek;
+    }
+  }
+  return state.phase == FirmwarePatchPhaseDone ? FirmwarePatchComplete : FirmwarePatchContinue;
+}
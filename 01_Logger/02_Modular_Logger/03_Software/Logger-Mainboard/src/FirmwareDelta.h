@@ -0,0 +1,50 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Delta patches of the firmware against the running firmware
+ */
+
+#ifndef FIRMWAREDELTA_H
+#define FIRMWAREDELTA_H
+
+#include <Arduino.h>
+
+// Patch header: magic "HFD", format version, size of the running and the new
+// firmware (uint32_t each, little endian), SHA-256 of both (32 bytes each)
+#define FIRMWARE_PATCH_MAGIC "HFD"
+#define FIRMWARE_PATCH_VERSION 1
+#define FIRMWARE_PATCH_HEADER_SIZE 76
+
+enum FirmwarePatchResult
+{
+  FirmwarePatchContinue = 0, // more patch bytes are needed
+  FirmwarePatchComplete,     // the whole firmware has been written
+  FirmwarePatchRejected      // other running firmware, invalid patch or write error
+};
+
+// Receives the bytes of the new firmware in order
+typedef bool (*FirmwarePatchOutput)(const uint8_t *data, size_t length);
+
+// Position in the patch, kept over deep sleep with the download
+struct FirmwarePatchState
+{
+  uint8_t header[FIRMWARE_PATCH_HEADER_SIZE];
+  uint8_t headerLength;
+  uint8_t phase;
+  uint8_t varintShift;
+  uint32_t varint;
+  uint32_t remaining;      // literal bytes of the current command
+  uint32_t basePosition;   // read position in the running firmware
+  uint32_t targetPosition; // bytes of the new firmware written
+};
+
+bool isFirmwarePatch(const uint8_t *data, size_t length);
+String runningFirmwareSha256();
+FirmwarePatchResult applyFirmwarePatch(FirmwarePatchState &state, const uint8_t *data, size_t length, const char *targetSha256, uint32_t targetCapacity, FirmwarePatchOutput output);
+
+#endif
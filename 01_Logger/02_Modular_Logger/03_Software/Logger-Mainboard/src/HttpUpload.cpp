@@ -0,0 +1,277 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Upload of whole files to the deck box via HTTP
+ *
+ * The file is identified by logger_id, channel, name, size and SHA-256 in the
+ * query string of HTTP_UPLOAD_PATH. A GET request returns how much of the
+ * file the deck box already has: "308" with "Range: bytes=0-<last byte>", or
+ * "200" if the file is complete. The file is then sent in segments of
+ * HTTP_UPLOAD_SEGMENT_SIZE, each one POST request with "Content-Range" and a
+ * chunked body read from the SD card in blocks of HTTP_UPLOAD_READ_SIZE.
+ * After the last segment the deck box checks the SHA-256 and answers "200",
+ * or "409" if the hash does not match and the upload starts again.
+ */
+
+#include <WiFi.h>
+
+#include "DebuggingSDLog.h"
+#include "HttpUpload.h"
+#include "Utility.h"
+#include "loggerConfig.h"
+
+#define HTTP_STATUS_OK 200
+#define HTTP_STATUS_RESUME_INCOMPLETE 308
+#define HTTP_STATUS_CONFLICT 409
+
+// Segments in a row the deck box does not take before the upload is aborted
+#define HTTP_UPLOAD_RETRIES 3
+
+// Response of the deck box
+struct HttpUploadResponse
+{
+  int status;
+  uint32_t received; // bytes the deck box has from the start of the file
+  bool keepAlive;
+};
+
+static WiFiClient httpClient;
+static uint8_t httpBuffer[HTTP_UPLOAD_READ_SIZE];
+
+/**
+ * @brief Connects to the deck box unless the previous connection is still open.
+ * @param host Address of the deck box.
+ * @param port Port of the HTTP server of the deck box.
+ * @return true if connected.
+ */
+static bool connectHttp(const char *host, uint16_t port)
+{
+  if (httpClient.connected())
+  {
+    return true;
+  }
+  httpClient.stop();
+  if (!httpClient.connect(host, port, HTTP_UPLOAD_TIMEOUT))
+  {
+    return false;
+  }
+  httpClient.setTimeout(HTTP_UPLOAD_TIMEOUT / 1000); // seconds
+  return true;
+}
+
+/**
+ * @brief Reads the status line and headers of a response and discards the body.
+ * @param response Receives status, Range and Connection of the response.
+ * @return true if a response has been read.
+ */
+static bool readHttpResponse(HttpUploadResponse &response)
+{
+  // "HTTP/1.1 308 Permanent Redirect"
+  String line = httpClient.readStringUntil('\n');
+  int space = line.indexOf(' ');
+  if (!line.startsWith("HTTP/") || space < 0)
+  {
+    return false;
+  }
+  response.status = line.substring(space + 1).toInt();
+  response.received = 0;
+  response.keepAlive = line.startsWith("HTTP/1.1");
+
+  long contentLength = 0;
+  while (true)
+  {
+    line = httpClient.readStringUntil('\n');
+    line.trim();
+    if (line.length() == 0)
+    {
+      break;
+    }
+    int colon = line.indexOf(':');
+    if (colon < 0)
+    {
+      continue;
+    }
+    String name = line.substring(0, colon);
+    String value = line.substring(colon + 1);
+    name.toLowerCase();
+    value.trim();
+    value.toLowerCase();
+
+    if (name == "content-length")
+    {
+      contentLength = value.toInt();
+    }
+    else if (name == "range" && value.startsWith("bytes=0-"))
+    {
+      response.received = value.substring(8).toInt() + 1;
+    }
+    else if (name == "connection")
+    {
+      response.keepAlive = value != "close";
+    }
+    else if (name == "transfer-encoding")
+    {
+      // A chunked body is not parsed, the connection is opened again
+      response.keepAlive = false;
+    }
+  }
+
+  while (contentLength > 0)
+  {
+    size_t length = httpClient.readBytes(httpBuffer, min((long)sizeof(httpBuffer), contentLength));
+    if (length == 0)
+    {
+      response.keepAlive = false;
+      break;
+    }
+    contentLength -= length;
+  }
+  return true;
+}
+
+/**
+ * @brief Sends the request line and headers.
+ * @param method HTTP method.
+ * @param target Path and query string.
+ * @param host Address of the deck box.
+ * @param headers Further header lines, each ending with CRLF.
+ * @return true if all bytes were written.
+ */
+static bool sendHttpRequestHead(const char *method, const String &target, const char *host, const String &headers)
+{
+  String head = String(method) + " " + target + " HTTP/1.1\r\nHost: " + host + "\r\n" + headers + "\r\n";
+  return httpClient.print(head) == head.length();
+}
+
+/**
+ * @brief POSTs one segment of the file as chunked body.
+ * @param file The file being uploaded.
+ * @param target Path and query string.
+ * @param host Address of the deck box.
+ * @param offset First byte of the segment.
+ * @param end Byte following the segment.
+ * @param fileSize Size of the file.
+ * @return true if the request has been written.
+ */
+static bool sendHttpSegment(File &file, const String &target, const char *host, uint32_t offset, uint32_t end, uint32_t fileSize)
+{
+  String headers = "Content-Type: application/octet-stream\r\nTransfer-Encoding: chunked\r\n";
+  if (fileSize == 0)
+  {
+    headers += "Content-Range: bytes */0\r\n";
+  }
+  else
+  {
+    headers += "Content-Range: bytes " + String(offset) + "-" + String(end - 1) + "/" + String(fileSize) + "\r\n";
+  }
+  if (!sendHttpRequestHead("POST", target, host, headers) || !file.seek(offset))
+  {
+    return false;
+  }
+
+  uint32_t position = offset;
+  while (position < end)
+  {
+    size_t length = file.read(httpBuffer, min((uint32_t)sizeof(httpBuffer), end - position));
+    if (length == 0)
+    {
+      return false;
+    }
+    char chunkHeader[12];
+    size_t headerLength = snprintf(chunkHeader, sizeof(chunkHeader), "%x\r\n", (unsigned)length);
+    if (httpClient.write((const uint8_t *)chunkHeader, headerLength) != headerLength || httpClient.write(httpBuffer, length) != length || httpClient.write((const uint8_t *)"\r\n", 2) != 2)
+    {
+      return false;
+    }
+    position += length;
+  }
+  return httpClient.write((const uint8_t *)"0\r\n\r\n", 5) == 5;
+}
+
+/**
+ * @brief Uploads a file to the deck box via HTTP.
+ *
+ * An interrupted upload continues at the end of the last segment the deck
+ * box has received.
+ *
+ * @param host Address of the deck box.
+ * @param port Port of the HTTP server of the deck box (upload_http_port in Config.json).
+ * @param file The file to upload.
+ * @param channelName Upload channel of the file (header, data or log).
+ * @return true if the deck box has confirmed the SHA-256 of the file.
+ */
+bool transmitFileHttp(const char *host, uint16_t port, File &file, const char *channelName)
+{
+  uint32_t fileSize = file.size();
+  char sha256[65];
+  if (!calculateFileSha256(file, sha256))
+  {
+    Log(LogCategoryMQTT, LogLevelERROR, "HTTP upload: file could not be read: ", String(file.name()));
+    return false;
+  }
+  String target = String(HTTP_UPLOAD_PATH) + "?logger_id=" + String(configRTC.logger_id) + "&channel=" + channelName + "&file=" + file.name() + "&size=" + String(fileSize) + "&sha256=" + sha256;
+
+  unsigned long startTime = millis();
+  uint32_t bytesSent = 0;
+  HttpUploadResponse response;
+  if (!connectHttp(host, port) || !sendHttpRequestHead("GET", target, host, "") || !readHttpResponse(response))
+  {
+    Log(LogCategoryMQTT, LogLevelWARNING, "HTTP upload: no response from the deck box");
+    httpClient.stop();
+    return false;
+  }
+
+  uint8_t retries = 0;
+  while (response.status == HTTP_STATUS_RESUME_INCOMPLETE)
+  {
+    if (!response.keepAlive)
+    {
+      httpClient.stop();
+    }
+    uint32_t offset = min(response.received, fileSize);
+    uint32_t end = min(offset + HTTP_UPLOAD_SEGMENT_SIZE, fileSize);
+    if (!connectHttp(host, port) || !sendHttpSegment(file, target, host, offset, end, fileSize) || !readHttpResponse(response))
+    {
+      Log(LogCategoryMQTT, LogLevelWARNING, "HTTP upload: ", String(file.name()), " interrupted at ", String(offset), "/", String(fileSize), " bytes");
+      httpClient.stop();
+      return false;
+    }
+    bytesSent += end - offset;
+
+    if (response.status == HTTP_STATUS_RESUME_INCOMPLETE && response.received <= offset)
+    {
+      if (++retries > HTTP_UPLOAD_RETRIES)
+      {
+        Log(LogCategoryMQTT, LogLevelERROR, "HTTP upload: deck box does not take ", String(file.name()), " at ", String(offset), " bytes");
+        httpClient.stop();
+        return false;
+      }
+    }
+    else
+    {
+      retries = 0;
+    }
+  }
+  httpClient.stop();
+
+  if (response.status == HTTP_STATUS_OK)
+  {
+    unsigned long elapsed = max(millis() - startTime, 1UL);
+    Log(LogCategoryMQTT, LogLevelDEBUG, "HTTP upload: ", String(file.name()), " | ", String(bytesSent), "/", String(fileSize), " bytes sent | ", String(elapsed), " ms | ", String(bytesSent / elapsed), " kB/s");
+    return true;
+  }
+  if (response.status == HTTP_STATUS_CONFLICT)
+  {
+    Log(LogCategoryMQTT, LogLevelERROR, "HTTP upload: SHA-256 of ", String(file.name()), " does not match at the deck box");
+  }
+  else
+  {
+    Log(LogCategoryMQTT, LogLevelERROR, "HTTP upload: ", String(file.name()), " failed with status ", String(response.status));
+  }
+  return false;
+}
@@ -0,0 +1,31 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Upload of whole files to the deck box via HTTP
+ */
+
+#ifndef HTTPUPLOAD_H
+#define HTTPUPLOAD_H
+
+#include <Arduino.h>
+#include <SD.h>
+
+#define HTTP_UPLOAD_PATH "/hyfive/upload"
+
+// Bytes of one POST request, an interrupted request is sent again from its start
+#define HTTP_UPLOAD_SEGMENT_SIZE 65536
+
+// Bytes of one SD card read and one HTTP chunk
+#define HTTP_UPLOAD_READ_SIZE 4096
+
+// Time to wait for a response of the deck box (ms)
+#define HTTP_UPLOAD_TIMEOUT 5000
+
+bool transmitFileHttp(const char *host, uint16_t port, File &file, const char *channelName);
+
+#endif
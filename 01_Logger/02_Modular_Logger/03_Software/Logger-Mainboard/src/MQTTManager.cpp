@@ -15,12 +15,25 @@
 #include <regex>
 
 #include "BMS.h"
+#include "BulkTransfer.h"
+#include "Compression.h"
+#include "ConfigManifest.h"
 #include "DS3231TimeNtp.h"
 #include "DebuggingSDLog.h"
+#include "DownloadBuffer.h"
+#include "FileManifest.h"
+#include "HttpUpload.h"
 #include "Led.h"
 #include "MQTTManager.h"
+#include "MeasurementRecord.h"
+#include "MqttPipeline.h"
+#include "SampleRing.h"
 #include "SensorManagement.h"
+#include "SeriesEncoding.h"
+#include "SpaceLedger.h"
 #include "SystemVariables.h"
+#include "UploadCursor.h"
+#include "UploadSession.h"
 #include "Utility.h"
 #include "WifiNetwork.h"
 #include "firmwareUpdate.h"
@@ -29,7 +42,7 @@
 #define MMMS 1024 // MAX_MQTT_MESSAGE_SIZE
 
 WiFiClient wifi;
-MQTTClient client(512, 512); // Read/write buffer size = 512
+MQTTClient client(1024, MQTT_WRITE_BUFFER_SIZE); // The read buffer holds the bitmap of a bulk status, the write buffer batch messages
 
 const char *mqttHost = "192.168.1.1";
 const int mqttPort = 1883;
@@ -41,10 +54,16 @@ const char *mqttPassword = "";
  * @brief Transmits an update message via MQTT.
  * @param updateInfo The update message to send.
  * @param mqtt_topic The MQTT topic to publish to.
- * @return true if the message was sent successfully, false otherwise.
+ * @return true if the message was sent successfully or kept until the end of a pipelined upload, false otherwise.
  */
 bool transmitUpdateMessage(const char *updateInfo, const char *mqtt_topic)
 {
+  if (pipelineDeferPublish(mqtt_topic, updateInfo))
+  {
+    // Called by the handler during a pipelined upload, sent after it
+    return true;
+  }
+
   uint8_t errorCount = 0;
   while (1)
   {
@@ -99,6 +118,9 @@ void uploadStatus()
   doc["battery_remaining"] = getRemainingBatteryPercentage();
   doc["memory_capacity_total"] = sdCardSpaceTotal();
   doc["memory_capacity_used"] = sdCardSpaceUsed();
+  doc["log_dropped"] = logSinkDroppedCount();
+  doc["compression_ratio"] = serialized(String(compressionRatio(), 2));
+  doc["compression_ms_per_mb"] = compressionMillisPerMegabyte();
 
   char payload[MMMS];
 
@@ -148,12 +170,30 @@ bool moveFileWithTimestamp(const char *sourceFolder, const char *fileName, const
   String sourcePath = String(sourceFolder) + "/" + fileName;
   String destinationPath = String(destinationFolder) + "/" + fileName;
 
+  if (backupCompressionEnabled)
+  {
+    // The plain file is only removed after the compressed copy was verified
+    String compressedName = String(fileName) + COMPRESSED_FILE_EXTENSION;
+    String compressedPath = String(destinationFolder) + "/" + compressedName;
+    if (compressFile(sourcePath, compressedPath))
+    {
+      if (ledgerRemoveFile(sourcePath))
+      {
+        manifestFileRemoved(sourceFolder, fileName);
+        manifestFileAdded(destinationFolder, compressedName);
+        return true;
+      }
+      ledgerRemoveFile(compressedPath);
+    }
+  }
+
   if (!SD.rename(sourcePath.c_str(), destinationPath.c_str()))
   {
     // Attempt to delete the file
-    if (SD.remove(sourcePath.c_str()))
+    if (ledgerRemoveFile(sourcePath))
     {
       Log(LogCategoryMQTT, LogLevelERROR, "File deleted after failed move: ", fileName);
+      manifestFileRemoved(sourceFolder, fileName);
       return false;
     }
     else
@@ -162,6 +202,8 @@ bool moveFileWithTimestamp(const char *sourceFolder, const char *fileName, const
       return false;
     }
   }
+  manifestFileRemoved(sourceFolder, fileName);
+  manifestFileAdded(destinationFolder, fileName);
   return true;
 }
 
@@ -246,6 +288,18 @@ unsigned long lastMessageTime = 0;
 bool readFileIn = false;
 File dataFile;
 String received_sha256 = "";
+bool firmwareStreamReceiving = false; // chunks of hyfive/updateFW go to the OTA partition
+
+/**
+ * @brief Appends a part of the downloaded config file, called by the download writer task.
+ * @note Not called after finishDownloadBuffer() has returned, dataFile is closed then.
+ * @param data The part of the file.
+ * @param length Number of bytes.
+ */
+static void writeConfigChunk(const uint8_t *data, size_t length)
+{
+  dataFile.write(data, length);
+}
 
 /**
  * @brief Received MQTT message.
@@ -256,14 +310,16 @@ String received_sha256 = "";
  */
 void handleReceivedMessage(MQTTClient *client, char *topic, char *payload, int length)
 {
+  if (handleBulkStatusMessage(topic, (const uint8_t *)payload, length) || handleEncodingStatusMessage(topic, (const uint8_t *)payload, length) || handleSessionStatusMessage(topic, (const uint8_t *)payload, length) || handleConfigManifestMessage(topic, (const uint8_t *)payload, length))
+  {
+    return;
+  }
+
+  // Only the short control messages become a String, the chunks of a download go to the download buffer
   String messageTemp;
   if (noUpdateAvaiable)
   {
-    for (int i = 0; i < length; i++)
-    {
-      messageTemp += (char)payload[i];
-    }
-
+    messageTemp.concat(payload, length);
     messageTemp.trim();
 
     if ((messageTemp == String(configRTC.logger_id) + "_0") && isNodeRedStatus)
@@ -324,16 +380,22 @@ void handleReceivedMessage(MQTTClient *client, char *topic, char *payload, int l
       }
 
       FWUpdateAvaiable = false;
-      readFileIn = true;
 
-      dataFile = SD.open("/updateFW/firmware.bin", FILE_APPEND);
-      if (!dataFile)
-      {
-        Serial.println("Error opening the file on the SD card.");
-      }
-      else
+      // "<sha256>:<offset>" asks for chunks with header from the offset on,
+      // "<sha256>:<offset>:<running sha256>" for a patch if the deck box has one
+      uint32_t resumeOffset;
+      String baseSha256;
+      if (beginFirmwareStream(received_sha256, resumeOffset, baseSha256))
       {
-        transmitUpdateMessage((messageTemp).c_str(), "hyfive/updateFWRequest");
+        readFileIn = true;
+        firmwareStreamReceiving = true;
+        beginDownloadBuffer(writeFirmwareChunk);
+        String request = messageTemp + ":" + String(resumeOffset);
+        if (!baseSha256.isEmpty())
+        {
+          request += ":" + baseSha256;
+        }
+        transmitUpdateMessage(request.c_str(), "hyfive/updateFWRequest");
         return;
       }
     }
@@ -381,6 +443,7 @@ void handleReceivedMessage(MQTTClient *client, char *topic, char *payload, int l
         else
         {
           // File opened on SD card.
+          beginDownloadBuffer(writeConfigChunk);
           transmitUpdateMessage((messageTemp).c_str(), "hyfive/updateConfigUpload");
           return;
         }
@@ -399,11 +462,8 @@ void handleReceivedMessage(MQTTClient *client, char *topic, char *payload, int l
 
   if (readFileIn)
   {
-    for (int i = 0; i < length; i++)
-    {
-      // Serial.print(payload[i]);
-      dataFile.print(payload[i]);
-    }
+    // Written by the download writer task, waits here while both buffers are full
+    appendDownloadBuffer((const uint8_t *)payload, length);
   }
 
   lastMessageTime = millis();
@@ -448,12 +508,16 @@ bool connectToMqtt()
         client.subscribe("hyfive/updateConfig", 2);
         client.subscribe("hyfive/updateFirmwareSHA256", 2);
         client.subscribe("hyfive/updateFW", 0);
-        client.subscribe("hyfive/nodeRedLogin", 2);
-        client.subscribe("hyfive/nodeRedBusyStatus", 2);
+        client.subscribe(SESSION_STATUS_TOPIC, 1);
+        client.subscribe(BULK_STATUS_TOPIC, 1);
+        client.subscribe(SERIES_ENCODING_STATUS_TOPIC, 1);
 
         // Set up callback function for incoming messages
         client.onMessageAdvanced(handleReceivedMessage);
 
+        // Retained, arrives after the callback is set and before the config request of this wake
+        subscribeConfigManifest(client);
+
         return true;
       }
       else
@@ -494,7 +558,11 @@ void updateConfigViaMqtt()
 
       if (readFileIn)
       {
+        finishDownloadBuffer();
+        // The downloaded file is created empty
+        size_t fileSize = dataFile.size();
         dataFile.close();
+        ledgerFileResized(0, fileSize);
       }
       readFileIn = false;
       break;
@@ -504,7 +572,8 @@ void updateConfigViaMqtt()
 
 /**
  * @brief Performs firmware update via MQTT.
- *        Receives firmware data through MQTT messages and verifies SHA256.
+ *        Streams the firmware into the OTA partition and verifies SHA256.
+ *        An interrupted download continues at its last offset with the next call.
  * @note Timeout or completion will end the process
  */
 void updateFWViaMqtt()
@@ -519,16 +588,33 @@ void updateFWViaMqtt()
 
     if (millis() - lastMessageTime > 1500)
     {
-
       if (readFileIn)
       {
+        finishDownloadBuffer();
+      }
+
+      if (readFileIn && !firmwareStreamReceiving)
+      {
+        // The downloaded file is created empty
+        size_t fileSize = dataFile.size();
         dataFile.close();
+        ledgerFileResized(0, fileSize);
       }
       readFileIn = false;
 
       noUpdateAvaiable = true;
       FWUpdateAvaiable = true;
-      if (!isFirmwareUpdate)
+      if (!isFirmwareUpdate && firmwareStreamReceiving)
+      {
+        firmwareStreamReceiving = false;
+        if (finishFirmwareStream() == FirmwareStreamVerified)
+        {
+          isFirmwareUpdate = true;
+          client.unsubscribe("hyfive/updateFW");
+          client.unsubscribe("hyfive/updateFirmwareSHA256");
+        }
+      }
+      else if (!isFirmwareUpdate)
       {
         if (calculateSha256(received_sha256))
         {
@@ -547,7 +633,7 @@ void updateFWViaMqtt()
           }
           else
           {
-            SD.remove("/updateFW/firmware.bin");
+            ledgerRemoveFile("/updateFW/firmware.bin");
             isFirmwareUpdate = false;
           }
         }
@@ -562,6 +648,8 @@ void updateFWViaMqtt()
  */
 void requestNodeRedStatus()
 {
+  // Only subscribed for the busy/login handshake, see UploadSession.cpp
+  client.subscribe("hyfive/nodeRedLogin", 2);
   isNodeRedLogin = true;
   isNodeRedAvailable = false;
   transmitUpdateMessage((String(configRTC.logger_id)).c_str(), "hyfive/nodeRedRequest");
@@ -591,6 +679,7 @@ void requestNodeRedStatus()
  */
 void requestNodeRedBusyStatus()
 {
+  client.subscribe("hyfive/nodeRedBusyStatus", 2);
   isNodeRedStatus = true;
   isNodeRedBusy = true;
   transmitUpdateMessage((String(configRTC.logger_id)).c_str(), "hyfive/nodeRedBusyRequest");
@@ -618,6 +707,27 @@ void requestNodeRedBusyStatus()
   }
 }
 
+/**
+ * @brief Asks Node-RED for an upload slot, busy check and login in one round trip.
+ * @return SessionResult Ready, Busy, or NoAnswer if the deck box only knows the busy/login handshake.
+ */
+SessionResult requestNodeRedSession()
+{
+  if (!connectToMqtt())
+  {
+    return SessionNoAnswer;
+  }
+  return requestUploadSession(client);
+}
+
+/**
+ * @brief Frees the upload slot at Node-RED after all data has been transmitted.
+ */
+void releaseNodeRedSession()
+{
+  releaseUploadSession(client);
+}
+
 /**
  * @brief Checks if Node-RED is responsive.
  * @return true if Node-RED is responsive, false otherwise.
@@ -641,8 +751,15 @@ bool isNodeRedResponsePositive()
  */
 void moveMeasurementAndData()
 {
+  // Convert the binary records of the deployment into the JSON lines for the upload
+  flushSampleRing();
+  if (SD.exists(MEASUREMENT_RECORD_FILE))
+  {
+    convertMeasurementRecordsToJson(MEASUREMENT_RECORD_FILE, "/measurements/measurement.json");
+  }
+
   // Check if there are measurement JSON files in the "/measurements" directory
-  if (checkFileProperties("/measurements", 0, ".json"))
+  if (SD.exists("/measurements/configHeader.json") || SD.exists("/measurements/measurement.json"))
   {
     // Move the config header file to the MQTT header directory
     moveFileToDestination("/measurements", "configHeader.json", "/measurements/mqtt_header", true);
@@ -652,6 +769,15 @@ void moveMeasurementAndData()
   }
 }
 
+/**
+ * @brief Checks whether log data is waiting for the upload.
+ * @return true if there are closed log segments or a current log.
+ */
+static bool hasPendingLogData()
+{
+  return manifestFileCount(ManifestLogSegments) > 0 || SD.exists("/log/log.txt");
+}
+
 /**
  * @brief Processes and transmits measurement data.
  */
@@ -660,12 +786,19 @@ void processAndTransmitMeasurementData()
   moveMeasurementAndData();
 
   // Check if there are any files in the MQTT header or measurements or log directories
-  if (checkFileProperties("/measurements/mqtt_header", 0, ".json") || checkFileProperties("/measurements/mqtt_measurements", 0, ".json") || checkFileProperties("/log", 0, ".txt"))
+  if (manifestFileCount(ManifestMqttHeader) > 0 || manifestFileCount(ManifestMqttMeasurements) > 0 || hasPendingLogData())
   {
+    beginUploadTiming();
     while (checkWetSensorAndNodeRed())
     {
+      if (connectToMqtt())
+      {
+        markUploadPhase(UploadPhaseMqtt);
+        logTimeToFirstByte();
+      }
+
       // Transmit all header data while header files are present
-      if (checkFileProperties("/measurements/mqtt_header", 0, ".json"))
+      if (manifestFileCount(ManifestMqttHeader) > 0)
       {
         if (connectToMqtt())
         {
@@ -674,7 +807,7 @@ void processAndTransmitMeasurementData()
       }
 
       // Transmit all measurement data while measurement files are present
-      if (checkFileProperties("/measurements/mqtt_measurements", 0, ".json"))
+      if (manifestFileCount(ManifestMqttMeasurements) > 0)
       {
         if (connectToMqtt())
         {
@@ -683,7 +816,7 @@ void processAndTransmitMeasurementData()
       }
 
       // Transmit all log data while files are present
-      if (checkFileProperties("/log", 0, ".txt"))
+      if (hasPendingLogData())
       {
         if (connectToMqtt())
         {
@@ -692,9 +825,10 @@ void processAndTransmitMeasurementData()
       }
 
       // Check if there are not measurement JSON files in the "/measurements" directory
-      if (!checkFileProperties("/measurements/mqtt_header", 0, ".json") && !checkFileProperties("/measurements/mqtt_measurements", 0, ".json"))
+      if (manifestFileCount(ManifestMqttHeader) == 0 && manifestFileCount(ManifestMqttMeasurements) == 0)
       {
         Log(LogCategoryMQTT, LogLevelDEBUG, "Data successfully transmitted");
+        releaseNodeRedSession();
         loggerTransmittedMeasurementDataLED();
         break;
       }
@@ -707,108 +841,152 @@ void processAndTransmitMeasurementData()
   }
 }
 
-struct TransmissionState
-{
-  char filename[55];
-  long lineNumber;
-  long totalLines;
-};
-
 RTC_DATA_ATTR TransmissionState rtcHeaderState;
 RTC_DATA_ATTR TransmissionState rtcDataState;
 RTC_DATA_ATTR TransmissionState rtcLogState;
 
+static TransmissionChannel headerChannel = {"header", "/measurements/mqtt_header", "hyfive/header", "/backup/header", "/measurements/header.cursor", nullptr, "hyfive/headerBatch", nullptr, &rtcHeaderState, &hasMqttHeaderError};
+static TransmissionChannel dataChannel = {"data", "/measurements/mqtt_measurements", "hyfive/data", "/backup/measurements", "/measurements/data.cursor", nullptr, "hyfive/dataBatch", "hyfive/dataSeries", &rtcDataState, &hasMqttMeasurementError};
+static TransmissionChannel logChannel = {"log", "/log", "hyfive/Log", nullptr, "/measurements/log.cursor", "log.txt", "hyfive/LogBatch", nullptr, &rtcLogState, &hasMqttLogError};
+
 /**
- * @brief Saves the current transmission status for header data.
- *
- * This function updates the saved status of the header data transmission,
- * to be able to continue the transmission in the event of interruptions or restarts.
- *
- * @param state The saved transmission state.
+ * @brief Handles a failed publish of a channel.
+ * @param channel The upload channel.
+ * @param state Cursor of the current file, saved for the next attempt.
  */
-void saveHeaderTransmissionState(const TransmissionState &state)
+static void reportPublishFailure(const TransmissionChannel &channel, TransmissionState &state)
 {
-  rtcHeaderState = state;
+  Log(LogCategoryMQTT, LogLevelDEBUG, "MQTT Disconnection: ", "filename: ", String(state.filename), " | ", String(state.lineNumber), " lines | ", String(state.byteOffset), "/", String(state.fileSize), " bytes");
+  saveTransmissionState(channel, state, true);
+  *channel.errorFlag = true;
+  mqttErrorCounter++;
 }
 
+// Set once per wake if the deck box decodes series blocks
+static bool seriesEncodingActive = false;
+
 /**
- * @brief Saves the current transmission status for log data.
- *
- * This function updates the saved status of the header data transmission,
- * to be able to continue the transmission in the event of interruptions or restarts.
- *
- * @param state The saved transmission state.
+ * @brief Sends the messages of a file one by one, each after the PUBACK of the previous one.
+ * @param channel The upload channel.
+ * @param file The file being uploaded.
+ * @param state Cursor of the file, moved past every acknowledged message.
+ * @param batchSize Payload size of batch messages, 0 for single lines.
+ * @return true if the end of the file was reached, false if a publish failed.
  */
-void saveLogTransmissionState(const TransmissionState &state)
+static bool transmitFileStopAndWait(const TransmissionChannel &channel, File &file, TransmissionState &state, size_t batchSize)
 {
-  rtcLogState = state;
+  UploadMessage message;
+  while (readUploadMessage(channel, file, state, batchSize, seriesEncodingActive, message))
+  {
+    if (message.lineCount > 0 && client.publish(message.topic, (const char *)message.payload, message.length, false, 1) == 0)
+    {
+      return false;
+    }
+    advanceTransmissionState(channel, state, message.nextOffset, message.lineCount);
+  }
+  return true;
 }
 
+// Upload of one file by the pipeline
+struct PipelineUpload
+{
+  const TransmissionChannel *channel;
+  File *file;
+  TransmissionState *state;
+  size_t batchSize;
+};
+
 /**
- * @brief Loads the saved transmission status for header data.
- * @return bool True if a state has been loaded, otherwise False.
+ * @brief PipelineReader of transmitFilePipelined(), see readUploadMessage().
  */
-bool loadHeaderTransmissionState(TransmissionState &state)
+static bool readPipelineMessage(uint32_t byteOffset, long lineNumber, UploadMessage &message, void *context)
 {
-  if (rtcHeaderState.filename[0] != '\0')
-  {
-    state = rtcHeaderState;
-    return true;
-  }
-  return false;
+  PipelineUpload *upload = (PipelineUpload *)context;
+  TransmissionState messageState = *upload->state;
+  messageState.byteOffset = byteOffset;
+  messageState.lineNumber = lineNumber;
+  return readUploadMessage(*upload->channel, *upload->file, messageState, upload->batchSize, seriesEncodingActive, message);
+}
+
+/**
+ * @brief PipelineAdvance of transmitFilePipelined(), see advanceTransmissionState().
+ */
+static void advancePipelineMessage(const UploadMessage &message, void *context)
+{
+  PipelineUpload *upload = (PipelineUpload *)context;
+  advanceTransmissionState(*upload->channel, *upload->state, message.nextOffset, message.lineCount);
 }
 
 /**
- * @brief Loads the saved transmission status for log data.
- * @return bool True if a state has been loaded, otherwise False.
+ * @brief PipelineReconnect of transmitFilePipelined().
  */
-bool loadLogTransmissionState(TransmissionState &state)
+static bool reconnectPipeline(void *context)
 {
-  if (rtcLogState.filename[0] != '\0')
+  client.disconnect();
+  if (!connectToMqtt())
   {
-    state = rtcLogState;
-    return true;
+    return false;
   }
-  return false;
+  // Messages the MQTTClient has already read from the new connection
+  client.loop();
+  return true;
 }
 
 /**
- * @brief Saves the current transmission status for measurement data.
- *
- * This function updates the saved status of the measurement data transmission,
- * to be able to continue the transmission in the event of interruptions or restarts.
- *
- * @param state The saved transmission state.
+ * @brief Passes messages received by the pipeline to handleReceivedMessage().
  */
-void saveDataTransmissionState(const TransmissionState &state)
+static void handlePipelineMessage(char *topic, char *payload, int length)
 {
-  rtcDataState = state;
+  handleReceivedMessage(&client, topic, payload, length);
 }
 
 /**
- * @brief Loads the saved transmission status for measurement data.
- * @return bool True if a state has been loaded, otherwise False.
+ * @brief Sends the messages of a file with up to window unacknowledged messages.
+ *
+ * See pipelineTransmit(). Messages of subscribed topics that arrive during
+ * the upload are handled like in client.loop(). The replies of the handler
+ * are sent by transmitUpdateMessage() after the upload.
+ *
+ * @param channel The upload channel.
+ * @param file The file being uploaded.
+ * @param state Cursor of the file, moved past every acknowledged message.
+ * @param batchSize Payload size of batch messages, 0 for single lines.
+ * @param window Largest number of unacknowledged messages.
+ * @return true if the end of the file was reached, false if the connection failed.
  */
-bool loadDataTransmissionState(TransmissionState &state)
+static bool transmitFilePipelined(const TransmissionChannel &channel, File &file, TransmissionState &state, size_t batchSize, uint8_t window)
 {
-  if (rtcDataState.filename[0] != '\0')
+  PipelineUpload upload = {&channel, &file, &state, batchSize};
+
+  // The pipeline takes over the connection, so the MQTTClient has to hand over everything it has read
+  client.loop();
+  beginMqttPipeline(wifi, handlePipelineMessage);
+  bool complete = pipelineTransmit(readPipelineMessage, advancePipelineMessage, reconnectPipeline, &upload, state.byteOffset, state.lineNumber, window);
+
+  String topic;
+  String payload;
+  while (pipelineTakeDeferred(topic, payload))
   {
-    state = rtcDataState;
-    return true;
+    transmitUpdateMessage(payload.c_str(), topic.c_str());
   }
-  return false;
+  return complete;
 }
 
 /**
- * @brief Transmits header data via MQTT.
+ * @brief Transmits the files of a channel via MQTT.
+ *
+ * An interrupted upload resumes at the saved byte offset. The messages are
+ * built by readUploadMessage(). With upload_window in Config.json, several
+ * messages are sent before their PUBACK arrives. Files whose upload has not
+ * started are sent by transmitFileHttp() with upload_http_port, or by
+ * transmitFileBulk() with upload_bulk_chunk_size instead.
+ *
+ * @param channel The upload channel.
  * @return true if the transmission was successful, otherwise false.
  */
-bool transmitHeaderViaMqtt()
+bool transmitChannelViaMqtt(const TransmissionChannel &channel)
 {
-  char mqtt_topic[] = "hyfive/header";
-  bool pass = true;
-
-  File dir = SD.open("/measurements/mqtt_header");
+  File dir = SD.open(channel.directory);
   if (!dir)
   {
     Serial.println("Directory could not be opened");
@@ -821,318 +999,139 @@ bool transmitHeaderViaMqtt()
     return false;
   }
 
-  File currentHeaderFile;
-  TransmissionState headerState;
-  if (loadHeaderTransmissionState(headerState))
+  File currentFile;
+  TransmissionState state;
+  if (loadTransmissionState(channel, state))
   {
-    // Saved transmission status for header found
-    String basePath = "/measurements/mqtt_header/";
-    currentHeaderFile = SD.open(basePath + headerState.filename);
-    if (currentHeaderFile)
+    // Saved transmission status found, continue at the next unsent line
+    currentFile = SD.open(String(channel.directory) + "/" + state.filename);
+    if (!currentFile)
     {
-      // Jump to the saved line number
-      for (long i = 0; i < headerState.lineNumber; i++)
-      {
-        currentHeaderFile.readStringUntil('\n');
-      }
+      clearTransmissionState(channel);
+    }
+    else
+    {
+      checkTransmissionState(channel, currentFile, state);
     }
   }
   else
   {
-    currentHeaderFile = dir.openNextFile();
-    if (currentHeaderFile)
+    currentFile = dir.openNextFile();
+    while (currentFile && channel.activeFile != nullptr && strcmp(currentFile.name(), channel.activeFile) == 0)
     {
-      strncpy(headerState.filename, currentHeaderFile.name(), sizeof(headerState.filename));
-      headerState.lineNumber = 0;
-
-      // Count the total number of lines in the file
-      headerState.totalLines = 0;
-      while (currentHeaderFile.available())
-      {
-        currentHeaderFile.readStringUntil('\n');
-        headerState.totalLines++;
-      }
-
-      // Set the file pointer back to the beginning
-      currentHeaderFile.seek(0);
+      currentFile.close();
+      currentFile = dir.openNextFile();
+    }
+    if (currentFile)
+    {
+      strncpy(state.filename, currentFile.name(), sizeof(state.filename));
+      state.filename[sizeof(state.filename) - 1] = '\0';
+      state.byteOffset = 0;
+      state.fileSize = currentFile.size();
+      state.lineNumber = 0;
     }
   }
+  dir.close();
 
-  while (currentHeaderFile)
+  if (!currentFile)
   {
+    return true;
+  }
 
-    // if (currentHeaderFile.available() || (headerState.lineNumber != headerState.totalLines))
-    if (currentHeaderFile.available() && headerState.lineNumber < headerState.totalLines)
-    {
-      char payload[MMMS];
-      String buf = currentHeaderFile.readStringUntil('\n');
-
-      // Skip empty lines
-      if (buf.length() == 0)
-      {
-        headerState.lineNumber++;
-        continue;
-      }
-
-      buf.toCharArray(payload, sizeof(payload));
+  // Upload rate of this call, for the comparison of the upload settings
+  unsigned long startTime = millis();
+  long startLineNumber = state.lineNumber;
+  size_t batchSize = min((size_t)configRTC.upload_batch_size, (size_t)MQTT_BATCH_MAX_PAYLOAD);
+  uint8_t window = min(configRTC.upload_window, (uint8_t)MQTT_PIPELINE_MAX_WINDOW);
 
-      if (client.publish(mqtt_topic, payload, false, 1) == 0)
+  size_t bulkChunkSize = configRTC.upload_bulk_chunk_size;
 
-      {
-        Log(LogCategoryMQTT, LogLevelDEBUG, "MQTT Disconnection: ", "filename: ", String(headerState.filename), " | ", String(headerState.lineNumber), "/", String(headerState.totalLines));
-        pass = false;
-        saveHeaderTransmissionState(headerState);
-        hasMqttHeaderError = true;
-        mqttErrorCounter++;
-        break;
-      }
-      else
-      {
-        headerState.lineNumber++;
-        saveHeaderTransmissionState(headerState);
-        hasMqttHeaderError = false;
-      }
+  bool pass;
+  if (configRTC.upload_http_port > 0 && state.byteOffset == 0)
+  {
+    // Whole file via HTTP, MQTT stays connected for control and status messages
+    pass = transmitFileHttp(mqttHost, configRTC.upload_http_port, currentFile, channel.name);
+    if (pass)
+    {
+      state.byteOffset = state.fileSize;
     }
-    else
+  }
+  else if (bulkChunkSize > 0 && state.byteOffset == 0 && bulkTransferFits(state.fileSize, bulkChunkSize))
+  {
+    // The whole file is confirmed at once, the deck box keeps the chunks of an interrupted transfer
+    pass = transmitFileBulk(client, currentFile, channel.name, bulkChunkSize);
+    if (pass)
     {
-      currentHeaderFile.close();
-      if (headerState.lineNumber == headerState.totalLines)
-      {
-        String basePath = "/measurements/mqtt_header";
-        moveFileWithTimestamp("/measurements/mqtt_header", headerState.filename, "/backup/header");
-        Log(LogCategoryMQTT, LogLevelINFO, "header lines transmitted: ", "filename: ", String(headerState.filename), " | ", String(headerState.lineNumber), "/", String(headerState.totalLines));
-        memset(headerState.filename, '\0', sizeof(headerState.filename));
-        headerState.lineNumber = 0;
-        headerState.totalLines = 0;
-        saveHeaderTransmissionState(headerState);
-      }
+      state.byteOffset = state.fileSize;
     }
   }
-
-  dir.close();
-  return pass;
-}
-
-/**
- * @brief Transmits Log data via MQTT.
- * @return true if the transmission was successful, otherwise false.
- */
-bool transmitLogViaMqtt()
-{
-  char mqtt_topic[] = "hyfive/Log";
-  bool pass = true;
-
-  File dir = SD.open("/log");
-  if (!dir)
+  else
   {
-    Serial.println("Directory could not be opened");
-    return false;
+    pass = window > 1 ? transmitFilePipelined(channel, currentFile, state, batchSize, window) : transmitFileStopAndWait(channel, currentFile, state, batchSize);
   }
-  if (!dir.isDirectory())
+  currentFile.close();
+  if (!pass)
   {
-    Serial.println("No directory");
-    dir.close();
+    reportPublishFailure(channel, state);
     return false;
   }
 
-  File currentLogFile;
-  TransmissionState LogState;
-  if (loadLogTransmissionState(LogState))
+  // End of file reached, lines appended after the start are moved with the file
+  if (channel.backupDirectory != nullptr)
   {
-    // Saved transmission status for log found
-    String basePath = "/log/";
-    currentLogFile = SD.open(basePath + LogState.filename);
-    if (currentLogFile)
-    {
-      // Jump to the saved line number
-      for (long i = 0; i < LogState.lineNumber; i++)
-      {
-        currentLogFile.readStringUntil('\n');
-      }
-    }
+    moveFileWithTimestamp(channel.directory, state.filename, channel.backupDirectory);
   }
   else
   {
-    currentLogFile = dir.openNextFile();
-    if (currentLogFile)
-    {
-      strncpy(LogState.filename, currentLogFile.name(), sizeof(LogState.filename));
-      LogState.lineNumber = 0;
-
-      // Count the total number of lines in the file
-      LogState.totalLines = 0;
-      while (currentLogFile.available())
-      {
-        currentLogFile.readStringUntil('\n');
-        LogState.totalLines++;
-      }
-
-      // Set the file pointer back to the beginning
-      currentLogFile.seek(0);
-    }
+    moveLogToBackup(state.filename);
   }
-
-  while (currentLogFile)
+  unsigned long elapsed = max(millis() - startTime, 1UL);
+  Log(LogCategoryMQTT, LogLevelINFO, channel.name, " transmitted: ", "filename: ", String(state.filename), " | ", String(state.lineNumber), " lines | ", String(state.byteOffset), " bytes");
+  if (state.lineNumber > startLineNumber)
   {
-
-    // if (currentLogFile.available() || (LogState.lineNumber != LogState.totalLines))
-    if (currentLogFile.available() && LogState.lineNumber < LogState.totalLines)
-    {
-      char payload[MMMS];
-      String buf = currentLogFile.readStringUntil('\n');
-
-      // Skip empty lines
-      if (buf.length() == 0)
-      {
-        LogState.lineNumber++;
-        continue;
-      }
-
-      buf.toCharArray(payload, sizeof(payload));
-
-      if (client.publish(mqtt_topic, payload, false, 1) == 0)
-
-      {
-        Log(LogCategoryMQTT, LogLevelDEBUG, "MQTT Disconnection: ", "filename: ", String(LogState.filename), " | ", String(LogState.lineNumber), "/", String(LogState.totalLines));
-        pass = false;
-        saveLogTransmissionState(LogState);
-        hasMqttLogError = true;
-        mqttErrorCounter++;
-        break;
-      }
-      else
-      {
-        LogState.lineNumber++;
-        saveLogTransmissionState(LogState);
-        hasMqttLogError = false;
-      }
-    }
-    else
-    {
-      currentLogFile.close();
-      if (LogState.lineNumber == LogState.totalLines)
-      {
-        moveLogToBackup();
-        memset(LogState.filename, '\0', sizeof(LogState.filename));
-        LogState.lineNumber = 0;
-        LogState.totalLines = 0;
-        saveLogTransmissionState(LogState);
-      }
-    }
+    Log(LogCategoryMQTT, LogLevelDEBUG, channel.name, " upload: ", String(state.lineNumber - startLineNumber), " records in ", String(elapsed), " ms | ", String((state.lineNumber - startLineNumber) * 1000.0 / elapsed, 1), " records/s");
   }
-
-  dir.close();
-  return pass;
+  clearTransmissionState(channel);
+  return true;
 }
 
 /**
- * @brief Transmits measurement data via MQTT.
+ * @brief Transmits header data via MQTT.
  * @return true if the transmission was successful, otherwise false.
  */
-bool transmitDataViaMqtt()
+bool transmitHeaderViaMqtt()
 {
-  char mqtt_topic[] = "hyfive/data";
-  bool pass = true;
-
-  File dir = SD.open("/measurements/mqtt_measurements");
-  if (!dir)
-  {
-    Serial.println("Directory could not be opened");
-    return false;
-  }
-  if (!dir.isDirectory())
-  {
-    Serial.println("No directory");
-    dir.close();
-    return false;
-  }
+  return transmitChannelViaMqtt(headerChannel);
+}
 
-  File currentMeasurementFile;
-  TransmissionState dataState;
-  if (loadDataTransmissionState(dataState))
+/**
+ * @brief Transmits Log data via MQTT.
+ * @return true if the transmission was successful, otherwise false.
+ */
+bool transmitLogViaMqtt()
+{
+  // Only closed segments are uploaded, the current log is closed once per wake
+  static bool logSegmentClosed = false;
+  if (!logSegmentClosed && rtcLogState.filename[0] == '\0')
   {
-    String basePath = "/measurements/mqtt_measurements/";
-    currentMeasurementFile = SD.open(basePath + dataState.filename);
-    if (currentMeasurementFile)
-    {
-      // Jump to the saved line number
-      for (long i = 0; i < dataState.lineNumber; i++)
-      {
-        currentMeasurementFile.readStringUntil('\n');
-      }
-    }
-  }
-  else
-  {
-    currentMeasurementFile = dir.openNextFile();
-    if (currentMeasurementFile)
-    {
-      strncpy(dataState.filename, currentMeasurementFile.name(), sizeof(dataState.filename));
-      dataState.lineNumber = 0;
-
-      // Count the total number of lines in the file
-      dataState.totalLines = 0;
-      while (currentMeasurementFile.available())
-      {
-        currentMeasurementFile.readStringUntil('\n');
-        dataState.totalLines++;
-      }
-
-      // Set the file pointer back to the beginning
-      currentMeasurementFile.seek(0);
-    }
+    rotateLogSegment();
+    logSegmentClosed = true;
   }
+  return transmitChannelViaMqtt(logChannel);
+}
 
-  while (currentMeasurementFile)
+/**
+ * @brief Transmits measurement data via MQTT.
+ * @return true if the transmission was successful, otherwise false.
+ */
+bool transmitDataViaMqtt()
+{
+  // The encoding is agreed once per wake, JSON lines are sent if the deck box does not answer
+  static bool seriesEncodingNegotiated = false;
+  if (!seriesEncodingNegotiated && configRTC.upload_series_encoding)
   {
-
-    // if (currentMeasurementFile.available() || (dataState.lineNumber != dataState.totalLines))
-    if (currentMeasurementFile.available() && dataState.lineNumber < dataState.totalLines)
-    {
-      char payload[MMMS];
-      String buf = currentMeasurementFile.readStringUntil('\n');
-
-      // Skip empty lines
-      if (buf.length() == 0)
-      {
-        dataState.lineNumber++;
-        continue;
-      }
-
-      buf.toCharArray(payload, sizeof(payload));
-
-      if (client.publish(mqtt_topic, payload, false, 1) == 0)
-      {
-        Log(LogCategoryMQTT, LogLevelDEBUG, "MQTT Disconnection: ", "filename: ", String(dataState.filename), " | ", String(dataState.lineNumber), "/", String(dataState.totalLines));
-        pass = false;
-        saveDataTransmissionState(dataState);
-        hasMqttMeasurementError = true;
-        mqttErrorCounter++;
-        break;
-      }
-      else
-      {
-        dataState.lineNumber++;
-        saveDataTransmissionState(dataState);
-        hasMqttMeasurementError = false;
-      }
-    }
-    else
-    {
-      currentMeasurementFile.close();
-      if (dataState.lineNumber == dataState.totalLines)
-      {
-        String basePath = "/measurements/mqtt_measurements";
-        moveFileWithTimestamp("/measurements/mqtt_measurements", dataState.filename, "/backup/measurements");
-        Log(LogCategoryMQTT, LogLevelINFO, "data lines transmitted: ", "filename: ", String(dataState.filename), " | ", String(dataState.lineNumber), "/", String(dataState.totalLines));
-        memset(dataState.filename, '\0', sizeof(dataState.filename));
-        dataState.lineNumber = 0;
-        dataState.totalLines = 0;
-        saveDataTransmissionState(dataState);
-      }
-    }
+    seriesEncodingActive = negotiateSeriesEncoding(client);
+    seriesEncodingNegotiated = true;
   }
-
-  dir.close();
-  return pass;
-}
\ No newline at end of file
+  return transmitChannelViaMqtt(dataChannel);
+}
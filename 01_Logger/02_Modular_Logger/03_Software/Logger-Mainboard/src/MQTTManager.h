@@ -12,6 +12,14 @@
 #ifndef MQTTMANAGER_H
 #define MQTTMANAGER_H
 
+#include "UploadSession.h"
+
+// Write buffer of the MQTT client, holds packet header, topic and payload
+#define MQTT_WRITE_BUFFER_SIZE 4096
+
+// Largest payload of a batch message (upload_batch_size in Config.json)
+#define MQTT_BATCH_MAX_PAYLOAD (MQTT_WRITE_BUFFER_SIZE - 64)
+
 void processAndTransmitMeasurementData();
 void moveMeasurementAndData();
 void uploadStatus();
@@ -24,6 +32,8 @@ void updateFWViaMqtt();
 bool transmitUpdateMessage(const char *updateInfo, const char *mqtt_topic);
 bool errorInloggerIdOrTimestamp();
 bool isNodeRedResponsePositive();
+SessionResult requestNodeRedSession();
+void releaseNodeRedSession();
 bool connectToMqtt();
 bool transmitHeaderViaMqtt();
 bool transmitDataViaMqtt();
@@ -0,0 +1,418 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Fixed-width binary measurement records with sidecar index
+ *
+ * Record file layout (little endian):
+ *   MeasurementFileHeader (16 bytes)
+ *   record[n]: time u32 | valid_mask u32 | slot[slotCount]: value f32, raw f32
+ *
+ * The slot names are written once per deployment into the "record_schema"
+ * object of the logger line in configHeader.json.
+ */
+
+#include <ArduinoJson.h>
+#include <SD.h>
+#include <unistd.h>
+
+#include "DS3231TimeNtp.h"
+#include "DebuggingSDLog.h"
+#include "MeasurementRecord.h"
+#include "SpaceLedger.h"
+#include "SystemVariables.h"
+#include "Utility.h"
+#include "loggerConfig.h"
+
+/**
+ * @brief Calculates the size of one record.
+ * @param slotCount Number of sensor slots in the record.
+ * @return uint16_t Record size in bytes.
+ */
+uint16_t measurementRecordSize(uint8_t slotCount)
+{
+  return MEASUREMENT_RECORD_BASE_SIZE + slotCount * MEASUREMENT_RECORD_SLOT_SIZE;
+}
+
+/**
+ * @brief Adds the record schema of the running deployment to the logger header.
+ * @param doc The JSON document of the logger header line.
+ */
+void addRecordSchemaToHeader(JsonDocument &doc)
+{
+  JsonObject schema = doc.createNestedObject("record_schema");
+  schema["version"] = MEASUREMENT_RECORD_VERSION;
+  schema["record_size"] = measurementRecordSize(numberOfActiveSensors);
+  schema["index_stride"] = MEASUREMENT_INDEX_STRIDE;
+
+  JsonArray slots = schema.createNestedArray("slots");
+  for (int i = 0; i < numberOfActiveSensors; i++)
+  {
+    slots.add(configRTC.sensor[i].parameter);
+  }
+}
+
+/**
+ * @brief Writes the file header of a new record file.
+ * @param file The opened record file.
+ * @param slotCount Number of sensor slots per record.
+ * @param loggerId Logger the records belong to.
+ * @param deploymentId Deployment the records belong to.
+ * @return true if the header was written completely.
+ */
+static bool writeMeasurementFileHeader(File &file, uint8_t slotCount, uint16_t loggerId, uint32_t deploymentId)
+{
+  MeasurementFileHeader header;
+  header.magic = MEASUREMENT_RECORD_MAGIC;
+  header.version = MEASUREMENT_RECORD_VERSION;
+  header.slotCount = slotCount;
+  header.recordSize = measurementRecordSize(slotCount);
+  header.logger_id = loggerId;
+  header.indexStride = MEASUREMENT_INDEX_STRIDE;
+  header.deployment_id = deploymentId;
+
+  return file.write((const uint8_t *)&header, sizeof(header)) == sizeof(header);
+}
+
+/**
+ * @brief Reads and validates the file header of a record file.
+ * @param file The opened record file.
+ * @param header Receives the header.
+ * @return true if the header is valid.
+ */
+static bool readMeasurementFileHeader(File &file, MeasurementFileHeader &header)
+{
+  file.seek(0);
+  if (file.read((uint8_t *)&header, sizeof(header)) != sizeof(header))
+  {
+    return false;
+  }
+  return header.magic == MEASUREMENT_RECORD_MAGIC && header.version == MEASUREMENT_RECORD_VERSION &&
+         header.recordSize == measurementRecordSize(header.slotCount) && header.slotCount <= MAX_SENSOR_CREDENTIALS;
+}
+
+/**
+ * @brief Encodes one measurement into a record.
+ * @param record Receives the record, must hold measurementRecordSize(slotCount) bytes.
+ * @param time Unix time of the measurement.
+ * @param valid Per slot flag whether the measurement was successful.
+ * @param values Converted values per slot.
+ * @param rawValues Raw values per slot.
+ * @param slotCount Number of slots.
+ */
+void encodeMeasurementRecord(uint8_t *record, uint32_t time, const bool *valid, const float *values, const float *rawValues, uint8_t slotCount)
+{
+  uint32_t validMask = 0;
+  for (uint8_t i = 0; i < slotCount; i++)
+  {
+    if (valid[i])
+    {
+      validMask |= (1UL << i);
+    }
+  }
+  memcpy(record, &time, sizeof(time));
+  memcpy(record + 4, &validMask, sizeof(validMask));
+  for (uint8_t i = 0; i < slotCount; i++)
+  {
+    memcpy(record + MEASUREMENT_RECORD_BASE_SIZE + i * MEASUREMENT_RECORD_SLOT_SIZE, &values[i], sizeof(float));
+    memcpy(record + MEASUREMENT_RECORD_BASE_SIZE + i * MEASUREMENT_RECORD_SLOT_SIZE + 4, &rawValues[i], sizeof(float));
+  }
+}
+
+/**
+ * @brief Writes a block of encoded records to the record file.
+ *
+ * The block is written with a single write. A record torn by a power failure
+ * is overwritten by the block, so the file always stays aligned to the record
+ * size. Index entries are added for every record on an index stride.
+ *
+ * @param records The encoded records.
+ * @param recordCount Number of records in the block.
+ * @param slotCount Number of slots per record.
+ * @param loggerId Logger the records belong to.
+ * @param deploymentId Deployment the records belong to.
+ * @return true if the block was written, otherwise false.
+ */
+bool writeMeasurementRecords(const uint8_t *records, uint16_t recordCount, uint8_t slotCount, uint16_t loggerId, uint32_t deploymentId)
+{
+  unsigned long startTime = micros();
+  uint16_t recordSize = measurementRecordSize(slotCount);
+
+  File file = SD.open(MEASUREMENT_RECORD_FILE, SD.exists(MEASUREMENT_RECORD_FILE) ? "r+" : FILE_WRITE);
+  if (!file)
+  {
+    Log(LogCategorySDCard, LogLevelERROR, "Error opening the record file");
+    return false;
+  }
+
+  size_t fileSize = file.size();
+  size_t previousSize = fileSize;
+  if (fileSize > 0)
+  {
+    MeasurementFileHeader header;
+    if (!readMeasurementFileHeader(file, header) || header.slotCount != slotCount || header.deployment_id != deploymentId)
+    {
+      // The file belongs to another deployment or sensor set, hand it over to the JSON file first
+      file.close();
+      Log(LogCategorySDCard, LogLevelWARNING, "Record file does not match the current deployment, converting");
+      if (!convertMeasurementRecordsToJson(MEASUREMENT_RECORD_FILE, "/measurements/measurement.json") && SD.exists(MEASUREMENT_RECORD_FILE))
+      {
+        // Not converted, FILE_WRITE would truncate it
+        Log(LogCategorySDCard, LogLevelERROR, "Record file of the former deployment not converted, block not written");
+        return false;
+      }
+      file = SD.open(MEASUREMENT_RECORD_FILE, FILE_WRITE);
+      if (!file)
+      {
+        Log(LogCategorySDCard, LogLevelERROR, "Error opening the record file");
+        return false;
+      }
+      fileSize = 0;
+      previousSize = 0;
+    }
+  }
+
+  if (fileSize == 0)
+  {
+    if (!writeMeasurementFileHeader(file, slotCount, loggerId, deploymentId))
+    {
+      file.close();
+      Log(LogCategorySDCard, LogLevelERROR, "Error writing the record file header");
+      return false;
+    }
+    fileSize = sizeof(MeasurementFileHeader);
+  }
+
+  uint32_t firstRecordNumber = (fileSize - sizeof(MeasurementFileHeader)) / recordSize;
+  file.seek(sizeof(MeasurementFileHeader) + firstRecordNumber * recordSize);
+
+  size_t blockSize = (size_t)recordCount * recordSize;
+  bool pass = file.write(records, blockSize) == blockSize;
+  file.close();
+
+  if (pass)
+  {
+    ledgerFileResized(previousSize, sizeof(MeasurementFileHeader) + (size_t)(firstRecordNumber + recordCount) * recordSize);
+
+    File index;
+    size_t indexSize = 0;
+    size_t indexWritten = 0;
+    for (uint16_t n = 0; n < recordCount; n++)
+    {
+      uint32_t recordNumber = firstRecordNumber + n;
+      if (recordNumber % MEASUREMENT_INDEX_STRIDE != 0)
+      {
+        continue;
+      }
+      if (!index)
+      {
+        index = SD.open(MEASUREMENT_INDEX_FILE, FILE_APPEND);
+        if (!index)
+        {
+          break;
+        }
+        indexSize = index.size();
+      }
+      MeasurementIndexEntry entry;
+      entry.recordNumber = recordNumber;
+      memcpy(&entry.time, records + n * recordSize, sizeof(entry.time));
+      indexWritten += index.write((const uint8_t *)&entry, sizeof(entry));
+    }
+    if (index)
+    {
+      index.close();
+      ledgerFileResized(indexSize, indexSize + indexWritten);
+    }
+  }
+
+  Log(LogCategoryMeasurement, LogLevelDEBUG, "Records ", String(firstRecordNumber), "+", String(recordCount), ": ", String(blockSize), " bytes in ", String(micros() - startTime), " us");
+  return pass;
+}
+
+/**
+ * @brief Loads the slot names of a deployment from configHeader.json.
+ * @param deploymentId The deployment whose schema is searched.
+ * @param slotNames Receives the slot names.
+ * @param slotCount Number of slots expected.
+ * @return true if a matching schema was found.
+ */
+static bool loadRecordSchema(uint32_t deploymentId, char slotNames[][SENSOR_PARAMETER_SIZE], uint8_t slotCount)
+{
+  File file = SD.open("/measurements/configHeader.json", FILE_READ);
+  if (!file)
+  {
+    return false;
+  }
+
+  StaticJsonDocument<64> filter;
+  filter["deployment_id"] = true;
+  filter["record_schema"]["slots"] = true;
+
+  bool found = false;
+  DynamicJsonDocument doc(4096);
+  while (file.available() && !found)
+  {
+    String line = file.readStringUntil('\n');
+    if (deserializeJson(doc, line, DeserializationOption::Filter(filter)) != DeserializationError::Ok)
+    {
+      continue;
+    }
+    JsonArray slots = doc["record_schema"]["slots"];
+    if (slots.isNull() || doc["deployment_id"] != deploymentId || slots.size() != slotCount)
+    {
+      continue;
+    }
+    for (uint8_t i = 0; i < slotCount; i++)
+    {
+      strlcpy(slotNames[i], slots[i] | "", SENSOR_PARAMETER_SIZE);
+    }
+    found = true;
+  }
+
+  file.close();
+  return found;
+}
+
+/**
+ * @brief Cuts the JSON file back to its size before a failed conversion.
+ * @param jsonPath Path of the JSON file.
+ * @param jsonSize Size before the conversion.
+ */
+static void rollBackJsonFile(const char *jsonPath, size_t jsonSize)
+{
+  // SD.begin() mounts the card at /sd, the Arduino File has no truncate
+  String vfsPath = String("/sd") + jsonPath;
+  if (truncate(vfsPath.c_str(), jsonSize) != 0)
+  {
+    Log(LogCategorySDCard, LogLevelERROR, "JSON file could not be cut back: ", jsonPath);
+    File jsonFile = SD.open(jsonPath, FILE_READ);
+    if (jsonFile)
+    {
+      ledgerFileResized(jsonSize, jsonFile.size());
+      jsonFile.close();
+    }
+  }
+}
+
+/**
+ * @brief Converts a record file into the JSON lines format used for the upload.
+ *
+ * The output is identical to the former per-sample JSON lines, so Node-RED
+ * and the server receive unchanged data. Record and index file are removed
+ * after a successful conversion. After a short write (card full or failing)
+ * the JSON file is cut back and the record file is kept for the next attempt.
+ *
+ * @param recordPath Path of the record file.
+ * @param jsonPath Path of the JSON file, lines are appended.
+ * @return true if the conversion was successful, otherwise false.
+ */
+bool convertMeasurementRecordsToJson(const char *recordPath, const char *jsonPath)
+{
+  unsigned long startTime = millis();
+
+  File recordFile = SD.open(recordPath, FILE_READ);
+  if (!recordFile)
+  {
+    return false;
+  }
+
+  MeasurementFileHeader header;
+  if (!readMeasurementFileHeader(recordFile, header))
+  {
+    recordFile.close();
+    Log(LogCategorySDCard, LogLevelERROR, "Invalid record file: ", recordPath);
+    String recordFolder = recordPath;
+    int separator = recordFolder.lastIndexOf('/');
+    String recordName = recordFolder.substring(separator + 1);
+    recordFolder = recordFolder.substring(0, separator);
+    moveFileToDestination(recordFolder.c_str(), recordName.c_str(), "/backup/measurements", true);
+    return false;
+  }
+
+  static char slotNames[MAX_SENSOR_CREDENTIALS][SENSOR_PARAMETER_SIZE];
+  if (!loadRecordSchema(header.deployment_id, slotNames, header.slotCount))
+  {
+    Log(LogCategorySDCard, LogLevelWARNING, "No record schema found, using current configuration");
+    for (uint8_t i = 0; i < header.slotCount; i++)
+    {
+      strlcpy(slotNames[i], configRTC.sensor[i].parameter, sizeof(slotNames[i]));
+    }
+  }
+
+  File jsonFile = SD.open(jsonPath, FILE_APPEND);
+  if (!jsonFile)
+  {
+    recordFile.close();
+    Log(LogCategorySDCard, LogLevelERROR, "Error opening the file: ", jsonPath);
+    return false;
+  }
+
+  uint8_t record[MEASUREMENT_RECORD_MAX_SIZE];
+  uint32_t recordCount = 0;
+  size_t jsonSize = jsonFile.size();
+  size_t jsonBytes = 0;
+  bool shortWrite = false;
+  while (!shortWrite && recordFile.read(record, header.recordSize) == header.recordSize)
+  {
+    uint32_t time;
+    uint32_t validMask;
+    memcpy(&time, record, sizeof(time));
+    memcpy(&validMask, record + 4, sizeof(validMask));
+
+    StaticJsonDocument<1024> doc;
+    doc["time"] = formatUnixTimeAsISOString(time);
+    doc["logger_id"] = header.logger_id;
+    doc["deployment_id"] = header.deployment_id;
+
+    for (uint8_t i = 0; i < header.slotCount; i++)
+    {
+      if (validMask & (1UL << i))
+      {
+        float value;
+        float rawValue;
+        memcpy(&value, record + MEASUREMENT_RECORD_BASE_SIZE + i * MEASUREMENT_RECORD_SLOT_SIZE, sizeof(float));
+        memcpy(&rawValue, record + MEASUREMENT_RECORD_BASE_SIZE + i * MEASUREMENT_RECORD_SLOT_SIZE + 4, sizeof(float));
+        doc[slotNames[i]] = String(value);
+        doc[String(slotNames[i]) + "_raw"] = String(rawValue);
+      }
+    }
+
+    if (validMask != 0)
+    {
+      size_t lineBytes = measureJson(doc) + 2;
+      size_t written = serializeJson(doc, jsonFile);
+      written += jsonFile.println();
+      jsonBytes += written;
+      shortWrite = written != lineBytes;
+    }
+    recordCount++;
+  }
+
+  jsonFile.flush();
+  shortWrite = shortWrite || jsonFile.size() != jsonSize + jsonBytes;
+  size_t recordBytes = recordFile.size();
+  recordFile.close();
+  jsonFile.close();
+
+  if (shortWrite)
+  {
+    Log(LogCategorySDCard, LogLevelERROR, "Short write to ", jsonPath, ", record file kept: ", recordPath);
+    rollBackJsonFile(jsonPath, jsonSize);
+    return false;
+  }
+  ledgerFileResized(jsonSize, jsonSize + jsonBytes);
+
+  if (SD.remove(recordPath))
+  {
+    ledgerFileRemoved(recordBytes);
+  }
+  ledgerRemoveFile(MEASUREMENT_INDEX_FILE);
+
+  Log(LogCategoryMeasurement, LogLevelINFO, "Records converted: ", String(recordCount), " in ", String(millis() - startTime), " ms");
+  Log(LogCategoryMeasurement, LogLevelDEBUG, "Record file: ", String(recordBytes), " bytes, JSON: ", String(jsonBytes), " bytes");
+  return true;
+}
@@ -0,0 +1,64 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Fixed-width binary measurement records with sidecar index
+ */
+
+#ifndef MEASUREMENTRECORD_H
+#define MEASUREMENTRECORD_H
+
+#include <ArduinoJson.h>
+
+#include "loggerConfig.h"
+
+// Files of the running deployment
+#define MEASUREMENT_RECORD_FILE "/measurements/measurement.bin"
+#define MEASUREMENT_INDEX_FILE "/measurements/measurement.idx"
+
+// Format identification
+#define MEASUREMENT_RECORD_MAGIC 0x42564648 // "HFVB" little endian
+#define MEASUREMENT_RECORD_VERSION 1
+
+// One index entry is written every MEASUREMENT_INDEX_STRIDE records
+#define MEASUREMENT_INDEX_STRIDE 32
+
+// Size of a record without the sensor slots (time + valid mask)
+#define MEASUREMENT_RECORD_BASE_SIZE 8
+
+// Size of one sensor slot (value + raw value)
+#define MEASUREMENT_RECORD_SLOT_SIZE 8
+
+// Largest possible record
+#define MEASUREMENT_RECORD_MAX_SIZE (MEASUREMENT_RECORD_BASE_SIZE + MAX_SENSOR_CREDENTIALS * MEASUREMENT_RECORD_SLOT_SIZE)
+
+// File header, written once at the beginning of measurement.bin
+typedef struct __attribute__((packed))
+{
+  uint32_t magic;
+  uint8_t version;
+  uint8_t slotCount;
+  uint16_t recordSize;
+  uint16_t logger_id;
+  uint16_t indexStride;
+  uint32_t deployment_id;
+} MeasurementFileHeader;
+
+// Index entry, maps a record number to its timestamp
+typedef struct __attribute__((packed))
+{
+  uint32_t recordNumber;
+  uint32_t time;
+} MeasurementIndexEntry;
+
+uint16_t measurementRecordSize(uint8_t slotCount);
+void addRecordSchemaToHeader(JsonDocument &doc);
+void encodeMeasurementRecord(uint8_t *record, uint32_t time, const bool *valid, const float *values, const float *rawValues, uint8_t slotCount);
+bool writeMeasurementRecords(const uint8_t *records, uint16_t recordCount, uint8_t slotCount, uint16_t loggerId, uint32_t deploymentId);
+bool convertMeasurementRecordsToJson(const char *recordPath, const char *jsonPath);
+
+#endif
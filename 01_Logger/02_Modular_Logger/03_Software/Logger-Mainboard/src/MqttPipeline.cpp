@@ -0,0 +1,493 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: QoS 1 publishing with several unacknowledged messages
+ *
+ * MQTTClient::publish() waits for the PUBACK of every QoS 1 message, so the
+ * link is idle for one round trip per message. During the upload the PUBLISH
+ * packets are therefore written directly to the connection of the
+ * MQTTClient and the PUBACKs are read back here, which allows several
+ * messages in flight. The MQTTClient must not be used at the same time.
+ * Packet identifiers start at 0x8000 and do not collide with the ones of
+ * the MQTTClient. Messages of subscribed topics that arrive meanwhile are
+ * passed to the same handler as in MQTTClient::loop() and acknowledged
+ * afterwards like lwmqtt does, so retained and status messages are not lost.
+ * A reply that the handler publishes meanwhile (e.g. to a config update)
+ * would start a QoS 2 exchange on the same connection that reads the
+ * PUBACKs of the upload. It is kept by pipelineDeferPublish() instead and
+ * sent by the caller once pipelineTransmit() has returned.
+ */
+
+#include "DebuggingSDLog.h"
+#include "MqttPipeline.h"
+
+#define MQTT_PACKET_PUBLISH 0x30
+#define MQTT_PACKET_PUBACK 0x40
+#define MQTT_PACKET_PUBREC 0x50
+#define MQTT_PACKET_PUBREL 0x60
+#define MQTT_PACKET_PUBCOMP 0x70
+
+// Longest topic of an upload message
+#define MQTT_PIPELINE_TOPIC_SIZE 48
+
+// Longest topic of an incoming message
+#define MQTT_PIPELINE_INCOMING_TOPIC_SIZE 64
+
+static WiFiClient *pipelineNetwork = nullptr;
+static PipelineMessageHandler pipelineHandler = nullptr;
+static uint16_t nextPacketId = 0;
+
+// Incoming packet, one byte more to terminate the payload
+static uint8_t pipelineReadBuffer[MQTT_PIPELINE_READ_SIZE + 1];
+
+// Message published by the handler during the upload
+struct DeferredMessage
+{
+  char topic[MQTT_PIPELINE_INCOMING_TOPIC_SIZE + 1];
+  char payload[MQTT_PIPELINE_DEFERRED_SIZE];
+};
+
+static bool pipelineActive = false;
+static DeferredMessage deferredMessages[MQTT_PIPELINE_DEFERRED_MESSAGES];
+static uint8_t deferredCount = 0;
+static uint8_t deferredHead = 0;
+
+/**
+ * @brief Uses the connection of the MQTT client for the pipeline.
+ *
+ * Packets that the MQTTClient has already received must be processed with
+ * MQTTClient::loop() before.
+ *
+ * @param network The connected network client of the MQTTClient.
+ * @param handler Receives the messages of subscribed topics.
+ */
+void beginMqttPipeline(WiFiClient &network, PipelineMessageHandler handler)
+{
+  pipelineNetwork = &network;
+  pipelineHandler = handler;
+  // Small packets are sent at once instead of waiting for the ACK of the previous one
+  network.setNoDelay(true);
+}
+
+/**
+ * @brief Reads bytes from the connection.
+ * @param buffer Receives the bytes, nullptr to discard them.
+ * @param length Number of bytes.
+ * @param deadline Value of millis() at which the read is aborted.
+ * @return true if all bytes were read.
+ */
+static bool readPipelineBytes(uint8_t *buffer, size_t length, unsigned long deadline)
+{
+  for (size_t i = 0; i < length; i++)
+  {
+    while (pipelineNetwork->available() == 0)
+    {
+      if (!pipelineNetwork->connected() || (long)(millis() - deadline) >= 0)
+      {
+        return false;
+      }
+      delay(1);
+    }
+    int value = pipelineNetwork->read();
+    if (value < 0)
+    {
+      return false;
+    }
+    if (buffer != nullptr)
+    {
+      buffer[i] = value;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Writes an acknowledgement packet (PUBACK, PUBREC, PUBCOMP).
+ * @param type Packet type including the flags.
+ * @param packetId Identifier of the acknowledged packet.
+ */
+static void writeAcknowledgement(uint8_t type, uint16_t packetId)
+{
+  uint8_t packet[4] = {type, 2, (uint8_t)(packetId >> 8), (uint8_t)packetId};
+  pipelineNetwork->write(packet, sizeof(packet));
+}
+
+/**
+ * @brief Publishes a QoS 1 message without waiting for the PUBACK.
+ * @param topic Topic of the message.
+ * @param payload Payload of the message.
+ * @param length Length of the payload.
+ * @return uint16_t Packet identifier, 0 if the connection failed.
+ */
+uint16_t pipelinePublish(const char *topic, const uint8_t *payload, size_t length)
+{
+  if (pipelineNetwork == nullptr || !pipelineNetwork->connected())
+  {
+    return 0;
+  }
+
+  nextPacketId = (nextPacketId + 1) & 0x7FFF;
+  uint16_t packetId = 0x8000 | nextPacketId;
+
+  size_t topicLength = strlen(topic);
+  if (topicLength > MQTT_PIPELINE_TOPIC_SIZE)
+  {
+    return 0;
+  }
+  size_t remainingLength = 2 + topicLength + 2 + length;
+
+  // Fixed header, remaining length, topic and packet identifier in one write
+  uint8_t header[5 + 2 + MQTT_PIPELINE_TOPIC_SIZE + 2];
+  size_t headerLength = 0;
+  header[headerLength++] = MQTT_PACKET_PUBLISH | 0x02;
+  do
+  {
+    uint8_t encoded = remainingLength % 128;
+    remainingLength /= 128;
+    header[headerLength++] = encoded | (remainingLength > 0 ? 0x80 : 0);
+  } while (remainingLength > 0);
+  header[headerLength++] = topicLength >> 8;
+  header[headerLength++] = topicLength & 0xFF;
+  memcpy(header + headerLength, topic, topicLength);
+  headerLength += topicLength;
+  header[headerLength++] = packetId >> 8;
+  header[headerLength++] = packetId & 0xFF;
+
+  if (pipelineNetwork->write(header, headerLength) != headerLength || pipelineNetwork->write(payload, length) != length)
+  {
+    return 0;
+  }
+  return packetId;
+}
+
+/**
+ * @brief Passes an incoming message to the handler and acknowledges it.
+ * @param type Packet type including the flags.
+ * @param body Variable header and payload, one byte longer than length.
+ * @param length Length of the packet without fixed header.
+ */
+static void dispatchPipelineMessage(uint8_t type, uint8_t *body, size_t length)
+{
+  uint8_t qos = (type >> 1) & 0x03;
+  uint16_t topicLength = length >= 2 ? (body[0] << 8) | body[1] : 0;
+  size_t payloadOffset = 2 + topicLength + (qos > 0 ? 2 : 0);
+  if (payloadOffset > length || topicLength > MQTT_PIPELINE_INCOMING_TOPIC_SIZE)
+  {
+    Log(LogCategoryMQTT, LogLevelWARNING, "Invalid message during the upload");
+    return;
+  }
+
+  char topic[MQTT_PIPELINE_INCOMING_TOPIC_SIZE + 1];
+  memcpy(topic, body + 2, topicLength);
+  topic[topicLength] = '\0';
+  uint16_t packetId = qos > 0 ? (body[2 + topicLength] << 8) | body[3 + topicLength] : 0;
+
+  // Terminated like the payload passed by the MQTTClient
+  body[length] = '\0';
+  if (pipelineHandler != nullptr)
+  {
+    pipelineHandler(topic, (char *)body + payloadOffset, length - payloadOffset);
+  }
+
+  if (qos == 1)
+  {
+    writeAcknowledgement(MQTT_PACKET_PUBACK, packetId);
+  }
+  else if (qos == 2)
+  {
+    writeAcknowledgement(MQTT_PACKET_PUBREC, packetId);
+  }
+}
+
+/**
+ * @brief Waits for the next PUBACK.
+ *
+ * Messages of subscribed topics are passed to the handler of
+ * beginMqttPipeline(). A message larger than MQTT_PIPELINE_READ_SIZE is
+ * acknowledged and dropped.
+ *
+ * @param timeout Longest time to wait in ms.
+ * @return int32_t Packet identifier of the PUBACK, 0 on timeout, -1 if the connection is lost.
+ */
+int32_t pipelineReadAck(uint32_t timeout)
+{
+  unsigned long deadline = millis() + timeout;
+  while (true)
+  {
+    uint8_t type;
+    if (!readPipelineBytes(&type, 1, deadline))
+    {
+      return pipelineNetwork->connected() ? 0 : -1;
+    }
+
+    uint32_t remainingLength = 0;
+    uint8_t shift = 0;
+    uint8_t encoded;
+    do
+    {
+      if (!readPipelineBytes(&encoded, 1, deadline) || shift > 21)
+      {
+        return -1;
+      }
+      remainingLength |= (uint32_t)(encoded & 0x7F) << shift;
+      shift += 7;
+    } while (encoded & 0x80);
+
+    uint8_t *body = pipelineReadBuffer;
+    size_t kept = min(remainingLength, (uint32_t)MQTT_PIPELINE_READ_SIZE);
+    if (!readPipelineBytes(body, kept, deadline) || !readPipelineBytes(nullptr, remainingLength - kept, deadline))
+    {
+      return -1;
+    }
+
+    switch (type & 0xF0)
+    {
+    case MQTT_PACKET_PUBACK:
+      if (kept >= 2)
+      {
+        return (body[0] << 8) | body[1];
+      }
+      break;
+    case MQTT_PACKET_PUBLISH:
+      if (kept == remainingLength)
+      {
+        dispatchPipelineMessage(type, body, kept);
+      }
+      else
+      {
+        uint8_t qos = (type >> 1) & 0x03;
+        uint16_t topicLength = (body[0] << 8) | body[1];
+        if (qos > 0 && kept >= 4u + topicLength)
+        {
+          uint16_t packetId = (body[2 + topicLength] << 8) | body[3 + topicLength];
+          writeAcknowledgement(qos == 1 ? MQTT_PACKET_PUBACK : MQTT_PACKET_PUBREC, packetId);
+        }
+        Log(LogCategoryMQTT, LogLevelWARNING, "Message too large during the upload, ", String(remainingLength), " bytes dropped");
+      }
+      break;
+    case MQTT_PACKET_PUBREL:
+      if (kept >= 2)
+      {
+        writeAcknowledgement(MQTT_PACKET_PUBCOMP, (body[0] << 8) | body[1]);
+      }
+      break;
+    default:
+      // PINGRESP and others
+      break;
+    }
+  }
+}
+
+// Message in the send window, packetId 0 marks an acknowledged message
+struct InFlightMessage
+{
+  uint16_t packetId;
+  uint32_t byteOffset;
+  long lineNumber;
+  uint32_t nextOffset;
+  uint16_t lineCount;
+};
+
+static InFlightMessage inFlightMessages[MQTT_PIPELINE_MAX_WINDOW];
+
+/**
+ * @brief Sends the unacknowledged messages of the window again.
+ * @param read Reads the message at a cursor.
+ * @param context Passed to read.
+ * @param head Index of the oldest message of the window.
+ * @param count Number of messages in the window.
+ * @return true if all messages were sent.
+ */
+static bool resendInFlightMessages(PipelineReader read, void *context, uint8_t head, uint8_t count)
+{
+  for (uint8_t i = 0; i < count; i++)
+  {
+    InFlightMessage &entry = inFlightMessages[(head + i) % MQTT_PIPELINE_MAX_WINDOW];
+    if (entry.packetId == 0)
+    {
+      continue;
+    }
+    UploadMessage message;
+    if (!read(entry.byteOffset, entry.lineNumber, message, context))
+    {
+      return false;
+    }
+    entry.packetId = pipelinePublish(message.topic, message.payload, message.length);
+    if (entry.packetId == 0)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Keeps a message that is published while pipelineTransmit() runs.
+ *
+ * Called instead of MQTTClient::publish() by code that the handler of
+ * beginMqttPipeline() reaches. A message that does not fit is dropped with
+ * a warning.
+ *
+ * @param topic Topic of the message.
+ * @param payload Payload of the message.
+ * @return true if the upload owns the connection and the message was taken, false if it can be sent now.
+ */
+bool pipelineDeferPublish(const char *topic, const char *payload)
+{
+  if (!pipelineActive)
+  {
+    return false;
+  }
+  if (deferredCount == MQTT_PIPELINE_DEFERRED_MESSAGES || strlen(topic) > MQTT_PIPELINE_INCOMING_TOPIC_SIZE || strlen(payload) >= MQTT_PIPELINE_DEFERRED_SIZE)
+  {
+    Log(LogCategoryMQTT, LogLevelWARNING, "Message dropped during the upload: ", topic);
+    return true;
+  }
+  DeferredMessage &entry = deferredMessages[(deferredHead + deferredCount) % MQTT_PIPELINE_DEFERRED_MESSAGES];
+  strlcpy(entry.topic, topic, sizeof(entry.topic));
+  strlcpy(entry.payload, payload, sizeof(entry.payload));
+  deferredCount++;
+  return true;
+}
+
+/**
+ * @brief Takes the oldest message kept by pipelineDeferPublish().
+ * @param topic Receives the topic.
+ * @param payload Receives the payload.
+ * @return true if a message was taken, false if none is left.
+ */
+bool pipelineTakeDeferred(String &topic, String &payload)
+{
+  if (deferredCount == 0)
+  {
+    return false;
+  }
+  topic = deferredMessages[deferredHead].topic;
+  payload = deferredMessages[deferredHead].payload;
+  deferredHead = (deferredHead + 1) % MQTT_PIPELINE_DEFERRED_MESSAGES;
+  deferredCount--;
+  return true;
+}
+
+/**
+ * @brief Sends the messages of a file with up to window unacknowledged messages, see pipelineTransmit().
+ */
+static bool transmitWindow(PipelineReader read, PipelineAdvance advance, PipelineReconnect reconnect, void *context, uint32_t byteOffset, long lineNumber, uint8_t window)
+{
+  window = constrain(window, 1, MQTT_PIPELINE_MAX_WINDOW);
+  uint8_t head = 0;
+  uint8_t count = 0;
+  uint8_t retries = 0;
+  bool endOfFile = false;
+  bool connectionLost = false;
+
+  while (true)
+  {
+    // Fill the window
+    UploadMessage message;
+    while (!connectionLost && count < window && !(endOfFile = !read(byteOffset, lineNumber, message, context)))
+    {
+      InFlightMessage &entry = inFlightMessages[(head + count) % MQTT_PIPELINE_MAX_WINDOW];
+      entry.byteOffset = byteOffset;
+      entry.lineNumber = lineNumber;
+      entry.nextOffset = message.nextOffset;
+      entry.lineCount = message.lineCount;
+      entry.packetId = 0;
+      if (message.lineCount > 0)
+      {
+        entry.packetId = pipelinePublish(message.topic, message.payload, message.length);
+        connectionLost = entry.packetId == 0;
+        if (connectionLost)
+        {
+          break;
+        }
+      }
+      count++;
+      byteOffset = message.nextOffset;
+      lineNumber += message.lineCount;
+    }
+
+    // Move the cursor past the acknowledged messages at the start of the window
+    while (count > 0 && inFlightMessages[head].packetId == 0)
+    {
+      UploadMessage acknowledged = {};
+      acknowledged.nextOffset = inFlightMessages[head].nextOffset;
+      acknowledged.lineCount = inFlightMessages[head].lineCount;
+      advance(acknowledged, context);
+      head = (head + 1) % MQTT_PIPELINE_MAX_WINDOW;
+      count--;
+      retries = 0;
+    }
+    if (count == 0 && !connectionLost)
+    {
+      if (endOfFile)
+      {
+        return true;
+      }
+      continue;
+    }
+
+    if (!connectionLost)
+    {
+      int32_t packetId = pipelineReadAck(MQTT_PIPELINE_ACK_TIMEOUT);
+      if (packetId > 0)
+      {
+        for (uint8_t i = 0; i < count; i++)
+        {
+          InFlightMessage &entry = inFlightMessages[(head + i) % MQTT_PIPELINE_MAX_WINDOW];
+          if (entry.packetId == packetId)
+          {
+            entry.packetId = 0;
+            break;
+          }
+        }
+        continue;
+      }
+    }
+
+    // No PUBACK in time or connection lost: connect again and repeat the unacknowledged messages
+    if (++retries > MQTT_PIPELINE_RETRIES)
+    {
+      return false;
+    }
+    Log(LogCategoryMQTT, LogLevelWARNING, "Upload window interrupted, sending ", String(count), " messages again");
+    if (!reconnect(context))
+    {
+      return false;
+    }
+    pipelineNetwork->setNoDelay(true);
+    connectionLost = !resendInFlightMessages(read, context, head, count);
+  }
+}
+
+/**
+ * @brief Sends the messages of a file with up to window unacknowledged messages.
+ *
+ * The cursor only moves past messages whose PUBACK has been received and
+ * that follow only acknowledged messages. If a PUBACK does not arrive in
+ * time, the connection is established again and only the unacknowledged
+ * messages of the window are sent again. beginMqttPipeline() must be called
+ * before. Messages that the handler publishes meanwhile are kept, see
+ * pipelineDeferPublish().
+ *
+ * @param read Reads the message at a cursor.
+ * @param advance Moves the cursor of the file past an acknowledged message.
+ * @param reconnect Connects to the broker again.
+ * @param context Passed to the functions.
+ * @param byteOffset Cursor of the first message.
+ * @param lineNumber Line number of the first message.
+ * @param window Largest number of unacknowledged messages.
+ * @return true if the end of the file was reached, false if the connection failed.
+ */
+bool pipelineTransmit(PipelineReader read, PipelineAdvance advance, PipelineReconnect reconnect, void *context, uint32_t byteOffset, long lineNumber, uint8_t window)
+{
+  pipelineActive = true;
+  bool complete = transmitWindow(read, advance, reconnect, context, byteOffset, lineNumber, window);
+  pipelineActive = false;
+  return complete;
+}
@@ -0,0 +1,65 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: QoS 1 publishing with several unacknowledged messages
+ */
+
+#ifndef MQTTPIPELINE_H
+#define MQTTPIPELINE_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+
+// Largest number of unacknowledged messages (upload_window in Config.json)
+#define MQTT_PIPELINE_MAX_WINDOW 16
+
+// Time to wait for the next PUBACK before the connection is considered lost (ms)
+#define MQTT_PIPELINE_ACK_TIMEOUT 3000
+
+// Largest incoming message that is passed on during the upload, like the read buffer of the MQTTClient
+#define MQTT_PIPELINE_READ_SIZE 1024
+
+// Reconnections of one pipelined upload without progress
+#define MQTT_PIPELINE_RETRIES 3
+
+// Messages that the handler publishes during the upload, sent after it
+#define MQTT_PIPELINE_DEFERRED_MESSAGES 4
+
+// Longest payload of such a message including '\0'
+#define MQTT_PIPELINE_DEFERRED_SIZE 256
+
+// One message of the upload, built from the file at a cursor
+struct UploadMessage
+{
+  const char *topic;
+  const uint8_t *payload;
+  size_t length;
+  uint32_t nextOffset;
+  uint16_t lineCount; // 0: empty line, nothing to send
+};
+
+// Reads the message at a cursor, returns false at the end of the file
+typedef bool (*PipelineReader)(uint32_t byteOffset, long lineNumber, UploadMessage &message, void *context);
+
+// Moves the cursor past an acknowledged message
+typedef void (*PipelineAdvance)(const UploadMessage &message, void *context);
+
+// Connects to the broker again, returns false if that fails
+typedef bool (*PipelineReconnect)(void *context);
+
+// Receives the messages of subscribed topics that arrive during the upload
+typedef void (*PipelineMessageHandler)(char *topic, char *payload, int length);
+
+void beginMqttPipeline(WiFiClient &network, PipelineMessageHandler handler);
+uint16_t pipelinePublish(const char *topic, const uint8_t *payload, size_t length);
+int32_t pipelineReadAck(uint32_t timeout);
+bool pipelineTransmit(PipelineReader read, PipelineAdvance advance, PipelineReconnect reconnect, void *context, uint32_t byteOffset, long lineNumber, uint8_t window);
+bool pipelineDeferPublish(const char *topic, const char *payload);
+bool pipelineTakeDeferred(String &topic, String &payload);
+
+#endif
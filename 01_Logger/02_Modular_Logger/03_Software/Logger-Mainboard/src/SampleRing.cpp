@@ -0,0 +1,168 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: RTC memory sample buffer with batched SD flushes
+ *
+ * The encoded measurement records are collected in RTC slow memory across
+ * deep sleep cycles and written to the SD card in one block when the buffer
+ * is full, at the end of the deployment or when the battery is empty.
+ * RTC_NOINIT memory also survives a reset (watchdog, panic, brownout reset),
+ * the remaining records are then written on the next boot. It does not
+ * survive a power loss: the records of up to one buffer are lost when the
+ * battery is removed or the supply drops out, the checksum then discards the
+ * random content.
+ */
+
+#include <esp_rom_crc.h>
+
+#include "DebuggingSDLog.h"
+#include "MeasurementRecord.h"
+#include "SampleRing.h"
+#include "SystemVariables.h"
+#include "loggerConfig.h"
+
+RTC_NOINIT_ATTR SampleRing sampleRing;
+
+RTC_DATA_ATTR uint32_t sampleRingFlushCount = 0;
+RTC_DATA_ATTR uint32_t sampleRingFlushedBytes = 0;
+
+/**
+ * @brief Checks whether the buffer contains consistent data.
+ * @return true if magic, size and checksum are valid.
+ */
+static bool isSampleRingValid()
+{
+  if (sampleRing.magic != SAMPLE_RING_MAGIC || sampleRing.slotCount > MAX_SENSOR_CREDENTIALS)
+  {
+    return false;
+  }
+  size_t used = (size_t)sampleRing.recordCount * measurementRecordSize(sampleRing.slotCount);
+  if (used > SAMPLE_RING_SIZE)
+  {
+    return false;
+  }
+  return esp_rom_crc32_le(0, sampleRing.data, used) == sampleRing.crc;
+}
+
+/**
+ * @brief Empties the buffer and assigns it to a deployment.
+ * @param slotCount Number of slots per record.
+ * @param loggerId Logger the records belong to.
+ * @param deploymentId Deployment the records belong to.
+ */
+static void resetSampleRing(uint8_t slotCount, uint16_t loggerId, uint32_t deploymentId)
+{
+  sampleRing.magic = SAMPLE_RING_MAGIC;
+  sampleRing.loggerId = loggerId;
+  sampleRing.slotCount = slotCount;
+  sampleRing.recordCount = 0;
+  sampleRing.deploymentId = deploymentId;
+  sampleRing.crc = esp_rom_crc32_le(0, sampleRing.data, 0);
+}
+
+/**
+ * @brief Gets the number of records waiting in the buffer.
+ * @return uint16_t Number of records.
+ */
+uint16_t sampleRingRecordCount()
+{
+  return isSampleRingValid() ? sampleRing.recordCount : 0;
+}
+
+/**
+ * @brief Writes all buffered records to the SD card in one block.
+ * @return true if the buffer is empty afterwards, otherwise false.
+ */
+bool flushSampleRing()
+{
+  if (!isSampleRingValid() || sampleRing.recordCount == 0)
+  {
+    return true;
+  }
+
+  size_t used = (size_t)sampleRing.recordCount * measurementRecordSize(sampleRing.slotCount);
+  if (!writeMeasurementRecords(sampleRing.data, sampleRing.recordCount, sampleRing.slotCount, sampleRing.loggerId, sampleRing.deploymentId))
+  {
+    Log(LogCategorySDCard, LogLevelERROR, "Sample buffer flush failed, records kept: ", String(sampleRing.recordCount));
+    return false;
+  }
+
+  sampleRingFlushCount++;
+  sampleRingFlushedBytes += used;
+  Log(LogCategoryMeasurement, LogLevelDEBUG, "Sample buffer flush ", String(sampleRingFlushCount), ": ", String(used), " bytes, average ", String(sampleRingFlushedBytes / sampleRingFlushCount), " bytes");
+
+  resetSampleRing(sampleRing.slotCount, sampleRing.loggerId, sampleRing.deploymentId);
+  return true;
+}
+
+/**
+ * @brief Adds one measurement to the buffer, flushes when the buffer is full.
+ * @param time Unix time of the measurement.
+ * @param valid Per slot flag whether the measurement was successful.
+ * @param values Converted values per slot.
+ * @param rawValues Raw values per slot.
+ * @param slotCount Number of slots.
+ */
+void pushSampleRecord(uint32_t time, const bool *valid, const float *values, const float *rawValues, uint8_t slotCount)
+{
+  uint16_t recordSize = measurementRecordSize(slotCount);
+
+  if (!isSampleRingValid())
+  {
+    resetSampleRing(slotCount, configRTC.logger_id, deployment_id);
+  }
+
+  // Records of another deployment or sensor set are written out first
+  if (sampleRing.slotCount != slotCount || sampleRing.deploymentId != deployment_id || sampleRing.loggerId != configRTC.logger_id)
+  {
+    flushSampleRing();
+    resetSampleRing(slotCount, configRTC.logger_id, deployment_id);
+  }
+
+  size_t used = (size_t)sampleRing.recordCount * recordSize;
+  if (used + recordSize > SAMPLE_RING_SIZE)
+  {
+    // A previous flush failed, the buffer has to be emptied to accept new samples
+    if (!flushSampleRing())
+    {
+      Log(LogCategorySDCard, LogLevelERROR, "Sample buffer full, records discarded: ", String(sampleRing.recordCount));
+      resetSampleRing(slotCount, configRTC.logger_id, deployment_id);
+    }
+    used = 0;
+  }
+
+  uint8_t *record = sampleRing.data + used;
+  encodeMeasurementRecord(record, time, valid, values, rawValues, slotCount);
+  sampleRing.crc = esp_rom_crc32_le(sampleRing.crc, record, recordSize);
+  sampleRing.recordCount++;
+
+  if (used + 2 * recordSize > SAMPLE_RING_SIZE)
+  {
+    flushSampleRing();
+  }
+}
+
+/**
+ * @brief Writes records left in the buffer by a reset to the SD card.
+ *
+ * Must be called once after a cold boot, when the SD card is available.
+ */
+void recoverSampleRing()
+{
+  if (!isSampleRingValid())
+  {
+    resetSampleRing(0, configRTC.logger_id, deployment_id);
+    return;
+  }
+
+  if (sampleRing.recordCount > 0)
+  {
+    Log(LogCategoryMeasurement, LogLevelWARNING, "Replaying sample buffer after reset: ", String(sampleRing.recordCount), " records of deployment ", String(sampleRing.deploymentId));
+    flushSampleRing();
+  }
+}
@@ -0,0 +1,40 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: RTC memory sample buffer with batched SD flushes
+ */
+
+#ifndef SAMPLERING_H
+#define SAMPLERING_H
+
+#include <Arduino.h>
+
+// Size of the record area in RTC slow memory
+#define SAMPLE_RING_SIZE 2048
+
+// Marks an initialized buffer, RTC_NOINIT memory is random after power-on
+#define SAMPLE_RING_MAGIC 0x53524E47
+
+// Records of one deployment, kept over deep sleep and resets but not over a power loss
+typedef struct
+{
+  uint32_t magic;
+  uint16_t loggerId;
+  uint8_t slotCount;
+  uint16_t recordCount;
+  uint32_t deploymentId;
+  uint32_t crc;
+  uint8_t data[SAMPLE_RING_SIZE];
+} SampleRing;
+
+void pushSampleRecord(uint32_t time, const bool *valid, const float *values, const float *rawValues, uint8_t slotCount);
+bool flushSampleRing();
+void recoverSampleRing();
+uint16_t sampleRingRecordCount();
+
+#endif
@@ -21,8 +21,11 @@
 #include "Led.h"
 #include "LoggerHER.h"
 #include "MQTTManager.h"
+#include "MeasurementRecord.h"
 #include "SDCard.h"
+#include "SampleRing.h"
 #include "SensorManagement.h"
+#include "SpaceLedger.h"
 #include "SystemVariables.h"
 #include "Utility.h"
 #include "WifiNetwork.h"
@@ -163,15 +166,28 @@ void performSensorMeasurement(int sensorNumber)
     detectConnecteOxygenSensor(sensorNumber);
   }
 
+  uint8_t busAddress = configRTC.sensor[sensorNumber].bus_address;
   uint64_t start_time = esp_timer_get_time() / 1000; // Start time in milliseconds
   bool measuringTimeTooLong = true;
   bool interfaceErrorRdy2 = false;
 
+  // With the sample frame ready status, value and raw value come in one transaction
+  bool useSampleFrame = interfaceFeatures[busAddress] & FEATURE_SAMPLE_FRAME;
+  InterfaceSample sample = {};
+
   while ((esp_timer_get_time() / 1000 - start_time) < 5000)
   {
     Log(LogCategorySensors, LogLevelDEBUG, "esp_timer_get_time: ", String(esp_timer_get_time() / 1000 - start_time));
-    Logger.getInterfaceRDY(configRTC.sensor[sensorNumber].bus_address);
-    uint32_t interfaceRDY = AdapterSensorRawValue[configRTC.sensor[sensorNumber].bus_address];
+    uint32_t interfaceRDY;
+    if (useSampleFrame)
+    {
+      interfaceRDY = Logger.MeasureSample(busAddress, configRTC.sensor[sensorNumber].parameter_no, sample) ? sample.ready : 0;
+    }
+    else
+    {
+      Logger.getInterfaceRDY(busAddress);
+      interfaceRDY = AdapterSensorRawValue[busAddress];
+    }
 
     if (interfaceRDY == 1)
     {
@@ -186,7 +202,7 @@ void performSensorMeasurement(int sensorNumber)
 
     if (interfaceRDY == 2)
     {
-      Log(LogCategorySensors, LogLevelDEBUG, "sensor_id ", String(configRTC.sensor[sensorNumber].sensor_id), " returns no value");
+      Log(LogCategorySensors, LogLevelDEBUG, "sensor_id ", String(configRTC.sensor[sensorNumber].sensor_id), " returns no value", useSampleFrame ? ", error bits: " + String(sample.error) : "");
       interfaceError = true;
       interfaceErrorRdy2 = true;
       interfaceErrorSensorId = configRTC.sensor[sensorNumber].sensor_id;
@@ -222,7 +238,17 @@ void performSensorMeasurement(int sensorNumber)
     sensorCalibToInterfaceIfRdyErrorCounter = 4;
   }
 
-  if (!measuringTimeTooLong && !interfaceErrorRdy2)
+  if (!measuringTimeTooLong && !interfaceErrorRdy2 && useSampleFrame)
+  {
+    if (sample.sequence == interfaceSampleSequence[busAddress])
+    {
+      Log(LogCategorySensors, LogLevelDEBUG, "sensor_id ", String(configRTC.sensor[sensorNumber].sensor_id), " no new conversion since the last sample");
+    }
+    interfaceSampleSequence[busAddress] = sample.sequence;
+    sensorValue[sensorNumber] = floatingPointConvert(sample.value);
+    sensorValueRaw[sensorNumber] = sample.rawValue;
+  }
+  else if (!measuringTimeTooLong && !interfaceErrorRdy2)
   {
     Logger.Measure(configRTC.sensor[sensorNumber].bus_address, configRTC.sensor[sensorNumber].parameter_no);
     uint32_t rawValue = AdapterSensorRawValue[configRTC.sensor[sensorNumber].bus_address];
@@ -282,11 +308,67 @@ void updateSensorMeasurements()
   }
 }
 
+/**
+ * @brief Puts the interface boards of all active sensors into INTERFACE_GROUP_MEASUREMENT.
+ *
+ * The group is only used if every board has FEATURE_GROUPS, boards with an
+ * older firmware are started one after another.
+ */
+void assignInterfaceGroups()
+{
+  interfaceGroupsReady = numberOfActiveSensors > 0;
+  for (int sensorNumber = 0; sensorNumber < numberOfActiveSensors; ++sensorNumber)
+  {
+    uint8_t busAddress = configRTC.sensor[sensorNumber].bus_address;
+    if (AdapterSensorTypeID[busAddress] == 0)
+    {
+      continue;
+    }
+    if (!(interfaceFeatures[busAddress] & FEATURE_GROUPS) || !Logger.setInterfaceGroups(busAddress, 1 << INTERFACE_GROUP_MEASUREMENT))
+    {
+      interfaceGroupsReady = false;
+    }
+  }
+  Log(LogCategorySensors, LogLevelDEBUG, "interface groups: ", interfaceGroupsReady ? "start conversion with one transaction" : "start conversion per bus address");
+}
+
+/**
+ * @brief Starts the conversion of all interface boards of the active sensors in one transaction.
+ * @return false if a board has no group, the conversion is started per bus address.
+ */
+static bool startConversionOfMeasurementGroup()
+{
+  if (!interfaceGroupsReady || !Logger.startConversionGroup(INTERFACE_GROUP_MEASUREMENT))
+  {
+    return false;
+  }
+  Log(LogCategorySensors, LogLevelDEBUG, "startConversionGroup: ", String(INTERFACE_GROUP_MEASUREMENT));
+  delay(100);
+  return true;
+}
+
 /**
  * @brief Starts conversion for underwater operations.
+ *
+ * When all sensors are due the boards are started together, their samples are time-aligned.
  */
 void startConversionformUnderWaterOperations()
 {
+  bool allDue = true;
+  for (int sensorNumber = 0; sensorNumber < numberOfActiveSensors; ++sensorNumber)
+  {
+    if ((float)(totalOperationTime - lastSensorMeasurementTime[sensorNumber]) < intervalSensorArray[sensorNumber])
+    {
+      allDue = false;
+      break;
+    }
+  }
+  // Only when all are due; sensors skipped after an error are started with the group too, they are not read
+  if (allDue && startConversionOfMeasurementGroup())
+  {
+    return;
+  }
+
   for (int sensorNumber = 0; sensorNumber < numberOfActiveSensors; ++sensorNumber)
   {
     if ((float)(totalOperationTime - lastSensorMeasurementTime[sensorNumber]) >= intervalSensorArray[sensorNumber])
@@ -320,6 +402,11 @@ void startConversionformUnderWaterOperations()
  */
 void startConversionForPerformInitialMeasurement()
 {
+  if (startConversionOfMeasurementGroup())
+  {
+    return;
+  }
+
   for (int sensorNumber = 0; sensorNumber < numberOfActiveSensors; ++sensorNumber)
   {
     bool shouldSkip = false;
@@ -415,34 +502,27 @@ float calculateShortestSensorWaitTime()
 
 /**
  * @brief Writes measurement data to a file.
+ *
+ * The values are stored as fixed-width binary record, see MeasurementRecord.h.
+ * The records are collected in RTC memory and written to the SD card in blocks,
+ * see SampleRing.h. The JSON lines for the upload are created at the end of the deployment.
  */
 void writeMeasurementDataToFile()
 {
   bool valuePresent = false;
 
-  StaticJsonDocument<1024> doc;
-
-  doc["time"] = formatLocalTimeAsISOString();
-  doc["logger_id"] = configRTC.logger_id;
-  doc["deployment_id"] = deployment_id;
-
-  // Iterate over all sensors and add their data if the measurement was successful
   for (int i = 0; i < numberOfActiveSensors; i++)
   {
     if (measurementSuccessful[i])
     {
-      doc[configRTC.sensor[i].parameter] = String(sensorValue[i]);
-      doc[String(configRTC.sensor[i].parameter) + "_raw"] = String(sensorValueRaw[i]);
       valuePresent = true;
     }
   }
 
   if (valuePresent)
   {
-    String daten = "";
-    serializeJson(doc, daten);
-
-    appendDataToFile("/measurements/measurement.json", daten);
+    uint32_t measurementTime = getCurrentTimeFromRTC();
+    pushSampleRecord(measurementTime, measurementSuccessful, sensorValue, sensorValueRaw, numberOfActiveSensors);
 
     // sampleCast
     for (int i = 0; i < numberOfActiveSensors; i++)
@@ -451,14 +531,7 @@ void writeMeasurementDataToFile()
       {
         if (!sensorValue[i] == 0)
         {
-          File datei = SD.open("/measurements/sample_cast.txt", FILE_APPEND);
-          if (datei)
-          {
-            datei.print(getCurrentTimeFromRTC());
-            datei.print(",");
-            datei.println(sensorValue[i]);
-          }
-          datei.close();
+          addCastSample(measurementTime, sensorValue[i]);
         }
       }
     }
@@ -490,6 +563,8 @@ void detectConnectedSensorDevices()
 
       Logger.getFwVersion(configRTC.sensor[i].bus_address);
       uint8_t FwVersion = AdapterSensorRawValue[configRTC.sensor[i].bus_address];
+      Logger.getInterfaceFeatures(configRTC.sensor[i].bus_address);
+      interfaceFeatures[configRTC.sensor[i].bus_address] = AdapterSensorRawValue[configRTC.sensor[i].bus_address];
       Log(LogCategorySensors, LogLevelINFO, "Interfaceboard: FWVersion: ", String(FwVersion), " | ", "sensor_id: ", String(configRTC.sensor[i].sensor_id), " | ", "model: ", String(config.sensor[i].model), " | ", "long_name: ", String(config.sensor[i].long_name), " | ", "sensor_type_id: ", String(config.sensor[i].sensor_type_id), " | ", "bus_address: ", String(configRTC.sensor[i].bus_address));
 
       for (int id = 0; id < 4; id++)
@@ -821,6 +896,7 @@ void enterDeepSleepAfterMeasurement()
   Log(LogCategorySensors, LogLevelDEBUG, "Restzeit für den Zyklus Sleep: ", String(millis()));
   Log(LogCategorySensors, LogLevelDEBUG, "Sensor deep sleep time: ", String((shortestWaitingTime * 1000000 - micros()) / 1000000));
   esp_sleep_enable_timer_wakeup(shortestWaitingTime * 1000000 - micros()); // Mikrosekunden
+  flushLogBeforeSleep();
   esp_deep_sleep_start();
 }
 
@@ -878,8 +954,10 @@ void createConfigHeader()
     Serial.println("Error opening the file!");
     return;
   }
+  size_t fileSize = file.size();
+  size_t written = 0;
 
-  StaticJsonDocument<1000> doc1;
+  StaticJsonDocument<3000> doc1;
   doc1["logger_id"] = configRTC.logger_id;
   doc1["deployment_id"] = deployment_id;
   doc1["parameter"] = "logger";
@@ -890,9 +968,10 @@ void createConfigHeader()
   doc1["deployment_contact_id"] = config.deployment_contact_id;
   doc1["contact_first_name"] = config.contact_first_name;
   doc1["contact_last_name"] = config.contact_last_name;
+  addRecordSchemaToHeader(doc1);
 
-  serializeJson(doc1, file);
-  file.println();
+  written += serializeJson(doc1, file);
+  written += file.println();
 
   StaticJsonDocument<3000> doc2;
   for (int sensorNumber = 0; sensorNumber < Logger.AdapterNum_Sensors; sensorNumber++)
@@ -934,11 +1013,12 @@ void createConfigHeader()
     doc2["logger_id"] = configRTC.logger_id;
     doc2["deployment_id"] = deployment_id;
 
-    serializeJson(doc2, file);
-    file.println();
+    written += serializeJson(doc2, file);
+    written += file.println();
   }
 
   file.close();
+  ledgerFileResized(fileSize, fileSize + written);
 }
 
 /**
@@ -1306,7 +1386,12 @@ void interfaceSleep()
 void initiateUnderwaterMode()
 {
   setRequiredVoltage(true);
-  createOrClearSampleFile();
+  if (SD.exists(MEASUREMENT_RECORD_FILE) || sampleRingRecordCount() > 0)
+  {
+    // Records of an interrupted deployment are handed over before the new header is written
+    moveMeasurementAndData();
+  }
+  resetCastDetector();
   writeDeploymentIdToFile();
   createConfigHeader();
 
@@ -1491,6 +1576,7 @@ void sensorAvailability()
 
   detectConnectedSensorDevices();
   detectDryWetCastSensors();
+  assignInterfaceGroups();
 
   Logger.sensorWakeupDetection(waterDetectionSensorBusAddress);
   Logger.startConversion(waterDetectionSensorBusAddress);
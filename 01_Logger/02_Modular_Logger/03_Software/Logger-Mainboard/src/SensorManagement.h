@@ -25,9 +25,13 @@ bool checkWetSensorStatus();
 void detectConnectedSensorDevices();
 void detectDryWetCastSensors();
 void detectConnecteOxygenSensor(uint8_t sensorNumber);
+void assignInterfaceGroups();
 
 // Measurements
 
+// Group of the interface boards of all active sensors, started with one bus transaction
+#define INTERFACE_GROUP_MEASUREMENT 1
+
 void updateSensorMeasurements();
 void performSensorMeasurement(int sensorNumber);
 void performInitialMeasurement();
@@ -0,0 +1,494 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Compact time series encoding of the measurement data upload
+ *
+ * A block holds consecutive measurement lines with the same channels as
+ * columns: the time stamps as delta of delta, each channel as Gorilla XOR
+ * stream of float32 values. The deck box formats the values with the
+ * decimals of the original strings again, so it gets back the same JSON
+ * lines. A line is only encoded if this gives back the same text, every
+ * other line is sent as JSON. The format is described in
+ * 03_Server/03_Python/hyfive_series.py, the reference decoder.
+ *
+ * The logger asks on hyfive/encodingRequest whether the deck box decodes the
+ * blocks ("<logger_id>_series1"). The deck box answers with the same string
+ * on hyfive/encodingStatus. Without answer, the JSON upload is used.
+ */
+
+#include <ArduinoJson.h>
+#include <RTClib.h>
+
+#include "DS3231TimeNtp.h"
+#include "DebuggingSDLog.h"
+#include "SeriesEncoding.h"
+#include "loggerConfig.h"
+
+// Time to wait for the answer of the deck box (ms)
+#define SERIES_ENCODING_TIMEOUT 1000
+
+// Longest line that is encoded
+#define SERIES_LINE_SIZE 2048
+
+// Channel names of a block, each terminated by '\0'
+#define SERIES_NAMES_SIZE 1024
+
+// Decimals of a value string that are encoded
+#define SERIES_MAX_DECIMALS 7
+
+static char encodingRequest[32];
+static bool encodingStatusReceived = false;
+static bool encodingAccepted = false;
+
+static char seriesLine[SERIES_LINE_SIZE];
+static StaticJsonDocument<2048> seriesDoc;
+
+// Records of the current block, the values of a record follow each other
+static float seriesValues[SERIES_VALUE_CAPACITY];
+static uint32_t seriesTimes[SERIES_MAX_RECORDS];
+static uint32_t seriesLineEnds[SERIES_MAX_RECORDS];
+static char seriesNames[SERIES_NAMES_SIZE];
+static uint8_t seriesDecimals[SERIES_MAX_CHANNELS];
+static uint8_t seriesChannelCount = 0;
+static uint32_t seriesLoggerId = 0;
+static uint32_t seriesDeploymentId = 0;
+
+/**
+ * @brief Takes the answer of the deck box to the encoding request.
+ * @param topic Topic of the received message.
+ * @param payload The received message.
+ * @param length Length of the received message.
+ * @return true if the message belongs to the encoding negotiation, also for other loggers.
+ */
+bool handleEncodingStatusMessage(const char *topic, const uint8_t *payload, int length)
+{
+  if (strcmp(topic, SERIES_ENCODING_STATUS_TOPIC) != 0)
+  {
+    return false;
+  }
+
+  // "<logger_id>_<encoding>", the deck box answers "<logger_id>_json" if it does not decode the blocks
+  char prefix[12];
+  int prefixLength = snprintf(prefix, sizeof(prefix), "%u_", configRTC.logger_id);
+  if (length > prefixLength && memcmp(payload, prefix, prefixLength) == 0)
+  {
+    encodingAccepted = (size_t)length == strlen(encodingRequest) && memcmp(payload, encodingRequest, length) == 0;
+    encodingStatusReceived = true;
+  }
+  return true;
+}
+
+/**
+ * @brief Asks the deck box whether it decodes series blocks.
+ * @param client The connected MQTT client.
+ * @return true if the deck box accepts the series encoding.
+ */
+bool negotiateSeriesEncoding(MQTTClient &client)
+{
+  snprintf(encodingRequest, sizeof(encodingRequest), "%u_series%u", configRTC.logger_id, SERIES_VERSION);
+  encodingStatusReceived = false;
+  encodingAccepted = false;
+  if (!client.publish(SERIES_ENCODING_REQUEST_TOPIC, encodingRequest, false, 1))
+  {
+    return false;
+  }
+
+  unsigned long start = millis();
+  while (!encodingStatusReceived && millis() - start < SERIES_ENCODING_TIMEOUT)
+  {
+    client.loop();
+    delay(10);
+  }
+  Log(LogCategoryMQTT, LogLevelDEBUG, "Series encoding: ", encodingAccepted ? "accepted" : "not accepted", " by the deck box");
+  return encodingAccepted;
+}
+
+/**
+ * @brief Parses a time stamp written by formatUnixTimeAsISOString().
+ * @param text The time stamp.
+ * @param unixTime Receives the seconds since 1970-01-01.
+ * @return true if the time stamp is formatted the same way again.
+ */
+static bool parseSeriesTime(const char *text, uint32_t &unixTime)
+{
+  int year, month, day, hour, minute, second;
+  if (sscanf(text, "%4d-%2d-%2dT%2d:%2d:%2dZ", &year, &month, &day, &hour, &minute, &second) != 6 || year < 2000)
+  {
+    return false;
+  }
+  unixTime = DateTime(year, month, day, hour, minute, second).unixtime();
+  return formatUnixTimeAsISOString(unixTime) == text;
+}
+
+/**
+ * @brief Parses a value string written by String(float).
+ * @param text The value string.
+ * @param value Receives the value.
+ * @param decimals Receives the number of decimals of the string.
+ * @return true if the float32 value gives back the same string.
+ */
+static bool parseSeriesValue(const char *text, float &value, uint8_t &decimals)
+{
+  const char *c = text;
+  if (*c == '-')
+  {
+    c++;
+  }
+  if (!isdigit(*c))
+  {
+    return false;
+  }
+  while (isdigit(*c))
+  {
+    c++;
+  }
+  decimals = 0;
+  if (*c == '.')
+  {
+    c++;
+    while (isdigit(*c))
+    {
+      c++;
+      decimals++;
+    }
+    if (decimals == 0)
+    {
+      return false;
+    }
+  }
+  if (*c != '\0' || decimals > SERIES_MAX_DECIMALS)
+  {
+    return false;
+  }
+  value = strtof(text, nullptr);
+  return String(value, (unsigned int)decimals) == text;
+}
+
+/**
+ * @brief Takes the line in seriesLine as record of the current block.
+ *
+ * The line must start with time, logger_id and deployment_id, followed by
+ * value strings. The first record sets the channels of the block, the
+ * following records must have the same channels and decimals.
+ *
+ * @param record Index of the record in the block.
+ * @return true if the record can be encoded.
+ */
+static bool parseSeriesRecord(uint16_t record)
+{
+  if (deserializeJson(seriesDoc, seriesLine) || !seriesDoc.is<JsonObject>())
+  {
+    return false;
+  }
+  JsonObject object = seriesDoc.as<JsonObject>();
+  JsonObject::iterator it = object.begin();
+
+  uint32_t time;
+  if (it == object.end() || strcmp(it->key().c_str(), "time") != 0 || !it->value().is<const char *>() || !parseSeriesTime(it->value().as<const char *>(), time))
+  {
+    return false;
+  }
+  ++it;
+  if (it == object.end() || strcmp(it->key().c_str(), "logger_id") != 0 || !it->value().is<uint32_t>())
+  {
+    return false;
+  }
+  uint32_t loggerId = it->value().as<uint32_t>();
+  ++it;
+  if (it == object.end() || strcmp(it->key().c_str(), "deployment_id") != 0 || !it->value().is<uint32_t>())
+  {
+    return false;
+  }
+  uint32_t deploymentId = it->value().as<uint32_t>();
+  ++it;
+
+  if (record > 0 && (loggerId != seriesLoggerId || deploymentId != seriesDeploymentId || (record + 1u) * seriesChannelCount > SERIES_VALUE_CAPACITY))
+  {
+    return false;
+  }
+
+  uint8_t channel = 0;
+  char *name = seriesNames;
+  for (; it != object.end(); ++it, channel++)
+  {
+    float value;
+    uint8_t decimals;
+    if (channel == SERIES_MAX_CHANNELS || !it->value().is<const char *>() || !parseSeriesValue(it->value().as<const char *>(), value, decimals))
+    {
+      return false;
+    }
+
+    const char *key = it->key().c_str();
+    size_t keyLength = strlen(key);
+    if (record == 0)
+    {
+      if (name + keyLength + 1 > seriesNames + sizeof(seriesNames))
+      {
+        return false;
+      }
+      memcpy(name, key, keyLength + 1);
+      seriesDecimals[channel] = decimals;
+    }
+    else if (channel == seriesChannelCount || strcmp(name, key) != 0 || seriesDecimals[channel] != decimals)
+    {
+      return false;
+    }
+    name += keyLength + 1;
+    seriesValues[record * seriesChannelCount + channel] = value; // seriesChannelCount is not yet set for record 0
+  }
+
+  if (record == 0)
+  {
+    if (channel == 0)
+    {
+      return false;
+    }
+    seriesChannelCount = channel;
+    seriesLoggerId = loggerId;
+    seriesDeploymentId = deploymentId;
+  }
+  else if (channel != seriesChannelCount)
+  {
+    return false;
+  }
+  seriesTimes[record] = time;
+  return true;
+}
+
+// Writes a block MSB first, bytes are written as 8 bits
+struct SeriesWriter
+{
+  uint8_t *data;
+  size_t size;
+  size_t bit;
+  bool overflow;
+};
+
+/**
+ * @brief Appends bits to the block.
+ * @param writer The block.
+ * @param value The bits, right aligned.
+ * @param count Number of bits (1 to 32).
+ */
+static void writeSeriesBits(SeriesWriter &writer, uint32_t value, uint8_t count)
+{
+  for (int8_t i = count - 1; i >= 0; i--)
+  {
+    size_t byte = writer.bit / 8;
+    if (byte >= writer.size)
+    {
+      writer.overflow = true;
+      return;
+    }
+    if (writer.bit % 8 == 0)
+    {
+      writer.data[byte] = 0;
+    }
+    if ((value >> i) & 1)
+    {
+      writer.data[byte] |= 0x80 >> (writer.bit % 8);
+    }
+    writer.bit++;
+  }
+}
+
+/**
+ * @brief Appends an unsigned LEB128 varint to the block.
+ * @param writer The block, at a byte boundary.
+ * @param value The value.
+ */
+static void writeSeriesVarint(SeriesWriter &writer, uint64_t value)
+{
+  while (value >= 0x80)
+  {
+    writeSeriesBits(writer, (value & 0x7F) | 0x80, 8);
+    value >>= 7;
+  }
+  writeSeriesBits(writer, value, 8);
+}
+
+/**
+ * @brief Appends a string with its length to the block.
+ * @param writer The block, at a byte boundary.
+ * @param name The string.
+ */
+static void writeSeriesName(SeriesWriter &writer, const char *name)
+{
+  size_t length = strlen(name);
+  writeSeriesVarint(writer, length);
+  for (size_t i = 0; i < length; i++)
+  {
+    writeSeriesBits(writer, (uint8_t)name[i], 8);
+  }
+}
+
+/**
+ * @brief Appends the values of one channel as Gorilla XOR stream.
+ *
+ * The first value is written with 32 bits. Each following value is written as
+ * XOR with the previous one: "0" if it is the same, "10" and the meaningful
+ * bits if they fit into the window of the previous XOR, otherwise "11", 5 bits
+ * leading zeros, 5 bits length - 1 and the meaningful bits.
+ *
+ * @param writer The block, at a byte boundary.
+ * @param channel Index of the channel.
+ * @param count Number of records.
+ */
+static void writeSeriesChannel(SeriesWriter &writer, uint8_t channel, uint16_t count)
+{
+  uint32_t previous;
+  memcpy(&previous, &seriesValues[channel], sizeof(previous));
+  writeSeriesBits(writer, previous, 32);
+
+  int8_t leading = -1;
+  int8_t trailing = -1;
+  for (uint16_t record = 1; record < count; record++)
+  {
+    uint32_t bits;
+    memcpy(&bits, &seriesValues[record * seriesChannelCount + channel], sizeof(bits));
+    uint32_t xorValue = bits ^ previous;
+    previous = bits;
+    if (xorValue == 0)
+    {
+      writeSeriesBits(writer, 0, 1);
+      continue;
+    }
+    writeSeriesBits(writer, 1, 1);
+
+    int8_t newLeading = __builtin_clz(xorValue);
+    int8_t newTrailing = __builtin_ctz(xorValue);
+    if (leading >= 0 && newLeading >= leading && newTrailing >= trailing)
+    {
+      writeSeriesBits(writer, 0, 1);
+      writeSeriesBits(writer, xorValue >> trailing, 32 - leading - trailing);
+    }
+    else
+    {
+      leading = newLeading;
+      trailing = newTrailing;
+      uint8_t meaningful = 32 - leading - trailing;
+      writeSeriesBits(writer, 1, 1);
+      writeSeriesBits(writer, leading, 5);
+      writeSeriesBits(writer, meaningful - 1, 5);
+      writeSeriesBits(writer, xorValue >> trailing, meaningful);
+    }
+  }
+
+  // Every channel starts at a byte boundary
+  writer.bit = (writer.bit + 7) / 8 * 8;
+}
+
+/**
+ * @brief Writes the first records of the current block.
+ * @param count Number of records.
+ * @param filename Name of the file being uploaded.
+ * @param firstLine Line number of the first record in the file.
+ * @param payload Receives the block.
+ * @param payloadSize Size of payload.
+ * @return size_t Length of the block, 0 if it does not fit.
+ */
+static size_t writeSeriesBlock(uint16_t count, const char *filename, long firstLine, uint8_t *payload, size_t payloadSize)
+{
+  SeriesWriter writer = {payload, payloadSize, 0, false};
+  for (const char *c = SERIES_MAGIC; *c != '\0'; c++)
+  {
+    writeSeriesBits(writer, *c, 8);
+  }
+  writeSeriesBits(writer, SERIES_VERSION, 8);
+  writeSeriesVarint(writer, seriesLoggerId);
+  writeSeriesVarint(writer, seriesDeploymentId);
+  writeSeriesName(writer, filename);
+  writeSeriesVarint(writer, firstLine);
+  writeSeriesVarint(writer, count);
+  writeSeriesVarint(writer, seriesChannelCount);
+
+  const char *name = seriesNames;
+  for (uint8_t channel = 0; channel < seriesChannelCount; channel++)
+  {
+    writeSeriesName(writer, name);
+    writeSeriesBits(writer, seriesDecimals[channel], 8);
+    name += strlen(name) + 1;
+  }
+
+  // Time stamps as delta of delta, zigzag encoded
+  writeSeriesVarint(writer, seriesTimes[0]);
+  int64_t delta = 0;
+  for (uint16_t record = 1; record < count; record++)
+  {
+    int64_t newDelta = (int64_t)seriesTimes[record] - seriesTimes[record - 1];
+    int64_t deltaOfDelta = newDelta - delta;
+    writeSeriesVarint(writer, ((uint64_t)deltaOfDelta << 1) ^ (uint64_t)(deltaOfDelta >> 63));
+    delta = newDelta;
+  }
+
+  for (uint8_t channel = 0; channel < seriesChannelCount; channel++)
+  {
+    writeSeriesChannel(writer, channel, count);
+  }
+  return writer.overflow ? 0 : writer.bit / 8;
+}
+
+/**
+ * @brief Encodes the lines following the cursor as one series block.
+ *
+ * The block ends before the first line that cannot be encoded, at an empty
+ * line, at a change of the channels and after SERIES_MAX_RECORDS records.
+ * Blocks larger than payloadSize are written again with half the records.
+ *
+ * @param file The file being uploaded.
+ * @param byteOffset Start of the first line.
+ * @param fileSize Size of the file at the start of the upload.
+ * @param filename Name of the file, the deck box drops blocks it has already received.
+ * @param firstLine Line number of the first line.
+ * @param payload Receives the block.
+ * @param payloadSize Largest block.
+ * @param nextOffset Offset following the last line of the block.
+ * @param lineCount Number of records in the block.
+ * @return size_t Length of the block, 0 if the first line cannot be encoded.
+ */
+size_t encodeSeriesBatch(File &file, uint32_t byteOffset, uint32_t fileSize, const char *filename, long firstLine, uint8_t *payload, size_t payloadSize, uint32_t &nextOffset, uint16_t &lineCount)
+{
+  if (!file.seek(byteOffset))
+  {
+    return 0;
+  }
+
+  uint16_t count = 0;
+  while (count < SERIES_MAX_RECORDS && file.position() < fileSize)
+  {
+    size_t length = file.readBytesUntil('\n', seriesLine, sizeof(seriesLine) - 1);
+    uint32_t lineEnd = file.position();
+    if (length == sizeof(seriesLine) - 1 || lineEnd > fileSize)
+    {
+      break;
+    }
+    if (length > 0 && seriesLine[length - 1] == '\r')
+    {
+      length--;
+    }
+    seriesLine[length] = '\0';
+    if (length == 0 || !parseSeriesRecord(count))
+    {
+      break;
+    }
+    seriesLineEnds[count++] = lineEnd;
+  }
+
+  while (count > 0)
+  {
+    size_t length = writeSeriesBlock(count, filename, firstLine, payload, payloadSize);
+    if (length > 0)
+    {
+      nextOffset = seriesLineEnds[count - 1];
+      lineCount = count;
+      return length;
+    }
+    count /= 2;
+  }
+  return 0;
+}
@@ -0,0 +1,38 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Compact time series encoding of the measurement data upload
+ */
+
+#ifndef SERIESENCODING_H
+#define SERIESENCODING_H
+
+#include <MQTT.h>
+#include <SD.h>
+
+#define SERIES_ENCODING_REQUEST_TOPIC "hyfive/encodingRequest"
+#define SERIES_ENCODING_STATUS_TOPIC "hyfive/encodingStatus"
+
+// Block header: magic "HFS" and format version
+#define SERIES_MAGIC "HFS"
+#define SERIES_VERSION 1
+
+// Largest number of records of one block
+#define SERIES_MAX_RECORDS 128
+
+// Largest number of values (records * channels) of one block
+#define SERIES_VALUE_CAPACITY 4096
+
+// Largest number of channels (values and raw values of MAX_SENSOR_CREDENTIALS slots)
+#define SERIES_MAX_CHANNELS 64
+
+bool negotiateSeriesEncoding(MQTTClient &client);
+bool handleEncodingStatusMessage(const char *topic, const uint8_t *payload, int length);
+size_t encodeSeriesBatch(File &file, uint32_t byteOffset, uint32_t fileSize, const char *filename, long firstLine, uint8_t *payload, size_t payloadSize, uint32_t &nextOffset, uint16_t &lineCount);
+
+#endif
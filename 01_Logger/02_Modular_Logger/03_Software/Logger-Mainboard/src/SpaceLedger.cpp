@@ -0,0 +1,217 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Incremental accounting of the used SD card space
+ *
+ * SD.usedBytes() walks the whole FAT to count the free clusters, which takes
+ * seconds on a large card. The ledger keeps card size and used bytes in RTC
+ * memory instead and the file helpers adjust it by the clusters a file gains
+ * or loses. The full scan is only done when the checksum does not match,
+ * e.g. after a cold boot, and once per SPACE_LEDGER_RESYNC_INTERVAL to
+ * correct changes that are not tracked (directories, small fixed size files).
+ */
+
+#include <SD.h>
+#include <esp_rom_crc.h>
+#include <ff.h>
+
+#include "DS3231TimeNtp.h"
+#include "DebuggingSDLog.h"
+#include "SpaceLedger.h"
+
+#define SPACE_LEDGER_MAGIC 0x4C454447
+
+struct SpaceLedger
+{
+  uint32_t magic;
+  uint32_t clusterSize;
+  uint64_t totalBytes;
+  uint64_t usedBytes;
+  uint32_t syncTime;
+  uint32_t checksum;
+};
+
+RTC_DATA_ATTR SpaceLedger spaceLedger;
+
+// The log writer task updates the ledger as well
+static portMUX_TYPE spaceLedgerLock = portMUX_INITIALIZER_UNLOCKED;
+
+/**
+ * @brief Calculates the checksum of the ledger.
+ * @return uint32_t CRC32 over all fields except the checksum.
+ */
+static uint32_t calculateLedgerChecksum()
+{
+  return esp_rom_crc32_le(0, (const uint8_t *)&spaceLedger, offsetof(SpaceLedger, checksum));
+}
+
+/**
+ * @brief Checks magic and checksum of the ledger.
+ * @return true if the ledger can be used.
+ */
+static bool isSpaceLedgerValid()
+{
+  return spaceLedger.magic == SPACE_LEDGER_MAGIC && spaceLedger.checksum == calculateLedgerChecksum();
+}
+
+/**
+ * @brief Gets the cluster size of the mounted file system.
+ * @return uint32_t Bytes per cluster.
+ */
+static uint32_t readClusterSize()
+{
+  FATFS *fileSystem;
+  DWORD freeClusters;
+  // The free cluster count is cached by the preceding SD.usedBytes()
+  if (f_getfree("0:", &freeClusters, &fileSystem) != FR_OK || fileSystem->csize == 0)
+  {
+    return SPACE_LEDGER_DEFAULT_CLUSTER_SIZE;
+  }
+  return (uint32_t)fileSystem->csize * 512;
+}
+
+/**
+ * @brief Rounds a file size up to whole clusters.
+ * @param size File size in bytes.
+ * @return uint64_t Bytes allocated for the file.
+ */
+static uint64_t allocatedBytes(uint64_t size)
+{
+  uint64_t clusterSize = spaceLedger.clusterSize;
+  return (size + clusterSize - 1) / clusterSize * clusterSize;
+}
+
+/**
+ * @brief Reads card size and used bytes with a full scan of the file system.
+ */
+void syncSpaceLedger()
+{
+  unsigned long startTime = millis();
+
+  uint64_t totalBytes = SD.cardSize();
+  uint64_t usedBytes = SD.usedBytes();
+  uint32_t clusterSize = readClusterSize();
+  uint32_t syncTime = getCurrentTimeFromRTC();
+
+  taskENTER_CRITICAL(&spaceLedgerLock);
+  spaceLedger.magic = SPACE_LEDGER_MAGIC;
+  spaceLedger.totalBytes = totalBytes;
+  spaceLedger.usedBytes = usedBytes;
+  spaceLedger.clusterSize = clusterSize;
+  spaceLedger.syncTime = syncTime;
+  spaceLedger.checksum = calculateLedgerChecksum();
+  taskEXIT_CRITICAL(&spaceLedgerLock);
+
+  Log(LogCategorySDCard, LogLevelDEBUG, "Space ledger synchronized in ", String(millis() - startTime), " ms, used bytes: ", String(spaceLedger.usedBytes));
+}
+
+/**
+ * @brief Synchronizes the ledger if it is invalid or the last scan is too old.
+ */
+void syncSpaceLedgerIfDue()
+{
+  uint32_t now = getCurrentTimeFromRTC();
+  if (!isSpaceLedgerValid() || now < spaceLedger.syncTime || now - spaceLedger.syncTime >= SPACE_LEDGER_RESYNC_INTERVAL)
+  {
+    syncSpaceLedger();
+  }
+}
+
+/**
+ * @brief Records that a file changed its size, a new file has an old size of 0.
+ * @param oldSize Size before the change in bytes.
+ * @param newSize Size after the change in bytes.
+ */
+void ledgerFileResized(uint64_t oldSize, uint64_t newSize)
+{
+  taskENTER_CRITICAL(&spaceLedgerLock);
+  if (!isSpaceLedgerValid())
+  {
+    // An invalid ledger is synchronized on the next query and then includes the change
+    taskEXIT_CRITICAL(&spaceLedgerLock);
+    return;
+  }
+
+  uint64_t oldAllocation = allocatedBytes(oldSize);
+  uint64_t newAllocation = allocatedBytes(newSize);
+  if (newAllocation >= oldAllocation)
+  {
+    spaceLedger.usedBytes += newAllocation - oldAllocation;
+  }
+  else
+  {
+    uint64_t released = oldAllocation - newAllocation;
+    spaceLedger.usedBytes = spaceLedger.usedBytes > released ? spaceLedger.usedBytes - released : 0;
+  }
+  spaceLedger.checksum = calculateLedgerChecksum();
+  taskEXIT_CRITICAL(&spaceLedgerLock);
+}
+
+/**
+ * @brief Records that a file was removed.
+ * @param size Size of the removed file in bytes.
+ */
+void ledgerFileRemoved(uint64_t size)
+{
+  ledgerFileResized(size, 0);
+}
+
+/**
+ * @brief Removes a file from the SD card and records the released space.
+ * @param path Path of the file.
+ * @return true if the file was removed.
+ */
+bool ledgerRemoveFile(const String &path)
+{
+  uint64_t size = 0;
+  File file = SD.open(path, FILE_READ);
+  if (file)
+  {
+    size = file.size();
+    file.close();
+  }
+
+  if (!SD.remove(path))
+  {
+    return false;
+  }
+  ledgerFileRemoved(size);
+  return true;
+}
+
+/**
+ * @brief Gets the size of the SD card.
+ * @return uint64_t Size in bytes.
+ */
+uint64_t ledgerTotalBytes()
+{
+  if (!isSpaceLedgerValid())
+  {
+    syncSpaceLedger();
+  }
+  taskENTER_CRITICAL(&spaceLedgerLock);
+  uint64_t value = spaceLedger.totalBytes;
+  taskEXIT_CRITICAL(&spaceLedgerLock);
+  return value;
+}
+
+/**
+ * @brief Gets the used space of the SD card.
+ * @return uint64_t Used bytes.
+ */
+uint64_t ledgerUsedBytes()
+{
+  if (!isSpaceLedgerValid())
+  {
+    syncSpaceLedger();
+  }
+  taskENTER_CRITICAL(&spaceLedgerLock);
+  uint64_t value = spaceLedger.usedBytes;
+  taskEXIT_CRITICAL(&spaceLedgerLock);
+  return value;
+}
@@ -0,0 +1,33 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Incremental accounting of the used SD card space
+ */
+
+#ifndef SPACELEDGER_H
+#define SPACELEDGER_H
+
+#include <Arduino.h>
+
+// Full scan at the latest after this time to correct drift (seconds)
+#define SPACE_LEDGER_RESYNC_INTERVAL (7UL * 24UL * 60UL * 60UL)
+
+// Cluster size assumed if the file system does not report one
+#define SPACE_LEDGER_DEFAULT_CLUSTER_SIZE 32768
+
+void syncSpaceLedger();
+void syncSpaceLedgerIfDue();
+
+void ledgerFileResized(uint64_t oldSize, uint64_t newSize);
+void ledgerFileRemoved(uint64_t size);
+bool ledgerRemoveFile(const String &path);
+
+uint64_t ledgerTotalBytes();
+uint64_t ledgerUsedBytes();
+
+#endif
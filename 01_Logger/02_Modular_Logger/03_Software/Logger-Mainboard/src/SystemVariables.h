@@ -44,6 +44,8 @@ inline bool hasSensorError = false;
 inline RTC_DATA_ATTR LoggerConfigRTC configRTC;
 inline RTC_DATA_ATTR int WifiArraySize = 0;
 inline RTC_DATA_ATTR int lastSuccessfulNetworkIndex = -1;
+inline RTC_DATA_ATTR uint8_t lastSuccessfulBssid[6] = {0};  // access point of the last network, connects without scan
+inline RTC_DATA_ATTR int32_t lastSuccessfulChannel = 0;
 inline RTC_DATA_ATTR int SensorArraySize = 0;
 
 // Sensor-specific variables
@@ -110,6 +112,9 @@ inline RTC_DATA_ATTR int bootCounter = 0;
 inline RTC_DATA_ATTR uint16_t longestSensorWakeupTime = 0;
 inline RTC_DATA_ATTR uint8_t interfaceRdyErrorCounter = 0;
 inline RTC_DATA_ATTR uint8_t sensorCalibToInterfaceIfRdyErrorCounter = 0;
+inline RTC_DATA_ATTR uint8_t interfaceFeatures[MAX_SENSOR_CREDENTIALS] = {};       // feature bits of the interface board, per bus address
+inline RTC_DATA_ATTR bool interfaceGroupsReady = false;                           // every interface board is in INTERFACE_GROUP_MEASUREMENT
+inline RTC_DATA_ATTR uint8_t interfaceSampleSequence[MAX_SENSOR_CREDENTIALS] = {}; // sequence number of the last sample, per bus address
 
 // Measurement data variables
 
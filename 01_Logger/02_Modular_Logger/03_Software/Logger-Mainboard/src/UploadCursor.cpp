@@ -0,0 +1,290 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Upload cursor and messages of the files sent over MQTT
+ *
+ * The cursor of the file being uploaded is kept in RTC memory and written to
+ * a checkpoint file on the SD card. After a deep sleep the upload continues
+ * exactly at the next unsent line. After a reset that cleared RTC memory it
+ * continues at the last checkpoint, so at most TRANSMISSION_CHECKPOINT_INTERVAL - 1
+ * lines are sent again, with the same line numbers as before.
+ */
+
+#include "DebuggingSDLog.h"
+#include "MQTTManager.h"
+#include "SeriesEncoding.h"
+#include "UploadCursor.h"
+#include "loggerConfig.h"
+
+/**
+ * @brief Saves the upload cursor of a channel.
+ *
+ * The cursor is kept in RTC memory and written to the SD card as checkpoint
+ * every TRANSMISSION_CHECKPOINT_INTERVAL lines or when forced.
+ *
+ * @param channel The upload channel.
+ * @param state The cursor to save.
+ * @param forceCheckpoint Writes the checkpoint file regardless of the interval.
+ */
+void saveTransmissionState(const TransmissionChannel &channel, const TransmissionState &state, bool forceCheckpoint)
+{
+  *channel.state = state;
+
+  if (forceCheckpoint || state.lineNumber % TRANSMISSION_CHECKPOINT_INTERVAL == 0)
+  {
+    File checkpoint = SD.open(channel.checkpointFile, FILE_WRITE);
+    if (checkpoint)
+    {
+      checkpoint.write((const uint8_t *)&state, sizeof(state));
+      checkpoint.close();
+    }
+  }
+}
+
+/**
+ * @brief Loads the upload cursor of a channel from RTC memory or the checkpoint file.
+ * @param channel The upload channel.
+ * @param state Receives the cursor.
+ * @return bool True if a cursor has been loaded, otherwise False.
+ */
+bool loadTransmissionState(const TransmissionChannel &channel, TransmissionState &state)
+{
+  if (channel.state->filename[0] != '\0')
+  {
+    state = *channel.state;
+    return true;
+  }
+
+  File checkpoint = SD.open(channel.checkpointFile, FILE_READ);
+  if (!checkpoint)
+  {
+    return false;
+  }
+  bool loaded = checkpoint.read((uint8_t *)&state, sizeof(state)) == sizeof(state) && state.filename[0] != '\0';
+  checkpoint.close();
+
+  if (loaded)
+  {
+    state.filename[sizeof(state.filename) - 1] = '\0';
+    *channel.state = state;
+    Log(LogCategoryMQTT, LogLevelDEBUG, "Upload cursor restored from checkpoint: ", String(state.filename), " | ", String(state.byteOffset), " bytes");
+  }
+  return loaded;
+}
+
+/**
+ * @brief Clears the upload cursor of a channel.
+ * @param channel The upload channel.
+ */
+void clearTransmissionState(const TransmissionChannel &channel)
+{
+  memset(channel.state, 0, sizeof(TransmissionState));
+  SD.remove(channel.checkpointFile);
+}
+
+/**
+ * @brief Checks a loaded cursor against the file it belongs to.
+ *
+ * A file that is shorter than the cursor, e.g. after a power loss before the
+ * directory entry was written, or a cursor that is not at the start of a line
+ * is not trusted: the file is sent again from the start. The deck box drops
+ * the lines it already has by their line numbers.
+ *
+ * @param channel The upload channel.
+ * @param file The file of the cursor.
+ * @param state The loaded cursor, reset to the start of the file if invalid.
+ */
+void checkTransmissionState(const TransmissionChannel &channel, File &file, TransmissionState &state)
+{
+  uint32_t size = file.size();
+  bool lineStart = state.byteOffset == 0;
+  if (!lineStart && state.byteOffset <= size && file.seek(state.byteOffset - 1))
+  {
+    lineStart = file.read() == '\n';
+  }
+  if (!lineStart)
+  {
+    Log(LogCategoryMQTT, LogLevelWARNING, "Upload cursor not valid, file sent again: ", String(state.filename), " | ", String(state.byteOffset), "/", String(size), " bytes");
+    state.byteOffset = 0;
+    state.lineNumber = 0;
+    state.fileSize = size;
+    saveTransmissionState(channel, state, true);
+  }
+  else if (state.fileSize > size)
+  {
+    state.fileSize = size;
+  }
+}
+
+static char batchInput[MQTT_BATCH_MAX_PAYLOAD];
+static char batchPayload[MQTT_BATCH_MAX_PAYLOAD];
+
+/**
+ * @brief Packs the complete lines following the cursor into one batch message.
+ *
+ * The message starts with an envelope line
+ * {"logger_id":..,"file":"..","first_line":..,"count":..} followed by the
+ * records, each terminated by a line break. first_line is the line number of
+ * the first record in the file, so the deck box can drop a batch that is
+ * sent again after an interrupted upload. Empty lines are skipped like in
+ * the upload of single lines.
+ *
+ * @param file The file being uploaded.
+ * @param state Cursor of the file.
+ * @param payloadSize Largest payload of the message.
+ * @param nextOffset Offset following the last line of the batch.
+ * @param lineCount Number of records in the batch.
+ * @return size_t Length of the message in batchPayload, 0 if not even one line fits.
+ */
+static size_t packLineBatch(File &file, const TransmissionState &state, size_t payloadSize, uint32_t &nextOffset, uint16_t &lineCount)
+{
+  if (payloadSize <= BATCH_ENVELOPE_SIZE || !file.seek(state.byteOffset))
+  {
+    return 0;
+  }
+  size_t length = file.read((uint8_t *)batchInput, min(payloadSize - BATCH_ENVELOPE_SIZE, (size_t)(state.fileSize - state.byteOffset)));
+
+  // Keep complete lines only, a last line without line break is complete at the end of the file
+  size_t batchLength = 0;
+  for (size_t i = 0; i < length; i++)
+  {
+    if (batchInput[i] == '\n')
+    {
+      batchLength = i + 1;
+    }
+  }
+  if (batchLength == 0 && length > 0 && state.byteOffset + length == state.fileSize)
+  {
+    batchLength = length;
+  }
+  if (batchLength == 0)
+  {
+    return 0;
+  }
+
+  // Copy the records without empty lines and carriage returns
+  size_t recordsLength = 0;
+  lineCount = 0;
+  size_t lineStart = 0;
+  for (size_t i = 0; i <= batchLength; i++)
+  {
+    if (i < batchLength && batchInput[i] != '\n')
+    {
+      continue;
+    }
+    size_t lineEnd = i;
+    if (lineEnd > lineStart && batchInput[lineEnd - 1] == '\r')
+    {
+      lineEnd--;
+    }
+    if (lineEnd > lineStart)
+    {
+      memmove(batchInput + recordsLength, batchInput + lineStart, lineEnd - lineStart);
+      recordsLength += lineEnd - lineStart;
+      batchInput[recordsLength++] = '\n';
+      lineCount++;
+    }
+    lineStart = i + 1;
+  }
+  if (lineCount == 0)
+  {
+    // Only empty lines, they are skipped by the upload of single lines
+    return 0;
+  }
+  nextOffset = state.byteOffset + batchLength;
+
+  int envelopeLength = snprintf(batchPayload, BATCH_ENVELOPE_SIZE, "{\"logger_id\":%u,\"file\":\"%s\",\"first_line\":%ld,\"count\":%u}\n", configRTC.logger_id, state.filename, state.lineNumber, lineCount);
+  if (envelopeLength <= 0 || envelopeLength >= BATCH_ENVELOPE_SIZE)
+  {
+    return 0;
+  }
+  memcpy(batchPayload + envelopeLength, batchInput, recordsLength);
+  return envelopeLength + recordsLength;
+}
+
+static char linePayload[UPLOAD_LINE_SIZE];
+static uint8_t seriesPayload[MQTT_BATCH_MAX_PAYLOAD];
+
+/**
+ * @brief Reads the message that starts at the cursor of a file.
+ *
+ * If the deck box accepted the series encoding, the records following the
+ * cursor are encoded as one block for the series topic of the channel.
+ * Otherwise, with upload_batch_size in
+ * Config.json, as many lines as fit are packed for the batch topic. A line
+ * that does not fit into a batch or block is sent alone. The same cursor always
+ * gives the same message, so a message can be built again for a retransmission.
+ *
+ * @param channel The upload channel.
+ * @param file The file being uploaded.
+ * @param state Cursor of the message.
+ * @param batchSize Payload size of batch messages, 0 for single lines.
+ * @param seriesEncoding The deck box decodes series blocks.
+ * @param message Receives the message, valid until the next call.
+ * @return true if a message was read, false at the end of the file.
+ */
+bool readUploadMessage(const TransmissionChannel &channel, File &file, const TransmissionState &state, size_t batchSize, bool seriesEncoding, UploadMessage &message)
+{
+  if (state.byteOffset >= state.fileSize)
+  {
+    return false;
+  }
+
+  if (seriesEncoding && channel.seriesTopic != nullptr)
+  {
+    message.length = encodeSeriesBatch(file, state.byteOffset, state.fileSize, state.filename, state.lineNumber, seriesPayload, MQTT_BATCH_MAX_PAYLOAD, message.nextOffset, message.lineCount);
+    if (message.length > 0)
+    {
+      message.topic = channel.seriesTopic;
+      message.payload = seriesPayload;
+      return true;
+    }
+  }
+
+  if (batchSize > 0)
+  {
+    message.length = packLineBatch(file, state, batchSize, message.nextOffset, message.lineCount);
+    if (message.length > 0)
+    {
+      message.topic = channel.batchTopic;
+      message.payload = (const uint8_t *)batchPayload;
+      return true;
+    }
+  }
+
+  if (!file.seek(state.byteOffset) || !file.available())
+  {
+    return false;
+  }
+  String buf = file.readStringUntil('\n');
+  buf.toCharArray(linePayload, sizeof(linePayload));
+  message.topic = channel.topic;
+  message.payload = (const uint8_t *)linePayload;
+  message.length = strlen(linePayload);
+  message.nextOffset = file.position();
+  message.lineCount = buf.length() > 0 && buf != "\r" ? 1 : 0; // Skip empty lines, counted like in packLineBatch()
+  return true;
+}
+
+/**
+ * @brief Moves the cursor past an acknowledged message.
+ * @param channel The upload channel.
+ * @param state Cursor of the file.
+ * @param nextOffset Offset following the message.
+ * @param lineCount Number of lines in the message.
+ */
+void advanceTransmissionState(const TransmissionChannel &channel, TransmissionState &state, uint32_t nextOffset, uint16_t lineCount)
+{
+  state.byteOffset = nextOffset;
+  state.lineNumber += lineCount;
+  if (lineCount > 0)
+  {
+    saveTransmissionState(channel, state, (state.lineNumber - lineCount) / TRANSMISSION_CHECKPOINT_INTERVAL != state.lineNumber / TRANSMISSION_CHECKPOINT_INTERVAL);
+    *channel.errorFlag = false;
+  }
+}
@@ -0,0 +1,60 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Upload cursor and messages of the files sent over MQTT
+ */
+
+#ifndef UPLOADCURSOR_H
+#define UPLOADCURSOR_H
+
+#include <SD.h>
+
+#include "MqttPipeline.h"
+
+// Largest single line message
+#define UPLOAD_LINE_SIZE 1024
+
+// The cursor is written to the SD card every TRANSMISSION_CHECKPOINT_INTERVAL lines,
+// so an upload can also be resumed after a reset that cleared RTC memory.
+#define TRANSMISSION_CHECKPOINT_INTERVAL 32
+
+// Space kept free for the envelope line of a batch message
+#define BATCH_ENVELOPE_SIZE 128
+
+// Upload cursor of one file. byteOffset always points to the start of the next unsent line.
+struct TransmissionState
+{
+  char filename[55];
+  uint32_t byteOffset;
+  uint32_t fileSize;
+  long lineNumber;
+};
+
+// Describes one upload channel (header, data or log)
+struct TransmissionChannel
+{
+  const char *name;
+  const char *directory;
+  const char *topic;
+  const char *backupDirectory; // nullptr: log segments are moved by moveLogToBackup()
+  const char *checkpointFile;
+  const char *activeFile; // still written, not uploaded
+  const char *batchTopic;  // batches of lines, see upload_batch_size
+  const char *seriesTopic; // series blocks, see upload_series_encoding, nullptr: not encoded
+  TransmissionState *state;
+  bool *errorFlag;
+};
+
+void saveTransmissionState(const TransmissionChannel &channel, const TransmissionState &state, bool forceCheckpoint);
+bool loadTransmissionState(const TransmissionChannel &channel, TransmissionState &state);
+void clearTransmissionState(const TransmissionChannel &channel);
+void checkTransmissionState(const TransmissionChannel &channel, File &file, TransmissionState &state);
+bool readUploadMessage(const TransmissionChannel &channel, File &file, const TransmissionState &state, size_t batchSize, bool seriesEncoding, UploadMessage &message);
+void advanceTransmissionState(const TransmissionChannel &channel, TransmissionState &state, uint32_t nextOffset, uint16_t lineCount);
+
+#endif
@@ -0,0 +1,309 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Upload session with the deck box, kept over deep sleep
+ *
+ * One request on hyfive/sessionRequest ("<logger_id>") replaces the busy
+ * check and the login of requestNodeRedBusyStatus() / requestNodeRedStatus().
+ * The deck box answers on hyfive/sessionStatus with
+ * "<logger_id>:ready:<lease>:<waiting>" or "<logger_id>:busy:0". During the
+ * lease (s) the deck box keeps the upload slot for the logger, a wake within
+ * the lease continues an interrupted upload without handshake. The lease is
+ * kept in RTC memory together with the network it was granted on.
+ *
+ * A deck box that does not answer gets the busy/login handshake, the
+ * combined handshake is tried again after SESSION_LEGACY_RETRY.
+ *
+ * When several loggers surface together the deck box queues them and answers
+ * "<logger_id>:wait:<seconds>" with the estimated start of their slot. The
+ * logger sleeps until then without radio (limitSleepToUploadAttempt()). A
+ * busy answer without slot, also of the busy/login handshake, is retried
+ * with jittered exponential backoff. After the upload "<logger_id>:done"
+ * frees the slot for the next logger. <waiting>, the number of queued
+ * loggers, is not needed by the logger.
+ */
+
+#include <esp_rom_crc.h>
+
+#include "DS3231TimeNtp.h"
+#include "DebuggingSDLog.h"
+#include "SystemVariables.h"
+#include "UploadSession.h"
+#include "loggerConfig.h"
+
+// Upload session, kept over deep sleep
+struct UploadSessionState
+{
+  uint32_t leaseUntil; // RTC time the upload slot is granted until
+  int32_t leaseNetwork; // lastSuccessfulNetworkIndex of the lease
+  uint32_t legacyUntil; // RTC time until the busy/login handshake is used
+  uint32_t nextAttempt; // RTC time of the upload slot or the end of the backoff
+  uint8_t backoffExponent; // busy answers without slot in a row
+  uint32_t checksum;
+};
+
+RTC_DATA_ATTR UploadSessionState uploadSession;
+
+static bool sessionStatusReceived = false;
+static SessionResult sessionResult = SessionNoAnswer;
+static uint32_t sessionSeconds = 0; // lease of "ready", wait of "wait"
+
+static bool uploadTimingActive = false;
+static unsigned long uploadPhaseStart = 0;
+static unsigned long uploadPhaseTimes[UploadPhaseCount];
+static const char *uploadHandshake = "";
+
+/**
+ * @brief Calculates the checksum of the session state.
+ * @return uint32_t CRC32 over all fields except the checksum.
+ */
+static uint32_t uploadSessionChecksum()
+{
+  return esp_rom_crc32_le(0, (const uint8_t *)&uploadSession, offsetof(UploadSessionState, checksum));
+}
+
+/**
+ * @brief Checks the session state after a cold boot.
+ */
+static void validateUploadSession()
+{
+  if (uploadSession.checksum != uploadSessionChecksum())
+  {
+    memset(&uploadSession, 0, sizeof(uploadSession));
+    uploadSession.checksum = uploadSessionChecksum();
+  }
+}
+
+/**
+ * @brief Checks whether the deck box has granted an upload slot that is still valid.
+ * @return true if the upload can start without handshake.
+ */
+bool uploadLeaseValid()
+{
+  validateUploadSession();
+  uint32_t now = getCurrentTimeFromRTC();
+  return uploadSession.leaseUntil > now && uploadSession.leaseNetwork == lastSuccessfulNetworkIndex && uploadSession.leaseUntil - now <= 24 * 3600;
+}
+
+/**
+ * @brief Checks whether the deck box is expected to answer the combined handshake.
+ * @return false while the busy/login handshake is used.
+ */
+bool combinedHandshakeSupported()
+{
+  validateUploadSession();
+  uint32_t now = getCurrentTimeFromRTC();
+  return uploadSession.legacyUntil <= now || uploadSession.legacyUntil - now > SESSION_LEGACY_RETRY;
+}
+
+/**
+ * @brief Takes the answer of the deck box to the session request.
+ * @param topic Topic of the received message.
+ * @param payload The received message.
+ * @param length Length of the received message.
+ * @return true if the message belongs to the session handshake, also for other loggers.
+ */
+bool handleSessionStatusMessage(const char *topic, const uint8_t *payload, int length)
+{
+  if (strcmp(topic, SESSION_STATUS_TOPIC) != 0)
+  {
+    return false;
+  }
+
+  char message[48];
+  size_t messageLength = min((size_t)length, sizeof(message) - 1);
+  memcpy(message, payload, messageLength);
+  message[messageLength] = '\0';
+
+  unsigned int loggerId;
+  char state[8];
+  unsigned int seconds;
+  if (sscanf(message, "%u:%7[a-z]:%u", &loggerId, state, &seconds) == 3 && loggerId == configRTC.logger_id)
+  {
+    sessionResult = strcmp(state, "ready") == 0 ? SessionReady : SessionBusy;
+    sessionSeconds = strcmp(state, "busy") == 0 ? 0 : seconds;
+    sessionStatusReceived = true;
+  }
+  return true;
+}
+
+/**
+ * @brief Asks the deck box for an upload slot in one round trip.
+ * @param client The connected MQTT client.
+ * @return SessionResult Ready with a lease saved in RTC memory, Busy with the next attempt saved, or NoAnswer from an older deck box.
+ */
+SessionResult requestUploadSession(MQTTClient &client)
+{
+  validateUploadSession();
+  sessionStatusReceived = false;
+  sessionResult = SessionNoAnswer;
+
+  // The request is repeated by the next handshake, QoS 0 saves the round trip of the acknowledgement
+  char request[12];
+  snprintf(request, sizeof(request), "%u", configRTC.logger_id);
+  if (!client.publish(SESSION_REQUEST_TOPIC, request, false, 0))
+  {
+    return SessionNoAnswer;
+  }
+
+  unsigned long start = millis();
+  while (!sessionStatusReceived && millis() - start < SESSION_TIMEOUT)
+  {
+    client.loop();
+    delay(1);
+  }
+
+  uint32_t now = getCurrentTimeFromRTC();
+  if (!sessionStatusReceived)
+  {
+    Log(LogCategoryMQTT, LogLevelINFO, "Upload session: no answer, busy/login handshake for ", String(SESSION_LEGACY_RETRY), " s");
+    uploadSession.legacyUntil = now + SESSION_LEGACY_RETRY;
+  }
+  else if (sessionResult == SessionReady)
+  {
+    // One second less, the RTC of the logger and the clock of the deck box are not aligned
+    uploadSession.leaseUntil = sessionSeconds > 1 ? now + sessionSeconds - 1 : 0;
+    uploadSession.leaseNetwork = lastSuccessfulNetworkIndex;
+    uploadSession.legacyUntil = 0;
+    uploadSession.nextAttempt = 0;
+    uploadSession.backoffExponent = 0;
+    Log(LogCategoryMQTT, LogLevelDEBUG, "Upload session: ready, lease ", String(sessionSeconds), " s");
+  }
+  else if (sessionSeconds > 0 && sessionSeconds <= SESSION_WAIT_MAX)
+  {
+    uploadSession.leaseUntil = 0;
+    uploadSession.legacyUntil = 0;
+    uploadSession.nextAttempt = now + sessionSeconds;
+    uploadSession.backoffExponent = 0;
+    Log(LogCategoryMQTT, LogLevelINFO, "Upload session: deck box busy, slot in ", String(sessionSeconds), " s");
+  }
+  else
+  {
+    uploadSession.leaseUntil = 0;
+    uploadSession.legacyUntil = 0;
+    uploadSession.checksum = uploadSessionChecksum();
+    scheduleUploadBackoff();
+  }
+  uploadSession.checksum = uploadSessionChecksum();
+  return sessionResult;
+}
+
+/**
+ * @brief Frees the upload slot after the upload, the deck box hands it to the next logger.
+ * @param client The connected MQTT client.
+ */
+void releaseUploadSession(MQTTClient &client)
+{
+  validateUploadSession();
+  if (combinedHandshakeSupported() && client.connected())
+  {
+    char release[20];
+    snprintf(release, sizeof(release), "%u:done", configRTC.logger_id);
+    client.publish(SESSION_REQUEST_TOPIC, release, false, 0);
+  }
+  uploadSession.leaseUntil = 0;
+  uploadSession.nextAttempt = 0;
+  uploadSession.backoffExponent = 0;
+  uploadSession.checksum = uploadSessionChecksum();
+}
+
+/**
+ * @brief Checks whether the logger may ask the deck box again.
+ * @return false until the upload slot or the end of the backoff.
+ */
+bool uploadAttemptDue()
+{
+  validateUploadSession();
+  uint32_t now = getCurrentTimeFromRTC();
+  // A time far in the future is left from an RTC that was set back
+  return uploadSession.nextAttempt <= now || uploadSession.nextAttempt - now > SESSION_WAIT_MAX;
+}
+
+/**
+ * @brief Delays the next request after a busy answer without slot.
+ *
+ * The window doubles with every busy answer in a row, the attempt is in its
+ * second half so that loggers that surfaced together spread out.
+ */
+void scheduleUploadBackoff()
+{
+  validateUploadSession();
+  uint32_t window = min((uint32_t)SESSION_BACKOFF_BASE << min(uploadSession.backoffExponent, (uint8_t)10), (uint32_t)SESSION_BACKOFF_MAX);
+  uint32_t wait = window / 2 + esp_random() % (window / 2 + 1);
+  uploadSession.nextAttempt = getCurrentTimeFromRTC() + wait;
+  if (uploadSession.backoffExponent < 10)
+  {
+    uploadSession.backoffExponent++;
+  }
+  uploadSession.checksum = uploadSessionChecksum();
+  Log(LogCategoryMQTT, LogLevelINFO, "Upload session: deck box busy, next attempt in ", String(wait), " s");
+}
+
+/**
+ * @brief Shortens the deep sleep to the upload slot or the end of the backoff.
+ * @param sleepSeconds Deep sleep until the next periodic function (s).
+ * @return uint32_t Deep sleep (s).
+ */
+uint32_t limitSleepToUploadAttempt(uint32_t sleepSeconds)
+{
+  if (uploadAttemptDue())
+  {
+    return sleepSeconds;
+  }
+  uint32_t wait = uploadSession.nextAttempt - getCurrentTimeFromRTC();
+  return wait < sleepSeconds ? max(wait, (uint32_t)1) : sleepSeconds;
+}
+
+/**
+ * @brief Starts the time measurement of an upload up to its first data byte.
+ */
+void beginUploadTiming()
+{
+  uploadTimingActive = true;
+  uploadPhaseStart = millis();
+  memset(uploadPhaseTimes, 0, sizeof(uploadPhaseTimes));
+  uploadHandshake = "";
+}
+
+/**
+ * @brief Ends a phase of the time measurement, ignored without beginUploadTiming().
+ * @param phase The phase that ends.
+ * @param handshake Kind of handshake for UploadPhaseHandshake ("lease", "combined", "legacy").
+ */
+void markUploadPhase(UploadPhase phase, const char *handshake)
+{
+  if (!uploadTimingActive)
+  {
+    return;
+  }
+  unsigned long now = millis();
+  uploadPhaseTimes[phase] += now - uploadPhaseStart;
+  uploadPhaseStart = now;
+  if (handshake != nullptr)
+  {
+    uploadHandshake = handshake;
+  }
+}
+
+/**
+ * @brief Logs the time from the start of the upload to its first data byte, once per upload.
+ */
+void logTimeToFirstByte()
+{
+  if (!uploadTimingActive)
+  {
+    return;
+  }
+  uploadTimingActive = false;
+  unsigned long total = millis() - uploadPhaseStart;
+  for (int phase = 0; phase < UploadPhaseCount; phase++)
+  {
+    total += uploadPhaseTimes[phase];
+  }
+  Log(LogCategoryMQTT, LogLevelINFO, "Time to first byte: ", String(total), " ms | WiFi ", String(uploadPhaseTimes[UploadPhaseWifi]), " ms | MQTT ", String(uploadPhaseTimes[UploadPhaseMqtt]), " ms | handshake ", String(uploadPhaseTimes[UploadPhaseHandshake]), " ms (", uploadHandshake, ")");
+}
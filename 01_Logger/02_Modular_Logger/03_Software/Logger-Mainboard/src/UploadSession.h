@@ -0,0 +1,60 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Upload session with the deck box, kept over deep sleep
+ */
+
+#ifndef UPLOADSESSION_H
+#define UPLOADSESSION_H
+
+#include <MQTT.h>
+
+#define SESSION_REQUEST_TOPIC "hyfive/sessionRequest"
+#define SESSION_STATUS_TOPIC "hyfive/sessionStatus"
+
+// Time to wait for the answer of the deck box (ms), like requestNodeRedStatus()
+#define SESSION_TIMEOUT 500
+
+// Without answer the busy/login handshake is used, the combined handshake is tried again after (s)
+#define SESSION_LEGACY_RETRY 3600
+
+// Longest wait for an upload slot that is accepted from the deck box (s)
+#define SESSION_WAIT_MAX 1800
+
+// Busy without slot: jittered exponential backoff from SESSION_BACKOFF_BASE up to SESSION_BACKOFF_MAX (s)
+#define SESSION_BACKOFF_BASE 15
+#define SESSION_BACKOFF_MAX 600
+
+enum SessionResult
+{
+  SessionReady = 0, // the deck box accepts the upload
+  SessionBusy,      // another logger uploads, the logger waits for its slot or backs off
+  SessionNoAnswer   // deck box without combined handshake
+};
+
+enum UploadPhase
+{
+  UploadPhaseWifi = 0,
+  UploadPhaseMqtt,
+  UploadPhaseHandshake,
+  UploadPhaseCount
+};
+
+bool uploadLeaseValid();
+bool combinedHandshakeSupported();
+SessionResult requestUploadSession(MQTTClient &client);
+void releaseUploadSession(MQTTClient &client);
+bool uploadAttemptDue();
+void scheduleUploadBackoff();
+uint32_t limitSleepToUploadAttempt(uint32_t sleepSeconds);
+bool handleSessionStatusMessage(const char *topic, const uint8_t *payload, int length);
+void beginUploadTiming();
+void markUploadPhase(UploadPhase phase, const char *handshake = nullptr);
+void logTimeToFirstByte();
+
+#endif
@@ -11,17 +11,23 @@
 
 #include <ArduinoJson.h>
 #include <SD.h>
+#include <mbedtls/md.h>
 #include <vector>
 
 #include "BMS.h"
 #include "Charger.h"
+#include "Compression.h"
+#include "ConfigManifest.h"
 #include "DS3231TimeNtp.h"
 #include "DebuggingSDLog.h"
 #include "DeepSleep.h"
+#include "FileManifest.h"
 #include "LED.h"
 #include "MQTTManager.h"
 #include "SDCard.h"
+#include "SampleRing.h"
 #include "SensorManagement.h"
+#include "SpaceLedger.h"
 #include "SystemVariables.h"
 #include "Utility.h"
 #include "WifiNetwork.h"
@@ -73,6 +79,8 @@ bool copyFileToDestination(const char *sourceFolder, const char *fileName, const
   // Close files
   sourceFile.close();
   destinationFile.close();
+  manifestFileAdded(destinationFolder, fileName);
+  ledgerFileResized(0, size);
 
   delay(100);
   return true;
@@ -103,6 +111,8 @@ bool moveFileToDestination(const char *sourceFolder, const char *fileName, const
     {
       return false;
     }
+    manifestFileRemoved(sourceFolder, fileName);
+    manifestFileAdded(destinationFolder, "logger_" + String(configRTC.logger_id) + "_" + timestamp + "_" + fileName);
 
     delay(100);
     return true;
@@ -115,11 +125,12 @@ bool moveFileToDestination(const char *sourceFolder, const char *fileName, const
     if (SD.exists(destinationPath.c_str()))
     {
       // file already exists, try deleting it before moving it
-      if (!SD.remove(destinationPath.c_str()))
+      if (!ledgerRemoveFile(destinationPath))
       {
         Serial.println("Destination file could not be deleted: " + destinationPath);
         return false;
       }
+      manifestFileRemoved(destinationFolder, fileName);
     }
 
     if (!SD.rename(sourcePath.c_str(), destinationPath.c_str()))
@@ -127,6 +138,8 @@ bool moveFileToDestination(const char *sourceFolder, const char *fileName, const
       Serial.println("File could not be moved: " + sourcePath);
       return false;
     }
+    manifestFileRemoved(sourceFolder, fileName);
+    manifestFileAdded(destinationFolder, fileName);
 
     delay(100);
     return true;
@@ -199,7 +212,9 @@ void appendDataToFile(const String &filename, const String &data)
   File datei = SD.open(filename, FILE_APPEND);
   if (datei)
   {
-    datei.println(data);
+    size_t oldSize = datei.size();
+    size_t written = datei.println(data);
+    ledgerFileResized(oldSize, oldSize + written);
     datei.close();
   }
   else
@@ -227,7 +242,7 @@ bool checkFileProperties(const String &path, size_t minSize, const String &exten
       file = SD.open(path, FILE_WRITE);
       if (file)
       {
-        file.println(inhalt);
+        ledgerFileResized(0, file.println(inhalt));
         file.close();
         return true; // File successfully created
       }
@@ -296,13 +311,19 @@ void deleteAllFilesInFolder(String path)
     if (!file.isDirectory())
     {
       String filePath = path + "/" + file.name();
-      SD.remove(filePath.c_str());
+      uint64_t size = file.size();
+      file.close();
+      if (SD.remove(filePath.c_str()))
+      {
+        ledgerFileRemoved(size);
+      }
       Serial.println("Deleted: " + filePath);
     }
     file = dir.openNextFile();
   }
 
   dir.close();
+  manifestDirectoryCleared(path);
 }
 
 /**
@@ -454,6 +475,8 @@ void performFirstBootOperations()
     interfaceSleep();
     updateFirmware();
     validateAndLoadConfig();
+    // After the config, the slot names of a record file without schema are taken from it
+    recoverSampleRing();
     connectToWifiAndSyncNTP();
     manageBatteryCharging();
     firstBootLed();
@@ -470,86 +493,194 @@ void performFirstBootOperations()
   }
 }
 
+// Bookkeeping of the log backup segments /backup/log/log_<sequence>.txt
+struct LogBackupState
+{
+  bool valid;
+  uint32_t oldestSequence;
+  uint32_t nextSequence;
+  uint64_t totalSize;
+};
+
+RTC_DATA_ATTR LogBackupState logBackupState = {false, 0, 0, 0};
+
+/**
+ * @brief Builds the path of a log backup segment.
+ * @param sequence Sequence number of the segment.
+ * @return String The path of the segment.
+ */
+String logBackupSegmentPath(uint32_t sequence)
+{
+  char buffer[40];
+  snprintf(buffer, sizeof(buffer), "/backup/log/log_%08lu.txt", (unsigned long)sequence);
+  return String(buffer);
+}
+
 /**
- * @brief Moves the log file from the source directory to the backup directory.
-
- * This function performs the following operations:
- * 1. Checks if the source file exists.
- * 2. Creates the backup directory if it doesn't exist.
- * 3. If the backup file already exists, appends the content of the source file to it.
- * 4. If the backup file doesn't exist, renames the source file to the backup file.
- * 5. Deletes the original source file after successful backup.
+ * @brief Rebuilds the log backup bookkeeping by scanning /backup/log.
+ *
+ * Only needed once after a cold boot, when RTC memory was cleared.
  */
-void moveLogToBackup()
+void rebuildLogBackupState()
 {
+  logBackupState.oldestSequence = UINT32_MAX;
+  logBackupState.nextSequence = 0;
+  logBackupState.totalSize = 0;
+
+  File dir = SD.open("/backup/log");
+  if (dir && dir.isDirectory())
+  {
+    File file = dir.openNextFile();
+    while (file)
+    {
+      unsigned long sequence;
+      if (sscanf(file.name(), "log_%08lu.txt", &sequence) == 1)
+      {
+        logBackupState.totalSize += file.size();
+        logBackupState.oldestSequence = min(logBackupState.oldestSequence, (uint32_t)sequence);
+        logBackupState.nextSequence = max(logBackupState.nextSequence, (uint32_t)sequence + 1);
+      }
+      file.close();
+      file = dir.openNextFile();
+    }
+  }
+  dir.close();
+
+  if (logBackupState.oldestSequence == UINT32_MAX)
+  {
+    logBackupState.oldestSequence = logBackupState.nextSequence;
+  }
+  logBackupState.valid = true;
+}
 
-  const char *sourceFile = "/log/log.txt";
-  const char *backupDir = "/backup/log";
-  const char *backupFile = "/backup/log/log.txt";
+/**
+ * @brief Moves a log segment into the log backup.
+ *
+ * The segment is compressed into the next backup segment, or renamed when
+ * backupCompressionEnabled is off or the compression fails. The oldest backup segments are removed while the backup
+ * exceeds LOG_BACKUP_MAX_SIZE.
+ *
+ * @param fileName Name of the log segment in /log.
+ */
+void moveLogToBackup(const char *fileName)
+{
+  String sourceFile = String("/log/") + fileName;
 
   // Check if source file exists
-  if (!SD.exists(sourceFile))
+  File source = SD.open(sourceFile, FILE_READ);
+  if (!source)
   {
     Serial.println("Source file does not exist!");
     return;
   }
+  size_t segmentSize = source.size();
+  source.close();
 
   // Create backup directory if it doesn't exist
-  if (!SD.exists(backupDir))
+  if (!SD.exists("/backup/log"))
   {
-    SD.mkdir(backupDir);
+    SD.mkdir("/backup/log");
   }
 
-  File source = SD.open(sourceFile, FILE_READ);
-  if (!source)
+  if (!logBackupState.valid)
   {
-    Serial.println("Error opening source file!");
-    return;
+    rebuildLogBackupState();
   }
 
-  // If backup file already exists, append to it
-  if (SD.exists(backupFile))
+  String segmentPath = logBackupSegmentPath(logBackupState.nextSequence);
+  String compressedPath = segmentPath + COMPRESSED_FILE_EXTENSION;
+  if (backupCompressionEnabled && compressFile(sourceFile, compressedPath))
   {
-    File destination = SD.open(backupFile, FILE_APPEND);
-    if (!destination)
+    File compressed = SD.open(compressedPath, FILE_READ);
+    size_t compressedSize = compressed ? compressed.size() : 0;
+    compressed.close();
+    if (compressedSize > 0 && SD.remove(sourceFile.c_str()))
     {
-      Serial.println("Error opening backup file for appending!");
-      source.close();
-      return;
+      ledgerFileRemoved(segmentSize);
+      segmentSize = compressedSize;
+      segmentPath = compressedPath;
     }
-
-    while (source.available())
+    else
     {
-      destination.write(source.read());
+      ledgerRemoveFile(compressedPath);
     }
-
-    destination.println(); // Add a newline for separation
-    destination.close();
   }
-  // If backup file doesn't exist, just rename the source file
-  else
+  if (!segmentPath.endsWith(COMPRESSED_FILE_EXTENSION) && !SD.rename(sourceFile.c_str(), segmentPath.c_str()))
   {
-    source.close();
-    if (SD.rename(sourceFile, backupFile))
+    Serial.println("Error moving file!");
+    return;
+  }
+  manifestFileRemoved("/log", fileName);
+  manifestFileAdded("/backup/log", segmentPath.substring(segmentPath.lastIndexOf('/') + 1));
+  logBackupState.nextSequence++;
+  logBackupState.totalSize += segmentSize;
+
+  // Oldest-first eviction
+  while (logBackupState.totalSize > LOG_BACKUP_MAX_SIZE && logBackupState.oldestSequence + 1 < logBackupState.nextSequence)
+  {
+    String oldestPath = logBackupSegmentPath(logBackupState.oldestSequence);
+    if (!SD.exists(oldestPath))
     {
-      Serial.println("File moved successfully!");
+      oldestPath += COMPRESSED_FILE_EXTENSION;
     }
-    else
+    File oldest = SD.open(oldestPath, FILE_READ);
+    if (oldest)
     {
-      Serial.println("Error moving file!");
-      return;
+      size_t oldestSize = oldest.size();
+      oldest.close();
+      if (SD.remove(oldestPath))
+      {
+        ledgerFileRemoved(oldestSize);
+        logBackupState.totalSize -= min((uint64_t)oldestSize, logBackupState.totalSize);
+        manifestFileRemoved("/backup/log", oldestPath.substring(oldestPath.lastIndexOf('/') + 1));
+      }
     }
+    logBackupState.oldestSequence++;
   }
 
-  source.close();
+  Serial.println("Log backup completed successfully!");
+}
+
+/**
+ * @brief Calculates the SHA-256 hash of a file.
+ * @param file The file, read from the start.
+ * @param hex Receives the hash as 64 hex digits and terminator.
+ * @return true if the whole file was read.
+ */
+bool calculateFileSha256(File &file, char *hex)
+{
+  if (!file.seek(0))
+  {
+    return false;
+  }
+
+  mbedtls_md_context_t ctx;
+  unsigned char hash[32];
+  mbedtls_md_init(&ctx);
+  mbedtls_md_setup(&ctx, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 0);
+  mbedtls_md_starts(&ctx);
 
-  // Delete the original file if it still exists
-  if (SD.exists(sourceFile))
+  uint8_t buffer[512];
+  size_t total = 0;
+  while (file.available())
   {
-    SD.remove(sourceFile);
+    size_t length = file.read(buffer, sizeof(buffer));
+    if (length == 0)
+    {
+      break;
+    }
+    mbedtls_md_update(&ctx, buffer, length);
+    total += length;
   }
 
-  Serial.println("Log backup completed successfully!");
+  mbedtls_md_finish(&ctx, hash);
+  mbedtls_md_free(&ctx);
+
+  for (size_t i = 0; i < sizeof(hash); i++)
+  {
+    sprintf(hex + 2 * i, "%02x", hash[i]);
+  }
+  return total == file.size();
 }
 
 bool findLatestConfigFileLog = true;
@@ -579,6 +710,17 @@ String findLatestConfigurationFile(const String &pfad)
 {
   findLatestConfigFileLog = true;
 
+  // The configuration folder is read on every wake up, its latest file is kept in the manifest
+  if (pfad == "/loggerConfig")
+  {
+    String latestFileName = manifestLatestConfigFile();
+    if (latestFileName == "")
+    {
+      findLatestConfigFileLog = false;
+    }
+    return latestFileName;
+  }
+
   File root = SD.open(pfad);
 
   // Creates a vector that will store the names of the configuration update files
@@ -678,7 +820,9 @@ void performPeriodicConfigUpdate()
         {
           deleteAllFilesInFolder("/loggerConfig");
           moveFileToDestination("/updateConfig", (findLatestConfigurationFile("/updateConfig")).c_str(), "/loggerConfig");
+          configManifestConfigWritten(findLatestConfigurationFile("/loggerConfig"));
           copyFileToDestination("/loggerConfig/", (findLatestConfigurationFile("/loggerConfig")).c_str(), "/backup/config");
+          flushLogBeforeSleep();
           ESP.restart();
         }
       }
@@ -706,7 +850,7 @@ void getFirmwareUpdate()
   {
     if (SD.exists("/updateFW/firmware.bin"))
     {
-      SD.remove("/updateFW/firmware.bin");
+      ledgerRemoveFile("/updateFW/firmware.bin");
     }
     for (int i = 0; i < 3 && !isFirmwareUpdate; i++)
     {
@@ -723,16 +867,16 @@ void getFirmwareUpdate()
 }
 
 /**
- * @brief Calculates available space on the SD card.
- * @return int64_t Available space in bytes.
+ * @brief Calculates available space on the SD card from the space ledger.
+ * @return int64_t Available space in megabytes.
  */
 int64_t calculateAvailableSdCardSpace()
 {
   // SD card size
-  int64_t cardSize = SD.cardSize() / (1024 * 1024);
+  int64_t cardSize = ledgerTotalBytes() / (1024 * 1024);
 
   // Memory space used
-  int64_t usedSpace = (SD.usedBytes() / (1024 * 1024));
+  int64_t usedSpace = ledgerUsedBytes() / (1024 * 1024);
 
   // Free storage space
   int64_t freeSpace = cardSize - usedSpace; // Free memory in megabytes
@@ -741,12 +885,12 @@ int64_t calculateAvailableSdCardSpace()
 
 int64_t sdCardSpaceTotal()
 {
-  return SD.cardSize();
+  return ledgerTotalBytes();
 }
 
 int64_t sdCardSpaceUsed()
 {
-  return SD.usedBytes();
+  return ledgerUsedBytes();
 }
 
 /**
@@ -939,6 +1083,8 @@ void batteryRemainingLow(uint8_t batteryCharge)
         enableExternalWakeup(20); // if Power supply connected = LOW
         enableExternalWakeup(17); // when reed switch is actuated
         batteryEmpty = true;
+        flushSampleRing();
+        flushLogBeforeSleep();
         esp_deep_sleep_start();
       }
     }
@@ -963,6 +1109,7 @@ void programBms()
   disable3V3();
   Log(LogCategoryBMS, LogLevelINFO, "bmsProg");
   enableExternalWakeup(17); // reed switch
+  flushLogBeforeSleep();
   esp_deep_sleep_start();
 }
 
@@ -1067,7 +1214,7 @@ void batteryCompletelyCharged()
  */
 void configUpdatePeriodeFunktion(uint32_t config_update_periode)
 {
-  if (((totalElapsedTime - lastConfigUpdateTime) >= config_update_periode) || hasTransmissionUpdateError || askForConfigRequest)
+  if (((totalElapsedTime - lastConfigUpdateTime) >= config_update_periode) || hasTransmissionUpdateError || askForConfigRequest || configManifestUpdatePending())
   {
     uint8_t errorCount = 0;
     while (1)
@@ -1075,6 +1222,7 @@ void configUpdatePeriodeFunktion(uint32_t config_update_periode)
       Log(LogCategoryGeneral, LogLevelDEBUG, "config_update_periode");
       if (checkWetSensorAndNodeRed())
       {
+        configManifestRequested();
         performPeriodicConfigUpdate();
         getFirmwareUpdate();
 
@@ -1191,6 +1339,10 @@ void dataUploadRetryPeriodeFunktion(uint32_t data_upload_retry_periode)
  * 1. it checks whether the humidity sensor detects water.
  * 2. it checks the availability of Node-RED.
  *
+ * Within the lease of an earlier upload session Node-RED is not asked again.
+ * Otherwise the combined session handshake is used, or the busy/login
+ * handshake if the deck box does not answer it (UploadSession.cpp).
+ *
  * @return bool Returns true if the sensor does not detect moisture and Node-RED is available.
  * Returns false if either moisture is detected or Node-RED is not available.
  */
@@ -1201,8 +1353,34 @@ bool checkWetSensorAndNodeRed()
     return false;
   }
 
+  // Waiting for the upload slot or backing off, the radio stays off
+  if (!uploadAttemptDue())
+  {
+    return false;
+  }
+
   if (connectToWifiAndSyncNTP())
   {
+    markUploadPhase(UploadPhaseWifi);
+
+    // Upload slot granted to an earlier wake
+    if (uploadLeaseValid())
+    {
+      markUploadPhase(UploadPhaseHandshake, "lease");
+      return true;
+    }
+
+    if (combinedHandshakeSupported() && connectToMqtt())
+    {
+      markUploadPhase(UploadPhaseMqtt);
+      SessionResult result = requestNodeRedSession();
+      if (result != SessionNoAnswer)
+      {
+        markUploadPhase(UploadPhaseHandshake, "combined");
+        return result == SessionReady;
+      }
+    }
+
     uint8_t errorCount = 0;
 
     if (!getNodeRedBusyCheck)
@@ -1213,6 +1391,7 @@ bool checkWetSensorAndNodeRed()
 
     if (isNodeRedBusy)
     {
+      scheduleUploadBackoff();
       return false;
     }
 
@@ -1229,6 +1408,7 @@ bool checkWetSensorAndNodeRed()
       }
       errorCount++;
     }
+    markUploadPhase(UploadPhaseHandshake, "legacy");
 
     if (isNodeRedResponsePositive())
     {
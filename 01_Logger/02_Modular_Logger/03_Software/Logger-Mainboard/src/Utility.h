@@ -12,6 +12,8 @@
 #ifndef UTILITY_H
 #define UTILITY_H
 
+#include <SD.h>
+
 // System initialization
 
 void performFirstBootOperations();
@@ -37,7 +39,8 @@ int64_t calculateAvailableSdCardSpace();
 int64_t sdCardSpaceTotal();
 int64_t sdCardSpaceUsed();
 void checkWetSensorThreshold();
-void moveLogToBackup();
+void moveLogToBackup(const char *fileName);
+bool calculateFileSha256(File &file, char *hex);
 
 // Energy management
 
@@ -15,6 +15,39 @@
 #include "Led.h"
 #include "SystemVariables.h"
 
+// The connection is checked every WIFI_CONNECT_POLL_MS for WIFI_CONNECT_TIMEOUT_MS per attempt
+#define WIFI_CONNECT_POLL_MS 50
+#define WIFI_CONNECT_TIMEOUT_MS 2000
+
+/**
+ * @brief Waits for the connection after WiFi.begin().
+ * @return true if connected within WIFI_CONNECT_TIMEOUT_MS.
+ */
+static bool waitForWifiConnection()
+{
+  unsigned long start = millis();
+  while (WiFi.status() != WL_CONNECTED)
+  {
+    if (millis() - start >= WIFI_CONNECT_TIMEOUT_MS)
+    {
+      return false;
+    }
+    delay(WIFI_CONNECT_POLL_MS);
+  }
+  return true;
+}
+
+/**
+ * @brief Remembers the network and its access point for the next wake up.
+ * @param index Index of the network in configRTC.wificonfig.
+ */
+static void rememberWifiNetwork(int index)
+{
+  lastSuccessfulNetworkIndex = index;
+  memcpy(lastSuccessfulBssid, WiFi.BSSID(), sizeof(lastSuccessfulBssid));
+  lastSuccessfulChannel = WiFi.channel();
+}
+
 /**
  * @brief Connects to Wi-Fi and synchronizes time with NTP.
  * @return true if connection and synchronization were successful, false otherwise.
@@ -57,21 +90,28 @@ bool connectToWifiAndSyncNTP()
         
         for (int attempt = 0; attempt < 2; ++attempt)
         {
-          WiFi.begin(configRTC.wificonfig[lastSuccessfulNetworkIndex].ssid, 
-                    configRTC.wificonfig[lastSuccessfulNetworkIndex].pw);
-          
-          for (int i = 0; i < 2; i++)
+          // First attempt on the known channel and access point, without scan
+          if (attempt == 0 && lastSuccessfulChannel > 0)
+          {
+            WiFi.begin(configRTC.wificonfig[lastSuccessfulNetworkIndex].ssid,
+                       configRTC.wificonfig[lastSuccessfulNetworkIndex].pw, lastSuccessfulChannel, lastSuccessfulBssid);
+          }
+          else
+          {
+            WiFi.begin(configRTC.wificonfig[lastSuccessfulNetworkIndex].ssid, 
+                      configRTC.wificonfig[lastSuccessfulNetworkIndex].pw);
+          }
+
+          if (waitForWifiConnection())
           {
-            if (WiFi.status() == WL_CONNECTED)
-            {
-              Log(LogCategoryWiFi, LogLevelDEBUG, "Reconnected to last successful network: ", 
-                  String(configRTC.wificonfig[lastSuccessfulNetworkIndex].ssid));
-              hasWifiConnection = true;
-              synchronizeTimeWithNTP();
-              return true;
-            }
-            delay(1000);
+            Log(LogCategoryWiFi, LogLevelDEBUG, "Reconnected to last successful network: ", 
+                String(configRTC.wificonfig[lastSuccessfulNetworkIndex].ssid));
+            rememberWifiNetwork(lastSuccessfulNetworkIndex);
+            hasWifiConnection = true;
+            synchronizeTimeWithNTP();
+            return true;
           }
+          WiFi.disconnect();
           
           Log(LogCategoryWiFi, LogLevelDEBUG, "Reconnection to last network failed, trying all networks");
         }
@@ -92,21 +132,17 @@ bool connectToWifiAndSyncNTP()
         {
           WiFi.begin(configRTC.wificonfig[j].ssid, configRTC.wificonfig[j].pw);
           
-          for (int i = 0; i < 2; i++)
+          if (waitForWifiConnection())
           {
-            if (WiFi.status() == WL_CONNECTED)
-            {
-              Log(LogCategoryWiFi, LogLevelDEBUG, "Connected to network: ", 
-                  String(configRTC.wificonfig[j].ssid));
-              
-              // Remember this successful network for next time
-              lastSuccessfulNetworkIndex = j;
-              
-              hasWifiConnection = true;
-              synchronizeTimeWithNTP();
-              return true;
-            }
-            delay(1000);
+            Log(LogCategoryWiFi, LogLevelDEBUG, "Connected to network: ", 
+                String(configRTC.wificonfig[j].ssid));
+            
+            // Remember this successful network for next time
+            rememberWifiNetwork(j);
+            
+            hasWifiConnection = true;
+            synchronizeTimeWithNTP();
+            return true;
           }
 
           Log(LogCategoryWiFi, LogLevelDEBUG, "Connection failed for network: ", 
@@ -7,14 +7,389 @@
  * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
  *
  * Description: Firmware update management
+ *
+ * The firmware is streamed from hyfive/updateFW directly into the inactive
+ * OTA partition. Every chunk starts with its offset and the size of the
+ * firmware, the SHA-256 is calculated while the chunks arrive. After a lost
+ * link the download continues at the last written offset, the resume state
+ * is kept in RTC memory. The boot partition is only switched after the
+ * SHA-256 of the whole firmware matches. A firmware.bin copied to the SD
+ * card is still installed by updateFirmware().
+ *
+ * The logger asks for a patch against its running firmware (FirmwareDelta.cpp).
+ * The deck box sends one if it has a patch for that firmware, else the
+ * firmware image. A patch that does not fit is refused and the firmware image
+ * is requested instead.
  */
 
 #include <ArduinoOTA.h>
 #include <SD.h>
 #include <WiFiClientSecure.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+#include <esp_rom_crc.h>
+#include <mbedtls/md.h>
 
+#include "DebuggingSDLog.h"
+#include "FirmwareDelta.h"
+#include "SpaceLedger.h"
 #include "firmwareUpdate.h"
 
+#define FIRMWARE_SECTOR_SIZE 4096
+
+// Download of the firmware into the OTA partition, kept over deep sleep
+struct FirmwareStreamState
+{
+  char sha256[65];
+  uint32_t partitionAddress;
+  uint32_t size;    // size of the download (firmware or patch), 0 until the first chunk
+  uint32_t offset;  // bytes of the download received
+  uint32_t written; // bytes written to the partition
+  bool patch;        // the download is a patch against the running firmware
+  bool patchRefused; // a patch did not fit, the firmware image is requested
+  bool complete;     // the whole firmware has been written
+  FirmwarePatchState patchState;
+  bool verified;
+  uint32_t checksum;
+};
+
+RTC_DATA_ATTR FirmwareStreamState firmwareStream;
+
+static const esp_partition_t *streamPartition = nullptr;
+static mbedtls_md_context_t streamHash;
+static bool streamActive = false;
+static uint32_t streamErasedEnd = 0;
+static uint32_t streamStartOffset = 0;
+static unsigned long streamStartTime = 0;
+static uint8_t streamBuffer[FIRMWARE_SECTOR_SIZE];
+
+/**
+ * @brief Calculates the checksum of the resume state.
+ * @return uint32_t CRC32 over all fields except the checksum.
+ */
+static uint32_t firmwareStreamChecksum()
+{
+  return esp_rom_crc32_le(0, (const uint8_t *)&firmwareStream, offsetof(FirmwareStreamState, checksum));
+}
+
+/**
+ * @brief Saves the resume state with its checksum.
+ */
+static void saveFirmwareStream()
+{
+  firmwareStream.checksum = firmwareStreamChecksum();
+}
+
+/**
+ * @brief Starts the download of a firmware from the beginning.
+ * @param sha256 SHA-256 of the firmware.
+ * @param partition The partition the firmware is written to.
+ */
+static void resetFirmwareStream(const String &sha256, const esp_partition_t *partition)
+{
+  memset(&firmwareStream, 0, sizeof(firmwareStream));
+  strncpy(firmwareStream.sha256, sha256.c_str(), sizeof(firmwareStream.sha256) - 1);
+  firmwareStream.partitionAddress = partition != nullptr ? partition->address : 0;
+  saveFirmwareStream();
+#if FIRMWARE_SD_COPY
+  ledgerRemoveFile(FIRMWARE_SD_COPY_PATH);
+#endif
+}
+
+/**
+ * @brief Starts the download of the same firmware again.
+ * @param refusePatch true to request the firmware image instead of a patch.
+ */
+static void restartFirmwareStream(bool refusePatch)
+{
+  String sha256 = firmwareStream.sha256;
+  resetFirmwareStream(sha256, streamPartition);
+  firmwareStream.patchRefused = refusePatch;
+  saveFirmwareStream();
+}
+
+/**
+ * @brief Converts a SHA-256 to a hex string.
+ * @param hash The 32 bytes of the hash.
+ * @return String The hash as lower case hex string.
+ */
+static String sha256ToHex(const unsigned char *hash)
+{
+  char hex[65];
+  for (int i = 0; i < 32; i++)
+  {
+    sprintf(hex + 2 * i, "%02x", hash[i]);
+  }
+  return String(hex);
+}
+
+/**
+ * @brief Prepares the download of a firmware into the inactive OTA partition.
+ *
+ * A download of the same firmware that was interrupted continues at its last
+ * written offset: the SHA-256 of the bytes already in the partition is
+ * calculated again, they are not downloaded again.
+ *
+ * @param sha256 SHA-256 of the firmware from hyfive/updateFirmwareSHA256.
+ * @param resumeOffset Receives the offset the deck box sends from.
+ * @param baseSha256 Receives the SHA-256 of the running firmware if a patch can be sent, else an empty string.
+ * @return true if the download can start.
+ */
+bool beginFirmwareStream(const String &sha256, uint32_t &resumeOffset, String &baseSha256)
+{
+  if (streamActive)
+  {
+    mbedtls_md_free(&streamHash);
+    streamActive = false;
+  }
+  streamPartition = esp_ota_get_next_update_partition(NULL);
+  if (streamPartition == nullptr)
+  {
+    Log(LogCategoryGeneral, LogLevelERROR, "Firmware update: no OTA partition");
+    return false;
+  }
+
+  if (firmwareStream.checksum != firmwareStreamChecksum() || sha256 != firmwareStream.sha256 || firmwareStream.partitionAddress != streamPartition->address || firmwareStream.written > streamPartition->size)
+  {
+    resetFirmwareStream(sha256, streamPartition);
+  }
+
+  mbedtls_md_init(&streamHash);
+  mbedtls_md_setup(&streamHash, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 0);
+  mbedtls_md_starts(&streamHash);
+  for (uint32_t position = 0; position < firmwareStream.written; position += sizeof(streamBuffer))
+  {
+    size_t length = min((uint32_t)sizeof(streamBuffer), firmwareStream.written - position);
+    if (esp_partition_read(streamPartition, position, streamBuffer, length) != ESP_OK)
+    {
+      resetFirmwareStream(sha256, streamPartition);
+      mbedtls_md_starts(&streamHash);
+      break;
+    }
+    mbedtls_md_update(&streamHash, streamBuffer, length);
+  }
+
+  // The sector of the write position was erased before its first byte was written
+  streamErasedEnd = (firmwareStream.written + FIRMWARE_SECTOR_SIZE - 1) / FIRMWARE_SECTOR_SIZE * FIRMWARE_SECTOR_SIZE;
+  streamStartOffset = firmwareStream.offset;
+  streamStartTime = millis();
+  streamActive = true;
+  resumeOffset = firmwareStream.offset;
+
+  // A download that has started continues in its format
+  bool patchPossible = firmwareStream.patch || (firmwareStream.offset == 0 && !firmwareStream.patchRefused);
+  baseSha256 = patchPossible ? runningFirmwareSha256() : "";
+  if (resumeOffset > 0)
+  {
+    Log(LogCategoryGeneral, LogLevelINFO, "Firmware update: ", firmwareStream.patch ? "patch" : "download", " continues at ", String(resumeOffset), "/", String(firmwareStream.size), " bytes");
+  }
+  return true;
+}
+
+/**
+ * @brief Writes the next bytes of the firmware to the OTA partition.
+ * @param data The bytes.
+ * @param length Number of bytes.
+ * @return true on success, false on a flash error (the download is stopped).
+ */
+static bool writeFirmwareData(const uint8_t *data, size_t length)
+{
+  uint32_t offset = firmwareStream.written;
+  while (streamErasedEnd < offset + length)
+  {
+    if (esp_partition_erase_range(streamPartition, streamErasedEnd, FIRMWARE_SECTOR_SIZE) != ESP_OK)
+    {
+      Log(LogCategoryGeneral, LogLevelERROR, "Firmware update: erase failed at ", String(streamErasedEnd));
+      streamActive = false;
+      return false;
+    }
+    streamErasedEnd += FIRMWARE_SECTOR_SIZE;
+  }
+  if (length > 0 && esp_partition_write(streamPartition, offset, data, length) != ESP_OK)
+  {
+    Log(LogCategoryGeneral, LogLevelERROR, "Firmware update: write failed at ", String(offset));
+    streamActive = false;
+    return false;
+  }
+  mbedtls_md_update(&streamHash, data, length);
+  firmwareStream.written += length;
+
+#if FIRMWARE_SD_COPY
+  File copy = SD.open(FIRMWARE_SD_COPY_PATH, FILE_APPEND);
+  if (copy)
+  {
+    size_t copySize = copy.size();
+    copy.write(data, length);
+    copy.close();
+    ledgerFileResized(copySize, copySize + length);
+  }
+#endif
+  return true;
+}
+
+/**
+ * @brief Writes a chunk of hyfive/updateFW to the OTA partition, called by the download writer task.
+ *
+ * Chunks that do not start at the current offset are ignored, the download
+ * then continues at the gap with the next request. The first chunk tells
+ * whether the download is a patch or the firmware image.
+ *
+ * @param payload The chunk with FIRMWARE_CHUNK_HEADER_SIZE bytes header.
+ * @param length Length of the chunk.
+ */
+void writeFirmwareChunk(const uint8_t *payload, size_t length)
+{
+  if (!streamActive || length < FIRMWARE_CHUNK_HEADER_SIZE)
+  {
+    return;
+  }
+  uint32_t offset = ((uint32_t)payload[0] << 24) | ((uint32_t)payload[1] << 16) | ((uint32_t)payload[2] << 8) | payload[3];
+  uint32_t size = ((uint32_t)payload[4] << 24) | ((uint32_t)payload[5] << 16) | ((uint32_t)payload[6] << 8) | payload[7];
+  const uint8_t *data = payload + FIRMWARE_CHUNK_HEADER_SIZE;
+  size_t dataLength = length - FIRMWARE_CHUNK_HEADER_SIZE;
+
+  if (firmwareStream.size == 0)
+  {
+    if (size == 0 || size > streamPartition->size)
+    {
+      Log(LogCategoryGeneral, LogLevelERROR, "Firmware update: ", String(size), " bytes do not fit into the OTA partition");
+      streamActive = false;
+      return;
+    }
+    if (offset != 0)
+    {
+      return;
+    }
+    firmwareStream.size = size;
+    firmwareStream.patch = isFirmwarePatch(data, dataLength);
+  }
+  else if (size != firmwareStream.size)
+  {
+    // The deck box sends another file than before (firmware image or patch)
+    Log(LogCategoryGeneral, LogLevelWARNING, "Firmware update: download changed, started again");
+    restartFirmwareStream(firmwareStream.patchRefused);
+    streamActive = false;
+    return;
+  }
+  if (offset != firmwareStream.offset || offset + dataLength > size || firmwareStream.complete)
+  {
+    return;
+  }
+
+  if (firmwareStream.patch)
+  {
+    FirmwarePatchResult result = applyFirmwarePatch(firmwareStream.patchState, data, dataLength, firmwareStream.sha256, streamPartition->size, writeFirmwareData);
+    if (result == FirmwarePatchRejected)
+    {
+      if (streamActive)
+      {
+        // Not a flash error: the firmware image is requested instead
+        restartFirmwareStream(true);
+        streamActive = false;
+      }
+      return;
+    }
+    firmwareStream.complete = result == FirmwarePatchComplete;
+  }
+  else
+  {
+    if (!writeFirmwareData(data, dataLength))
+    {
+      return;
+    }
+    firmwareStream.complete = firmwareStream.written == size;
+  }
+  firmwareStream.offset += dataLength;
+  saveFirmwareStream();
+}
+
+/**
+ * @brief Ends a download when no more chunks arrive and checks the SHA-256.
+ * @return FirmwareStreamResult Verified if the whole firmware has been received and its SHA-256 matches.
+ */
+FirmwareStreamResult finishFirmwareStream()
+{
+  if (!streamActive && firmwareStream.size == 0)
+  {
+    mbedtls_md_free(&streamHash);
+    return FirmwareStreamFailed;
+  }
+  bool writeError = !streamActive;
+  streamActive = false;
+
+  unsigned long elapsed = max(millis() - streamStartTime, 1UL);
+  uint32_t received = firmwareStream.offset - streamStartOffset;
+  if (!writeError && firmwareStream.patch && firmwareStream.offset == firmwareStream.size && !firmwareStream.complete)
+  {
+    mbedtls_md_free(&streamHash);
+    Log(LogCategoryGeneral, LogLevelERROR, "Firmware update: patch ends before the firmware");
+    restartFirmwareStream(true);
+    return FirmwareStreamFailed;
+  }
+  if (writeError || !firmwareStream.complete)
+  {
+    mbedtls_md_free(&streamHash);
+    Log(LogCategoryGeneral, LogLevelWARNING, "Firmware update: download interrupted at ", String(firmwareStream.offset), "/", String(firmwareStream.size), " bytes | ", String(received), " bytes in ", String(elapsed), " ms");
+    return FirmwareStreamIncomplete;
+  }
+
+  unsigned char hash[32];
+  mbedtls_md_finish(&streamHash, hash);
+  mbedtls_md_free(&streamHash);
+  String calculatedHash = sha256ToHex(hash);
+  if (calculatedHash != firmwareStream.sha256)
+  {
+    Log(LogCategoryGeneral, LogLevelERROR, "Firmware update: SHA-256 mismatch ", calculatedHash, " / ", String(firmwareStream.sha256));
+    restartFirmwareStream(firmwareStream.patch);
+    return FirmwareStreamFailed;
+  }
+
+  firmwareStream.verified = true;
+  saveFirmwareStream();
+  String source = firmwareStream.patch ? " from a patch of " + String(firmwareStream.size) + " bytes" : "";
+  Log(LogCategoryGeneral, LogLevelINFO, "Firmware update: ", String(firmwareStream.written), " bytes verified", source, " | ", String(received), " bytes in ", String(elapsed), " ms | ", String(received / elapsed), " kB/s");
+  return FirmwareStreamVerified;
+}
+
+/**
+ * @brief Boots the streamed firmware if it has been verified.
+ * @return false if there is no verified firmware or the partition could not be activated.
+ */
+static bool applyFirmwareStream()
+{
+  if (firmwareStream.checksum != firmwareStreamChecksum() || !firmwareStream.verified)
+  {
+    return false;
+  }
+  const esp_partition_t *partition = esp_ota_get_next_update_partition(NULL);
+  bool samePartition = partition != nullptr && partition->address == firmwareStream.partitionAddress;
+  String sha256 = firmwareStream.sha256;
+
+  // The firmware is activated once, a failure starts the download again
+  memset(&firmwareStream, 0, sizeof(firmwareStream));
+  saveFirmwareStream();
+
+  // Also checks the image in the partition
+  esp_err_t error = samePartition ? esp_ota_set_boot_partition(partition) : ESP_ERR_NOT_FOUND;
+  if (error != ESP_OK)
+  {
+    Log(LogCategoryGeneral, LogLevelERROR, "Firmware update: partition could not be activated: ", String(esp_err_to_name(error)));
+    return false;
+  }
+
+  File hashFile = SD.open("/updateFW/current_firmware.sha256", FILE_WRITE);
+  if (hashFile)
+  {
+    hashFile.print(sha256);
+    hashFile.close();
+  }
+  Log(LogCategoryGeneral, LogLevelINFO, "Firmware update successful, restart");
+  delay(1000);
+  flushLogBeforeSleep();
+  ESP.restart();
+  return true;
+}
+
 /**
  * @brief Calculates the SHA-256 hash of the firmware file.
  */
@@ -57,15 +432,24 @@ String calculateCurrentHash()
 }
 
 /**
- * @brief Updates the firmware from a file on the SD card.
+ * @brief Boots a verified streamed firmware, or updates the firmware from a file on the SD card.
  */
 void updateFirmware()
 {
+  if (applyFirmwareStream())
+  {
+    return;
+  }
+
   if (SD.exists("/updateFW/firmware.bin"))
   {
     File updateFile = SD.open("/updateFW/firmware.bin");
     if (updateFile)
     {
+      // The file is written to the same partition as a streamed download
+      memset(&firmwareStream, 0, sizeof(firmwareStream));
+      saveFirmwareStream();
+
       if (Update.begin(updateFile.size()))
       {
         size_t written = Update.writeStream(updateFile);
@@ -89,40 +473,41 @@ void updateFirmware()
         else
         {
           Serial.println("Firmware update failed!");
-          SD.remove("/updateFW/firmware.bin");
+          ledgerRemoveFile("/updateFW/firmware.bin");
         }
         if (Update.end())
         {
           if (Update.isFinished())
           {
             updateFile.close();
-            SD.remove("/updateFW/firmware.bin");
+            ledgerRemoveFile("/updateFW/firmware.bin");
             delay(1000);
+            flushLogBeforeSleep();
             ESP.restart();
           }
           else
           {
             Serial.println("Update not completed. Error!");
-            SD.remove("/updateFW/firmware.bin");
+            ledgerRemoveFile("/updateFW/firmware.bin");
           }
         }
         else
         {
           Serial.printf("Error when ending the update");
-          SD.remove("/updateFW/firmware.bin");
+          ledgerRemoveFile("/updateFW/firmware.bin");
         }
       }
       else
       {
         Serial.printf("Not enough memory for the update.");
-        SD.remove("/updateFW/firmware.bin");
+        ledgerRemoveFile("/updateFW/firmware.bin");
       }
       updateFile.close();
     }
     else
     {
       Serial.println("Error opening the firmware file.");
-      SD.remove("/updateFW/firmware.bin");
+      ledgerRemoveFile("/updateFW/firmware.bin");
     }
   }
 }
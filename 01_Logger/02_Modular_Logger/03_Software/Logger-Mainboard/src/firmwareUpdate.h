@@ -12,7 +12,26 @@
 #ifndef FIRMWAREUPDATE_H
 #define FIRMWAREUPDATE_H
 
+#include <Arduino.h>
+
+// Header of a chunk on hyfive/updateFW: offset and size of the download, firmware or patch (uint32_t each, big endian)
+#define FIRMWARE_CHUNK_HEADER_SIZE 8
+
+// 1: the streamed firmware is also written to FIRMWARE_SD_COPY_PATH
+#define FIRMWARE_SD_COPY 0
+#define FIRMWARE_SD_COPY_PATH "/updateFW/downloaded_firmware.bin"
+
+enum FirmwareStreamResult
+{
+  FirmwareStreamIncomplete = 0, // link lost, continued with the next request
+  FirmwareStreamVerified,       // complete and SHA-256 matches
+  FirmwareStreamFailed          // SHA-256 mismatch or flash error, started again
+};
+
 void updateFirmware();
 bool calculateSha256(String received_sha256);
+bool beginFirmwareStream(const String &sha256, uint32_t &resumeOffset, String &baseSha256);
+void writeFirmwareChunk(const uint8_t *payload, size_t length);
+FirmwareStreamResult finishFirmwareStream();
 
-#endif
\ No newline at end of file
+#endif
@@ -209,6 +209,11 @@ void configureBasicSettingsFromJson()
   configRTC.dry_det_threshold = doc["dry_det_threshold"];
   configRTC.dry_det_verify_delay = doc["dry_det_verify_delay"];
   configRTC.data_upload_retry_periode = doc["data_upload_retry_periode"];
+  configRTC.upload_batch_size = doc["upload_batch_size"] | 0;
+  configRTC.upload_window = doc["upload_window"] | 0;
+  configRTC.upload_bulk_chunk_size = doc["upload_bulk_chunk_size"] | 0;
+  configRTC.upload_http_port = doc["upload_http_port"] | 0;
+  configRTC.upload_series_encoding = doc["upload_series_encoding"] | 0;
   config.deckunit_id = doc["deckunit_id"];
   config.platform_id = doc["platform_id"];
   config.vessel_id = doc["vessel_id"];
@@ -18,6 +18,9 @@
 // Maximum number of WIFI SENSORs
 #define MAX_WIFI_CREDENTIALS 5
 
+// Size of the parameter name of a sensor including the terminating '\0'
+#define SENSOR_PARAMETER_SIZE 46
+
 typedef struct
 {
   float calib_coeff_1;
@@ -60,7 +63,7 @@ typedef struct
   uint8_t sample_periode_multiplier;
   uint8_t sample_cast_periode_multiplier;
   uint8_t bus_address;
-  char parameter[46];
+  char parameter[SENSOR_PARAMETER_SIZE];
   uint8_t parameter_no;
 } SensorRTC;
 
@@ -88,6 +91,11 @@ typedef struct
   float dry_det_threshold;
   uint16_t dry_det_verify_delay;
   uint16_t data_upload_retry_periode;
+  uint16_t upload_batch_size;
+  uint8_t upload_window;
+  uint16_t upload_bulk_chunk_size;
+  uint16_t upload_http_port;
+  uint8_t upload_series_encoding;
   SensorRTC sensor[MAX_SENSOR_CREDENTIALS];
   WifiConfigRTC wificonfig[MAX_WIFI_CREDENTIALS];
 } LoggerConfigRTC;
@@ -11,8 +11,10 @@
 
 #include <ArduinoJson.h>
 
+#include "BulkTransfer.h"
 #include "DebuggingSDLog.h"
 #include "MQTTManager.h"
+#include "MqttPipeline.h"
 #include "SDCard.h"
 #include "SystemVariables.h"
 #include "Utility.h"
@@ -464,6 +466,11 @@ void validateBasicConfiguration()
   validateNumericValue(docValidation, "dry_det_threshold", 0, 65535);
   validateNumericValue(docValidation, "dry_det_verify_delay", 0, 65535);
   validateNumericValue(docValidation, "data_upload_retry_periode", 0, 65535);
+  validateNumericValue(docValidation, "upload_batch_size", 0, MQTT_BATCH_MAX_PAYLOAD);
+  validateNumericValue(docValidation, "upload_window", 0, MQTT_PIPELINE_MAX_WINDOW);
+  validateNumericValue(docValidation, "upload_bulk_chunk_size", 0, BULK_MAX_CHUNK_SIZE);
+  validateNumericValue(docValidation, "upload_http_port", 0, 65535);
+  validateNumericValue(docValidation, "upload_series_encoding", 0, 1);
   validateNumericValue(docValidation, "deckunit_id", 0, 65535);
   validateNumericValue(docValidation, "platform_id", 0, 65535);
   validateNumericValue(docValidation, "vessel_id", 0, 65535);
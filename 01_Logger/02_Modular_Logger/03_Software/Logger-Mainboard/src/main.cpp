@@ -12,6 +12,7 @@
 #include <Arduino.h>
 
 #include "BMS.h"
+#include "ConfigManifest.h"
 #include "DS3231TimeNtp.h"
 #include "DebuggingSDLog.h"
 #include "DeepSleep.h"
@@ -19,6 +20,7 @@
 #include "MQTTManager.h"
 #include "SDCard.h"
 #include "SensorManagement.h"
+#include "SpaceLedger.h"
 #include "SystemVariables.h"
 #include "Utility.h"
 
@@ -29,6 +31,8 @@ void setup()
   initializeLogger();
   initBmsAndRtc();
   initializeSdCard();
+  startLogWriterTask();
+  syncSpaceLedgerIfDue(); //* Full SD card scan only after a cold boot or once per week
   //programBms(); //* Optional (should only be activated if you want to program BMS, reason: BMS and RTC would use the interface at the same time!)
   performFirstBootOperations();
 }
@@ -46,17 +50,21 @@ void loop()
   //* time elapsed since the last run of the loop is added to the previous total time.
   totalElapsedTime += difftime(getCurrentTimeFromRTC(), currentTimeNow);
 
+  //* While the deck box publishes the config manifest, the config is only requested when it changes
+  uint32_t configPollPeriode = configUpdatePollPeriode(config_update_periode);
+
   //* Execution of the various periodic actions
   wetDetPeriodeFunktion(wet_det_periode);
   statusUploadPeriodeFunktion(status_upload_periode);
-  configUpdatePeriodeFunktion(config_update_periode);
+  configUpdatePeriodeFunktion(configPollPeriode);
   dataUploadRetryPeriodeFunktion(data_upload_retry_periode);
 
   //* Determines the largest number from a series of time periods to restart the time loop
-  resetTimePeriodeLoop(config_update_periode, status_upload_periode, wet_det_periode, data_upload_retry_periode);
+  resetTimePeriodeLoop(configPollPeriode, status_upload_periode, wet_det_periode, data_upload_retry_periode);
 
   //* Calculation of the minimum waiting time
-  minTimeUntilNextFunction = calculateShortestWaitTime(totalElapsedTime, lastConfigUpdateTime, lastStatusUploadTime, lastWetDetectionUploadTime, lastDataUploadRetryTime, isDataUploadRetryEnabled, config_update_periode, status_upload_periode, wet_det_periode, data_upload_retry_periode);
+  minTimeUntilNextFunction = calculateShortestWaitTime(totalElapsedTime, lastConfigUpdateTime, lastStatusUploadTime, lastWetDetectionUploadTime, lastDataUploadRetryTime, isDataUploadRetryEnabled, configPollPeriode, status_upload_periode, wet_det_periode, data_upload_retry_periode);
+  minTimeUntilNextFunction = limitSleepToUploadAttempt(minTimeUntilNextFunction);
 
   //* Deep Sleep
   //* The variable currentTimeNow = getCurrentTimeFromRTC(); updates the variable currentTimeNow with the
@@ -66,5 +74,6 @@ void loop()
   interfaceSleep();
   currentTimeNow = getCurrentTimeFromRTC();
   esp_sleep_enable_timer_wakeup((minTimeUntilNextFunction) * 1000000);
+  flushLogBeforeSleep();
   esp_deep_sleep_start();
 }
\ No newline at end of file
@@ -7,78 +7,86 @@
  * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
  *
  * Description: Sample casting and analysis functions
+ *
+ * The last sampleCastIntervals + 1 values of the cast detection sensor are
+ * kept in a circular buffer in RTC memory. Running sums allow the
+ * least-squares rate over the window to be updated in O(1) per sample.
  */
 
-#include <SD.h>
-#include <vector>
-
 #include "DebuggingSDLog.h"
 #include "SystemVariables.h"
 #include "loggerConfig.h"
 #include "sample_cast.h"
 
+// Circular buffer of the cast detection window
+struct CastWindow
+{
+  uint32_t origin; // time of the first sample, keeps the sums small
+  uint8_t head;    // index of the oldest sample
+  uint8_t count;
+  uint32_t time[CAST_WINDOW_MAX];
+  float pressure[CAST_WINDOW_MAX];
+  double sumT;
+  double sumP;
+  double sumTT;
+  double sumTP;
+};
+
+RTC_DATA_ATTR CastWindow castWindow;
+
 /**
- * @brief Keeps the latest sample cast lines in the file.
+ * @brief Gets the number of samples used for the rate.
+ * @return uint8_t The window size.
  */
-void keepLatestSampleCastLines()
+static uint8_t castWindowSize()
 {
-  const char *filePath = "/measurements/sample_cast.txt";
-  int maxLines = sampleCastIntervals + 10;
-  int linesToKeep = sampleCastIntervals + 5;
-
-  File file = SD.open(filePath, FILE_READ);
-  if (!file)
-  {
-    Serial.println("Error opening the file.");
-    return;
-  }
-
-  // Count the lines
-  int lineCount = 0;
-  long fileSize = file.size();
-  long positions[linesToKeep] = {0};
-
-  for (long i = fileSize - 1; i >= 0; i--)
-  {
-    file.seek(i);
-    if (file.read() == '\n' || i == 0)
-    {
-      lineCount++;
-      if (lineCount <= linesToKeep)
-      {
-        positions[linesToKeep - lineCount] = (i == 0 && lineCount > 1) ? 0 : i + 1;
-      }
-    }
-  }
+  return constrain(sampleCastIntervals + 1, 2, CAST_WINDOW_MAX);
+}
 
-  // If sampleCastIntervals + 1 or less lines, nothing to do
-  if (lineCount <= maxLines)
-  {
-    file.close();
-    return;
-  }
+/**
+ * @brief Clears the cast detection window, called at the start of a deployment.
+ */
+void resetCastDetector()
+{
+  memset(&castWindow, 0, sizeof(castWindow));
+}
 
-  // Save the last lines
-  String lastLines = "";
-  file.seek(positions[0]);
-  while (file.available())
+/**
+ * @brief Adds a value of the cast detection sensor to the window.
+ * @param time Unix time of the measurement.
+ * @param pressure Measured value.
+ */
+void addCastSample(uint32_t time, float pressure)
+{
+  if (castWindow.count == 0)
   {
-    lastLines += (char)file.read();
+    castWindow.origin = time;
   }
-  file.close();
 
-  file = SD.open(filePath, FILE_WRITE);
-  if (!file)
+  uint8_t windowSize = castWindowSize();
+  while (castWindow.count >= windowSize)
   {
-    Log(LogCategorySDCard, LogLevelERROR, "sample_cast.txt, Error opening the file.");
-    return;
+    // Remove the oldest sample from the sums
+    double t = (double)castWindow.time[castWindow.head] - castWindow.origin;
+    double p = castWindow.pressure[castWindow.head];
+    castWindow.sumT -= t;
+    castWindow.sumP -= p;
+    castWindow.sumTT -= t * t;
+    castWindow.sumTP -= t * p;
+    castWindow.head = (castWindow.head + 1) % CAST_WINDOW_MAX;
+    castWindow.count--;
   }
 
-  // Write the last lines back into the file
-  file.print(lastLines);
-  file.close();
+  uint8_t index = (castWindow.head + castWindow.count) % CAST_WINDOW_MAX;
+  castWindow.time[index] = time;
+  castWindow.pressure[index] = pressure;
+  castWindow.count++;
 
-  Log(LogCategorySDCard, LogLevelDEBUG, "File has been updated. Only the last lines were kept.");
+  double t = (double)time - castWindow.origin;
+  castWindow.sumT += t;
+  castWindow.sumP += pressure;
+  castWindow.sumTT += t * t;
+  castWindow.sumTP += t * pressure;
 }
 
 /**
@@ -92,80 +100,23 @@ bool performSampleCast()
     return true;
   }
 
-  const char *filePath = "/measurements/sample_cast.txt";
-
-  File file = SD.open(filePath, FILE_READ);
-  if (!file)
-  {
-    Serial.println("Error opening the file.");
-    Log(LogCategoryGeneral, LogLevelERROR, "Error opening the file. SampleCast");
-    return false;
-  }
-
-  // Log entries
-  std::vector<LogEntry> entries;
-  while (file.available())
-  {
-    String line = file.readStringUntil('\n');
-    int commaIndex = line.indexOf(',');
-    if (commaIndex != -1)
-    {
-      // Extracts the timestamp and print value from the line
-      long timestamp = line.substring(0, commaIndex).toInt();
-      int pressure = line.substring(commaIndex + 1).toInt(); // Skip comma and space
-      entries.push_back({String(timestamp), pressure});
-    }
-  }
-  file.close();
-  keepLatestSampleCastLines();
-
   // Check whether at least sampleCastIntervals + 1 entries are present
-  if (entries.size() < sampleCastIntervals + 1)
+  if (castWindow.count < castWindowSize())
   {
-    Serial.println("Not enough data available for the calculation.");
+    Log(LogCategorySensors, LogLevelDEBUG, "Not enough data available for the calculation.");
     return true;
   }
 
-  // Calculate the average speed of the pressure change over the last sampleCastIntervals lines
-  long startTime = entries[entries.size() - sampleCastIntervals - 1].time.toInt();
-  long endTime = entries[entries.size() - 1].time.toInt();
-  double timeDiff = abs(endTime - startTime);
-
-  int startPressure = entries[entries.size() - sampleCastIntervals - 1].pressure;
-  int endPressure = entries[entries.size() - 1].pressure;
-  double pressureChange = abs(endPressure - startPressure);
-
+  // Least-squares slope of pressure over time
+  double n = castWindow.count;
+  double denominator = n * castWindow.sumTT - castWindow.sumT * castWindow.sumT;
   double castAverageSpeed = 0;
-  if (timeDiff > 0)
+  if (denominator > 0)
   {
-    castAverageSpeed = pressureChange / timeDiff;
+    castAverageSpeed = fabs((n * castWindow.sumTP - castWindow.sumT * castWindow.sumP) / denominator);
   }
 
-  // Output of the formula with the actual values
-  String formula = "castAverageSpeed = abs((" + String(endPressure) + " - " + String(startPressure) + ") / (" + String(endTime) + " - " + String(startTime) + "))";
-  Log(LogCategoryGeneral, LogLevelDEBUG, "Formel: ", formula);
   Log(LogCategorySensors, LogLevelDEBUG, "Average speed of the last sampleCastIntervals rows: ", String(castAverageSpeed, 2), " Units/s");
 
-  if (castAverageSpeed > configRTC.cast_det_sensor_threshold)
-  {
-    return true;
-  }
-  else
-  {
-    return false;
-  }
+  return castAverageSpeed > configRTC.cast_det_sensor_threshold;
 }
-
-/**
- * @brief Creates or clears the sample file.
- */
-void createOrClearSampleFile()
-{
-  File file = SD.open("/measurements/sample_cast.txt", FILE_WRITE);
-  if (!file)
-  {
-    Serial.println("Error when creating the file.");
-  }
-  file.close();
-  Serial.println("File 'sample_cast.txt' created.");
-}
\ No newline at end of file
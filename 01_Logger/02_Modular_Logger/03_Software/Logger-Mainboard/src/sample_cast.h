@@ -12,15 +12,14 @@
 #ifndef SAMPLE_CAST_H
 #define SAMPLE_CAST_H
 
-// Data structure for log entries
-struct LogEntry
-{
-  String time;
-  int pressure;
-};
+#include <Arduino.h>
 
-void createOrClearSampleFile();
+// Maximum number of samples in the cast detection window
+#define CAST_WINDOW_MAX 32
+
+void resetCastDetector();
+void addCastSample(uint32_t time, float pressure);
 
 bool performSampleCast();
 
-#endif
\ No newline at end of file
+#endif
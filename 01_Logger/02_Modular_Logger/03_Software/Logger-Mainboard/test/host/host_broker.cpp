@@ -0,0 +1,41 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: The HostBroker of the host tests as a program for the tools
+ *
+ * Prints "port <port>" once the broker listens on the loopback interface and
+ * runs until its standard input is closed, e.g. by Tools/upload_fleet.py
+ * --host-broker, which thereby uses the broker of test_deckbox_load on a
+ * port of its own process.
+ */
+
+#include <poll.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "HostBroker.h"
+
+int main()
+{
+  HostBroker broker;
+  printf("port %u\n", broker.port());
+  fflush(stdout);
+
+  struct pollfd input = {STDIN_FILENO, POLLIN, 0};
+  char buffer[64];
+  while (true)
+  {
+    // The messages of the clients are only kept for the tests
+    broker.clearReceived();
+    if (poll(&input, 1, 1000) > 0 && read(STDIN_FILENO, buffer, sizeof(buffer)) <= 0)
+    {
+      break;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,489 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Host stand-in for the Arduino core of the ESP32, used by the host build in test/host
+ */
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+
+using std::max;
+using std::min;
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define RTC_DATA_ATTR
+#define RTC_NOINIT_ATTR
+#define IRAM_ATTR
+
+#define DEC 10
+#define HEX 16
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+#if defined(__GLIBC__) && (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38)
+inline size_t strlcpy(char *destination, const char *source, size_t size)
+{
+  size_t length = strlen(source);
+  if (size > 0)
+  {
+    size_t count = length < size - 1 ? length : size - 1;
+    memcpy(destination, source, count);
+    destination[count] = 0;
+  }
+  return length;
+}
+#endif
+
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void yield();
+uint32_t esp_random();
+int64_t esp_timer_get_time();
+
+// Critical sections of FreeRTOS, recursive like on the ESP32
+struct portMUX_TYPE
+{
+  std::recursive_mutex mutex;
+};
+
+#define portMUX_INITIALIZER_UNLOCKED {}
+#define taskENTER_CRITICAL(mux) (mux)->mutex.lock()
+#define taskEXIT_CRITICAL(mux) (mux)->mutex.unlock()
+#define portENTER_CRITICAL(mux) taskENTER_CRITICAL(mux)
+#define portEXIT_CRITICAL(mux) taskEXIT_CRITICAL(mux)
+
+// Queues, semaphores and tasks of FreeRTOS, a tick is 1 ms and a task is a thread
+typedef int BaseType_t;
+typedef uint32_t TickType_t;
+typedef void (*TaskFunction_t)(void *);
+typedef struct HostQueue *QueueHandle_t;
+typedef struct HostQueue *SemaphoreHandle_t;
+typedef struct HostTask *TaskHandle_t;
+#define pdTRUE 1
+#define pdFALSE 0
+#define portMAX_DELAY 0xFFFFFFFFUL
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+QueueHandle_t xQueueCreate(uint32_t length, uint32_t itemSize);
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks);
+SemaphoreHandle_t xSemaphoreCreateCounting(uint32_t maxCount, uint32_t initialCount);
+SemaphoreHandle_t xSemaphoreCreateMutex();
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name, uint32_t stackSize, void *parameter, uint32_t priority, TaskHandle_t *handle, BaseType_t core);
+
+class String
+{
+public:
+  String() {}
+  String(const char *value) : data(value ? value : "") {}
+  String(const char *value, size_t length) : data(value, length) {}
+  String(const std::string &value) : data(value) {}
+  explicit String(char value) : data(1, value) {}
+  String(int value, unsigned char base = 10) : data(formatInteger((long long)value, base)) {}
+  String(unsigned int value, unsigned char base = 10) : data(formatInteger((unsigned long long)value, base)) {}
+  String(long value, unsigned char base = 10) : data(formatInteger((long long)value, base)) {}
+  String(unsigned long value, unsigned char base = 10) : data(formatInteger((unsigned long long)value, base)) {}
+  String(long long value, unsigned char base = 10) : data(formatInteger(value, base)) {}
+  String(unsigned long long value, unsigned char base = 10) : data(formatInteger(value, base)) {}
+  String(float value, unsigned int decimalPlaces = 2) : data(formatFloat(value, decimalPlaces)) {}
+  String(double value, unsigned int decimalPlaces = 2) : data(formatFloat(value, decimalPlaces)) {}
+
+  const char *c_str() const { return data.c_str(); }
+  unsigned int length() const { return data.length(); }
+  bool isEmpty() const { return data.empty(); }
+  bool reserve(unsigned int size)
+  {
+    data.reserve(size);
+    return true;
+  }
+
+  bool concat(const String &value)
+  {
+    data += value.data;
+    return true;
+  }
+  bool concat(const char *value)
+  {
+    data += value ? value : "";
+    return true;
+  }
+  bool concat(const char *value, unsigned int length)
+  {
+    data.append(value, length);
+    return true;
+  }
+  bool concat(char value)
+  {
+    data += value;
+    return true;
+  }
+  template <typename T>
+  bool concat(T value)
+  {
+    return concat(String(value));
+  }
+
+  template <typename T>
+  String &operator+=(const T &value)
+  {
+    concat(value);
+    return *this;
+  }
+
+  char charAt(unsigned int index) const { return index < data.length() ? data[index] : 0; }
+  char operator[](unsigned int index) const { return charAt(index); }
+  char &operator[](unsigned int index) { return data[index]; }
+
+  bool equals(const String &other) const { return data == other.data; }
+  bool equalsIgnoreCase(const String &other) const
+  {
+    String a = *this;
+    String b = other;
+    a.toLowerCase();
+    b.toLowerCase();
+    return a.data == b.data;
+  }
+  bool operator==(const String &other) const { return data == other.data; }
+  bool operator==(const char *other) const { return data == (other ? other : ""); }
+  bool operator!=(const String &other) const { return data != other.data; }
+  bool operator!=(const char *other) const { return !(*this == other); }
+  bool operator<(const String &other) const { return data < other.data; }
+  bool operator>(const String &other) const { return data > other.data; }
+  int compareTo(const String &other) const { return data.compare(other.data); }
+
+  bool startsWith(const String &prefix) const { return data.compare(0, prefix.data.length(), prefix.data) == 0; }
+  bool endsWith(const String &suffix) const
+  {
+    return data.length() >= suffix.data.length() && data.compare(data.length() - suffix.data.length(), suffix.data.length(), suffix.data) == 0;
+  }
+
+  int indexOf(char value, unsigned int from = 0) const { return toIndex(data.find(value, from)); }
+  int indexOf(const String &value, unsigned int from = 0) const { return toIndex(data.find(value.data, from)); }
+  int lastIndexOf(char value) const { return toIndex(data.rfind(value)); }
+  int lastIndexOf(const String &value) const { return toIndex(data.rfind(value.data)); }
+
+  String substring(unsigned int from) const { return from < data.length() ? String(data.substr(from)) : String(); }
+  String substring(unsigned int from, unsigned int to) const
+  {
+    if (from > to)
+    {
+      std::swap(from, to);
+    }
+    if (from >= data.length())
+    {
+      return String();
+    }
+    return String(data.substr(from, std::min<size_t>(to, data.length()) - from));
+  }
+
+  void trim()
+  {
+    size_t start = data.find_first_not_of(" \t\r\n");
+    size_t end = data.find_last_not_of(" \t\r\n");
+    data = start == std::string::npos ? std::string() : data.substr(start, end - start + 1);
+  }
+  void toLowerCase()
+  {
+    for (char &c : data)
+    {
+      c = tolower((unsigned char)c);
+    }
+  }
+  void toUpperCase()
+  {
+    for (char &c : data)
+    {
+      c = toupper((unsigned char)c);
+    }
+  }
+  void replace(const String &find, const String &replacement)
+  {
+    if (find.data.empty())
+    {
+      return;
+    }
+    size_t position = 0;
+    while ((position = data.find(find.data, position)) != std::string::npos)
+    {
+      data.replace(position, find.data.length(), replacement.data);
+      position += replacement.data.length();
+    }
+  }
+  void remove(unsigned int index) { data.erase(std::min<size_t>(index, data.length())); }
+  void remove(unsigned int index, unsigned int count) { data.erase(std::min<size_t>(index, data.length()), count); }
+
+  long toInt() const { return strtol(data.c_str(), nullptr, 10); }
+  float toFloat() const { return strtof(data.c_str(), nullptr); }
+  double toDouble() const { return strtod(data.c_str(), nullptr); }
+
+  void toCharArray(char *buffer, unsigned int size, unsigned int index = 0) const { getBytes((unsigned char *)buffer, size, index); }
+  void getBytes(unsigned char *buffer, unsigned int size, unsigned int index = 0) const
+  {
+    if (size == 0)
+    {
+      return;
+    }
+    size_t count = index < data.length() ? std::min<size_t>(size - 1, data.length() - index) : 0;
+    memcpy(buffer, data.data() + std::min<size_t>(index, data.length()), count);
+    buffer[count] = 0;
+  }
+
+private:
+  std::string data;
+
+  static int toIndex(size_t position) { return position == std::string::npos ? -1 : (int)position; }
+
+  static std::string formatInteger(long long value, unsigned char base)
+  {
+    if (value < 0 && base == 10)
+    {
+      return "-" + formatInteger((unsigned long long)(-value), base);
+    }
+    return formatInteger((unsigned long long)value, base);
+  }
+
+  static std::string formatInteger(unsigned long long value, unsigned char base)
+  {
+    const char digits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+    std::string text;
+    do
+    {
+      text.insert(text.begin(), digits[value % base]);
+      value /= base;
+    } while (value != 0);
+    return text;
+  }
+
+  // dtostrf() of the ESP32 core: rounded by adding half a digit, no '-' for -0.0
+  static std::string formatFloat(double value, unsigned int decimalPlaces)
+  {
+    if (std::isnan(value))
+    {
+      return "nan";
+    }
+    if (std::isinf(value))
+    {
+      return "inf";
+    }
+    std::string text;
+    if (value < 0.0)
+    {
+      text += '-';
+      value = -value;
+    }
+    double rounding = 2.0;
+    for (unsigned int i = 0; i < decimalPlaces; i++)
+    {
+      rounding *= 10.0;
+    }
+    value += 1.0 / rounding;
+
+    double tenpow = 1.0;
+    int digitCount = 1;
+    while (value >= 10.0 * tenpow)
+    {
+      tenpow *= 10.0;
+      digitCount++;
+    }
+    value /= tenpow;
+    digitCount += decimalPlaces;
+    while (digitCount-- > 0)
+    {
+      int digit = std::min((int)value, 9);
+      text += (char)('0' + digit);
+      if (digitCount == (int)decimalPlaces && decimalPlaces > 0)
+      {
+        text += '.';
+      }
+      value -= digit;
+      value *= 10.0;
+    }
+    return text;
+  }
+};
+
+inline String operator+(const String &left, const String &right)
+{
+  String result = left;
+  result.concat(right);
+  return result;
+}
+
+inline String operator+(const String &left, const char *right)
+{
+  String result = left;
+  result.concat(right);
+  return result;
+}
+
+inline String operator+(const char *left, const String &right)
+{
+  String result(left);
+  result.concat(right);
+  return result;
+}
+
+template <typename T>
+inline String operator+(const String &left, T right)
+{
+  String result = left;
+  result.concat(right);
+  return result;
+}
+
+class Print
+{
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t value) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size)
+  {
+    size_t written = 0;
+    while (size-- > 0 && write(*buffer++) == 1)
+    {
+      written++;
+    }
+    return written;
+  }
+  size_t write(const char *text) { return text ? write((const uint8_t *)text, strlen(text)) : 0; }
+  size_t write(const char *buffer, size_t size) { return write((const uint8_t *)buffer, size); }
+
+  size_t print(const String &value) { return write((const uint8_t *)value.c_str(), value.length()); }
+  size_t print(const char *value) { return write(value); }
+  size_t print(char value) { return write((uint8_t)value); }
+  template <typename T>
+  size_t print(T value) { return print(String(value)); }
+  size_t println() { return write("\r\n"); }
+  template <typename T>
+  size_t println(T value) { return print(value) + println(); }
+  size_t printf(const char *format, ...)
+  {
+    char text[512];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    return length > 0 ? write((const uint8_t *)text, std::min<size_t>(length, sizeof(text) - 1)) : 0;
+  }
+  virtual void flush() {}
+};
+
+class Stream : public Print
+{
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+
+  void setTimeout(unsigned long timeout) { streamTimeout = timeout; }
+
+  size_t readBytes(uint8_t *buffer, size_t length)
+  {
+    size_t count = 0;
+    while (count < length)
+    {
+      int c = timedRead();
+      if (c < 0)
+      {
+        break;
+      }
+      buffer[count++] = (uint8_t)c;
+    }
+    return count;
+  }
+  size_t readBytes(char *buffer, size_t length) { return readBytes((uint8_t *)buffer, length); }
+
+  size_t readBytesUntil(char terminator, char *buffer, size_t length)
+  {
+    size_t count = 0;
+    while (count < length)
+    {
+      int c = timedRead();
+      if (c < 0 || c == terminator)
+      {
+        break;
+      }
+      buffer[count++] = (char)c;
+    }
+    return count;
+  }
+
+  String readStringUntil(char terminator)
+  {
+    std::string text;
+    int c = timedRead();
+    while (c >= 0 && c != terminator)
+    {
+      text += (char)c;
+      c = timedRead();
+    }
+    return String(text);
+  }
+
+  String readString()
+  {
+    std::string text;
+    int c = timedRead();
+    while (c >= 0)
+    {
+      text += (char)c;
+      c = timedRead();
+    }
+    return String(text);
+  }
+
+protected:
+  unsigned long streamTimeout = 1000;
+
+  virtual int timedRead()
+  {
+    unsigned long start = millis();
+    do
+    {
+      int c = read();
+      if (c >= 0)
+      {
+        return c;
+      }
+      yield();
+    } while (millis() - start < streamTimeout);
+    return -1;
+  }
+};
+
+// Serial output is discarded unless HYFIVE_HOST_VERBOSE is set
+class HostSerial : public Stream
+{
+public:
+  void begin(unsigned long) {}
+  size_t write(uint8_t value) override;
+  size_t write(const uint8_t *buffer, size_t size) override;
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+  operator bool() const { return true; }
+};
+
+extern HostSerial Serial;
+
+#endif
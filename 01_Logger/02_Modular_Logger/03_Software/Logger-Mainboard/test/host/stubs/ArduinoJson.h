@@ -0,0 +1,1164 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Host stand-in for ArduinoJson 6, used by the host build in test/host
+ *
+ * Covers the part of the library the firmware uses: documents, objects and
+ * arrays with the members in insertion order, deserializeJson() with filter
+ * and serializeJson()/measureJson() with the output of ArduinoJson (no
+ * spaces, the same string escapes). The capacity of a document is not
+ * checked, a document never reports NoMemory.
+ */
+
+#ifndef HOST_ARDUINOJSON_H
+#define HOST_ARDUINOJSON_H
+
+#include <Arduino.h>
+#include <cerrno>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+struct HostJsonNode
+{
+  enum Type
+  {
+    Null,
+    Boolean,
+    Integer,
+    Real,
+    Text,
+    Array,
+    Object
+  } type = Null;
+  bool boolean = false;
+  int64_t integer = 0;
+  double real = 0;
+  std::string text;
+  std::vector<std::unique_ptr<HostJsonNode>> elements;
+  std::vector<std::pair<std::string, std::unique_ptr<HostJsonNode>>> members;
+
+  void clear()
+  {
+    type = Null;
+    text.clear();
+    elements.clear();
+    members.clear();
+  }
+
+  HostJsonNode *member(const std::string &key) const
+  {
+    if (type != Object)
+    {
+      return nullptr;
+    }
+    for (const auto &m : members)
+    {
+      if (m.first == key)
+      {
+        return m.second.get();
+      }
+    }
+    return nullptr;
+  }
+
+  HostJsonNode *addMember(const std::string &key)
+  {
+    if (type != Object)
+    {
+      clear();
+      type = Object;
+    }
+    HostJsonNode *existing = member(key);
+    if (existing)
+    {
+      return existing;
+    }
+    members.emplace_back(key, std::unique_ptr<HostJsonNode>(new HostJsonNode()));
+    return members.back().second.get();
+  }
+
+  HostJsonNode *addElement()
+  {
+    if (type != Array)
+    {
+      clear();
+      type = Array;
+    }
+    elements.emplace_back(new HostJsonNode());
+    return elements.back().get();
+  }
+
+  void copyFrom(const HostJsonNode &other)
+  {
+    clear();
+    type = other.type;
+    boolean = other.boolean;
+    integer = other.integer;
+    real = other.real;
+    text = other.text;
+    for (const auto &e : other.elements)
+    {
+      addElement()->copyFrom(*e);
+    }
+    type = other.type;
+    for (const auto &m : other.members)
+    {
+      members.emplace_back(m.first, std::unique_ptr<HostJsonNode>(new HostJsonNode()));
+      members.back().second->copyFrom(*m.second);
+    }
+  }
+};
+
+class JsonArray;
+class JsonObject;
+class JsonVariant;
+
+// Creates the node of a variant on the first write, like the proxies of ArduinoJson
+typedef std::function<HostJsonNode *()> HostJsonCreate;
+
+class JsonString
+{
+public:
+  JsonString(const char *value = nullptr) : value(value) {}
+  const char *c_str() const { return value; }
+  bool isNull() const { return value == nullptr; }
+  bool operator==(const char *other) const { return value && other && strcmp(value, other) == 0; }
+
+private:
+  const char *value;
+};
+
+namespace HostJson
+{
+  void write(const HostJsonNode *node, std::string &out);
+
+  template <typename T>
+  struct IsInteger : std::integral_constant<bool, std::is_integral<T>::value && !std::is_same<T, bool>::value>
+  {
+  };
+}
+
+class JsonVariant
+{
+public:
+  JsonVariant() {}
+  JsonVariant(HostJsonNode *node, HostJsonCreate create = nullptr) : node(node), create(create) {}
+
+  bool isNull() const { return node == nullptr || node->type == HostJsonNode::Null; }
+
+  template <typename T>
+  bool is() const { return is(static_cast<T *>(nullptr)); }
+
+  template <typename T>
+  T as() const { return as(static_cast<T *>(nullptr)); }
+
+  template <typename T, typename = typename std::enable_if<HostJson::IsInteger<T>::value || std::is_floating_point<T>::value || std::is_same<T, String>::value || std::is_same<T, JsonArray>::value || std::is_same<T, JsonObject>::value>::type>
+  operator T() const { return as<T>(); }
+  operator const char *() const { return as<const char *>(); }
+  operator bool() const { return as<bool>(); }
+
+  template <typename T>
+  JsonVariant &operator=(const T &value)
+  {
+    set(value);
+    return *this;
+  }
+  JsonVariant &operator=(const JsonVariant &value)
+  {
+    set(value);
+    return *this;
+  }
+  JsonVariant(const JsonVariant &) = default;
+
+  JsonVariant operator[](const char *key) const { return memberVariant(key); }
+  JsonVariant operator[](const String &key) const { return memberVariant(key.c_str()); }
+  JsonVariant operator[](char *key) const { return memberVariant(key); }
+  JsonVariant operator[](int index) const { return elementVariant((size_t)index); }
+  JsonVariant operator[](size_t index) const { return elementVariant(index); }
+
+  bool containsKey(const char *key) const { return node && node->member(key); }
+  bool containsKey(const String &key) const { return containsKey(key.c_str()); }
+  size_t size() const
+  {
+    if (!node)
+    {
+      return 0;
+    }
+    return node->type == HostJsonNode::Array ? node->elements.size() : node->type == HostJsonNode::Object ? node->members.size()
+                                                                                                           : 0;
+  }
+
+  JsonObject createNestedObject(const char *key) const;
+  JsonObject createNestedObject(const String &key) const;
+  JsonArray createNestedArray(const char *key) const;
+  JsonArray createNestedArray(const String &key) const;
+  JsonObject createNestedObject() const;
+  JsonArray createNestedArray() const;
+
+  template <typename T>
+  bool add(const T &value) const
+  {
+    HostJsonNode *target = writable();
+    if (!target)
+    {
+      return false;
+    }
+    JsonVariant(target->addElement()).set(value);
+    return true;
+  }
+
+  const char *operator|(const char *fallback) const { return is<const char *>() ? node->text.c_str() : fallback; }
+  template <typename T>
+  T operator|(const T &fallback) const { return is<T>() ? as<T>() : fallback; }
+
+  template <typename T, typename = typename std::enable_if<HostJson::IsInteger<T>::value>::type>
+  bool operator==(T value) const
+  {
+    return node && ((node->type == HostJsonNode::Integer && node->integer == (int64_t)value) || (node->type == HostJsonNode::Real && node->real == (double)value));
+  }
+  template <typename T, typename = typename std::enable_if<HostJson::IsInteger<T>::value>::type>
+  bool operator!=(T value) const { return !(*this == value); }
+  bool operator==(const char *value) const { return is<const char *>() && value && node->text == value; }
+  bool operator!=(const char *value) const { return !(*this == value); }
+  bool operator==(const String &value) const { return *this == value.c_str(); }
+  bool operator!=(const String &value) const { return !(*this == value.c_str()); }
+
+  HostJsonNode *hostNode() const { return node; }
+
+  // Node for a write, created with the missing parents
+  HostJsonNode *writable() const
+  {
+    if (!node && create)
+    {
+      const_cast<JsonVariant *>(this)->node = create();
+    }
+    return node;
+  }
+
+protected:
+  HostJsonNode *node = nullptr;
+  HostJsonCreate create;
+
+  JsonVariant memberVariant(const std::string &key) const
+  {
+    HostJsonNode *child = node ? node->member(key) : nullptr;
+    JsonVariant parent = *this;
+    return JsonVariant(child, [parent, key]() -> HostJsonNode *
+                       {
+      HostJsonNode *target = parent.writable();
+      return target ? target->addMember(key) : nullptr; });
+  }
+
+  JsonVariant elementVariant(size_t index) const
+  {
+    if (node && node->type == HostJsonNode::Array && index < node->elements.size())
+    {
+      return JsonVariant(node->elements[index].get());
+    }
+    return JsonVariant();
+  }
+
+  // Type checks, like JsonVariant::is<T>() of ArduinoJson
+  bool is(const char **) const { return node && node->type == HostJsonNode::Text; }
+  bool is(char **) const { return is(static_cast<const char **>(nullptr)); }
+  bool is(String *) const { return is(static_cast<const char **>(nullptr)); }
+  bool is(bool *) const { return node && node->type == HostJsonNode::Boolean; }
+  bool is(float *) const { return node && (node->type == HostJsonNode::Real || node->type == HostJsonNode::Integer); }
+  bool is(double *) const { return is(static_cast<float *>(nullptr)); }
+  bool is(JsonObject *) const { return node && node->type == HostJsonNode::Object; }
+  bool is(JsonArray *) const { return node && node->type == HostJsonNode::Array; }
+  bool is(JsonVariant *) const { return true; }
+  template <typename T>
+  bool is(T *) const
+  {
+    static_assert(HostJson::IsInteger<T>::value, "type not supported by the host stand-in");
+    return node && node->type == HostJsonNode::Integer && node->integer >= (int64_t)std::numeric_limits<T>::min() &&
+           (node->integer < 0 || (uint64_t)node->integer <= (uint64_t)std::numeric_limits<T>::max());
+  }
+
+  const char *as(const char **) const { return is<const char *>() ? node->text.c_str() : nullptr; }
+  String as(String *) const
+  {
+    if (!node || node->type == HostJsonNode::Null)
+    {
+      return String("null");
+    }
+    if (node->type == HostJsonNode::Text)
+    {
+      return String(node->text);
+    }
+    std::string out;
+    HostJson::write(node, out);
+    return String(out);
+  }
+  bool as(bool *) const { return node && node->type == HostJsonNode::Boolean && node->boolean; }
+  float as(float *) const { return (float)as(static_cast<double *>(nullptr)); }
+  double as(double *) const
+  {
+    if (!node)
+    {
+      return 0;
+    }
+    if (node->type == HostJsonNode::Real)
+    {
+      return node->real;
+    }
+    if (node->type == HostJsonNode::Integer)
+    {
+      return (double)node->integer;
+    }
+    if (node->type == HostJsonNode::Text)
+    {
+      return strtod(node->text.c_str(), nullptr);
+    }
+    return 0;
+  }
+  JsonObject as(JsonObject *) const;
+  JsonArray as(JsonArray *) const;
+  JsonVariant as(JsonVariant *) const { return *this; }
+  template <typename T>
+  T as(T *) const
+  {
+    static_assert(HostJson::IsInteger<T>::value, "type not supported by the host stand-in");
+    if (!node)
+    {
+      return 0;
+    }
+    if (node->type == HostJsonNode::Integer)
+    {
+      return is<T>() ? (T)node->integer : 0;
+    }
+    if (node->type == HostJsonNode::Real)
+    {
+      return (T)node->real;
+    }
+    if (node->type == HostJsonNode::Text)
+    {
+      return (T)strtoll(node->text.c_str(), nullptr, 10);
+    }
+    return node->type == HostJsonNode::Boolean ? (T)node->boolean : 0;
+  }
+
+  void set(const char *value)
+  {
+    HostJsonNode *target = writable();
+    if (target)
+    {
+      target->clear();
+      if (value)
+      {
+        target->type = HostJsonNode::Text;
+        target->text = value;
+      }
+    }
+  }
+  void set(char *value) { set((const char *)value); }
+  template <size_t N>
+  void set(const char (&value)[N]) { set((const char *)value); }
+  template <size_t N>
+  void set(char (&value)[N]) { set((const char *)value); }
+  void set(const String &value) { set(value.c_str()); }
+  void set(bool value)
+  {
+    HostJsonNode *target = writable();
+    if (target)
+    {
+      target->clear();
+      target->type = HostJsonNode::Boolean;
+      target->boolean = value;
+    }
+  }
+  void set(float value) { set((double)value); }
+  void set(double value)
+  {
+    HostJsonNode *target = writable();
+    if (target)
+    {
+      target->clear();
+      target->type = HostJsonNode::Real;
+      target->real = value;
+    }
+  }
+  void set(const JsonVariant &value)
+  {
+    HostJsonNode *target = writable();
+    if (target && target != value.node)
+    {
+      if (value.node)
+      {
+        target->copyFrom(*value.node);
+      }
+      else
+      {
+        target->clear();
+      }
+    }
+  }
+  void set(const JsonObject &value);
+  void set(const JsonArray &value);
+  template <typename T>
+  typename std::enable_if<HostJson::IsInteger<T>::value>::type set(T value)
+  {
+    HostJsonNode *target = writable();
+    if (target)
+    {
+      target->clear();
+      target->type = HostJsonNode::Integer;
+      target->integer = (int64_t)value;
+    }
+  }
+  template <typename T>
+  typename std::enable_if<std::is_enum<T>::value>::type set(T value) { set((int64_t)value); }
+};
+
+class JsonPair
+{
+public:
+  JsonPair() {}
+  JsonPair(const char *key, HostJsonNode *value) : pairKey(key), pairValue(value) {}
+  JsonString key() const { return pairKey; }
+  JsonVariant value() const { return JsonVariant(pairValue); }
+
+private:
+  // The node and not a JsonVariant, assigning a JsonVariant copies the value
+  JsonString pairKey;
+  HostJsonNode *pairValue = nullptr;
+};
+
+class JsonObject : public JsonVariant
+{
+public:
+  JsonObject() {}
+  explicit JsonObject(const JsonVariant &variant) : JsonVariant(variant.is<JsonObject>() ? variant.hostNode() : nullptr) {}
+
+  class iterator
+  {
+  public:
+    iterator(HostJsonNode *node, size_t index) : node(node), index(index) { load(); }
+    const JsonPair &operator*() const { return pair; }
+    const JsonPair *operator->() const { return &pair; }
+    iterator &operator++()
+    {
+      index++;
+      load();
+      return *this;
+    }
+    bool operator==(const iterator &other) const { return index == other.index; }
+    bool operator!=(const iterator &other) const { return index != other.index; }
+
+  private:
+    HostJsonNode *node;
+    size_t index;
+    JsonPair pair;
+
+    void load()
+    {
+      if (node && index < node->members.size())
+      {
+        pair = JsonPair(node->members[index].first.c_str(), node->members[index].second.get());
+      }
+    }
+  };
+
+  iterator begin() const { return iterator(node, 0); }
+  iterator end() const { return iterator(node, node ? node->members.size() : 0); }
+
+  void remove(const char *key)
+  {
+    if (node)
+    {
+      for (auto it = node->members.begin(); it != node->members.end(); ++it)
+      {
+        if (it->first == key)
+        {
+          node->members.erase(it);
+          return;
+        }
+      }
+    }
+  }
+  void remove(const String &key) { remove(key.c_str()); }
+
+  template <typename T>
+  JsonObject &operator=(const T &value)
+  {
+    JsonVariant::operator=(value);
+    return *this;
+  }
+};
+
+class JsonArray : public JsonVariant
+{
+public:
+  JsonArray() {}
+  explicit JsonArray(const JsonVariant &variant) : JsonVariant(variant.is<JsonArray>() ? variant.hostNode() : nullptr) {}
+
+  class iterator
+  {
+  public:
+    iterator(HostJsonNode *node, size_t index) : node(node), index(index) {}
+    JsonVariant operator*() const { return JsonVariant(node->elements[index].get()); }
+    iterator &operator++()
+    {
+      index++;
+      return *this;
+    }
+    bool operator!=(const iterator &other) const { return index != other.index; }
+
+  private:
+    HostJsonNode *node;
+    size_t index;
+  };
+
+  iterator begin() const { return iterator(node, 0); }
+  iterator end() const { return iterator(node, node ? node->elements.size() : 0); }
+
+  void remove(size_t index)
+  {
+    if (node && index < node->elements.size())
+    {
+      node->elements.erase(node->elements.begin() + index);
+    }
+  }
+};
+
+inline JsonObject JsonVariant::as(JsonObject *) const { return JsonObject(*this); }
+inline JsonArray JsonVariant::as(JsonArray *) const { return JsonArray(*this); }
+inline void JsonVariant::set(const JsonObject &value) { set(static_cast<const JsonVariant &>(value)); }
+inline void JsonVariant::set(const JsonArray &value) { set(static_cast<const JsonVariant &>(value)); }
+
+inline JsonObject JsonVariant::createNestedObject(const char *key) const
+{
+  JsonVariant member = memberVariant(key);
+  HostJsonNode *target = member.writable();
+  if (target)
+  {
+    target->clear();
+    target->type = HostJsonNode::Object;
+  }
+  return JsonObject(JsonVariant(target));
+}
+inline JsonObject JsonVariant::createNestedObject(const String &key) const { return createNestedObject(key.c_str()); }
+
+inline JsonArray JsonVariant::createNestedArray(const char *key) const
+{
+  JsonVariant member = memberVariant(key);
+  HostJsonNode *target = member.writable();
+  if (target)
+  {
+    target->clear();
+    target->type = HostJsonNode::Array;
+  }
+  return JsonArray(JsonVariant(target));
+}
+inline JsonArray JsonVariant::createNestedArray(const String &key) const { return createNestedArray(key.c_str()); }
+
+inline JsonObject JsonVariant::createNestedObject() const
+{
+  HostJsonNode *target = writable();
+  if (!target)
+  {
+    return JsonObject();
+  }
+  HostJsonNode *element = target->addElement();
+  element->type = HostJsonNode::Object;
+  return JsonObject(JsonVariant(element));
+}
+
+inline JsonArray JsonVariant::createNestedArray() const
+{
+  HostJsonNode *target = writable();
+  if (!target)
+  {
+    return JsonArray();
+  }
+  HostJsonNode *element = target->addElement();
+  element->type = HostJsonNode::Array;
+  return JsonArray(JsonVariant(element));
+}
+
+class JsonDocument : public JsonVariant
+{
+public:
+  JsonDocument(size_t capacity) : JsonVariant(nullptr), root(new HostJsonNode()), documentCapacity(capacity) { node = root.get(); }
+  JsonDocument(const JsonDocument &other) : JsonDocument(other.documentCapacity) { root->copyFrom(*other.root); }
+  JsonDocument &operator=(const JsonDocument &other)
+  {
+    root->copyFrom(*other.root);
+    return *this;
+  }
+  template <typename T>
+  JsonDocument &operator=(const T &value)
+  {
+    JsonVariant::operator=(value);
+    return *this;
+  }
+
+  void clear() { root->clear(); }
+  size_t capacity() const { return documentCapacity; }
+  size_t memoryUsage() const { return 0; }
+  bool overflowed() const { return false; }
+  void shrinkToFit() {}
+  void garbageCollect() {}
+
+  template <typename T>
+  T to()
+  {
+    root->clear();
+    root->type = std::is_same<T, JsonArray>::value ? HostJsonNode::Array : HostJsonNode::Object;
+    return T(JsonVariant(root.get()));
+  }
+
+  void remove(const char *key) { as<JsonObject>().remove(key); }
+  void remove(const String &key) { remove(key.c_str()); }
+
+  HostJsonNode &hostRoot() const { return *root; }
+
+private:
+  std::unique_ptr<HostJsonNode> root;
+  size_t documentCapacity;
+};
+
+template <size_t Capacity>
+class StaticJsonDocument : public JsonDocument
+{
+public:
+  StaticJsonDocument() : JsonDocument(Capacity) {}
+  template <typename T>
+  StaticJsonDocument &operator=(const T &value)
+  {
+    JsonDocument::operator=(value);
+    return *this;
+  }
+};
+
+class DynamicJsonDocument : public JsonDocument
+{
+public:
+  explicit DynamicJsonDocument(size_t capacity) : JsonDocument(capacity) {}
+};
+
+class DeserializationError
+{
+public:
+  enum Code
+  {
+    Ok,
+    EmptyInput,
+    IncompleteInput,
+    InvalidInput,
+    NoMemory,
+    TooDeep
+  };
+
+  DeserializationError(Code code = Ok) : errorCode(code) {}
+  operator bool() const { return errorCode != Ok; }
+  bool operator==(Code code) const { return errorCode == code; }
+  bool operator!=(Code code) const { return errorCode != code; }
+  Code code() const { return errorCode; }
+  const char *c_str() const
+  {
+    static const char *names[] = {"Ok", "EmptyInput", "IncompleteInput", "InvalidInput", "NoMemory", "TooDeep"};
+    return names[errorCode];
+  }
+
+private:
+  Code errorCode;
+};
+
+namespace DeserializationOption
+{
+  class Filter
+  {
+  public:
+    explicit Filter(const JsonDocument &filter) : filter(&filter.hostRoot()) {}
+    const HostJsonNode *filter;
+  };
+}
+
+namespace HostJson
+{
+  // Reads one JSON value, the input following it is ignored like by ArduinoJson
+  class Reader
+  {
+  public:
+    Reader(const char *input, size_t length) : input(input), end(input + length) {}
+
+    DeserializationError read(HostJsonNode &node, const HostJsonNode *filter)
+    {
+      skipSpace();
+      if (input == end)
+      {
+        return DeserializationError::EmptyInput;
+      }
+      return value(&node, filter, 0);
+    }
+
+  private:
+    const char *input;
+    const char *end;
+
+    void skipSpace()
+    {
+      while (input < end && (*input == ' ' || *input == '\t' || *input == '\r' || *input == '\n'))
+      {
+        input++;
+      }
+    }
+
+    // A filter member set to true keeps the value, an object keeps the named members
+    static bool keeps(const HostJsonNode *filter) { return filter == nullptr || filter->type == HostJsonNode::Object || (filter->type == HostJsonNode::Boolean && filter->boolean); }
+
+    DeserializationError value(HostJsonNode *node, const HostJsonNode *filter, int depth)
+    {
+      if (depth > 10)
+      {
+        return DeserializationError::TooDeep;
+      }
+      skipSpace();
+      if (input == end)
+      {
+        return DeserializationError::IncompleteInput;
+      }
+      const HostJsonNode *childFilter = filter && filter->type == HostJsonNode::Object ? filter : nullptr;
+      if (*input == '{')
+      {
+        input++;
+        if (node)
+        {
+          node->clear();
+          node->type = HostJsonNode::Object;
+        }
+        skipSpace();
+        if (input < end && *input == '}')
+        {
+          input++;
+          return DeserializationError::Ok;
+        }
+        while (true)
+        {
+          skipSpace();
+          std::string key;
+          DeserializationError error = string(key);
+          if (error)
+          {
+            return error;
+          }
+          skipSpace();
+          if (input == end)
+          {
+            return DeserializationError::IncompleteInput;
+          }
+          if (*input++ != ':')
+          {
+            return DeserializationError::InvalidInput;
+          }
+          const HostJsonNode *memberFilter = nullptr;
+          bool keep = node != nullptr;
+          if (keep && filter)
+          {
+            memberFilter = childFilter ? childFilter->member(key) : nullptr;
+            keep = childFilter == nullptr || (memberFilter && keeps(memberFilter));
+            if (childFilter == nullptr)
+            {
+              memberFilter = nullptr;
+            }
+          }
+          error = value(keep ? node->addMember(key) : nullptr, memberFilter && memberFilter->type == HostJsonNode::Object ? memberFilter : nullptr, depth + 1);
+          if (error)
+          {
+            return error;
+          }
+          skipSpace();
+          if (input == end)
+          {
+            return DeserializationError::IncompleteInput;
+          }
+          char c = *input++;
+          if (c == '}')
+          {
+            return DeserializationError::Ok;
+          }
+          if (c != ',')
+          {
+            return DeserializationError::InvalidInput;
+          }
+        }
+      }
+      if (*input == '[')
+      {
+        input++;
+        if (node)
+        {
+          node->clear();
+          node->type = HostJsonNode::Array;
+        }
+        skipSpace();
+        if (input < end && *input == ']')
+        {
+          input++;
+          return DeserializationError::Ok;
+        }
+        while (true)
+        {
+          DeserializationError error = value(node ? node->addElement() : nullptr, nullptr, depth + 1);
+          if (error)
+          {
+            return error;
+          }
+          skipSpace();
+          if (input == end)
+          {
+            return DeserializationError::IncompleteInput;
+          }
+          char c = *input++;
+          if (c == ']')
+          {
+            return DeserializationError::Ok;
+          }
+          if (c != ',')
+          {
+            return DeserializationError::InvalidInput;
+          }
+        }
+      }
+      if (*input == '"')
+      {
+        std::string text;
+        DeserializationError error = string(text);
+        if (!error && node)
+        {
+          node->clear();
+          node->type = HostJsonNode::Text;
+          node->text = text;
+        }
+        return error;
+      }
+      for (const char *word : {"true", "false", "null"})
+      {
+        size_t length = strlen(word);
+        if ((size_t)(end - input) >= length && strncmp(input, word, length) == 0)
+        {
+          input += length;
+          if (node)
+          {
+            node->clear();
+            node->type = word[0] == 'n' ? HostJsonNode::Null : HostJsonNode::Boolean;
+            node->boolean = word[0] == 't';
+          }
+          return DeserializationError::Ok;
+        }
+        if ((size_t)(end - input) < length && strncmp(input, word, end - input) == 0)
+        {
+          return DeserializationError::IncompleteInput;
+        }
+      }
+      return number(node);
+    }
+
+    DeserializationError string(std::string &text)
+    {
+      if (input == end)
+      {
+        return DeserializationError::IncompleteInput;
+      }
+      if (*input++ != '"')
+      {
+        return DeserializationError::InvalidInput;
+      }
+      while (input < end && *input != '"')
+      {
+        char c = *input++;
+        if (c != '\\')
+        {
+          text += c;
+          continue;
+        }
+        if (input == end)
+        {
+          return DeserializationError::IncompleteInput;
+        }
+        c = *input++;
+        switch (c)
+        {
+        case 'b':
+          text += '\b';
+          break;
+        case 'f':
+          text += '\f';
+          break;
+        case 'n':
+          text += '\n';
+          break;
+        case 'r':
+          text += '\r';
+          break;
+        case 't':
+          text += '\t';
+          break;
+        case 'u':
+        {
+          if (end - input < 4)
+          {
+            return DeserializationError::IncompleteInput;
+          }
+          unsigned code = (unsigned)strtoul(std::string(input, 4).c_str(), nullptr, 16);
+          input += 4;
+          if (code < 0x80)
+          {
+            text += (char)code;
+          }
+          else if (code < 0x800)
+          {
+            text += (char)(0xC0 | (code >> 6));
+            text += (char)(0x80 | (code & 0x3F));
+          }
+          else
+          {
+            text += (char)(0xE0 | (code >> 12));
+            text += (char)(0x80 | ((code >> 6) & 0x3F));
+            text += (char)(0x80 | (code & 0x3F));
+          }
+          break;
+        }
+        default:
+          text += c;
+        }
+      }
+      if (input == end)
+      {
+        return DeserializationError::IncompleteInput;
+      }
+      input++;
+      return DeserializationError::Ok;
+    }
+
+    DeserializationError number(HostJsonNode *node)
+    {
+      const char *start = input;
+      bool real = false;
+      while (input < end && (isdigit((unsigned char)*input) || strchr("+-.eE", *input)))
+      {
+        real = real || strchr(".eE", *input) != nullptr;
+        input++;
+      }
+      if (input == start)
+      {
+        return DeserializationError::InvalidInput;
+      }
+      std::string text(start, input);
+      char *parsed;
+      if (!real)
+      {
+        errno = 0;
+        long long value = strtoll(text.c_str(), &parsed, 10);
+        if (*parsed == '\0' && errno == 0)
+        {
+          if (node)
+          {
+            node->clear();
+            node->type = HostJsonNode::Integer;
+            node->integer = value;
+          }
+          return DeserializationError::Ok;
+        }
+      }
+      double value = strtod(text.c_str(), &parsed);
+      if (*parsed != '\0')
+      {
+        return DeserializationError::InvalidInput;
+      }
+      if (node)
+      {
+        node->clear();
+        node->type = HostJsonNode::Real;
+        node->real = value;
+      }
+      return DeserializationError::Ok;
+    }
+  };
+
+  inline void writeString(const std::string &text, std::string &out)
+  {
+    out += '"';
+    for (unsigned char c : text)
+    {
+      switch (c)
+      {
+      case '"':
+        out += "\\\"";
+        break;
+      case '\\':
+        out += "\\\\";
+        break;
+      case '\b':
+        out += "\\b";
+        break;
+      case '\f':
+        out += "\\f";
+        break;
+      case '\n':
+        out += "\\n";
+        break;
+      case '\r':
+        out += "\\r";
+        break;
+      case '\t':
+        out += "\\t";
+        break;
+      default:
+        if (c < 0x20)
+        {
+          char code[7];
+          snprintf(code, sizeof(code), "\\u%04x", c);
+          out += code;
+        }
+        else
+        {
+          out += (char)c;
+        }
+      }
+    }
+    out += '"';
+  }
+
+  inline void write(const HostJsonNode *node, std::string &out)
+  {
+    if (node == nullptr)
+    {
+      out += "null";
+      return;
+    }
+    switch (node->type)
+    {
+    case HostJsonNode::Null:
+      out += "null";
+      break;
+    case HostJsonNode::Boolean:
+      out += node->boolean ? "true" : "false";
+      break;
+    case HostJsonNode::Integer:
+      out += std::to_string(node->integer);
+      break;
+    case HostJsonNode::Real:
+    {
+      // ArduinoJson writes up to 9 significant digits, NaN and infinity as null
+      if (std::isnan(node->real) || std::isinf(node->real))
+      {
+        out += "null";
+        break;
+      }
+      char text[32];
+      snprintf(text, sizeof(text), "%.9g", node->real);
+      out += text;
+      break;
+    }
+    case HostJsonNode::Text:
+      writeString(node->text, out);
+      break;
+    case HostJsonNode::Array:
+      out += '[';
+      for (size_t i = 0; i < node->elements.size(); i++)
+      {
+        out += i > 0 ? "," : "";
+        write(node->elements[i].get(), out);
+      }
+      out += ']';
+      break;
+    case HostJsonNode::Object:
+      out += '{';
+      for (size_t i = 0; i < node->members.size(); i++)
+      {
+        out += i > 0 ? "," : "";
+        writeString(node->members[i].first, out);
+        out += ':';
+        write(node->members[i].second.get(), out);
+      }
+      out += '}';
+      break;
+    }
+  }
+}
+
+inline DeserializationError deserializeJson(JsonDocument &doc, const char *input, size_t length)
+{
+  doc.clear();
+  return HostJson::Reader(input, length).read(doc.hostRoot(), nullptr);
+}
+
+inline DeserializationError deserializeJson(JsonDocument &doc, const char *input, size_t length, DeserializationOption::Filter filter)
+{
+  doc.clear();
+  return HostJson::Reader(input, length).read(doc.hostRoot(), filter.filter);
+}
+
+inline DeserializationError deserializeJson(JsonDocument &doc, const char *input) { return deserializeJson(doc, input, input ? strlen(input) : 0); }
+inline DeserializationError deserializeJson(JsonDocument &doc, const char *input, DeserializationOption::Filter filter) { return deserializeJson(doc, input, input ? strlen(input) : 0, filter); }
+inline DeserializationError deserializeJson(JsonDocument &doc, const String &input) { return deserializeJson(doc, input.c_str(), input.length()); }
+inline DeserializationError deserializeJson(JsonDocument &doc, const String &input, DeserializationOption::Filter filter) { return deserializeJson(doc, input.c_str(), input.length(), filter); }
+inline DeserializationError deserializeJson(JsonDocument &doc, const uint8_t *input, size_t length) { return deserializeJson(doc, (const char *)input, length); }
+inline DeserializationError deserializeJson(JsonDocument &doc, char *input, size_t length) { return deserializeJson(doc, (const char *)input, length); }
+inline DeserializationError deserializeJson(JsonDocument &doc, char *input) { return deserializeJson(doc, (const char *)input); }
+
+inline DeserializationError deserializeJson(JsonDocument &doc, Stream &input)
+{
+  String text = input.readString();
+  return deserializeJson(doc, text);
+}
+
+inline DeserializationError deserializeJson(JsonDocument &doc, Stream &input, DeserializationOption::Filter filter)
+{
+  String text = input.readString();
+  return deserializeJson(doc, text, filter);
+}
+
+inline std::string hostSerializeJson(const JsonVariant &source)
+{
+  std::string out;
+  HostJson::write(source.hostNode(), out);
+  return out;
+}
+
+inline size_t measureJson(const JsonVariant &source) { return hostSerializeJson(source).size(); }
+
+inline size_t serializeJson(const JsonVariant &source, Print &output)
+{
+  std::string out = hostSerializeJson(source);
+  return output.write((const uint8_t *)out.data(), out.size());
+}
+
+inline size_t serializeJson(const JsonVariant &source, String &output)
+{
+  std::string out = hostSerializeJson(source);
+  output = String(out);
+  return out.size();
+}
+
+inline size_t serializeJson(const JsonVariant &source, char *output, size_t size)
+{
+  std::string out = hostSerializeJson(source);
+  if (size == 0)
+  {
+    return 0;
+  }
+  size_t length = min(out.size(), size - 1);
+  memcpy(output, out.data(), length);
+  output[length] = '\0';
+  return length;
+}
+
+template <size_t N>
+inline size_t serializeJson(const JsonVariant &source, char (&output)[N]) { return serializeJson(source, output, N); }
+
+inline size_t serializeJsonPretty(const JsonVariant &source, Print &output) { return serializeJson(source, output); }
+
+#endif
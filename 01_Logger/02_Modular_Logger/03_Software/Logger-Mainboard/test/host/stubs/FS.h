@@ -0,0 +1,99 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Host stand-in for the file system of the ESP32 Arduino core, backed by a host directory
+ */
+
+#ifndef HOST_FS_H
+#define HOST_FS_H
+
+#include <Arduino.h>
+#include <memory>
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+namespace fs
+{
+
+enum SeekMode
+{
+  SeekSet = 0,
+  SeekCur = 1,
+  SeekEnd = 2
+};
+
+struct FileImpl;
+
+class File : public Stream
+{
+public:
+  File() {}
+  explicit File(std::shared_ptr<FileImpl> impl) : impl(impl) {}
+
+  using Print::write;
+  size_t write(uint8_t value) override;
+  size_t write(const uint8_t *buffer, size_t size) override;
+  int available() override;
+  int read() override;
+  int peek() override;
+  size_t read(uint8_t *buffer, size_t size);
+  void flush() override;
+  bool seek(uint32_t position, SeekMode mode = SeekSet);
+  size_t position() const;
+  size_t size() const;
+  void close();
+  operator bool() const;
+  const char *name() const;
+  const char *path() const;
+  bool isDirectory() const;
+  File openNextFile(const char *mode = FILE_READ);
+  void rewindDirectory();
+
+protected:
+  int timedRead() override { return read(); }
+
+private:
+  std::shared_ptr<FileImpl> impl;
+};
+
+class FS
+{
+public:
+  File open(const char *path, const char *mode = FILE_READ, bool create = false);
+  File open(const String &path, const char *mode = FILE_READ, bool create = false) { return open(path.c_str(), mode, create); }
+  bool exists(const char *path);
+  bool exists(const String &path) { return exists(path.c_str()); }
+  bool remove(const char *path);
+  bool remove(const String &path) { return remove(path.c_str()); }
+  bool rename(const char *pathFrom, const char *pathTo);
+  bool rename(const String &pathFrom, const String &pathTo) { return rename(pathFrom.c_str(), pathTo.c_str()); }
+  bool mkdir(const char *path);
+  bool mkdir(const String &path) { return mkdir(path.c_str()); }
+  bool rmdir(const char *path);
+  bool rmdir(const String &path) { return rmdir(path.c_str()); }
+};
+
+} // namespace fs
+
+using fs::File;
+using fs::FS;
+using fs::SeekCur;
+using fs::SeekEnd;
+using fs::SeekMode;
+using fs::SeekSet;
+
+// Directory on the host that stands for the root of the SD card
+void hostSetSdRoot(const std::string &root);
+std::string hostSdPath(const char *path);
+
+// Writes stop after this number of bytes like on a full card, -1 without limit
+void hostLimitSdWrites(long long bytes);
+
+#endif
@@ -0,0 +1,90 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Host stand-in for the 256dpi MQTT library (lwmqtt), speaks MQTT 3.1.1 over a host socket
+ *
+ * Like lwmqtt, publish() and subscribe() block until the acknowledgement
+ * arrives and pass messages that are received meanwhile to the callback,
+ * loop() reads the packets that are available. Incoming QoS 2 messages are
+ * passed on PUBLISH and acknowledged with PUBREC, PUBREL with PUBCOMP.
+ */
+
+#ifndef HOST_MQTT_H
+#define HOST_MQTT_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+
+class MQTTClient;
+
+typedef void (*MQTTClientCallbackSimple)(String &topic, String &payload);
+typedef void (*MQTTClientCallbackAdvanced)(MQTTClient *client, char topic[], char bytes[], int length);
+
+class MQTTClient
+{
+public:
+  explicit MQTTClient(int readBufSize = 128, int writeBufSize = 128);
+
+  void begin(const char host[], int port, Client &client);
+  void onMessage(MQTTClientCallbackSimple callback) { simpleCallback = callback; }
+  void onMessageAdvanced(MQTTClientCallbackAdvanced callback) { advancedCallback = callback; }
+  void setOptions(int keepAlive, bool cleanSession, int timeout);
+  void setTimeout(int timeout) { commandTimeout = timeout; }
+  void setKeepAlive(int keepAlive) { keepAliveSeconds = keepAlive; }
+  void setCleanSession(bool cleanSession) { this->cleanSession = cleanSession; }
+
+  bool connect(const char clientId[], const char username[] = nullptr, const char password[] = nullptr, bool skip = false);
+
+  bool publish(const String &topic) { return publish(topic.c_str(), "", 0, false, 0); }
+  bool publish(const char topic[]) { return publish(topic, "", 0, false, 0); }
+  bool publish(const String &topic, const String &payload) { return publish(topic.c_str(), payload.c_str(), payload.length(), false, 0); }
+  bool publish(const String &topic, const String &payload, bool retained, int qos) { return publish(topic.c_str(), payload.c_str(), payload.length(), retained, qos); }
+  bool publish(const char topic[], const String &payload) { return publish(topic, payload.c_str(), payload.length(), false, 0); }
+  bool publish(const char topic[], const String &payload, bool retained, int qos) { return publish(topic, payload.c_str(), payload.length(), retained, qos); }
+  bool publish(const char topic[], const char payload[]) { return publish(topic, payload, strlen(payload), false, 0); }
+  bool publish(const char topic[], const char payload[], bool retained, int qos) { return publish(topic, payload, strlen(payload), retained, qos); }
+  bool publish(const char topic[], const char payload[], int length) { return publish(topic, payload, length, false, 0); }
+  bool publish(const char topic[], const char payload[], int length, bool retained, int qos);
+
+  bool subscribe(const String &topic, int qos = 0) { return subscribe(topic.c_str(), qos); }
+  bool subscribe(const char topic[], int qos = 0);
+  bool unsubscribe(const String &topic) { return unsubscribe(topic.c_str()); }
+  bool unsubscribe(const char topic[]);
+
+  bool loop();
+  bool connected();
+  bool disconnect();
+  int lastError() { return error; }
+  int returnCode() { return connectReturnCode; }
+
+private:
+  size_t readBufferSize;
+  size_t writeBufferSize;
+  const char *host = nullptr;
+  int port = 0;
+  Client *network = nullptr;
+  MQTTClientCallbackSimple simpleCallback = nullptr;
+  MQTTClientCallbackAdvanced advancedCallback = nullptr;
+  int keepAliveSeconds = 10;
+  bool cleanSession = true;
+  int commandTimeout = 1000;
+  bool isConnected = false;
+  uint16_t nextPacketId = 1;
+  unsigned long lastSend = 0;
+  int error = 0;
+  int connectReturnCode = 0;
+
+  uint16_t packetId();
+  bool send(const std::string &packet);
+  bool readPacket(uint8_t &header, std::string &body, unsigned long timeout);
+  bool handlePacket(uint8_t header, const std::string &body);
+  bool waitFor(uint8_t type);
+  void close();
+};
+
+#endif
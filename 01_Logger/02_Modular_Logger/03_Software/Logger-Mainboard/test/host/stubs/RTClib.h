@@ -0,0 +1,39 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Host stand-in for the DateTime class of RTClib, UTC only
+ */
+
+#ifndef HOST_RTCLIB_H
+#define HOST_RTCLIB_H
+
+#include <Arduino.h>
+#include <time.h>
+
+class DateTime
+{
+public:
+  DateTime(uint32_t unixTime = 0) : value(unixTime) {}
+  DateTime(uint16_t year, uint8_t month, uint8_t day, uint8_t hour = 0, uint8_t minute = 0, uint8_t second = 0)
+  {
+    struct tm utc = {};
+    utc.tm_year = year - 1900;
+    utc.tm_mon = month - 1;
+    utc.tm_mday = day;
+    utc.tm_hour = hour;
+    utc.tm_min = minute;
+    utc.tm_sec = second;
+    value = (uint32_t)timegm(&utc);
+  }
+  uint32_t unixtime() const { return value; }
+
+private:
+  uint32_t value;
+};
+
+#endif
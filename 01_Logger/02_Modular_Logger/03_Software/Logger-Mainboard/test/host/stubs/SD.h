@@ -0,0 +1,30 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Host stand-in for the SD library of the ESP32 Arduino core
+ */
+
+#ifndef HOST_SD_H
+#define HOST_SD_H
+
+#include <FS.h>
+#include <SPI.h>
+
+class SDFS : public fs::FS
+{
+public:
+  bool begin(uint8_t ssPin = 0, SPIClass &spi = SPI, uint32_t frequency = 4000000, const char *mountpoint = "/sd", uint8_t maxFiles = 5) { return true; }
+  void end() {}
+  uint64_t cardSize();
+  uint64_t totalBytes();
+  uint64_t usedBytes();
+};
+
+extern SDFS SD;
+
+#endif
@@ -0,0 +1,59 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Host stand-in for the WiFi client of the ESP32 Arduino core, a TCP socket of the host
+ */
+
+#ifndef HOST_WIFI_H
+#define HOST_WIFI_H
+
+#include <Arduino.h>
+
+class Client : public Stream
+{
+public:
+  virtual int connect(const char *host, uint16_t port) = 0;
+  virtual uint8_t connected() = 0;
+  virtual void stop() = 0;
+  virtual size_t read(uint8_t *buffer, size_t size) = 0;
+  using Stream::read;
+};
+
+class WiFiClient : public Client
+{
+public:
+  WiFiClient() {}
+  ~WiFiClient() override { stop(); }
+
+  int connect(const char *host, uint16_t port) override { return connect(host, port, 3000); }
+  int connect(const char *host, uint16_t port, int32_t timeout);
+  uint8_t connected() override;
+  void stop() override;
+  int setNoDelay(bool noDelay);
+  // The ESP32 core takes the timeout of the client in seconds
+  void setTimeout(uint32_t seconds) { streamTimeout = seconds * 1000; }
+
+  using Print::write;
+  size_t write(uint8_t value) override { return write(&value, 1); }
+  size_t write(const uint8_t *buffer, size_t size) override;
+  int available() override;
+  int read() override;
+  int peek() override;
+  size_t read(uint8_t *buffer, size_t size) override;
+  operator bool() { return connected(); }
+
+private:
+  int socketFd = -1;
+  uint8_t rxBuffer[1460];
+  size_t rxStart = 0;
+  size_t rxEnd = 0;
+
+  bool fillBuffer();
+};
+
+#endif
@@ -0,0 +1,34 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Host stand-in for the I2C library of the ESP32 Arduino core, no devices answer
+ */
+
+#ifndef HOST_WIRE_H
+#define HOST_WIRE_H
+
+#include <Arduino.h>
+
+class TwoWire : public Stream
+{
+public:
+  bool begin(int sda = -1, int scl = -1, uint32_t frequency = 0) { return true; }
+  void beginTransmission(uint8_t address) {}
+  uint8_t endTransmission(bool sendStop = true) { return 2; }
+  uint8_t requestFrom(uint8_t address, uint8_t quantity, bool sendStop = true) { return 0; }
+  using Print::write;
+  size_t write(uint8_t value) override { return 1; }
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+};
+
+inline TwoWire Wire;
+inline TwoWire Wire1;
+
+#endif
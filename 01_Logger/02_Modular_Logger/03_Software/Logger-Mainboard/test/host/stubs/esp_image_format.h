@@ -0,0 +1,39 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Host stand-in for the image verification of ESP-IDF, backed by HostPartition.cpp
+ */
+
+#ifndef HOST_ESP_IMAGE_FORMAT_H
+#define HOST_ESP_IMAGE_FORMAT_H
+
+#include "esp_partition.h"
+
+typedef enum
+{
+  ESP_IMAGE_VERIFY,
+  ESP_IMAGE_VERIFY_SILENT
+} esp_image_load_mode_t;
+
+typedef struct
+{
+  uint32_t offset;
+  uint32_t size;
+} esp_partition_pos_t;
+
+typedef struct
+{
+  uint32_t start_addr;
+  uint32_t image_len; // including the checksum and the appended SHA-256
+  bool hash_appended;
+} esp_image_metadata_t;
+
+// Reports the length of the image set with hostSetRunningFirmware(), fails for other positions
+esp_err_t esp_image_verify(esp_image_load_mode_t mode, const esp_partition_pos_t *part, esp_image_metadata_t *data);
+
+#endif
@@ -0,0 +1,20 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Host stand-in for the OTA API of ESP-IDF, backed by HostPartition.cpp
+ */
+
+#ifndef HOST_ESP_OTA_OPS_H
+#define HOST_ESP_OTA_OPS_H
+
+#include "esp_partition.h"
+
+// The partition set with hostSetRunningFirmware(), nullptr before
+const esp_partition_t *esp_ota_get_running_partition();
+
+#endif
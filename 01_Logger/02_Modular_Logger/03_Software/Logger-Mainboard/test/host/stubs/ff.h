@@ -0,0 +1,34 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Host stand-in for the FatFs functions of the ESP-IDF used by the firmware
+ */
+
+#ifndef HOST_FF_H
+#define HOST_FF_H
+
+#include <stdint.h>
+
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+
+typedef enum
+{
+  FR_OK = 0,
+  FR_DISK_ERR,
+  FR_NOT_READY = 3
+} FRESULT;
+
+typedef struct
+{
+  WORD csize; // Sectors per cluster
+} FATFS;
+
+FRESULT f_getfree(const char *path, DWORD *freeClusters, FATFS **fileSystem);
+
+#endif
@@ -0,0 +1,169 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Time, random numbers, FreeRTOS and serial output of the host stand-in for the Arduino core
+ */
+
+#include <Arduino.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <random>
+#include <thread>
+
+HostSerial Serial;
+
+static const auto hostStart = std::chrono::steady_clock::now();
+
+unsigned long millis()
+{
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - hostStart).count();
+}
+
+unsigned long micros()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - hostStart).count();
+}
+
+int64_t esp_timer_get_time()
+{
+  return micros();
+}
+
+void delay(uint32_t ms)
+{
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void yield()
+{
+  std::this_thread::yield();
+}
+
+uint32_t esp_random()
+{
+  static std::mt19937 generator(1);
+  return generator();
+}
+
+// A queue of items; a semaphore is a queue of empty items, a mutex one with a single item
+struct HostQueue
+{
+  std::mutex lock;
+  std::condition_variable changed;
+  std::deque<std::string> items;
+  uint32_t length;
+  uint32_t itemSize;
+};
+
+// Tasks run until the end of the test program
+struct HostTask
+{
+};
+
+static bool waitForQueue(HostQueue *queue, std::unique_lock<std::mutex> &guard, TickType_t ticks, const std::function<bool()> &ready)
+{
+  if (ticks == portMAX_DELAY)
+  {
+    queue->changed.wait(guard, ready);
+    return true;
+  }
+  return queue->changed.wait_for(guard, std::chrono::milliseconds(ticks), ready);
+}
+
+QueueHandle_t xQueueCreate(uint32_t length, uint32_t itemSize)
+{
+  HostQueue *queue = new HostQueue();
+  queue->length = length;
+  queue->itemSize = itemSize;
+  return queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+  std::unique_lock<std::mutex> guard(queue->lock);
+  if (!waitForQueue(queue, guard, ticks, [queue]()
+                    { return queue->items.size() < queue->length; }))
+  {
+    return pdFALSE;
+  }
+  queue->items.push_back(item != nullptr ? std::string((const char *)item, queue->itemSize) : std::string());
+  queue->changed.notify_all();
+  return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+  std::unique_lock<std::mutex> guard(queue->lock);
+  if (!waitForQueue(queue, guard, ticks, [queue]()
+                    { return !queue->items.empty(); }))
+  {
+    return pdFALSE;
+  }
+  if (item != nullptr)
+  {
+    memcpy(item, queue->items.front().data(), queue->itemSize);
+  }
+  queue->items.pop_front();
+  queue->changed.notify_all();
+  return pdTRUE;
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(uint32_t maxCount, uint32_t initialCount)
+{
+  HostQueue *semaphore = xQueueCreate(maxCount, 0);
+  semaphore->items.resize(initialCount);
+  return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex()
+{
+  return xSemaphoreCreateCounting(1, 1);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks)
+{
+  return xQueueReceive(semaphore, nullptr, ticks);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+  return xQueueSend(semaphore, nullptr, 0);
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name, uint32_t stackSize, void *parameter, uint32_t priority, TaskHandle_t *handle, BaseType_t core)
+{
+  std::thread(task, parameter).detach();
+  static HostTask hostTask;
+  if (handle != nullptr)
+  {
+    *handle = &hostTask;
+  }
+  return pdTRUE;
+}
+
+static bool serialVerbose()
+{
+  static const bool verbose = getenv("HYFIVE_HOST_VERBOSE") != nullptr;
+  return verbose;
+}
+
+size_t HostSerial::write(uint8_t value)
+{
+  return write(&value, 1);
+}
+
+size_t HostSerial::write(const uint8_t *buffer, size_t size)
+{
+  if (serialVerbose())
+  {
+    fwrite(buffer, 1, size, stderr);
+  }
+  return size;
+}
@@ -0,0 +1,449 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Minimal MQTT 3.1.1 broker on a local port for the host tests
+ */
+
+#include "HostBroker.h"
+
+#include <Arduino.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <set>
+#include <sys/socket.h>
+#include <unistd.h>
+
+struct HostBroker::Connection
+{
+  int fd;
+  std::mutex writeLock;
+  std::vector<std::pair<std::string, int>> subscriptions;
+  std::set<uint16_t> pending;
+  std::map<uint16_t, MqttPublish> incomingQos2;
+  uint16_t nextPacketId = 0;
+  bool open = true;
+
+  explicit Connection(int fd) : fd(fd) {}
+
+  void send(const std::string &packet)
+  {
+    std::lock_guard<std::mutex> guard(writeLock);
+    size_t written = 0;
+    while (open && written < packet.size())
+    {
+      ssize_t result = ::send(fd, packet.data() + written, packet.size() - written, MSG_NOSIGNAL);
+      if (result <= 0)
+      {
+        break;
+      }
+      written += result;
+    }
+  }
+};
+
+// Reads exactly length bytes, false if the connection is closed or the broker stops
+static bool readExactly(int fd, char *buffer, size_t length, const std::atomic<bool> &stopping)
+{
+  size_t count = 0;
+  while (count < length)
+  {
+    struct pollfd descriptor = {fd, POLLIN, 0};
+    int ready = poll(&descriptor, 1, 50);
+    if (stopping)
+    {
+      return false;
+    }
+    if (ready <= 0)
+    {
+      continue;
+    }
+    ssize_t result = recv(fd, buffer + count, length - count, 0);
+    if (result <= 0)
+    {
+      return false;
+    }
+    count += result;
+  }
+  return true;
+}
+
+HostBroker::HostBroker()
+{
+  listenFd = socket(AF_INET, SOCK_STREAM, 0);
+  int reuse = 1;
+  setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  struct sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  bind(listenFd, (struct sockaddr *)&address, sizeof(address));
+  listen(listenFd, 64);
+  socklen_t length = sizeof(address);
+  getsockname(listenFd, (struct sockaddr *)&address, &length);
+  listenPort = ntohs(address.sin_port);
+  acceptThread = std::thread(&HostBroker::acceptLoop, this);
+}
+
+HostBroker::~HostBroker()
+{
+  stopping = true;
+  acceptThread.join();
+  ::close(listenFd);
+  disconnectAll();
+  std::vector<std::thread> running;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    running.swap(threads);
+  }
+  for (std::thread &thread : running)
+  {
+    thread.join();
+  }
+}
+
+void HostBroker::acceptLoop()
+{
+  while (!stopping)
+  {
+    struct pollfd descriptor = {listenFd, POLLIN, 0};
+    if (poll(&descriptor, 1, 50) <= 0)
+    {
+      continue;
+    }
+    int fd = accept(listenFd, nullptr, nullptr);
+    if (fd < 0)
+    {
+      continue;
+    }
+    int noDelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    std::shared_ptr<Connection> connection = std::make_shared<Connection>(fd);
+    std::lock_guard<std::mutex> guard(lock);
+    connections.push_back(connection);
+    threads.emplace_back(&HostBroker::serve, this, connection);
+  }
+}
+
+void HostBroker::serve(std::shared_ptr<Connection> connection)
+{
+  while (true)
+  {
+    char header;
+    if (!readExactly(connection->fd, &header, 1, stopping))
+    {
+      break;
+    }
+    size_t length = 0;
+    int shift = 0;
+    char digit;
+    do
+    {
+      if (shift > 21 || !readExactly(connection->fd, &digit, 1, stopping))
+      {
+        length = SIZE_MAX;
+        break;
+      }
+      length |= (size_t)(digit & 0x7F) << shift;
+      shift += 7;
+    } while (digit & 0x80);
+    if (length == SIZE_MAX)
+    {
+      break;
+    }
+    std::string body(length, '\0');
+    if (!readExactly(connection->fd, &body[0], length, stopping))
+    {
+      break;
+    }
+    if (((uint8_t)header & 0xF0) == MQTT_DISCONNECT)
+    {
+      break;
+    }
+    handlePacket(connection, header, body);
+  }
+
+  std::lock_guard<std::mutex> guard(lock);
+  {
+    std::lock_guard<std::mutex> writeGuard(connection->writeLock);
+    connection->open = false;
+    ::close(connection->fd);
+  }
+  for (size_t i = 0; i < connections.size(); i++)
+  {
+    if (connections[i] == connection)
+    {
+      connections.erase(connections.begin() + i);
+      break;
+    }
+  }
+}
+
+void HostBroker::handlePacket(const std::shared_ptr<Connection> &connection, uint8_t header, const std::string &body)
+{
+  switch (header & 0xF0)
+  {
+  case MQTT_CONNECT:
+    connection->send(mqttPacket(MQTT_CONNACK, std::string("\0\0", 2)));
+    break;
+  case MQTT_SUBSCRIBE:
+  {
+    uint16_t packetId = mqttReadUint16(body, 0);
+    std::string granted;
+    std::vector<MqttPublish> retained;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      size_t offset = 2;
+      while (offset + 2 < body.size())
+      {
+        uint16_t length = mqttReadUint16(body, offset);
+        std::string filter = body.substr(offset + 2, length);
+        int qos = (uint8_t)body[offset + 2 + length];
+        offset += 3 + length;
+        connection->subscriptions.emplace_back(filter, qos);
+        granted += (char)qos;
+        for (const auto &entry : retainedMessages)
+        {
+          if (mqttTopicMatches(filter, entry.first))
+          {
+            MqttPublish message = entry.second;
+            message.qos = std::min(message.qos, qos);
+            retained.push_back(message);
+          }
+        }
+      }
+    }
+    connection->send(mqttPacket(MQTT_SUBACK, mqttUint16(packetId) + granted));
+    // Like Mosquitto, retained messages follow the SUBACK
+    for (const MqttPublish &message : retained)
+    {
+      deliver(connection, message, message.qos);
+    }
+    break;
+  }
+  case MQTT_UNSUBSCRIBE:
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    std::string filter = body.substr(4, mqttReadUint16(body, 2));
+    auto &subscriptions = connection->subscriptions;
+    for (size_t i = 0; i < subscriptions.size(); i++)
+    {
+      if (subscriptions[i].first == filter)
+      {
+        subscriptions.erase(subscriptions.begin() + i);
+        break;
+      }
+    }
+    connection->send(mqttPacket(MQTT_UNSUBACK, mqttUint16(mqttReadUint16(body, 0))));
+    break;
+  }
+  case MQTT_PUBLISH:
+  {
+    MqttPublish message;
+    if (!mqttParsePublish(header, body, message))
+    {
+      break;
+    }
+    if (message.qos == 2)
+    {
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        connection->incomingQos2[message.packetId] = message;
+      }
+      connection->send(mqttPacket(MQTT_PUBREC, mqttUint16(message.packetId)));
+      break;
+    }
+    route(message, true);
+    if (message.qos == 1)
+    {
+      connection->send(mqttPacket(MQTT_PUBACK, mqttUint16(message.packetId)));
+    }
+    break;
+  }
+  case MQTT_PUBREL:
+  {
+    uint16_t packetId = mqttReadUint16(body, 0);
+    MqttPublish message;
+    bool found = false;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      auto entry = connection->incomingQos2.find(packetId);
+      if (entry != connection->incomingQos2.end())
+      {
+        message = entry->second;
+        connection->incomingQos2.erase(entry);
+        found = true;
+      }
+    }
+    if (found)
+    {
+      route(message, true);
+    }
+    connection->send(mqttPacket(MQTT_PUBCOMP, mqttUint16(packetId)));
+    break;
+  }
+  case MQTT_PUBACK:
+  case MQTT_PUBCOMP:
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    connection->pending.erase(mqttReadUint16(body, 0));
+    break;
+  }
+  case MQTT_PUBREC:
+    connection->send(mqttPacket(MQTT_PUBREL | 0x02, body.substr(0, 2)));
+    break;
+  case MQTT_PINGREQ:
+    connection->send(mqttPacket(MQTT_PINGRESP, ""));
+    break;
+  default:
+    break;
+  }
+}
+
+void HostBroker::route(const MqttPublish &message, bool fromClient)
+{
+  PublishHook hook;
+  std::vector<std::pair<std::shared_ptr<Connection>, int>> targets;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    if (fromClient)
+    {
+      receivedMessages.push_back(message);
+      hook = publishHook;
+    }
+    if (message.retained)
+    {
+      if (message.payload.empty())
+      {
+        retainedMessages.erase(message.topic);
+      }
+      else
+      {
+        retainedMessages[message.topic] = message;
+      }
+    }
+    for (const std::shared_ptr<Connection> &connection : connections)
+    {
+      int qos = -1;
+      for (const auto &subscription : connection->subscriptions)
+      {
+        if (mqttTopicMatches(subscription.first, message.topic))
+        {
+          qos = std::max(qos, std::min(subscription.second, message.qos));
+        }
+      }
+      if (qos >= 0)
+      {
+        targets.emplace_back(connection, qos);
+      }
+    }
+  }
+
+  if (hook)
+  {
+    hook(message);
+  }
+  MqttPublish forwarded = message;
+  forwarded.retained = false;
+  for (const auto &target : targets)
+  {
+    deliver(target.first, forwarded, target.second);
+  }
+}
+
+void HostBroker::deliver(const std::shared_ptr<Connection> &connection, const MqttPublish &message, int qos)
+{
+  uint16_t packetId = 0;
+  if (qos > 0)
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    connection->nextPacketId = connection->nextPacketId % 0xFFFF + 1;
+    packetId = connection->nextPacketId;
+    connection->pending.insert(packetId);
+  }
+  connection->send(mqttPublishPacket(message.topic, message.payload, qos, message.retained, packetId));
+}
+
+void HostBroker::publish(const std::string &topic, const std::string &payload, int qos, bool retained)
+{
+  MqttPublish message;
+  message.topic = topic;
+  message.payload = payload;
+  message.qos = qos;
+  message.retained = retained;
+  // Injected messages are not reported to the hook or in received()
+  route(message, false);
+}
+
+void HostBroker::onPublish(PublishHook hook)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  publishHook = hook;
+}
+
+std::vector<MqttPublish> HostBroker::received()
+{
+  std::lock_guard<std::mutex> guard(lock);
+  return receivedMessages;
+}
+
+size_t HostBroker::receivedCount(const std::string &filter)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  size_t count = 0;
+  for (const MqttPublish &message : receivedMessages)
+  {
+    count += mqttTopicMatches(filter, message.topic) ? 1 : 0;
+  }
+  return count;
+}
+
+void HostBroker::clearReceived()
+{
+  std::lock_guard<std::mutex> guard(lock);
+  receivedMessages.clear();
+}
+
+size_t HostBroker::pendingDeliveries()
+{
+  std::lock_guard<std::mutex> guard(lock);
+  size_t count = 0;
+  for (const std::shared_ptr<Connection> &connection : connections)
+  {
+    count += connection->pending.size();
+  }
+  return count;
+}
+
+bool HostBroker::waitForDeliveries(unsigned long timeout)
+{
+  unsigned long start = millis();
+  while (pendingDeliveries() > 0)
+  {
+    if (millis() - start >= timeout)
+    {
+      return false;
+    }
+    delay(5);
+  }
+  return true;
+}
+
+size_t HostBroker::connectionCount()
+{
+  std::lock_guard<std::mutex> guard(lock);
+  return connections.size();
+}
+
+void HostBroker::disconnectAll()
+{
+  std::lock_guard<std::mutex> guard(lock);
+  for (const std::shared_ptr<Connection> &connection : connections)
+  {
+    shutdown(connection->fd, SHUT_RDWR);
+  }
+}
@@ -0,0 +1,80 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Minimal MQTT 3.1.1 broker on a local port for the host tests
+ *
+ * Routes messages between the connected clients like Mosquitto: topic
+ * filters with wildcards, retained messages sent after the SUBACK, QoS 1
+ * and QoS 2 in both directions (an incoming QoS 2 message is forwarded on
+ * PUBREL). Tests inject messages with publish() and can answer messages of
+ * the loggers with onPublish(), e.g. as a stand-in for the Node-RED flow.
+ */
+
+#ifndef HOST_BROKER_H
+#define HOST_BROKER_H
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "HostMqttPacket.h"
+
+class HostBroker
+{
+public:
+  // Called for every message published by a client, before it is acknowledged
+  typedef std::function<void(const MqttPublish &message)> PublishHook;
+
+  HostBroker();
+  ~HostBroker();
+
+  uint16_t port() const { return listenPort; }
+
+  // Publishes a message to the subscribed clients as if a client had sent it
+  void publish(const std::string &topic, const std::string &payload, int qos = 0, bool retained = false);
+  void onPublish(PublishHook hook);
+
+  // Messages published by the clients, in the order of arrival
+  std::vector<MqttPublish> received();
+  size_t receivedCount(const std::string &filter);
+  void clearReceived();
+
+  // Outgoing QoS 1 and QoS 2 messages that are not completed by the clients
+  size_t pendingDeliveries();
+  bool waitForDeliveries(unsigned long timeout);
+
+  size_t connectionCount();
+  void disconnectAll();
+
+private:
+  struct Connection;
+
+  int listenFd = -1;
+  uint16_t listenPort = 0;
+  std::atomic<bool> stopping{false};
+  std::thread acceptThread;
+  std::mutex lock;
+  std::vector<std::shared_ptr<Connection>> connections;
+  std::vector<std::thread> threads;
+  std::map<std::string, MqttPublish> retainedMessages;
+  std::vector<MqttPublish> receivedMessages;
+  PublishHook publishHook;
+
+  void acceptLoop();
+  void serve(std::shared_ptr<Connection> connection);
+  void handlePacket(const std::shared_ptr<Connection> &connection, uint8_t header, const std::string &body);
+  void route(const MqttPublish &message, bool fromClient);
+  void deliver(const std::shared_ptr<Connection> &connection, const MqttPublish &message, int qos);
+};
+
+#endif
@@ -0,0 +1,92 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: findLatestConfigurationFile() of Utility.cpp for the host build
+ *
+ * Repeated unchanged like HostUtility.cpp. It is kept apart because it needs
+ * FileManifest.cpp, which only the tests that use it link.
+ */
+
+#include <algorithm>
+#include <vector>
+
+#include "FileManifest.h"
+#include "Utility.h"
+
+bool findLatestConfigFileLog = true;
+
+/**
+ * @brief Finds the latest configuration file.
+ * @param pfad Path to search for configuration files.
+ * @return String Name of the latest configuration file.
+ */
+String findLatestConfigurationFile(const String &pfad)
+{
+  findLatestConfigFileLog = true;
+
+  // The configuration folder is read on every wake up, its latest file is kept in the manifest
+  if (pfad == "/loggerConfig")
+  {
+    String latestFileName = manifestLatestConfigFile();
+    if (latestFileName == "")
+    {
+      findLatestConfigFileLog = false;
+    }
+    return latestFileName;
+  }
+
+  File root = SD.open(pfad);
+
+  // Creates a vector that will store the names of the configuration update files
+  std::vector<String> configUpdateFileNames;
+
+  // Iterates over all files in the /config directory
+  while (true)
+  {
+    File file = root.openNextFile(); // Opens the next file in the directory
+    if (!file)                       // If no more files are available, the loop ends
+    {
+      break;
+    }
+
+    if (!file.isDirectory()) // Checks whether the opened file is not a directory
+    {
+      String configUpdateFileName = file.name(); // Saves the name of the file
+      // Filtert nur JSON-Dateien
+      if (configUpdateFileName.endsWith(".json")) // Checks whether the file extension is .json
+      {
+        configUpdateFileNames.push_back(configUpdateFileName); // Adds the file name to the vector
+      }
+    }
+    file.close(); // Closes the currently open file
+  }
+
+  // Sort the files by timestamp
+  std::sort(configUpdateFileNames.begin(), configUpdateFileNames.end(), [](const String &a, const String &b) -> bool
+            {
+              // Extract timestamp directly before the .json extension
+              int posA = a.lastIndexOf('_') + 1;
+              int posB = b.lastIndexOf('_') + 1;
+              String timestampA = a.substring(posA, a.length() - 5); // -5 to remove “.json”
+              String timestampB = b.substring(posB, b.length() - 5); // -5 to remove “.json”
+              return timestampA > timestampB;                        // Descending sorting for the most recent timestamp first
+            });
+
+  // Checks whether the list of file names is not empty
+  if (!configUpdateFileNames.empty())
+  {
+    // Saves the name of the most recent configuration file
+    String latestFileName = configUpdateFileNames.front();
+    return latestFileName; // The newest file is now the first in the vector
+  }
+  else
+  {
+    findLatestConfigFileLog = false;
+  }
+  return "";
+}
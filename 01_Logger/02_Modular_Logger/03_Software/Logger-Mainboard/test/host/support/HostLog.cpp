@@ -0,0 +1,135 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Log sink and RTC of the host build
+ */
+
+#include "HostLog.h"
+#include "DebuggingSDLog.h"
+#include "SystemVariables.h"
+#include <ctime>
+#include <mutex>
+
+std::map<LogCategory, LogLevel> logSettings = {
+    {LogCategoryGeneral, LogLevelDEBUG},
+    {LogCategorySensors, LogLevelDEBUG},
+    {LogCategoryUnderwater, LogLevelDEBUG},
+    {LogCategoryAboveWater, LogLevelDEBUG},
+    {LogCategoryBMS, LogLevelDEBUG},
+    {LogCategoryCharger, LogLevelDEBUG},
+    {LogCategoryWiFi, LogLevelDEBUG},
+    {LogCategoryMQTT, LogLevelDEBUG},
+    {LogCategorySDCard, LogLevelDEBUG},
+    {LogCategoryRTC, LogLevelDEBUG},
+    {LogCategoryPowerManagement, LogLevelDEBUG},
+    {LogCategoryConfiguration, LogLevelDEBUG},
+    {LogCategoryError, LogLevelDEBUG},
+    {LogCategoryDebug, LogLevelDEBUG},
+    {LogCategoryMeasurement, LogLevelDEBUG},
+};
+
+static std::mutex logMutex;
+static std::vector<std::string> logLines;
+static unsigned long rtcTime = 0;
+
+void enqueueLogMessage(const char *message, size_t length, LogLevel level)
+{
+  std::lock_guard<std::mutex> lock(logMutex);
+  logLines.emplace_back(message, length);
+  if (getenv("HYFIVE_HOST_VERBOSE"))
+  {
+    fwrite(message, 1, length, stderr);
+  }
+}
+
+void flushLogSink()
+{
+}
+
+std::vector<std::string> hostLogLines()
+{
+  std::lock_guard<std::mutex> lock(logMutex);
+  return logLines;
+}
+
+void hostClearLog()
+{
+  std::lock_guard<std::mutex> lock(logMutex);
+  logLines.clear();
+}
+
+bool hostLogContains(const std::string &text)
+{
+  std::lock_guard<std::mutex> lock(logMutex);
+  for (const std::string &line : logLines)
+  {
+    if (line.find(text) != std::string::npos)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+void hostUseTemporarySd(std::initializer_list<const char *> folders)
+{
+  char root[] = "/tmp/hyfive_sd_XXXXXX";
+  if (mkdtemp(root) == nullptr)
+  {
+    abort();
+  }
+  hostSetSdRoot(root);
+  for (const char *folder : folders)
+  {
+    std::string path;
+    for (const char *c = folder; *c; c++)
+    {
+      if (*c == '/' && !path.empty())
+      {
+        SD.mkdir(path.c_str());
+      }
+      path += *c;
+    }
+    SD.mkdir(path.c_str());
+  }
+}
+
+void hostSetRtcTime(unsigned long unixTime)
+{
+  rtcTime = unixTime;
+}
+
+unsigned long getCurrentTimeFromRTC()
+{
+  return rtcTime != 0 ? rtcTime : (unsigned long)time(nullptr);
+}
+
+String formatUnixTimeAsISOString(uint32_t unixTime)
+{
+  time_t value = unixTime;
+  struct tm utc;
+  gmtime_r(&value, &utc);
+  char text[32];
+  strftime(text, sizeof(text), "%Y-%m-%dT%H:%M:%SZ", &utc);
+  return String(text);
+}
+
+String formatLocalTimeAsISOString()
+{
+  return formatUnixTimeAsISOString(getCurrentTimeFromRTC());
+}
+
+String getLocalTimeAsStringLog()
+{
+  return formatLocalTimeAsISOString();
+}
+
+String getLocalTimeAsStringBackup()
+{
+  return formatLocalTimeAsISOString();
+}
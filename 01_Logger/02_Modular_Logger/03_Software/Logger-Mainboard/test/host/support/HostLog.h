@@ -0,0 +1,30 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Log sink and RTC of the host build
+ */
+
+#ifndef HOST_LOG_H
+#define HOST_LOG_H
+
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+// Lines passed to enqueueLogMessage(), printed to stderr when HYFIVE_HOST_VERBOSE is set
+std::vector<std::string> hostLogLines();
+void hostClearLog();
+bool hostLogContains(const std::string &text);
+
+// Creates an empty directory for the SD card of a test and the given folders in it
+void hostUseTemporarySd(std::initializer_list<const char *> folders = {});
+
+// Unix time returned by getCurrentTimeFromRTC(), 0 uses the clock of the host
+void hostSetRtcTime(unsigned long unixTime);
+
+#endif
@@ -0,0 +1,149 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: SHA-256 (FIPS 180-4) behind the message digest API of mbed TLS for the host build
+ */
+
+#include <cstring>
+#include <mbedtls/md.h>
+
+static const mbedtls_md_info_t sha256Info = {MBEDTLS_MD_SHA256};
+
+static const uint32_t roundConstants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+static uint32_t rotateRight(uint32_t value, int bits)
+{
+  return (value >> bits) | (value << (32 - bits));
+}
+
+static void processBlock(mbedtls_md_context_t *ctx, const uint8_t *block)
+{
+  uint32_t w[64];
+  for (int i = 0; i < 16; i++)
+  {
+    w[i] = ((uint32_t)block[4 * i] << 24) | ((uint32_t)block[4 * i + 1] << 16) | ((uint32_t)block[4 * i + 2] << 8) | block[4 * i + 3];
+  }
+  for (int i = 16; i < 64; i++)
+  {
+    uint32_t s0 = rotateRight(w[i - 15], 7) ^ rotateRight(w[i - 15], 18) ^ (w[i - 15] >> 3);
+    uint32_t s1 = rotateRight(w[i - 2], 17) ^ rotateRight(w[i - 2], 19) ^ (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  uint32_t v[8];
+  memcpy(v, ctx->state, sizeof(v));
+  for (int i = 0; i < 64; i++)
+  {
+    uint32_t s1 = rotateRight(v[4], 6) ^ rotateRight(v[4], 11) ^ rotateRight(v[4], 25);
+    uint32_t choice = (v[4] & v[5]) ^ (~v[4] & v[6]);
+    uint32_t t1 = v[7] + s1 + choice + roundConstants[i] + w[i];
+    uint32_t s0 = rotateRight(v[0], 2) ^ rotateRight(v[0], 13) ^ rotateRight(v[0], 22);
+    uint32_t majority = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+    uint32_t t2 = s0 + majority;
+    memmove(v + 1, v, 7 * sizeof(uint32_t));
+    v[4] += t1;
+    v[0] = t1 + t2;
+  }
+  for (int i = 0; i < 8; i++)
+  {
+    ctx->state[i] += v[i];
+  }
+}
+
+const mbedtls_md_info_t *mbedtls_md_info_from_type(mbedtls_md_type_t type)
+{
+  return type == MBEDTLS_MD_SHA256 ? &sha256Info : nullptr;
+}
+
+void mbedtls_md_init(mbedtls_md_context_t *ctx)
+{
+  memset(ctx, 0, sizeof(*ctx));
+}
+
+int mbedtls_md_setup(mbedtls_md_context_t *ctx, const mbedtls_md_info_t *info, int hmac)
+{
+  if (info == nullptr || hmac != 0)
+  {
+    return -1;
+  }
+  ctx->info = info;
+  return 0;
+}
+
+int mbedtls_md_starts(mbedtls_md_context_t *ctx)
+{
+  static const uint32_t initial[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+  if (ctx->info == nullptr)
+  {
+    return -1;
+  }
+  memcpy(ctx->state, initial, sizeof(initial));
+  ctx->length = 0;
+  ctx->blockLength = 0;
+  return 0;
+}
+
+int mbedtls_md_update(mbedtls_md_context_t *ctx, const unsigned char *input, size_t length)
+{
+  if (ctx->info == nullptr)
+  {
+    return -1;
+  }
+  ctx->length += length;
+  while (length > 0)
+  {
+    size_t count = length < 64 - ctx->blockLength ? length : 64 - ctx->blockLength;
+    memcpy(ctx->block + ctx->blockLength, input, count);
+    ctx->blockLength += count;
+    input += count;
+    length -= count;
+    if (ctx->blockLength == 64)
+    {
+      processBlock(ctx, ctx->block);
+      ctx->blockLength = 0;
+    }
+  }
+  return 0;
+}
+
+int mbedtls_md_finish(mbedtls_md_context_t *ctx, unsigned char *output)
+{
+  if (ctx->info == nullptr)
+  {
+    return -1;
+  }
+  uint64_t bits = ctx->length * 8;
+  uint8_t padding[72] = {0x80};
+  size_t paddingLength = (ctx->blockLength < 56 ? 56 : 120) - ctx->blockLength;
+  for (int i = 0; i < 8; i++)
+  {
+    padding[paddingLength + i] = bits >> (56 - 8 * i);
+  }
+  mbedtls_md_update(ctx, padding, paddingLength + 8);
+  for (int i = 0; i < 8; i++)
+  {
+    output[4 * i] = ctx->state[i] >> 24;
+    output[4 * i + 1] = ctx->state[i] >> 16;
+    output[4 * i + 2] = ctx->state[i] >> 8;
+    output[4 * i + 3] = ctx->state[i];
+  }
+  return 0;
+}
+
+void mbedtls_md_free(mbedtls_md_context_t *ctx)
+{
+  memset(ctx, 0, sizeof(*ctx));
+}
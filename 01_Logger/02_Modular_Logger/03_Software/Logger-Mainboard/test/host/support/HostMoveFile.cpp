@@ -0,0 +1,71 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: moveFileToDestination() of Utility.cpp for the modules of the host build
+ *
+ * Kept apart from HostUtility.cpp, a test that uses it links FileManifest.cpp
+ * and SpaceLedger.cpp. The function is repeated here unchanged.
+ */
+
+#include "DS3231TimeNtp.h"
+#include "FileManifest.h"
+#include "SpaceLedger.h"
+#include "SystemVariables.h"
+#include "Utility.h"
+
+bool moveFileToDestination(const char *sourceFolder, const char *fileName, const char *destinationFolder, bool addTimestamp = false)
+{
+  if (addTimestamp)
+  {
+    String timestamp = getLocalTimeAsStringBackup();
+
+    if (timestamp == "")
+    {
+      return false;
+    }
+    String sourcePath = String(sourceFolder) + "/" + fileName;
+    String newFileName = String(destinationFolder) + "/" + "logger_" + configRTC.logger_id + "_" + timestamp + "_" + fileName;
+
+    if (!SD.rename(sourcePath.c_str(), newFileName.c_str()))
+    {
+      return false;
+    }
+    manifestFileRemoved(sourceFolder, fileName);
+    manifestFileAdded(destinationFolder, "logger_" + String(configRTC.logger_id) + "_" + timestamp + "_" + fileName);
+
+    delay(100);
+    return true;
+  }
+  else
+  {
+    String sourcePath = String(sourceFolder) + "/" + fileName;
+    String destinationPath = String(destinationFolder) + "/" + fileName;
+
+    if (SD.exists(destinationPath.c_str()))
+    {
+      // file already exists, try deleting it before moving it
+      if (!ledgerRemoveFile(destinationPath))
+      {
+        Serial.println("Destination file could not be deleted: " + destinationPath);
+        return false;
+      }
+      manifestFileRemoved(destinationFolder, fileName);
+    }
+
+    if (!SD.rename(sourcePath.c_str(), destinationPath.c_str()))
+    {
+      Serial.println("File could not be moved: " + sourcePath);
+      return false;
+    }
+    manifestFileRemoved(sourceFolder, fileName);
+    manifestFileAdded(destinationFolder, fileName);
+
+    delay(100);
+    return true;
+  }
+}
@@ -0,0 +1,318 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: MQTT client of the host build, behaves like lwmqtt of the 256dpi MQTT library
+ */
+
+#include "HostMqttPacket.h"
+#include <MQTT.h>
+
+MQTTClient::MQTTClient(int readBufSize, int writeBufSize) : readBufferSize(readBufSize), writeBufferSize(writeBufSize)
+{
+}
+
+void MQTTClient::begin(const char host[], int port, Client &client)
+{
+  this->host = host;
+  this->port = port;
+  network = &client;
+}
+
+void MQTTClient::setOptions(int keepAlive, bool cleanSession, int timeout)
+{
+  keepAliveSeconds = keepAlive;
+  this->cleanSession = cleanSession;
+  commandTimeout = timeout;
+}
+
+uint16_t MQTTClient::packetId()
+{
+  uint16_t id = nextPacketId++;
+  if (nextPacketId == 0)
+  {
+    nextPacketId = 1;
+  }
+  return id;
+}
+
+bool MQTTClient::send(const std::string &packet)
+{
+  if (network == nullptr || network->write((const uint8_t *)packet.data(), packet.size()) != packet.size())
+  {
+    close();
+    return false;
+  }
+  lastSend = millis();
+  return true;
+}
+
+bool MQTTClient::readPacket(uint8_t &header, std::string &body, unsigned long timeout)
+{
+  unsigned long start = millis();
+  auto readByte = [&](uint8_t &value) -> bool
+  {
+    while (network->available() == 0)
+    {
+      if (!network->connected() || millis() - start >= timeout)
+      {
+        return false;
+      }
+      delay(1);
+    }
+    value = network->read();
+    return true;
+  };
+
+  if (!readByte(header))
+  {
+    return false;
+  }
+  size_t length = 0;
+  int shift = 0;
+  uint8_t digit;
+  do
+  {
+    if (!readByte(digit))
+    {
+      return false;
+    }
+    length |= (size_t)(digit & 0x7F) << shift;
+    shift += 7;
+  } while (digit & 0x80);
+
+  body.resize(length);
+  for (size_t i = 0; i < length; i++)
+  {
+    uint8_t value;
+    if (!readByte(value))
+    {
+      return false;
+    }
+    body[i] = value;
+  }
+  return true;
+}
+
+bool MQTTClient::handlePacket(uint8_t header, const std::string &body)
+{
+  switch (header & 0xF0)
+  {
+  case MQTT_PUBLISH:
+  {
+    // lwmqtt fails on messages larger than the read buffer and closes the connection
+    if (body.size() + 5 > readBufferSize)
+    {
+      error = -1;
+      close();
+      return false;
+    }
+    MqttPublish message;
+    if (!mqttParsePublish(header, body, message))
+    {
+      return false;
+    }
+    if (advancedCallback)
+    {
+      std::string payload = message.payload;
+      payload.push_back(0);
+      advancedCallback(this, (char *)message.topic.c_str(), (char *)payload.data(), message.payload.size());
+    }
+    else if (simpleCallback)
+    {
+      String topic(message.topic);
+      String payload(message.payload);
+      simpleCallback(topic, payload);
+    }
+    if (message.qos == 1)
+    {
+      return send(mqttPacket(MQTT_PUBACK, mqttUint16(message.packetId)));
+    }
+    if (message.qos == 2)
+    {
+      return send(mqttPacket(MQTT_PUBREC, mqttUint16(message.packetId)));
+    }
+    return true;
+  }
+  case MQTT_PUBREL:
+    return send(mqttPacket(MQTT_PUBCOMP, body.substr(0, 2)));
+  case MQTT_PUBREC:
+    return send(mqttPacket(MQTT_PUBREL | 0x02, body.substr(0, 2)));
+  default:
+    return true;
+  }
+}
+
+bool MQTTClient::waitFor(uint8_t type)
+{
+  unsigned long start = millis();
+  while (millis() - start < (unsigned long)commandTimeout)
+  {
+    uint8_t header;
+    std::string body;
+    if (!readPacket(header, body, commandTimeout - (millis() - start)))
+    {
+      break;
+    }
+    if ((header & 0xF0) == type)
+    {
+      if (type == MQTT_PUBREC)
+      {
+        return send(mqttPacket(MQTT_PUBREL | 0x02, body.substr(0, 2)));
+      }
+      return true;
+    }
+    if (!handlePacket(header, body))
+    {
+      return false;
+    }
+  }
+  error = -2;
+  close();
+  return false;
+}
+
+bool MQTTClient::connect(const char clientId[], const char username[], const char password[], bool skip)
+{
+  if (network == nullptr)
+  {
+    return false;
+  }
+  if (!skip && !network->connect(host, port))
+  {
+    return false;
+  }
+  uint8_t flags = (cleanSession ? 0x02 : 0) | (username ? 0x80 : 0) | (password ? 0x40 : 0);
+  std::string body = mqttString("MQTT") + std::string{4, (char)flags} + mqttUint16(keepAliveSeconds) + mqttString(clientId);
+  if (username)
+  {
+    body += mqttString(username);
+  }
+  if (password)
+  {
+    body += mqttString(password);
+  }
+  if (!send(mqttPacket(MQTT_CONNECT, body)))
+  {
+    return false;
+  }
+  isConnected = true;
+  uint8_t header;
+  std::string answer;
+  if (!readPacket(header, answer, commandTimeout) || (header & 0xF0) != MQTT_CONNACK || answer.size() < 2)
+  {
+    close();
+    return false;
+  }
+  connectReturnCode = (uint8_t)answer[1];
+  if (connectReturnCode != 0)
+  {
+    close();
+    return false;
+  }
+  return true;
+}
+
+bool MQTTClient::publish(const char topic[], const char payload[], int length, bool retained, int qos)
+{
+  if (!connected())
+  {
+    return false;
+  }
+  uint16_t id = qos > 0 ? packetId() : 0;
+  std::string packet = mqttPublishPacket(topic, std::string(payload, length), qos, retained, id);
+  if (packet.size() > writeBufferSize)
+  {
+    error = -1;
+    return false;
+  }
+  if (!send(packet))
+  {
+    return false;
+  }
+  if (qos == 1)
+  {
+    return waitFor(MQTT_PUBACK);
+  }
+  if (qos == 2)
+  {
+    return waitFor(MQTT_PUBREC) && waitFor(MQTT_PUBCOMP);
+  }
+  return true;
+}
+
+bool MQTTClient::subscribe(const char topic[], int qos)
+{
+  if (!connected())
+  {
+    return false;
+  }
+  std::string body = mqttUint16(packetId()) + mqttString(topic) + std::string(1, (char)qos);
+  return send(mqttPacket(MQTT_SUBSCRIBE | 0x02, body)) && waitFor(MQTT_SUBACK);
+}
+
+bool MQTTClient::unsubscribe(const char topic[])
+{
+  if (!connected())
+  {
+    return false;
+  }
+  std::string body = mqttUint16(packetId()) + mqttString(topic);
+  return send(mqttPacket(MQTT_UNSUBSCRIBE | 0x02, body)) && waitFor(MQTT_UNSUBACK);
+}
+
+bool MQTTClient::loop()
+{
+  if (!connected())
+  {
+    return false;
+  }
+  while (network->available() > 0)
+  {
+    uint8_t header;
+    std::string body;
+    if (!readPacket(header, body, commandTimeout) || !handlePacket(header, body))
+    {
+      close();
+      return false;
+    }
+  }
+  if (keepAliveSeconds > 0 && millis() - lastSend >= (unsigned long)keepAliveSeconds * 1000)
+  {
+    return send(mqttPacket(MQTT_PINGREQ, ""));
+  }
+  return true;
+}
+
+bool MQTTClient::connected()
+{
+  if (isConnected && (network == nullptr || !network->connected()))
+  {
+    isConnected = false;
+  }
+  return isConnected;
+}
+
+bool MQTTClient::disconnect()
+{
+  if (!connected())
+  {
+    return false;
+  }
+  send(mqttPacket(MQTT_DISCONNECT, ""));
+  close();
+  return true;
+}
+
+void MQTTClient::close()
+{
+  isConnected = false;
+  if (network)
+  {
+    network->stop();
+  }
+}
@@ -0,0 +1,123 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: MQTT 3.1.1 packet helpers shared by the host MQTT client and the test broker
+ */
+
+#ifndef HOST_MQTT_PACKET_H
+#define HOST_MQTT_PACKET_H
+
+#include <cstdint>
+#include <string>
+
+#define MQTT_CONNECT 0x10
+#define MQTT_CONNACK 0x20
+#define MQTT_PUBLISH 0x30
+#define MQTT_PUBACK 0x40
+#define MQTT_PUBREC 0x50
+#define MQTT_PUBREL 0x60
+#define MQTT_PUBCOMP 0x70
+#define MQTT_SUBSCRIBE 0x80
+#define MQTT_SUBACK 0x90
+#define MQTT_UNSUBSCRIBE 0xA0
+#define MQTT_UNSUBACK 0xB0
+#define MQTT_PINGREQ 0xC0
+#define MQTT_PINGRESP 0xD0
+#define MQTT_DISCONNECT 0xE0
+
+inline std::string mqttUint16(uint16_t value)
+{
+  return std::string{(char)(value >> 8), (char)(value & 0xFF)};
+}
+
+inline uint16_t mqttReadUint16(const std::string &body, size_t offset)
+{
+  return offset + 2 <= body.size() ? ((uint8_t)body[offset] << 8) | (uint8_t)body[offset + 1] : 0;
+}
+
+inline std::string mqttString(const std::string &text)
+{
+  return mqttUint16(text.size()) + text;
+}
+
+inline std::string mqttPacket(uint8_t header, const std::string &body)
+{
+  std::string packet(1, (char)header);
+  size_t length = body.size();
+  do
+  {
+    uint8_t digit = length % 128;
+    length /= 128;
+    packet += (char)(length > 0 ? digit | 0x80 : digit);
+  } while (length > 0);
+  return packet + body;
+}
+
+inline std::string mqttPublishPacket(const std::string &topic, const std::string &payload, int qos, bool retained, uint16_t packetId, bool duplicate = false)
+{
+  uint8_t header = MQTT_PUBLISH | (duplicate ? 0x08 : 0) | (qos << 1) | (retained ? 1 : 0);
+  return mqttPacket(header, mqttString(topic) + (qos > 0 ? mqttUint16(packetId) : std::string()) + payload);
+}
+
+struct MqttPublish
+{
+  std::string topic;
+  std::string payload;
+  int qos = 0;
+  bool retained = false;
+  uint16_t packetId = 0;
+};
+
+inline bool mqttParsePublish(uint8_t header, const std::string &body, MqttPublish &publish)
+{
+  publish.qos = (header >> 1) & 0x03;
+  publish.retained = header & 0x01;
+  uint16_t topicLength = mqttReadUint16(body, 0);
+  size_t offset = 2 + topicLength + (publish.qos > 0 ? 2 : 0);
+  if (body.size() < offset)
+  {
+    return false;
+  }
+  publish.topic = body.substr(2, topicLength);
+  publish.packetId = publish.qos > 0 ? mqttReadUint16(body, 2 + topicLength) : 0;
+  publish.payload = body.substr(offset);
+  return true;
+}
+
+// Topic filter with + and # wildcards
+inline bool mqttTopicMatches(const std::string &filter, const std::string &topic)
+{
+  size_t f = 0;
+  size_t t = 0;
+  while (f < filter.size())
+  {
+    if (filter[f] == '#')
+    {
+      return true;
+    }
+    if (filter[f] == '+')
+    {
+      while (t < topic.size() && topic[t] != '/')
+      {
+        t++;
+      }
+      f++;
+      continue;
+    }
+    if (t >= topic.size() || filter[f] != topic[t])
+    {
+      // "a/#" also matches "a"
+      return t >= topic.size() && filter.compare(f, std::string::npos, "/#") == 0;
+    }
+    f++;
+    t++;
+  }
+  return t == topic.size();
+}
+
+#endif
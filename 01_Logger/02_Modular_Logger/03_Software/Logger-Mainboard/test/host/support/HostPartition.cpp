@@ -0,0 +1,57 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Running app partition of the host build
+ */
+
+#include "HostPartition.h"
+
+#include <cstring>
+#include <esp_image_format.h>
+#include <esp_ota_ops.h>
+
+#define HOST_APP_PARTITION_ADDRESS 0x10000
+
+static esp_partition_t runningPartition = {HOST_APP_PARTITION_ADDRESS, 0, "app0"};
+static std::string partitionContent;
+static uint32_t imageLength = 0;
+
+void hostSetRunningFirmware(const std::string &image, uint32_t partitionSize)
+{
+  partitionContent = image;
+  partitionContent.resize(partitionSize, '\xFF');
+  imageLength = image.size();
+  runningPartition.size = partitionSize;
+}
+
+const esp_partition_t *esp_ota_get_running_partition()
+{
+  return runningPartition.size > 0 ? &runningPartition : nullptr;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size)
+{
+  if (partition != &runningPartition || src_offset + size > partitionContent.size())
+  {
+    return ESP_FAIL;
+  }
+  memcpy(dst, partitionContent.data() + src_offset, size);
+  return ESP_OK;
+}
+
+esp_err_t esp_image_verify(esp_image_load_mode_t, const esp_partition_pos_t *part, esp_image_metadata_t *data)
+{
+  if (part->offset != runningPartition.address || part->size != runningPartition.size || imageLength == 0)
+  {
+    return ESP_FAIL;
+  }
+  data->start_addr = part->offset;
+  data->image_len = imageLength;
+  data->hash_appended = true;
+  return ESP_OK;
+}
@@ -0,0 +1,20 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Running app partition of the host build
+ */
+
+#ifndef HOST_PARTITION_H
+#define HOST_PARTITION_H
+
+#include <string>
+
+// Writes firmware.bin to the running partition, the rest of the partition is erased (0xFF)
+void hostSetRunningFirmware(const std::string &image, uint32_t partitionSize);
+
+#endif
@@ -0,0 +1,300 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: SD card of the host build, the files are kept in a directory of the host
+ */
+
+#include <SD.h>
+#include <dirent.h>
+#include <ff.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+SDFS SD;
+
+static std::string sdRoot = "/tmp/hyfive_sd";
+static long long sdWriteLimit = -1;
+
+void hostSetSdRoot(const std::string &root)
+{
+  sdRoot = root;
+  ::mkdir(sdRoot.c_str(), 0755);
+}
+
+void hostLimitSdWrites(long long bytes)
+{
+  sdWriteLimit = bytes;
+}
+
+std::string hostSdPath(const char *path)
+{
+  std::string relative = path ? path : "";
+  if (relative.empty() || relative[0] != '/')
+  {
+    relative = "/" + relative;
+  }
+  return sdRoot + relative;
+}
+
+namespace fs
+{
+
+struct FileImpl
+{
+  std::string path;
+  std::string name;
+  FILE *stream = nullptr;
+  bool directory = false;
+  std::vector<std::string> entries;
+  size_t nextEntry = 0;
+
+  ~FileImpl()
+  {
+    if (stream)
+    {
+      fclose(stream);
+    }
+  }
+};
+
+size_t File::write(uint8_t value)
+{
+  return write(&value, 1);
+}
+
+size_t File::write(const uint8_t *buffer, size_t size)
+{
+  if (!impl || !impl->stream)
+  {
+    return 0;
+  }
+  if (sdWriteLimit >= 0 && (long long)size > sdWriteLimit)
+  {
+    size = sdWriteLimit;
+  }
+  size_t written = fwrite(buffer, 1, size, impl->stream);
+  if (sdWriteLimit >= 0)
+  {
+    sdWriteLimit -= written;
+  }
+  return written;
+}
+
+int File::available()
+{
+  if (!impl || !impl->stream)
+  {
+    return 0;
+  }
+  long remaining = (long)size() - (long)position();
+  return remaining > 0 ? (int)remaining : 0;
+}
+
+int File::read()
+{
+  if (!impl || !impl->stream)
+  {
+    return -1;
+  }
+  int c = fgetc(impl->stream);
+  return c == EOF ? -1 : c;
+}
+
+int File::peek()
+{
+  int c = read();
+  if (c >= 0)
+  {
+    ungetc(c, impl->stream);
+  }
+  return c;
+}
+
+size_t File::read(uint8_t *buffer, size_t size)
+{
+  return impl && impl->stream ? fread(buffer, 1, size, impl->stream) : 0;
+}
+
+void File::flush()
+{
+  if (impl && impl->stream)
+  {
+    fflush(impl->stream);
+  }
+}
+
+bool File::seek(uint32_t position, SeekMode mode)
+{
+  if (!impl || !impl->stream)
+  {
+    return false;
+  }
+  int whence = mode == SeekSet ? SEEK_SET : (mode == SeekCur ? SEEK_CUR : SEEK_END);
+  return fseek(impl->stream, position, whence) == 0;
+}
+
+size_t File::position() const
+{
+  return impl && impl->stream ? ftell(impl->stream) : 0;
+}
+
+size_t File::size() const
+{
+  if (!impl || !impl->stream)
+  {
+    return 0;
+  }
+  fflush(impl->stream);
+  struct stat info;
+  return fstat(fileno(impl->stream), &info) == 0 ? info.st_size : 0;
+}
+
+void File::close()
+{
+  impl.reset();
+}
+
+File::operator bool() const
+{
+  return impl != nullptr;
+}
+
+const char *File::name() const
+{
+  return impl ? impl->name.c_str() : "";
+}
+
+const char *File::path() const
+{
+  return impl ? impl->path.c_str() : "";
+}
+
+bool File::isDirectory() const
+{
+  return impl && impl->directory;
+}
+
+File File::openNextFile(const char *mode)
+{
+  if (!impl || !impl->directory || impl->nextEntry >= impl->entries.size())
+  {
+    return File();
+  }
+  std::string path = impl->path == "/" ? "/" + impl->entries[impl->nextEntry] : impl->path + "/" + impl->entries[impl->nextEntry];
+  impl->nextEntry++;
+  return SD.open(path.c_str(), mode);
+}
+
+void File::rewindDirectory()
+{
+  if (impl)
+  {
+    impl->nextEntry = 0;
+  }
+}
+
+File FS::open(const char *path, const char *mode, bool create)
+{
+  std::string hostPath = hostSdPath(path);
+  auto impl = std::make_shared<FileImpl>();
+  impl->path = path;
+  impl->name = impl->path.substr(impl->path.find_last_of('/') + 1);
+
+  struct stat info;
+  if (stat(hostPath.c_str(), &info) == 0 && S_ISDIR(info.st_mode))
+  {
+    impl->directory = true;
+    DIR *directory = opendir(hostPath.c_str());
+    if (!directory)
+    {
+      return File();
+    }
+    while (struct dirent *entry = readdir(directory))
+    {
+      if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+      {
+        impl->entries.push_back(entry->d_name);
+      }
+    }
+    closedir(directory);
+    return File(impl);
+  }
+
+  // The ESP32 opens FILE_WRITE as "w" and FILE_APPEND as "a", both binary
+  std::string hostMode = std::string(mode) + "b";
+  impl->stream = fopen(hostPath.c_str(), hostMode.c_str());
+  if (!impl->stream)
+  {
+    return File();
+  }
+  return File(impl);
+}
+
+bool FS::exists(const char *path)
+{
+  struct stat info;
+  return stat(hostSdPath(path).c_str(), &info) == 0;
+}
+
+bool FS::remove(const char *path)
+{
+  return ::unlink(hostSdPath(path).c_str()) == 0;
+}
+
+bool FS::rename(const char *pathFrom, const char *pathTo)
+{
+  return ::rename(hostSdPath(pathFrom).c_str(), hostSdPath(pathTo).c_str()) == 0;
+}
+
+bool FS::mkdir(const char *path)
+{
+  return ::mkdir(hostSdPath(path).c_str(), 0755) == 0 || exists(path);
+}
+
+bool FS::rmdir(const char *path)
+{
+  return ::rmdir(hostSdPath(path).c_str()) == 0;
+}
+
+} // namespace fs
+
+uint64_t SDFS::cardSize()
+{
+  return 32ULL * 1024ULL * 1024ULL * 1024ULL;
+}
+
+uint64_t SDFS::totalBytes()
+{
+  return cardSize();
+}
+
+uint64_t SDFS::usedBytes()
+{
+  return 0;
+}
+
+// The firmware calls truncate() with the VFS path of the card, SD.begin() mounts it at /sd
+extern "C" int truncate(const char *path, off_t length)
+{
+  if (strncmp(path, "/sd/", 4) == 0)
+  {
+    return syscall(SYS_truncate, hostSdPath(path + 3).c_str(), length);
+  }
+  return syscall(SYS_truncate, path, length);
+}
+
+FRESULT f_getfree(const char *path, DWORD *freeClusters, FATFS **fileSystem)
+{
+  // 32 KB clusters like a card formatted with the defaults
+  static FATFS hostFileSystem = {64};
+  *freeClusters = (SD.cardSize() - SD.usedBytes()) / (hostFileSystem.csize * 512);
+  *fileSystem = &hostFileSystem;
+  return FR_OK;
+}
@@ -0,0 +1,53 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Functions of Utility.cpp used by the modules of the host build
+ *
+ * Utility.cpp depends on the whole firmware, the functions are repeated here
+ * unchanged.
+ */
+
+#include <mbedtls/md.h>
+
+#include "Utility.h"
+
+bool calculateFileSha256(File &file, char *hex)
+{
+  if (!file.seek(0))
+  {
+    return false;
+  }
+
+  mbedtls_md_context_t ctx;
+  unsigned char hash[32];
+  mbedtls_md_init(&ctx);
+  mbedtls_md_setup(&ctx, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 0);
+  mbedtls_md_starts(&ctx);
+
+  uint8_t buffer[512];
+  size_t total = 0;
+  while (file.available())
+  {
+    size_t length = file.read(buffer, sizeof(buffer));
+    if (length == 0)
+    {
+      break;
+    }
+    mbedtls_md_update(&ctx, buffer, length);
+    total += length;
+  }
+
+  mbedtls_md_finish(&ctx, hash);
+  mbedtls_md_free(&ctx);
+
+  for (size_t i = 0; i < sizeof(hash); i++)
+  {
+    sprintf(hex + 2 * i, "%02x", hash[i]);
+  }
+  return total == file.size();
+}
@@ -0,0 +1,145 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: WiFi client of the host build, a TCP socket of the host
+ */
+
+#include <WiFi.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+int WiFiClient::connect(const char *host, uint16_t port, int32_t timeout)
+{
+  stop();
+  struct addrinfo hints = {};
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo *result = nullptr;
+  if (getaddrinfo(host, String(port).c_str(), &hints, &result) != 0 || result == nullptr)
+  {
+    return 0;
+  }
+  socketFd = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+  if (socketFd >= 0 && ::connect(socketFd, result->ai_addr, result->ai_addrlen) != 0)
+  {
+    ::close(socketFd);
+    socketFd = -1;
+  }
+  freeaddrinfo(result);
+  return socketFd >= 0 ? 1 : 0;
+}
+
+uint8_t WiFiClient::connected()
+{
+  if (socketFd < 0)
+  {
+    return 0;
+  }
+  if (rxStart < rxEnd)
+  {
+    return 1;
+  }
+  uint8_t value;
+  ssize_t result = recv(socketFd, &value, 1, MSG_PEEK | MSG_DONTWAIT);
+  if (result == 0 || (result < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+  {
+    stop();
+    return 0;
+  }
+  return 1;
+}
+
+void WiFiClient::stop()
+{
+  if (socketFd >= 0)
+  {
+    ::close(socketFd);
+    socketFd = -1;
+  }
+  rxStart = rxEnd = 0;
+}
+
+int WiFiClient::setNoDelay(bool noDelay)
+{
+  int value = noDelay ? 1 : 0;
+  return socketFd >= 0 ? setsockopt(socketFd, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value)) : -1;
+}
+
+size_t WiFiClient::write(const uint8_t *buffer, size_t size)
+{
+  size_t written = 0;
+  while (socketFd >= 0 && written < size)
+  {
+    ssize_t result = send(socketFd, buffer + written, size - written, MSG_NOSIGNAL);
+    if (result <= 0)
+    {
+      stop();
+      break;
+    }
+    written += result;
+  }
+  return written;
+}
+
+bool WiFiClient::fillBuffer()
+{
+  if (rxStart < rxEnd)
+  {
+    return true;
+  }
+  if (socketFd < 0)
+  {
+    return false;
+  }
+  ssize_t result = recv(socketFd, rxBuffer, sizeof(rxBuffer), MSG_DONTWAIT);
+  if (result == 0 || (result < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+  {
+    stop();
+    return false;
+  }
+  if (result < 0)
+  {
+    return false;
+  }
+  rxStart = 0;
+  rxEnd = result;
+  return true;
+}
+
+int WiFiClient::available()
+{
+  fillBuffer();
+  return rxEnd - rxStart;
+}
+
+int WiFiClient::read()
+{
+  return fillBuffer() ? rxBuffer[rxStart++] : -1;
+}
+
+int WiFiClient::peek()
+{
+  return fillBuffer() ? rxBuffer[rxStart] : -1;
+}
+
+size_t WiFiClient::read(uint8_t *buffer, size_t size)
+{
+  if (!fillBuffer())
+  {
+    return 0;
+  }
+  size_t count = min(size, rxEnd - rxStart);
+  memcpy(buffer, rxBuffer + rxStart, count);
+  rxStart += count;
+  return count;
+}
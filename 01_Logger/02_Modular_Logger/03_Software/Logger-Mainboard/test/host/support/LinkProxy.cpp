@@ -0,0 +1,191 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: TCP proxy with one-way latency, segment loss and connection drops for the host tests
+ */
+
+#include "LinkProxy.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+
+typedef std::chrono::steady_clock Clock;
+
+LinkProxy::LinkProxy(uint16_t serverPort, const LinkConditions &conditions) : serverPort(serverPort), conditions(conditions), random(conditions.seed)
+{
+  listenFd = socket(AF_INET, SOCK_STREAM, 0);
+  int reuse = 1;
+  setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  struct sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  bind(listenFd, (struct sockaddr *)&address, sizeof(address));
+  listen(listenFd, 64);
+  socklen_t length = sizeof(address);
+  getsockname(listenFd, (struct sockaddr *)&address, &length);
+  listenPort = ntohs(address.sin_port);
+  acceptThread = std::thread(&LinkProxy::acceptLoop, this);
+}
+
+LinkProxy::~LinkProxy()
+{
+  stopping = true;
+  acceptThread.join();
+  ::close(listenFd);
+  disconnectAll();
+  for (std::thread &thread : threads)
+  {
+    thread.join();
+  }
+  for (int fd : sockets)
+  {
+    ::close(fd);
+  }
+}
+
+bool LinkProxy::chance(double probability)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  return std::uniform_real_distribution<double>(0.0, 1.0)(random) < probability;
+}
+
+void LinkProxy::disconnectAll()
+{
+  std::lock_guard<std::mutex> guard(lock);
+  dropCount++;
+  for (int fd : sockets)
+  {
+    shutdown(fd, SHUT_RDWR);
+  }
+}
+
+void LinkProxy::acceptLoop()
+{
+  while (!stopping)
+  {
+    struct pollfd descriptor = {listenFd, POLLIN, 0};
+    if (poll(&descriptor, 1, 50) <= 0)
+    {
+      continue;
+    }
+    int client = accept(listenFd, nullptr, nullptr);
+    if (client < 0)
+    {
+      continue;
+    }
+    int server = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(serverPort);
+    if (connect(server, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+      ::close(server);
+      ::close(client);
+      continue;
+    }
+    int noDelay = 1;
+    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    setsockopt(server, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    std::lock_guard<std::mutex> guard(lock);
+    sockets.push_back(client);
+    sockets.push_back(server);
+    threads.emplace_back(&LinkProxy::forward, this, client, server, false);
+    threads.emplace_back(&LinkProxy::forward, this, server, client, true);
+  }
+}
+
+void LinkProxy::forward(int source, int destination, bool towardsClient)
+{
+  struct Segment
+  {
+    Clock::time_point due;
+    std::string data;
+  };
+  std::deque<Segment> queue;
+  std::mutex queueLock;
+  std::condition_variable queueChanged;
+  bool closed = false;
+
+  // Delivers the segments when they are due, in order
+  std::thread delivery([&]()
+                       {
+    std::unique_lock<std::mutex> guard(queueLock);
+    while (true)
+    {
+      queueChanged.wait(guard, [&]() { return closed || !queue.empty(); });
+      if (queue.empty())
+      {
+        break;
+      }
+      if (Clock::now() < queue.front().due)
+      {
+        queueChanged.wait_until(guard, queue.front().due);
+        continue;
+      }
+      std::string data = queue.front().data;
+      queue.pop_front();
+      guard.unlock();
+      bool sent = ::send(destination, data.data(), data.size(), MSG_NOSIGNAL) == (ssize_t)data.size();
+      guard.lock();
+      if (!sent)
+      {
+        break;
+      }
+    }
+    shutdown(destination, SHUT_WR); });
+
+  Clock::time_point last = Clock::now();
+  char buffer[65536];
+  while (!stopping)
+  {
+    struct pollfd descriptor = {source, POLLIN, 0};
+    int ready = poll(&descriptor, 1, 50);
+    if (ready == 0)
+    {
+      continue;
+    }
+    ssize_t length = ready > 0 ? recv(source, buffer, sizeof(buffer), 0) : -1;
+    if (length <= 0)
+    {
+      break;
+    }
+    if (towardsClient && chance(conditions.drop))
+    {
+      dropCount++;
+      shutdown(source, SHUT_RDWR);
+      shutdown(destination, SHUT_RDWR);
+      break;
+    }
+    Clock::time_point due = Clock::now() + std::chrono::milliseconds(conditions.latency);
+    if (chance(conditions.loss))
+    {
+      due += std::chrono::milliseconds(conditions.rto);
+    }
+    // TCP keeps the order, a delayed segment also delays the following ones
+    due = std::max(due, last);
+    last = due;
+    std::lock_guard<std::mutex> guard(queueLock);
+    queue.push_back({due, std::string(buffer, length)});
+    queueChanged.notify_one();
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(queueLock);
+    closed = true;
+    queueChanged.notify_one();
+  }
+  delivery.join();
+}
@@ -0,0 +1,65 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: TCP proxy with one-way latency, segment loss and connection drops for the host tests
+ *
+ * A lost segment is modelled as a delay by the retransmission timeout, TCP
+ * keeps the order, so it also delays the data behind it. Connection drops
+ * are injected on the way back to the client, after the server got the data,
+ * which is the case that leaves unacknowledged messages on the logger.
+ */
+
+#ifndef LINK_PROXY_H
+#define LINK_PROXY_H
+
+#include <atomic>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+struct LinkConditions
+{
+  unsigned long latency = 0; // one way, ms
+  double loss = 0.0;         // probability of a lost segment
+  unsigned long rto = 200;   // retransmission timeout, ms
+  double drop = 0.0;         // probability of a connection drop per segment to the client
+  unsigned seed = 1;
+};
+
+class LinkProxy
+{
+public:
+  LinkProxy(uint16_t serverPort, const LinkConditions &conditions);
+  ~LinkProxy();
+
+  uint16_t port() const { return listenPort; }
+  unsigned drops() const { return dropCount; }
+
+  // Closes all connections like a lost WiFi, counted as a drop
+  void disconnectAll();
+
+private:
+  uint16_t serverPort;
+  LinkConditions conditions;
+  int listenFd = -1;
+  uint16_t listenPort = 0;
+  std::atomic<bool> stopping{false};
+  std::atomic<unsigned> dropCount{0};
+  std::mutex lock;
+  std::mt19937 random;
+  std::thread acceptThread;
+  std::vector<std::thread> threads;
+  std::vector<int> sockets;
+
+  bool chance(double probability);
+  void acceptLoop();
+  void forward(int source, int destination, bool towardsClient);
+};
+
+#endif
@@ -0,0 +1,414 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Host test of the bulk file transfer in BulkTransfer.cpp
+ *
+ * transmitFileBulk() sends a file of the SD card through the HostBroker to
+ * a stand-in for the "Bulk transfer" node of the Node-RED flow, which loses
+ * a share of the QoS 0 chunks. The records forwarded by the deck box must
+ * match the file, and only missing chunks may be sent again.
+ *
+ * HYFIVE_BULK_FILE=<measurement file> sends a file of the SD card with
+ * 0 %, 1 % and 10 % lost chunks (HYFIVE_BULK_CHUNK_SIZE, default 2048) and
+ * prints the messages and acknowledgements compared with the line upload.
+ */
+
+#include <MQTT.h>
+#include <SD.h>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <mbedtls/md.h>
+#include <random>
+#include <sstream>
+
+#include "BulkTransfer.h"
+#include "HostBroker.h"
+#include "HostLog.h"
+#include "loggerConfig.h"
+
+#define BULK_STATE_INCOMPLETE 0
+#define BULK_STATE_COMPLETE 1
+
+// PUBACK of a QoS 1 message
+#define PUBACK_SIZE 4
+
+static std::string sha256Hex(const std::string &data)
+{
+  mbedtls_md_context_t ctx;
+  unsigned char hash[32];
+  mbedtls_md_init(&ctx);
+  mbedtls_md_setup(&ctx, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 0);
+  mbedtls_md_starts(&ctx);
+  mbedtls_md_update(&ctx, (const unsigned char *)data.data(), data.size());
+  mbedtls_md_finish(&ctx, hash);
+  char hex[65];
+  for (int i = 0; i < 32; i++)
+  {
+    sprintf(hex + 2 * i, "%02x", hash[i]);
+  }
+  return hex;
+}
+
+static std::vector<std::string> recordsOf(const std::string &data)
+{
+  std::vector<std::string> records;
+  std::istringstream stream(data);
+  std::string line;
+  while (std::getline(stream, line))
+  {
+    if (!line.empty() && line.back() == '\r')
+    {
+      line.pop_back();
+    }
+    if (line.find_first_not_of(" \t") != std::string::npos)
+    {
+      records.push_back(line);
+    }
+  }
+  return records;
+}
+
+static unsigned jsonNumber(const std::string &json, const std::string &key)
+{
+  size_t position = json.find("\"" + key + "\":");
+  return position == std::string::npos ? 0 : strtoul(json.c_str() + position + key.size() + 3, nullptr, 10);
+}
+
+static std::string jsonString(const std::string &json, const std::string &key)
+{
+  size_t position = json.find("\"" + key + "\":\"");
+  if (position == std::string::npos)
+  {
+    return "";
+  }
+  position += key.size() + 4;
+  return json.substr(position, json.find('"', position) - position);
+}
+
+// Same behaviour as the "Bulk transfer" function node of the Node-RED flow
+class BulkDeckbox
+{
+public:
+  double loss = 0.0;
+  int answerLimit = -1; // queries that are answered, -1 all
+  bool corruptNextChunk = false;
+  std::vector<std::string> forwarded;
+  unsigned chunksReceived = 0;
+  unsigned queries = 0;
+  unsigned statusBytes = 0;
+
+  BulkDeckbox(HostBroker &broker, unsigned seed) : broker(broker), random(seed)
+  {
+    broker.onPublish([this](const MqttPublish &message)
+                     {
+      if (message.topic == BULK_CHUNK_TOPIC)
+      {
+        onChunk(message.payload);
+      }
+      else if (message.topic == BULK_QUERY_TOPIC)
+      {
+        onQuery(message.payload);
+      } });
+  }
+
+  ~BulkDeckbox() { broker.onPublish(nullptr); }
+
+private:
+  struct Transfer
+  {
+    unsigned transfer = 0;
+    unsigned chunks = 0;
+    unsigned chunkSize = 0;
+    unsigned size = 0;
+    std::string sha256;
+    std::vector<std::string> received;
+    std::vector<bool> present;
+    bool done = false;
+  };
+
+  HostBroker &broker;
+  std::mt19937 random;
+  std::mutex lock;
+  std::map<unsigned, Transfer> transfers;
+
+  void onChunk(const std::string &payload)
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    if (payload.size() < BULK_CHUNK_HEADER_SIZE || std::uniform_real_distribution<double>(0.0, 1.0)(random) < loss)
+    {
+      return;
+    }
+    unsigned loggerId = mqttReadUint16(payload, 0);
+    unsigned transferId = mqttReadUint16(payload, 2);
+    unsigned index = mqttReadUint16(payload, 4);
+    auto entry = transfers.find(loggerId);
+    if (entry == transfers.end() || entry->second.done || entry->second.transfer != transferId || index >= entry->second.chunks)
+    {
+      return;
+    }
+    chunksReceived++;
+    entry->second.received[index] = payload.substr(BULK_CHUNK_HEADER_SIZE);
+    entry->second.present[index] = true;
+    if (corruptNextChunk)
+    {
+      entry->second.received[index][0] ^= 0x01;
+      corruptNextChunk = false;
+    }
+  }
+
+  void onQuery(const std::string &query)
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    queries++;
+    if (answerLimit >= 0 && queries > (unsigned)answerLimit)
+    {
+      return;
+    }
+    unsigned loggerId = jsonNumber(query, "logger_id");
+    Transfer &transfer = transfers[loggerId];
+    if (transfer.sha256 != jsonString(query, "sha256") || transfer.chunks != jsonNumber(query, "chunks") || transfer.chunkSize != jsonNumber(query, "chunk_size"))
+    {
+      transfer = Transfer();
+      transfer.transfer = jsonNumber(query, "transfer");
+      transfer.chunks = jsonNumber(query, "chunks");
+      transfer.chunkSize = jsonNumber(query, "chunk_size");
+      transfer.size = jsonNumber(query, "size");
+      transfer.sha256 = jsonString(query, "sha256");
+      transfer.received.assign(transfer.chunks, "");
+      transfer.present.assign(transfer.chunks, false);
+    }
+
+    if (!transfer.done && std::find(transfer.present.begin(), transfer.present.end(), false) == transfer.present.end())
+    {
+      std::string data;
+      for (const std::string &chunk : transfer.received)
+      {
+        data += chunk;
+      }
+      if (data.size() == transfer.size && sha256Hex(data) == transfer.sha256)
+      {
+        transfer.done = true;
+        std::vector<std::string> records = recordsOf(data);
+        forwarded.insert(forwarded.end(), records.begin(), records.end());
+      }
+      else
+      {
+        transfer.present.assign(transfer.chunks, false);
+      }
+    }
+
+    std::string status = mqttUint16(loggerId) + mqttUint16(transfer.transfer) + (char)(transfer.done ? BULK_STATE_COMPLETE : BULK_STATE_INCOMPLETE) + mqttUint16(transfer.chunks);
+    std::string bitmap(transfer.done ? 0 : (transfer.chunks + 7) / 8, '\0');
+    for (unsigned i = 0; i < bitmap.size() * 8 && i < transfer.chunks; i++)
+    {
+      if (!transfer.present[i])
+      {
+        bitmap[i / 8] |= 1 << (i % 8);
+      }
+    }
+    statusBytes += status.size() + bitmap.size();
+    broker.publish(BULK_STATUS_TOPIC, status + bitmap, 1);
+  }
+};
+
+static void handleMessage(MQTTClient *, char *topic, char *payload, int length)
+{
+  handleBulkStatusMessage(topic, (const uint8_t *)payload, length);
+}
+
+static std::string buildMeasurementFile(int records)
+{
+  std::string content;
+  for (int i = 0; i < records; i++)
+  {
+    char line[200];
+    snprintf(line, sizeof(line), "{\"logger_id\":7,\"time\":%d,\"pressure\":%.2f,\"temperature\":%.3f,\"conductivity\":%.3f}\r\n", 1717243200 + i, 1.5 + i * 0.1, 12.0 + i * 0.001, 35.0 - i * 0.002);
+    content += line;
+  }
+  return content;
+}
+
+static void writeSdFile(const char *path, const std::string &content)
+{
+  File file = SD.open(path, FILE_WRITE);
+  file.write((const uint8_t *)content.data(), content.size());
+  file.close();
+}
+
+class BulkTransferTest : public ::testing::Test
+{
+protected:
+  HostBroker broker;
+  WiFiClient network;
+  MQTTClient client{1024, MQTT_WRITE_BUFFER_SIZE};
+
+  void SetUp() override
+  {
+    hostUseTemporarySd({"/measurements/mqtt_measurements"});
+    hostClearLog();
+    configRTC.logger_id = 7;
+    client.begin("127.0.0.1", broker.port(), network);
+    client.onMessageAdvanced(handleMessage);
+    ASSERT_TRUE(client.connect("logger7"));
+    ASSERT_TRUE(client.subscribe(BULK_STATUS_TOPIC, 1));
+  }
+
+  void TearDown() override { client.disconnect(); }
+
+  bool transmit(const char *path, size_t chunkSize)
+  {
+    File file = SD.open(path, FILE_READ);
+    bool complete = transmitFileBulk(client, file, "data", chunkSize);
+    file.close();
+    return complete;
+  }
+};
+
+TEST_F(BulkTransferTest, CompleteWithoutLoss)
+{
+  std::string content = buildMeasurementFile(300);
+  writeSdFile("/measurements/mqtt_measurements/m.json", content);
+  BulkDeckbox deckbox(broker, 1);
+
+  ASSERT_TRUE(transmit("/measurements/mqtt_measurements/m.json", 1024));
+  unsigned chunks = (content.size() + 1023) / 1024;
+  EXPECT_EQ(deckbox.forwarded, recordsOf(content));
+  EXPECT_EQ(broker.receivedCount(BULK_CHUNK_TOPIC), chunks);
+  // One query for the missing chunks, one that confirms the file
+  EXPECT_EQ(deckbox.queries, 2u);
+  EXPECT_TRUE(hostLogContains(std::to_string(chunks) + " chunks | " + std::to_string(chunks) + " sent | 1 queries"));
+}
+
+TEST_F(BulkTransferTest, LostChunksAreSentAgain)
+{
+  std::string content = buildMeasurementFile(600);
+  writeSdFile("/measurements/mqtt_measurements/m.json", content);
+  unsigned chunks = (content.size() + 511) / 512;
+
+  for (double loss : {0.1, 0.3})
+  {
+    broker.clearReceived();
+    BulkDeckbox deckbox(broker, 3);
+    deckbox.loss = loss;
+    ASSERT_TRUE(transmit("/measurements/mqtt_measurements/m.json", 512)) << "loss " << loss;
+    EXPECT_EQ(deckbox.forwarded, recordsOf(content));
+    EXPECT_GT(broker.receivedCount(BULK_CHUNK_TOPIC), chunks);
+    // Every chunk that arrived was sent only once
+    EXPECT_EQ(deckbox.chunksReceived, chunks);
+  }
+}
+
+TEST_F(BulkTransferTest, InterruptedTransferSendsOnlyMissingChunks)
+{
+  std::string content = buildMeasurementFile(400);
+  writeSdFile("/measurements/mqtt_measurements/m.json", content);
+  unsigned chunks = (content.size() + 1023) / 1024;
+  BulkDeckbox deckbox(broker, 5);
+
+  // Half of the chunks arrive, then the deck box does not answer anymore
+  deckbox.loss = 0.5;
+  deckbox.answerLimit = 1;
+  ASSERT_FALSE(transmit("/measurements/mqtt_measurements/m.json", 1024));
+  EXPECT_EQ(broker.receivedCount(BULK_CHUNK_TOPIC), chunks);
+  unsigned missing = chunks - deckbox.chunksReceived;
+  ASSERT_GT(missing, 0u);
+
+  // The next attempt continues the transfer with the chunks the deck box kept
+  broker.clearReceived();
+  deckbox.loss = 0.0;
+  deckbox.answerLimit = -1;
+  ASSERT_TRUE(transmit("/measurements/mqtt_measurements/m.json", 1024));
+  EXPECT_EQ(broker.receivedCount(BULK_CHUNK_TOPIC), missing);
+  EXPECT_EQ(deckbox.forwarded, recordsOf(content));
+}
+
+TEST_F(BulkTransferTest, CorruptFileIsSentAgain)
+{
+  std::string content = buildMeasurementFile(200);
+  writeSdFile("/measurements/mqtt_measurements/m.json", content);
+  unsigned chunks = (content.size() + 1023) / 1024;
+  BulkDeckbox deckbox(broker, 7);
+  deckbox.corruptNextChunk = true;
+
+  ASSERT_TRUE(transmit("/measurements/mqtt_measurements/m.json", 1024));
+  EXPECT_EQ(broker.receivedCount(BULK_CHUNK_TOPIC), 2 * chunks);
+  EXPECT_EQ(deckbox.forwarded, recordsOf(content));
+}
+
+TEST_F(BulkTransferTest, NoStatusFailsAndKeepsFile)
+{
+  writeSdFile("/measurements/mqtt_measurements/m.json", buildMeasurementFile(50));
+  BulkDeckbox deckbox(broker, 9);
+  deckbox.answerLimit = 0;
+
+  EXPECT_FALSE(transmit("/measurements/mqtt_measurements/m.json", 1024));
+  EXPECT_TRUE(hostLogContains("Bulk transfer: no status from the deck box"));
+  EXPECT_TRUE(SD.exists("/measurements/mqtt_measurements/m.json"));
+}
+
+TEST_F(BulkTransferTest, StatusOfOtherLoggerIsIgnored)
+{
+  writeSdFile("/measurements/mqtt_measurements/m.json", buildMeasurementFile(50));
+  broker.onPublish([this](const MqttPublish &message)
+                   {
+    if (message.topic == BULK_QUERY_TOPIC)
+    {
+      unsigned transfer = jsonNumber(message.payload, "transfer");
+      broker.publish(BULK_STATUS_TOPIC, mqttUint16(8) + mqttUint16(transfer) + (char)BULK_STATE_COMPLETE + mqttUint16(1), 1);
+    } });
+
+  EXPECT_FALSE(transmit("/measurements/mqtt_measurements/m.json", 1024));
+  broker.onPublish(nullptr);
+}
+
+TEST(BulkTransferFits, ChunkLimit)
+{
+  EXPECT_TRUE(bulkTransferFits(BULK_MAX_CHUNKS * 1024u, 1024));
+  EXPECT_FALSE(bulkTransferFits(BULK_MAX_CHUNKS * 1024u + 1, 1024));
+  EXPECT_FALSE(bulkTransferFits(100, 0));
+}
+
+TEST_F(BulkTransferTest, RecordedFile)
+{
+  const char *path = getenv("HYFIVE_BULK_FILE");
+  if (path == nullptr)
+  {
+    GTEST_SKIP() << "HYFIVE_BULK_FILE not set";
+  }
+  std::ifstream stream(path, std::ios::binary);
+  ASSERT_TRUE(stream.good()) << path;
+  std::string content((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+  const char *size = getenv("HYFIVE_BULK_CHUNK_SIZE");
+  size_t chunkSize = min(size ? strtoul(size, nullptr, 10) : 2048ul, (unsigned long)BULK_MAX_CHUNK_SIZE);
+  if (!bulkTransferFits(content.size(), chunkSize))
+  {
+    GTEST_SKIP() << "more than " << BULK_MAX_CHUNKS << " chunks, the logger uses the line upload";
+  }
+  writeSdFile("/measurements/mqtt_measurements/recorded.json", content);
+
+  size_t lines = recordsOf(content).size();
+  unsigned chunks = (content.size() + chunkSize - 1) / chunkSize;
+  printf("%zu bytes, %zu lines, %u chunks of %zu bytes\n", content.size(), lines, chunks, chunkSize);
+  printf("%14s %9s %7s %10s %7s\n", "upload", "messages", "acks", "ack bytes", "resent");
+  printf("%14s %9zu %7zu %10zu %7s\n", "per line QoS 1", lines, lines, lines * PUBACK_SIZE, "-");
+  for (double loss : {0.0, 0.01, 0.1})
+  {
+    broker.clearReceived();
+    BulkDeckbox deckbox(broker, 1);
+    deckbox.loss = loss;
+    ASSERT_TRUE(transmit("/measurements/mqtt_measurements/recorded.json", chunkSize));
+    EXPECT_EQ(deckbox.forwarded, recordsOf(content));
+    size_t sent = broker.receivedCount(BULK_CHUNK_TOPIC);
+    // PUBACK of each query, the status messages and their PUBACKs from the logger
+    size_t acks = 3 * deckbox.queries;
+    size_t ackBytes = 2 * PUBACK_SIZE * deckbox.queries + deckbox.statusBytes + deckbox.queries * (4 + strlen(BULK_STATUS_TOPIC));
+    char label[32];
+    snprintf(label, sizeof(label), "bulk loss %g", loss);
+    printf("%14s %9zu %7zu %10zu %7zu\n", label, sent + deckbox.queries, acks, ackBytes, sent - chunks);
+  }
+}
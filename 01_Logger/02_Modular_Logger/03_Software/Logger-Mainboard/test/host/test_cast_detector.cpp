@@ -0,0 +1,197 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Host test of the cast detection in sample_cast.cpp
+ *
+ * Replays pressure traces through addCastSample() and performSampleCast()
+ * and compares every decision with a least-squares fit over the window that
+ * is calculated from scratch. HYFIVE_CAST_TRACE names a recorded trace with
+ * one "unixtime,value" pair per line, as in the former sample_cast.txt.
+ */
+
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <vector>
+
+#include "SystemVariables.h"
+#include "sample_cast.h"
+
+struct TraceSample
+{
+  uint32_t time;
+  float pressure;
+};
+
+// Surface, descent, bottom phase and ascent in the unit of the cast sensor (e.g. mbar)
+static std::vector<TraceSample> syntheticTrace(uint32_t period = 2, float depth = 2000.0f, float speed = 25.0f, uint32_t bottom = 300, float noise = 2.0f)
+{
+  std::vector<TraceSample> trace;
+  uint32_t t = 1717243200;
+  float p = 1013.0f;
+  uint32_t seed = 1;
+  auto jitter = [&]()
+  {
+    seed = seed * 1103515245 + 12345;
+    return ((seed & 0x7FFFFFFF) / 2147483648.0f - 0.5f) * 2 * noise;
+  };
+
+  for (int i = 0; i < 30; i++, t += period)
+  {
+    trace.push_back({t, p + jitter()});
+  }
+  while (p < 1013.0f + depth)
+  {
+    p += speed * period;
+    trace.push_back({t, p + jitter()});
+    t += period;
+  }
+  for (uint32_t i = 0; i < bottom / period; i++, t += period)
+  {
+    trace.push_back({t, p + jitter()});
+  }
+  while (p > 1013.0f)
+  {
+    p -= speed * period;
+    trace.push_back({t, p + jitter()});
+    t += period;
+  }
+  return trace;
+}
+
+// Least-squares rate over the window, calculated from scratch
+static double referenceRate(const std::deque<TraceSample> &window)
+{
+  double n = window.size();
+  double sumT = 0, sumP = 0, sumTT = 0, sumTP = 0;
+  for (const TraceSample &sample : window)
+  {
+    double t = (double)sample.time - window.front().time;
+    sumT += t;
+    sumP += sample.pressure;
+    sumTT += t * t;
+    sumTP += t * sample.pressure;
+  }
+  double denominator = n * sumTT - sumT * sumT;
+  return denominator > 0 ? fabs((n * sumTP - sumT * sumP) / denominator) : 0;
+}
+
+struct ReplayResult
+{
+  size_t fastSampling = 0;
+  size_t differences = 0;
+  double microsecondsPerSample = 0;
+};
+
+// The logger evaluates the window before the new sample is added
+static ReplayResult replay(const std::vector<TraceSample> &trace, float threshold, int intervals)
+{
+  configRTC.sample_cast_enable = true;
+  configRTC.cast_det_sensor_threshold = threshold;
+  sampleCastIntervals = intervals;
+  resetCastDetector();
+
+  size_t windowSize = constrain(intervals + 1, 2, CAST_WINDOW_MAX);
+  std::deque<TraceSample> window;
+  ReplayResult result;
+  double elapsed = 0;
+  for (const TraceSample &sample : trace)
+  {
+    auto start = std::chrono::steady_clock::now();
+    bool fast = performSampleCast();
+    addCastSample(sample.time, sample.pressure);
+    elapsed += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+    bool expected = window.size() < windowSize || referenceRate(window) > threshold;
+    result.fastSampling += fast;
+    result.differences += fast != expected;
+    window.push_back(sample);
+    if (window.size() > windowSize)
+    {
+      window.pop_front();
+    }
+  }
+  result.microsecondsPerSample = trace.empty() ? 0 : elapsed / trace.size();
+  return result;
+}
+
+TEST(CastDetector, SyntheticCastMatchesReference)
+{
+  std::vector<TraceSample> trace = syntheticTrace();
+  ReplayResult result = replay(trace, 5.0f, 3);
+
+  EXPECT_EQ(result.differences, 0u);
+  // Descent and ascent (80 samples) are sampled fast, surface and bottom phase are not
+  EXPECT_GE(result.fastSampling, 80u);
+  EXPECT_LE(result.fastSampling, 90u);
+  printf("samples %zu, fast sampling %zu, %.3f us per sample\n", trace.size(), result.fastSampling, result.microsecondsPerSample);
+}
+
+TEST(CastDetector, RunningSumsDoNotDriftOverLongDeployments)
+{
+  std::vector<TraceSample> trace;
+  for (int cast = 0; cast < 200; cast++)
+  {
+    std::vector<TraceSample> part = syntheticTrace();
+    uint32_t offset = trace.empty() ? 0 : trace.back().time + 2 - part.front().time;
+    for (TraceSample sample : part)
+    {
+      sample.time += offset;
+      trace.push_back(sample);
+    }
+  }
+  for (int intervals : {1, 3, 10, CAST_WINDOW_MAX - 1})
+  {
+    EXPECT_EQ(replay(trace, 5.0f, intervals).differences, 0u) << "intervals " << intervals;
+  }
+}
+
+TEST(CastDetector, NotEnoughSamplesOrDisabledMeansFastSampling)
+{
+  configRTC.cast_det_sensor_threshold = 5.0f;
+  sampleCastIntervals = 3;
+  resetCastDetector();
+  configRTC.sample_cast_enable = true;
+  for (uint32_t t = 0; t < 3; t++)
+  {
+    addCastSample(1000 + t, 1013.0f);
+    EXPECT_TRUE(performSampleCast());
+  }
+  addCastSample(1003, 1013.0f);
+  EXPECT_FALSE(performSampleCast());
+
+  configRTC.sample_cast_enable = false;
+  EXPECT_TRUE(performSampleCast());
+}
+
+TEST(CastDetector, RecordedTrace)
+{
+  const char *path = getenv("HYFIVE_CAST_TRACE");
+  if (path == nullptr)
+  {
+    GTEST_SKIP() << "HYFIVE_CAST_TRACE is not set";
+  }
+  std::ifstream input(path);
+  ASSERT_TRUE(input.good()) << path;
+  std::vector<TraceSample> trace;
+  std::string line;
+  while (std::getline(input, line))
+  {
+    size_t comma = line.find(',');
+    if (comma != std::string::npos && comma > 0)
+    {
+      trace.push_back({(uint32_t)strtod(line.c_str(), nullptr), strtof(line.c_str() + comma + 1, nullptr)});
+    }
+  }
+  float threshold = getenv("HYFIVE_CAST_THRESHOLD") ? atof(getenv("HYFIVE_CAST_THRESHOLD")) : 5.0f;
+  int intervals = getenv("HYFIVE_CAST_INTERVALS") ? atoi(getenv("HYFIVE_CAST_INTERVALS")) : 3;
+  ReplayResult result = replay(trace, threshold, intervals);
+  EXPECT_EQ(result.differences, 0u);
+  printf("samples %zu, fast sampling %zu, %.3f us per sample\n", trace.size(), result.fastSampling, result.microsecondsPerSample);
+}
@@ -0,0 +1,183 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Host test of the .hfz compression in Compression.cpp against Tools/hfz.py
+ *
+ * Files are compressed with compressFile() on the SD card of the test and
+ * decompressed with hfz.py, which is used for the backups copied from the
+ * card. hfz.py compresses the same files, the firmware must accept its
+ * streams and, as both use the same match search and window sliding,
+ * produce the same bytes.
+ * Without Python, only the golden vector of hfz.py is checked.
+ */
+
+#include <SD.h>
+#include <algorithm>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <random>
+
+#include "Compression.h"
+#include "HostLog.h"
+
+#define SOURCE "/backup/measurements/measurement.json"
+#define COMPRESSED "/backup/measurements/measurement.json.hfz"
+
+static std::string readFile(const char *path)
+{
+  std::string content;
+  File file = SD.open(path, FILE_READ);
+  while (file && file.available())
+  {
+    content += (char)file.read();
+  }
+  return content;
+}
+
+static void writeFile(const char *path, const std::string &content)
+{
+  File file = SD.open(path, FILE_WRITE);
+  file.write((const uint8_t *)content.data(), content.size());
+  file.close();
+}
+
+static std::string hex(const std::string &data)
+{
+  std::string text;
+  char digits[3];
+  for (unsigned char c : data)
+  {
+    snprintf(digits, sizeof(digits), "%02x", c);
+    text += digits;
+  }
+  return text;
+}
+
+class CompressionTest : public ::testing::Test
+{
+protected:
+  void SetUp() override
+  {
+    hostClearLog();
+    hostUseTemporarySd({"/backup/measurements"});
+  }
+
+  static bool pythonAvailable()
+  {
+    return system((std::string(HYFIVE_PYTHON) + " -c 'import zlib' > /dev/null 2>&1").c_str()) == 0;
+  }
+
+  // Runs hfz.py <command> on a file of the SD card, returns the output file
+  static bool runHfz(const char *command, const char *input, std::string &output)
+  {
+    std::string outputPath = hostSdPath(input) + ".out";
+    std::string line = std::string(HYFIVE_PYTHON) + " " + HYFIVE_TOOLS_DIR "/hfz.py " + command + " " + hostSdPath(input) + " -o " + outputPath + " > /dev/null 2>&1";
+    bool success = system(line.c_str()) == 0;
+    std::ifstream file(outputPath, std::ios::binary);
+    output.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    remove(outputPath.c_str());
+    return success;
+  }
+
+  // Compresses the content with the firmware and with hfz.py, each one decoding the other
+  static void compareWithHfz(const std::string &content)
+  {
+    writeFile(SOURCE, content);
+    ASSERT_TRUE(compressFile(SOURCE, COMPRESSED));
+    std::string stream = readFile(COMPRESSED);
+
+    std::string decompressed;
+    EXPECT_TRUE(runHfz("decompress", COMPRESSED, decompressed));
+    EXPECT_TRUE(decompressed == content) << "hfz.py decoded " << decompressed.size() << " of " << content.size() << " bytes";
+
+    std::string hostStream;
+    EXPECT_TRUE(runHfz("compress", SOURCE, hostStream));
+    size_t difference = std::mismatch(stream.begin(), stream.end(), hostStream.begin(), hostStream.end()).first - stream.begin();
+    EXPECT_EQ(difference, stream.size()) << "streams differ at byte " << difference << " of " << stream.size() << " and " << hostStream.size();
+    writeFile(COMPRESSED, hostStream);
+    EXPECT_TRUE(verifyCompressedFile(COMPRESSED));
+  }
+
+  static std::string measurementLines(size_t count)
+  {
+    std::string lines;
+    for (size_t n = 0; n < count; n++)
+    {
+      char line[160];
+      snprintf(line, sizeof(line), "{\"time\":\"2024-06-01T%02u:%02u:%02uZ\",\"logger_id\":7,\"deployment_id\":12,\"temperature\":\"%.2f\",\"pressure\":\"%.3f\"}\r\n",
+               (unsigned)(n / 3600 % 24), (unsigned)(n / 60 % 60), (unsigned)(n % 60), 12.0 + (n % 97) * 0.01, 1.0 + n * 0.0371);
+      lines += line;
+    }
+    return lines;
+  }
+};
+
+TEST_F(CompressionTest, GoldenVector)
+{
+  std::string content = "{\"time\":\"2024-06-01T12:00:00Z\",\"logger_id\":7}\r\n{\"time\":\"2024-06-01T12:00:10Z\",\"logger_id\":7}\r\n";
+  writeFile(SOURCE, content);
+  ASSERT_TRUE(compressFile(SOURCE, COMPRESSED));
+  // hfz.compress() of the same lines
+  EXPECT_EQ(hex(readFile(COMPRESSED)),
+            "48465a31010b0400bdc8ae969b6d96453a914ca61329a4b6613696cc2635498cca753098001056a452c915b2df67b3d96e55fb4d92453a9bdf61b0a02ef02e5988177c36145e000000407992be");
+}
+
+TEST_F(CompressionTest, MeasurementFileDecodesWithHfz)
+{
+  if (!pythonAvailable())
+  {
+    GTEST_SKIP() << "python3 not found";
+  }
+  // Many times the window, so the window slides
+  compareWithHfz(measurementLines(2000));
+  EXPECT_GT(compressionRatio(), 2.0f);
+}
+
+TEST_F(CompressionTest, EdgeCasesDecodeWithHfz)
+{
+  if (!pythonAvailable())
+  {
+    GTEST_SKIP() << "python3 not found";
+  }
+  std::mt19937 random(1);
+  std::string noise(10000, '\0');
+  for (char &c : noise)
+  {
+    c = (char)random();
+  }
+  // A block repeated at the largest distance and one byte beyond it
+  std::string block = noise.substr(0, 2048);
+  std::string longBlock = noise.substr(0, 2049);
+  // Ends at the first slide of the window and just after it
+  std::string lines = measurementLines(100);
+
+  for (const std::string &content : {std::string(), std::string("x"), std::string("abc"), std::string(5000, 'a'), noise, block + block + block, longBlock + longBlock + longBlock,
+                                     measurementLines(5) + noise.substr(0, 300) + measurementLines(40), lines.substr(0, 4096), lines.substr(0, 4097), lines.substr(0, 4079)})
+  {
+    SCOPED_TRACE(content.size());
+    compareWithHfz(content);
+  }
+}
+
+TEST_F(CompressionTest, DamagedStreamIsRejected)
+{
+  std::string content = measurementLines(200);
+  writeFile(SOURCE, content);
+  ASSERT_TRUE(compressFile(SOURCE, COMPRESSED));
+  std::string stream = readFile(COMPRESSED);
+
+  for (size_t position : {sizeof(CompressionHeader) + 1, stream.size() / 2, stream.size() - 2})
+  {
+    std::string damaged = stream;
+    damaged[position] ^= 0x04;
+    writeFile(COMPRESSED, damaged);
+    EXPECT_FALSE(verifyCompressedFile(COMPRESSED)) << "byte " << position;
+  }
+  writeFile(COMPRESSED, stream.substr(0, stream.size() - 20));
+  EXPECT_FALSE(verifyCompressedFile(COMPRESSED));
+}
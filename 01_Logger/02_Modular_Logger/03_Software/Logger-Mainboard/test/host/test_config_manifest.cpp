@@ -0,0 +1,180 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Host test of the wait for the config manifest in ConfigManifest.cpp
+ *
+ * The deck box publishes the retained manifest of logger 7 on the HostBroker,
+ * late or not at all. The logger must decide about the config request of the
+ * wake on the manifest that arrives within CONFIG_MANIFEST_WAIT. The MQTT
+ * callback must not read the SD card, the manifest is compared afterwards.
+ */
+
+#include <MQTT.h>
+#include <SD.h>
+#include <gtest/gtest.h>
+#include <thread>
+
+#include "ConfigManifest.h"
+#include "FileManifest.h"
+#include "HostBroker.h"
+#include "HostLog.h"
+#include "SystemVariables.h"
+#include "Utility.h"
+
+#define START_TIME 1717243200UL
+#define CONFIG_FILE "logger_7_config_1717243200.json"
+#define MANIFEST_TOPIC "hyfive/configManifest/7"
+
+static void handleMessage(MQTTClient *, char *topic, char *payload, int length)
+{
+  handleConfigManifestMessage(topic, (const uint8_t *)payload, length);
+}
+
+class ConfigManifestTest : public ::testing::Test
+{
+protected:
+  HostBroker broker;
+  WiFiClient network;
+  MQTTClient client{1024, 1024};
+  std::string currentManifest;
+
+  void SetUp() override
+  {
+    // The manifest state is kept like over deep sleep, every test starts after CONFIG_MANIFEST_VALID
+    static unsigned long testTime = START_TIME;
+    testTime += CONFIG_MANIFEST_VALID + 1;
+    hostSetRtcTime(testTime);
+    hostClearLog();
+    hostUseTemporarySd({"/measurements/mqtt_header", "/measurements/mqtt_measurements", "/log", "/loggerConfig", "/backup/header", "/backup/measurements", "/backup/log", "/updateFW"});
+    invalidateFileManifest();
+    configRTC.logger_id = 7;
+
+    File file = SD.open("/loggerConfig/" CONFIG_FILE, FILE_WRITE);
+    file.print("{\"logger_id\":7}");
+    file.close();
+    file = SD.open("/loggerConfig/" CONFIG_FILE);
+    char hex[65];
+    ASSERT_TRUE(calculateFileSha256(file, hex));
+    file.close();
+    currentManifest = std::string(CONFIG_FILE ":") + std::string(hex) + ":";
+
+    client.begin("127.0.0.1", broker.port(), network);
+    client.onMessageAdvanced(handleMessage);
+    ASSERT_TRUE(client.connect("logger7"));
+  }
+
+  void TearDown() override
+  {
+    client.disconnect();
+    hostSetRtcTime(0);
+  }
+
+  // A manifest received on an earlier wake, the deck box is known to send them
+  void receivedBefore(const std::string &manifest)
+  {
+    ASSERT_TRUE(handleConfigManifestMessage(MANIFEST_TOPIC, (const uint8_t *)manifest.data(), manifest.size()));
+  }
+
+  // Manifest of the config file with the given content, written past the file manifest
+  static std::string manifestOf(const char *configFile, const char *content)
+  {
+    File file = SD.open(String("/loggerConfig/") + configFile, FILE_WRITE);
+    file.print(content);
+    file.close();
+    invalidateFileManifest();
+    file = SD.open(String("/loggerConfig/") + configFile);
+    char hex[65];
+    EXPECT_TRUE(calculateFileSha256(file, hex));
+    file.close();
+    return std::string(configFile) + ":" + std::string(hex) + ":";
+  }
+
+  unsigned long subscribeTimed()
+  {
+    unsigned long start = millis();
+    subscribeConfigManifest(client);
+    return millis() - start;
+  }
+};
+
+TEST_F(ConfigManifestTest, WaitsForLateManifest)
+{
+  receivedBefore(currentManifest);
+  ASSERT_FALSE(configManifestUpdatePending());
+
+  std::thread deckBox([this]()
+                      {
+    delay(100);
+    broker.publish(MANIFEST_TOPIC, "logger_7_config_1717300000.json:0123:", 1, true); });
+  unsigned long waited = subscribeTimed();
+  deckBox.join();
+
+  EXPECT_GE(waited, 100u);
+  EXPECT_LT(waited, (unsigned long)CONFIG_MANIFEST_WAIT);
+  EXPECT_TRUE(configManifestUpdatePending());
+}
+
+TEST_F(ConfigManifestTest, RetainedManifestEndsTheWait)
+{
+  receivedBefore(currentManifest);
+  broker.publish(MANIFEST_TOPIC, "logger_7_config_1717300000.json:0123:", 1, true);
+  EXPECT_LT(subscribeTimed(), 100u);
+  EXPECT_TRUE(configManifestUpdatePending());
+}
+
+TEST_F(ConfigManifestTest, GivesUpWithoutManifest)
+{
+  receivedBefore(currentManifest);
+  // The manifest of another logger does not end the wait
+  broker.publish("hyfive/configManifest/8", "logger_8_config_1717300000.json:0123:", 1, true);
+  EXPECT_GE(subscribeTimed(), (unsigned long)CONFIG_MANIFEST_WAIT);
+  EXPECT_FALSE(configManifestUpdatePending());
+  EXPECT_TRUE(hostLogContains("Config manifest: none within 500 ms"));
+}
+
+TEST_F(ConfigManifestTest, NoWaitForDeckBoxWithoutManifests)
+{
+  EXPECT_LT(subscribeTimed(), 100u);
+  EXPECT_FALSE(hostLogContains("Config manifest: none"));
+}
+
+TEST_F(ConfigManifestTest, CallbackDoesNotReadTheCard)
+{
+  receivedBefore(currentManifest);
+  ASSERT_FALSE(configManifestUpdatePending());
+
+  // The card is empty while the callback runs, the config is only looked at afterwards
+  std::string root = hostSdPath("");
+  root.pop_back();
+  hostUseTemporarySd();
+  receivedBefore(currentManifest);
+  hostSetSdRoot(root);
+  EXPECT_FALSE(configManifestUpdatePending());
+
+  // Without config on the card the manifest differs
+  hostUseTemporarySd();
+  invalidateFileManifest();
+  receivedBefore(currentManifest);
+  EXPECT_TRUE(configManifestUpdatePending());
+}
+
+TEST_F(ConfigManifestTest, HashOfTheWrittenConfigIsKept)
+{
+  configManifestConfigWritten(CONFIG_FILE);
+  // Not hashed again, changing the file behind the back of the firmware goes unnoticed
+  std::string changed = manifestOf(CONFIG_FILE, "{\"logger_id\":7,\"changed\":1}");
+  receivedBefore(currentManifest);
+  EXPECT_FALSE(configManifestUpdatePending());
+  receivedBefore(changed);
+  EXPECT_TRUE(configManifestUpdatePending());
+
+  // A new config file is hashed
+  std::string next = manifestOf("logger_7_config_1717300000.json", "{\"logger_id\":7,\"next\":1}");
+  receivedBefore(next);
+  EXPECT_FALSE(configManifestUpdatePending());
+}
@@ -0,0 +1,978 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Load of several loggers on the broker and Node-RED of one deck box
+ *
+ * N virtual loggers surface one after the other and send the MQTT packets of
+ * MQTTManager.cpp through a LinkProxy with latency, segment loss and
+ * connection drops:
+ *
+ *   hyfive/sessionRequest         upload session (QoS 0), answered on hyfive/sessionStatus
+ *   hyfive/status                 status JSON like uploadStatus() (QoS 2)
+ *   hyfive/updateConfigRequest    name of the latest config file (QoS 2), answered on hyfive/updateConfig
+ *   hyfive/updateFwSHA256Request  "fwRequest" (QoS 2), answered on hyfive/updateFirmwareSHA256
+ *   hyfive/header, hyfive/data, hyfive/Log (with the suffix Batch for a batch size)
+ *                                 the files of the SD card, QoS 1 with up to window messages in flight
+ *
+ * A Node-RED stand-in takes all messages in one queue like the event loop of
+ * Node-RED, spends a fixed time on each message and answers the requests
+ * without update. A dropped connection is taken up again at the first
+ * unacknowledged message, like the next wake of the logger.
+ *
+ * The report shows messages/s and MB/s taken by the stand-in, the latency
+ * from publish to the end of the processing, the answer times of the
+ * requests and the backlog of the stand-in. A backlog that grows until the
+ * last logger is done means that the deck box does not keep up.
+ *
+ * HYFIVE_LOAD_SD=<copy of the SD card> (measurements/mqtt_header,
+ * measurements/mqtt_measurements and log, else backup/header and
+ * backup/measurements) or HYFIVE_LOAD_RECORDS=<records of a generated cast>
+ * runs the load with HYFIVE_LOAD_LOGGERS (default 10),
+ * HYFIVE_LOAD_STAGGER_MS (500), HYFIVE_LOAD_WINDOW (1),
+ * HYFIVE_LOAD_BATCH_SIZE (0, single lines), HYFIVE_LOAD_DECKBOX_MS (1),
+ * HYFIVE_LOAD_LATENCY_MS (5), HYFIVE_LOAD_LOSS (0), HYFIVE_LOAD_RTO_MS (200)
+ * and HYFIVE_LOAD_DROP (0). HYFIVE_LOAD_BROKER_PORT uses a broker on this
+ * host, e.g. Mosquitto, instead of the HostBroker.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <numeric>
+#include <poll.h>
+#include <random>
+#include <set>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+#include "HostBroker.h"
+#include "HostMqttPacket.h"
+#include "LinkProxy.h"
+#include "MqttPipeline.h"
+#include "UploadSession.h"
+
+// Answer times the firmware waits for (ms), UploadSession.h and updateConfigViaMqtt()
+#define LOAD_REQUEST_TIMEOUT 1000
+// Longest wait for an answer before the logger gives up (ms)
+#define LOAD_ANSWER_WAIT 10000
+#define LOAD_RECONNECTS 10
+// Space kept free for the envelope line of a batch message, MQTTManager.cpp
+#define LOAD_BATCH_ENVELOPE_SIZE 128
+
+typedef std::chrono::steady_clock Clock;
+
+static double millisecondsSince(Clock::time_point start)
+{
+  return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static double environmentValue(const char *name, double fallback)
+{
+  const char *value = getenv(name);
+  return value ? strtod(value, nullptr) : fallback;
+}
+
+struct LoadSettings
+{
+  unsigned loggers = 10;
+  unsigned staggerMs = 500;
+  unsigned window = 1;
+  size_t batchSize = 0;
+  double deckboxMs = 1.0;
+  LinkConditions link;
+};
+
+// Files of one channel of the SD card
+struct LoadChannel
+{
+  const char *name;
+  const char *directories[2];
+  const char *topic;
+};
+
+static const LoadChannel loadChannels[] = {
+    {"header", {"measurements/mqtt_header", "backup/header"}, "hyfive/header"},
+    {"data", {"measurements/mqtt_measurements", "backup/measurements"}, "hyfive/data"},
+    {"log", {"log", nullptr}, "hyfive/Log"}};
+
+struct SdCard
+{
+  // Per channel: file name and content
+  std::vector<std::pair<std::string, std::string>> files[3];
+  std::string configName;
+};
+
+static SdCard readSdCard(const std::string &path)
+{
+  namespace fs = std::filesystem;
+  SdCard card;
+  for (int channel = 0; channel < 3; channel++)
+  {
+    for (const char *directory : loadChannels[channel].directories)
+    {
+      if (directory == nullptr || !card.files[channel].empty() || !fs::is_directory(fs::path(path) / directory))
+      {
+        continue;
+      }
+      std::vector<fs::path> names;
+      for (const fs::directory_entry &entry : fs::directory_iterator(fs::path(path) / directory))
+      {
+        if (entry.is_regular_file() && entry.path().filename() != "log.txt")
+        {
+          names.push_back(entry.path());
+        }
+      }
+      std::sort(names.begin(), names.end());
+      for (const fs::path &name : names)
+      {
+        std::ifstream stream(name, std::ios::binary);
+        card.files[channel].emplace_back(name.filename().string(), std::string((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>()));
+      }
+    }
+  }
+  fs::path configDirectory = fs::path(path) / "loggerConfig";
+  if (fs::is_directory(configDirectory))
+  {
+    for (const fs::directory_entry &entry : fs::directory_iterator(configDirectory))
+    {
+      card.configName = std::max(card.configName, entry.path().filename().string());
+    }
+  }
+  return card;
+}
+
+// One cast: a header line, records of four sensors at 1 Hz and a few log lines
+static SdCard syntheticSdCard(unsigned records, unsigned seed)
+{
+  std::mt19937 random(seed);
+  std::normal_distribution<double> noise(0.0, 1.0);
+  SdCard card;
+  const unsigned long start = 1748779200;
+  std::string data;
+  for (unsigned n = 0; n < records; n++)
+  {
+    double depth = 20.0 * n / std::max(records - 1, 1u);
+    char line[200];
+    snprintf(line, sizeof(line), "{\"time\":%lu,\"pressure\":%.2f,\"temperature\":%.3f,\"conductivity\":%.3f,\"oxygen\":%.1f}\r\n", start + n, 1013 + 100 * depth, 12.5 - depth / 10 + 0.01 * noise(random), 35.1 + 0.01 * noise(random), 260 - depth + 0.3 * noise(random));
+    data += line;
+  }
+  std::string log;
+  for (unsigned n = 0; n <= records / 100; n++)
+  {
+    log += "[" + std::to_string(start + 60 * n) + "] INFO measurement cycle " + std::to_string(n) + "\r\n";
+  }
+  card.files[0].emplace_back("header.json", "{\"logger_id\":1,\"deployment_id\":1,\"time\":" + std::to_string(start) + ",\"record_schema\":[\"pressure\",\"temperature\",\"conductivity\",\"oxygen\"]}\r\n");
+  card.files[1].emplace_back("measurement.json", data);
+  card.files[2].emplace_back("log_0001.txt", log);
+  return card;
+}
+
+// Messages of a file like readUploadMessage() in MQTTManager.cpp, single lines or batches
+static void appendUploadMessages(std::vector<MqttPublish> &messages, const std::string &topic, const std::string &name, const std::string &content, unsigned loggerId, size_t batchSize)
+{
+  std::vector<std::string> lines;
+  size_t start = 0;
+  while (start < content.size())
+  {
+    size_t end = content.find('\n', start);
+    end = end == std::string::npos ? content.size() : end;
+    lines.push_back(content.substr(start, end - start));
+    start = end + 1;
+  }
+
+  size_t line = 0;
+  long lineNumber = 0;
+  while (line < lines.size())
+  {
+    std::string records;
+    unsigned count = 0;
+    size_t next = line;
+    size_t bytes = 0;
+    // As many complete lines as fit into a batch, a line that does not fit is sent alone
+    while (batchSize > LOAD_BATCH_ENVELOPE_SIZE && next < lines.size() && bytes + lines[next].size() + 1 <= batchSize - LOAD_BATCH_ENVELOPE_SIZE)
+    {
+      bytes += lines[next].size() + 1;
+      std::string record = lines[next++];
+      if (!record.empty() && record.back() == '\r')
+      {
+        record.pop_back();
+      }
+      if (!record.empty())
+      {
+        records += record + '\n';
+        count++;
+      }
+    }
+    if (next > line && count > 0)
+    {
+      char envelope[LOAD_BATCH_ENVELOPE_SIZE];
+      snprintf(envelope, sizeof(envelope), "{\"logger_id\":%u,\"file\":\"%s\",\"first_line\":%ld,\"count\":%u}\n", loggerId, name.c_str(), lineNumber, count);
+      messages.push_back({topic + "Batch", envelope + records, 1});
+      lineNumber += count;
+      line = next;
+      continue;
+    }
+    if (next > line)
+    {
+      // Only empty lines
+      line = next;
+      continue;
+    }
+    if (!lines[line].empty())
+    {
+      messages.push_back({topic, lines[line], 1});
+      lineNumber++;
+    }
+    line++;
+  }
+}
+
+// Publish times of the messages in flight, the stand-in takes them in the order of arrival
+class Registry
+{
+public:
+  void publish(const std::string &topic, const std::string &payload)
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    sent[topic + '\n' + payload].push_back(Clock::now());
+    count++;
+  }
+
+  bool take(const std::string &topic, const std::string &payload, Clock::time_point &time)
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    std::deque<Clock::time_point> &times = sent[topic + '\n' + payload];
+    if (times.empty())
+    {
+      return false;
+    }
+    time = times.front();
+    times.pop_front();
+    return true;
+  }
+
+  size_t published()
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    return count;
+  }
+
+private:
+  std::mutex lock;
+  std::map<std::string, std::deque<Clock::time_point>> sent;
+  size_t count = 0;
+};
+
+// MQTT connection over a socket, with the packets and QoS flows of lwmqtt
+class LoadConnection
+{
+public:
+  std::deque<MqttPublish> messages;
+
+  ~LoadConnection() { close(); }
+
+  bool open(uint16_t port, const std::string &clientId)
+  {
+    close();
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+      close();
+      return false;
+    }
+    int noDelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    // Clean session, keep alive 10 s like the MQTTClient of the firmware
+    std::string body = mqttString("MQTT") + std::string{4, 0x02} + mqttUint16(10) + mqttString(clientId);
+    std::string answer;
+    return send(mqttPacket(MQTT_CONNECT, body)) && waitFor(MQTT_CONNACK, answer) && answer.size() >= 2 && answer[1] == 0;
+  }
+
+  void close()
+  {
+    if (fd >= 0)
+    {
+      ::close(fd);
+      fd = -1;
+    }
+    buffer.clear();
+  }
+
+  uint16_t nextPacketId()
+  {
+    packetId = packetId % 65535 + 1;
+    return packetId;
+  }
+
+  bool send(const std::string &packet)
+  {
+    std::lock_guard<std::mutex> guard(sendLock);
+    return fd >= 0 && ::send(fd, packet.data(), packet.size(), MSG_NOSIGNAL) == (ssize_t)packet.size();
+  }
+
+  bool subscribe(const std::string &topic, int qos)
+  {
+    std::string answer;
+    return send(mqttPacket(MQTT_SUBSCRIBE | 0x02, mqttUint16(nextPacketId()) + mqttString(topic) + std::string(1, (char)qos))) && waitFor(MQTT_SUBACK, answer);
+  }
+
+  // Blocks until the flow of the QoS is complete, like MQTTClient::publish()
+  bool publish(const std::string &topic, const std::string &payload, int qos)
+  {
+    uint16_t id = qos > 0 ? nextPacketId() : 0;
+    if (!send(mqttPublishPacket(topic, payload, qos, false, id)))
+    {
+      return false;
+    }
+    std::string answer;
+    if (qos == 1)
+    {
+      return waitFor(MQTT_PUBACK, answer);
+    }
+    if (qos == 2)
+    {
+      return waitFor(MQTT_PUBREC, answer) && send(mqttPacket(MQTT_PUBREL | 0x02, mqttUint16(id))) && waitFor(MQTT_PUBCOMP, answer);
+    }
+    return true;
+  }
+
+  // Waits for a message of a subscribed topic
+  bool waitMessage(const std::string &topic, const std::string &payload, unsigned long timeout)
+  {
+    Clock::time_point start = Clock::now();
+    while (true)
+    {
+      for (auto message = messages.begin(); message != messages.end(); message++)
+      {
+        if (message->topic == topic && message->payload == payload)
+        {
+          messages.erase(message);
+          return true;
+        }
+      }
+      long remaining = (long)timeout - (long)millisecondsSince(start);
+      uint8_t header;
+      std::string body;
+      if (remaining <= 0 || (!readPacket(header, body, remaining) && fd < 0))
+      {
+        return false;
+      }
+    }
+  }
+
+  // Reads the next packet, answers incoming messages and keeps them. False on timeout or a lost connection.
+  bool readPacket(uint8_t &header, std::string &body, long timeout)
+  {
+    Clock::time_point start = Clock::now();
+    while (fd >= 0)
+    {
+      if (buffer.size() >= 2)
+      {
+        size_t length = 0;
+        size_t position = 1;
+        int shift = 0;
+        bool complete = false;
+        while (position < buffer.size() && position < 5)
+        {
+          uint8_t digit = buffer[position++];
+          length |= (size_t)(digit & 0x7F) << shift;
+          shift += 7;
+          if (!(digit & 0x80))
+          {
+            complete = true;
+            break;
+          }
+        }
+        if (complete && buffer.size() >= position + length)
+        {
+          header = buffer[0];
+          body = buffer.substr(position, length);
+          buffer.erase(0, position + length);
+          handleIncoming(header, body);
+          return true;
+        }
+      }
+      long remaining = timeout - (long)millisecondsSince(start);
+      struct pollfd descriptor = {fd, POLLIN, 0};
+      if (remaining <= 0 || poll(&descriptor, 1, remaining) <= 0)
+      {
+        return false;
+      }
+      char data[16384];
+      ssize_t length = recv(fd, data, sizeof(data), 0);
+      if (length <= 0)
+      {
+        close();
+        return false;
+      }
+      buffer.append(data, length);
+    }
+    return false;
+  }
+
+  bool connected() const { return fd >= 0; }
+
+private:
+  int fd = -1;
+  std::string buffer;
+  uint16_t packetId = 0;
+  std::mutex sendLock;
+
+  bool waitFor(uint8_t type, std::string &answer)
+  {
+    Clock::time_point start = Clock::now();
+    uint8_t header;
+    while (millisecondsSince(start) < LOAD_ANSWER_WAIT)
+    {
+      if (readPacket(header, answer, LOAD_ANSWER_WAIT - (long)millisecondsSince(start)) && (header & 0xF0) == type)
+      {
+        return true;
+      }
+      if (fd < 0)
+      {
+        return false;
+      }
+    }
+    return false;
+  }
+
+  void handleIncoming(uint8_t header, const std::string &body)
+  {
+    if ((header & 0xF0) == MQTT_PUBREL)
+    {
+      send(mqttPacket(MQTT_PUBCOMP, body.substr(0, 2)));
+      return;
+    }
+    MqttPublish message;
+    if ((header & 0xF0) != MQTT_PUBLISH || !mqttParsePublish(header, body, message))
+    {
+      return;
+    }
+    if (message.qos == 1)
+    {
+      send(mqttPacket(MQTT_PUBACK, mqttUint16(message.packetId)));
+    }
+    else if (message.qos == 2)
+    {
+      send(mqttPacket(MQTT_PUBREC, mqttUint16(message.packetId)));
+    }
+    messages.push_back(message);
+  }
+};
+
+// One queue of incoming messages like the event loop of Node-RED, a fixed processing time per message
+class NodeRedStandIn
+{
+public:
+  std::mutex lock;
+  size_t messages = 0;
+  size_t bytes = 0;
+  std::vector<double> latencies;
+  std::vector<std::pair<double, size_t>> backlog; // ms since start, messages in the queue
+  std::set<std::string> dataPayloads;
+
+  NodeRedStandIn(uint16_t port, double processingMs, Registry &registry) : processingMs(processingMs), registry(registry)
+  {
+    connected = connection.open(port, "hyfive-deckbox-load");
+    // QoS 0: the stand-in does not complete the QoS 2 flow of incoming messages
+    for (const char *topic : {SESSION_REQUEST_TOPIC, "hyfive/status", "hyfive/updateConfigRequest", "hyfive/updateFwSHA256Request", "hyfive/ConfigError", "hyfive/header", "hyfive/data", "hyfive/Log", "hyfive/headerBatch", "hyfive/dataBatch", "hyfive/LogBatch"})
+    {
+      connected = connected && connection.subscribe(topic, 0);
+    }
+    start = Clock::now();
+    receiver = std::thread(&NodeRedStandIn::receive, this);
+    processor = std::thread(&NodeRedStandIn::process, this);
+    sampler = std::thread(&NodeRedStandIn::sample, this);
+  }
+
+  ~NodeRedStandIn()
+  {
+    running = false;
+    inboxChanged.notify_all();
+    receiver.join();
+    processor.join();
+    sampler.join();
+  }
+
+  bool ready() const { return connected; }
+
+  size_t queued()
+  {
+    std::lock_guard<std::mutex> guard(inboxLock);
+    return inbox.size() + (busy ? 1 : 0);
+  }
+
+private:
+  LoadConnection connection;
+  bool connected = false;
+  double processingMs;
+  Registry &registry;
+  Clock::time_point start;
+  std::atomic<bool> running{true};
+  std::mutex inboxLock;
+  std::condition_variable inboxChanged;
+  std::deque<MqttPublish> inbox;
+  bool busy = false;
+  std::thread receiver;
+  std::thread processor;
+  std::thread sampler;
+
+  void receive()
+  {
+    uint8_t header;
+    std::string body;
+    while (running && connection.connected())
+    {
+      connection.readPacket(header, body, 100);
+      std::lock_guard<std::mutex> guard(inboxLock);
+      while (!connection.messages.empty())
+      {
+        inbox.push_back(connection.messages.front());
+        connection.messages.pop_front();
+        inboxChanged.notify_one();
+      }
+    }
+  }
+
+  void process()
+  {
+    while (running)
+    {
+      MqttPublish message;
+      {
+        std::unique_lock<std::mutex> guard(inboxLock);
+        inboxChanged.wait_for(guard, std::chrono::milliseconds(100), [this]()
+                              { return !inbox.empty() || !running; });
+        if (inbox.empty())
+        {
+          continue;
+        }
+        message = inbox.front();
+        inbox.pop_front();
+        busy = true;
+      }
+      if (processingMs > 0)
+      {
+        std::this_thread::sleep_for(std::chrono::microseconds((long)(processingMs * 1000)));
+      }
+      std::string answerTopic;
+      std::string answer;
+      if (message.topic == SESSION_REQUEST_TOPIC && message.payload.find(':') == std::string::npos)
+      {
+        answerTopic = SESSION_STATUS_TOPIC;
+        answer = message.payload + ":ready:0:0";
+      }
+      else if (message.topic == "hyfive/updateConfigRequest")
+      {
+        answerTopic = "hyfive/updateConfig";
+        answer = "no_update_available";
+      }
+      else if (message.topic == "hyfive/updateFwSHA256Request")
+      {
+        answerTopic = "hyfive/updateFirmwareSHA256";
+        answer = "no_firmware_update";
+      }
+      if (!answerTopic.empty())
+      {
+        connection.send(mqttPublishPacket(answerTopic, answer, 0, false, 0));
+      }
+      Clock::time_point sent;
+      bool known = registry.take(message.topic, message.payload, sent);
+      std::lock_guard<std::mutex> guard(lock);
+      messages++;
+      bytes += message.payload.size();
+      if (known)
+      {
+        latencies.push_back(std::chrono::duration<double, std::milli>(Clock::now() - sent).count());
+      }
+      if (message.topic == "hyfive/data" || message.topic == "hyfive/dataBatch")
+      {
+        dataPayloads.insert(message.payload);
+      }
+      std::lock_guard<std::mutex> inboxGuard(inboxLock);
+      busy = false;
+    }
+  }
+
+  void sample()
+  {
+    while (running)
+    {
+      size_t size = queued();
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        backlog.emplace_back(millisecondsSince(start), size);
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+  }
+};
+
+class VirtualLogger
+{
+public:
+  std::string id;
+  std::vector<MqttPublish> uploads;
+  std::map<std::string, std::vector<double>> answerTimes;
+  unsigned reconnects = 0;
+  double durationMs = 0;
+  std::string failed;
+
+  VirtualLogger(unsigned number, uint16_t port, const SdCard &card, const LoadSettings &settings, Registry &registry) : id(std::to_string(100 + number)), port(port), settings(settings), registry(registry)
+  {
+    configName = card.configName.empty() ? id + "_20250601120000.json" : card.configName;
+    for (int channel = 0; channel < 3; channel++)
+    {
+      for (const std::pair<std::string, std::string> &file : card.files[channel])
+      {
+        // The logger id makes the records of the loggers distinct
+        std::string content = channel == 1 && card.configName.empty() ? tagRecords(file.second) : file.second;
+        appendUploadMessages(uploads, loadChannels[channel].topic, file.first, content, 100 + number, settings.batchSize);
+      }
+    }
+  }
+
+  void run()
+  {
+    Clock::time_point start = Clock::now();
+    bool handshakeDone = false;
+    size_t position = 0;
+    while (true)
+    {
+      std::string error;
+      if (!connect())
+      {
+        error = "connection failed";
+      }
+      else if (!handshakeDone && !handshake(error))
+      {
+      }
+      else
+      {
+        handshakeDone = true;
+        position = upload(position);
+        if (position >= uploads.size())
+        {
+          publish(SESSION_REQUEST_TOPIC, id + ":done", 0);
+          failed.clear();
+          break;
+        }
+        error = "connection lost during the upload";
+      }
+      // A dropped connection is taken up again like the next wake of the logger
+      if (reconnects >= LOAD_RECONNECTS)
+      {
+        failed = "not finished after " + std::to_string(LOAD_RECONNECTS) + " reconnects (" + error + ")";
+        break;
+      }
+      reconnects++;
+    }
+    durationMs = millisecondsSince(start);
+    connection.close();
+  }
+
+private:
+  uint16_t port;
+  const LoadSettings &settings;
+  Registry &registry;
+  std::string configName;
+  LoadConnection connection;
+
+  std::string tagRecords(const std::string &content)
+  {
+    std::string tagged;
+    size_t start = 0;
+    while (start < content.size())
+    {
+      size_t end = content.find('\n', start);
+      end = end == std::string::npos ? content.size() : end + 1;
+      std::string line = content.substr(start, end - start);
+      if (line.size() > 2 && line[0] == '{')
+      {
+        line.insert(1, "\"logger_id\":" + id + ",");
+      }
+      tagged += line;
+      start = end;
+    }
+    return tagged;
+  }
+
+  bool connect()
+  {
+    if (!connection.open(port, "HyFiVe-" + id))
+    {
+      return false;
+    }
+    // The subscriptions of connectToMqtt()
+    return connection.subscribe("hyfive/updateConfig", 2) && connection.subscribe("hyfive/updateFirmwareSHA256", 2) && connection.subscribe("hyfive/updateFW", 0) && connection.subscribe(SESSION_STATUS_TOPIC, 1) && connection.subscribe("hyfive/bulkStatus", 1) && connection.subscribe("hyfive/encodingStatus", 1) && connection.subscribe("hyfive/configManifest/" + id, 1);
+  }
+
+  bool publish(const std::string &topic, const std::string &payload, int qos)
+  {
+    registry.publish(topic, payload);
+    return connection.publish(topic, payload, qos);
+  }
+
+  bool request(const std::string &kind, const std::string &topic, const std::string &payload, int qos, const std::string &answerTopic, const std::string &answer, std::string &error)
+  {
+    Clock::time_point start = Clock::now();
+    if (!publish(topic, payload, qos) || !connection.waitMessage(answerTopic, answer, LOAD_ANSWER_WAIT))
+    {
+      error = "no answer to " + kind;
+      return false;
+    }
+    answerTimes[kind].push_back(millisecondsSince(start));
+    return true;
+  }
+
+  // Session, status, config and firmware request, like one wake before the upload
+  bool handshake(std::string &error)
+  {
+    std::string status = "{\"logger_id\":" + id + ",\"battery_remaining\":80,\"memory_capacity_total\":31902400512,\"memory_capacity_used\":1048576,\"log_dropped\":0}";
+    return request("session", SESSION_REQUEST_TOPIC, id, 0, SESSION_STATUS_TOPIC, id + ":ready:0:0", error) && publish("hyfive/status", status, 2) && request("config", "hyfive/updateConfigRequest", configName, 2, "hyfive/updateConfig", "no_update_available", error) && request("firmware", "hyfive/updateFwSHA256Request", "fwRequest", 2, "hyfive/updateFirmwareSHA256", "no_firmware_update", error);
+  }
+
+  // QoS 1 with up to window messages in flight, returns the index of the first message not acknowledged
+  size_t upload(size_t position)
+  {
+    std::map<uint16_t, size_t> pending;
+    size_t next = position;
+    Clock::time_point lastAck = Clock::now();
+    while (next < uploads.size() || !pending.empty())
+    {
+      while (next < uploads.size() && pending.size() < settings.window)
+      {
+        uint16_t packetId = connection.nextPacketId();
+        registry.publish(uploads[next].topic, uploads[next].payload);
+        if (!connection.send(mqttPublishPacket(uploads[next].topic, uploads[next].payload, 1, false, packetId)))
+        {
+          break;
+        }
+        pending[packetId] = next++;
+      }
+      uint8_t header;
+      std::string body;
+      long remaining = MQTT_PIPELINE_ACK_TIMEOUT - (long)millisecondsSince(lastAck);
+      if (connection.readPacket(header, body, remaining) && (header & 0xF0) == MQTT_PUBACK)
+      {
+        pending.erase(mqttReadUint16(body, 0));
+        lastAck = Clock::now();
+      }
+      else if (!connection.connected() || millisecondsSince(lastAck) >= MQTT_PIPELINE_ACK_TIMEOUT)
+      {
+        size_t first = next;
+        for (const std::pair<const uint16_t, size_t> &entry : pending)
+        {
+          first = std::min(first, entry.second);
+        }
+        return first;
+      }
+    }
+    return uploads.size();
+  }
+};
+
+static double percentile(std::vector<double> values, double p)
+{
+  if (values.empty())
+  {
+    return NAN;
+  }
+  std::sort(values.begin(), values.end());
+  return values[std::min(values.size() - 1, (size_t)std::lround(p / 100 * (values.size() - 1)))];
+}
+
+struct LoadResult
+{
+  std::vector<std::unique_ptr<VirtualLogger>> loggers;
+  std::set<std::string> expectedData;
+  std::set<std::string> processedData;
+  double backlogGrowth = 0;
+  size_t backlogMax = 0;
+};
+
+static LoadResult runLoad(const SdCard &card, const LoadSettings &settings)
+{
+  LoadResult result;
+  std::unique_ptr<HostBroker> hostBroker;
+  uint16_t brokerPort = environmentValue("HYFIVE_LOAD_BROKER_PORT", 0);
+  if (brokerPort == 0)
+  {
+    hostBroker.reset(new HostBroker());
+    brokerPort = hostBroker->port();
+  }
+  Registry registry;
+  NodeRedStandIn standIn(brokerPort, settings.deckboxMs, registry);
+  EXPECT_TRUE(standIn.ready()) << "no broker on port " << brokerPort;
+  LinkProxy proxy(brokerPort, settings.link);
+  for (unsigned i = 0; i < settings.loggers; i++)
+  {
+    result.loggers.emplace_back(new VirtualLogger(i, proxy.port(), card, settings, registry));
+  }
+  size_t kilobytes = 0;
+  for (const MqttPublish &message : result.loggers[0]->uploads)
+  {
+    kilobytes += message.payload.size();
+  }
+  printf("%u loggers, %zu messages (%zu KB) each, surfacing every %u ms, Node-RED %.1f ms per message, window %u, batch %zu\n", settings.loggers, result.loggers[0]->uploads.size(), kilobytes / 1024, settings.staggerMs, settings.deckboxMs, settings.window, settings.batchSize);
+
+  Clock::time_point start = Clock::now();
+  std::vector<std::thread> threads;
+  for (std::unique_ptr<VirtualLogger> &logger : result.loggers)
+  {
+    threads.emplace_back(&VirtualLogger::run, logger.get());
+    std::this_thread::sleep_for(std::chrono::milliseconds(settings.staggerMs));
+  }
+  for (std::thread &thread : threads)
+  {
+    thread.join();
+  }
+  double uploadedMs = millisecondsSince(start);
+  while (standIn.queued() > 0 && millisecondsSince(start) < uploadedMs + 60000)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  }
+  double drainedMs = millisecondsSince(start);
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+  std::lock_guard<std::mutex> guard(standIn.lock);
+  std::vector<double> backlog;
+  for (const std::pair<double, size_t> &sample : standIn.backlog)
+  {
+    if (sample.first <= uploadedMs)
+    {
+      backlog.push_back(sample.second);
+      result.backlogMax = std::max(result.backlogMax, sample.second);
+    }
+  }
+  size_t half = backlog.size() / 2;
+  if (half > 0)
+  {
+    double first = std::accumulate(backlog.begin(), backlog.begin() + half, 0.0) / half;
+    double second = std::accumulate(backlog.begin() + half, backlog.end(), 0.0) / (backlog.size() - half);
+    result.backlogGrowth = (second - first) / (uploadedMs / 2000);
+  }
+
+  printf("uploaded in %.1f s, processed by the stand-in in %.1f s\n", uploadedMs / 1000, drainedMs / 1000);
+  printf("throughput   %.0f messages/s, %.2f MB/s, %zu of %zu published messages processed\n", standIn.messages * 1000.0 / drainedMs, standIn.bytes / drainedMs / 1000, standIn.messages, registry.published());
+  printf("latency      p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, max %.1f ms (publish to end of processing)\n", percentile(standIn.latencies, 50), percentile(standIn.latencies, 90), percentile(standIn.latencies, 99), percentile(standIn.latencies, 100));
+  for (const std::pair<const char *, unsigned> kind : {std::make_pair("session", SESSION_TIMEOUT), std::make_pair("config", LOAD_REQUEST_TIMEOUT), std::make_pair("firmware", LOAD_REQUEST_TIMEOUT)})
+  {
+    std::vector<double> times;
+    for (const std::unique_ptr<VirtualLogger> &logger : result.loggers)
+    {
+      times.insert(times.end(), logger->answerTimes[kind.first].begin(), logger->answerTimes[kind.first].end());
+    }
+    size_t late = std::count_if(times.begin(), times.end(), [&](double time)
+                                { return time > kind.second; });
+    printf("%-12s p50 %.1f ms, p99 %.1f ms, %zu over the %u ms the logger waits\n", kind.first, percentile(times, 50), percentile(times, 99), late, kind.second);
+  }
+  printf("backlog      max %zu messages, growth %+.1f messages/s while uploading\n", result.backlogMax, result.backlogGrowth);
+  std::vector<double> durations;
+  unsigned reconnects = 0;
+  for (const std::unique_ptr<VirtualLogger> &logger : result.loggers)
+  {
+    durations.push_back(logger->durationMs / 1000);
+    reconnects += logger->reconnects;
+    if (!logger->failed.empty())
+    {
+      printf("FAILED: logger %s: %s\n", logger->id.c_str(), logger->failed.c_str());
+    }
+    for (const MqttPublish &message : logger->uploads)
+    {
+      if (message.topic == "hyfive/data" || message.topic == "hyfive/dataBatch")
+      {
+        result.expectedData.insert(message.payload);
+      }
+    }
+  }
+  printf("per logger   %.1f s on average, %.1f s at most, %u reconnects, %u connection drops by the proxy\n", std::accumulate(durations.begin(), durations.end(), 0.0) / durations.size(), *std::max_element(durations.begin(), durations.end()), reconnects, proxy.drops());
+  result.processedData = standIn.dataPayloads;
+  return result;
+}
+
+TEST(DeckboxLoad, LossAndDropsKeepEveryRecord)
+{
+  LoadSettings settings;
+  settings.loggers = 6;
+  settings.staggerMs = 100;
+  settings.window = 4;
+  settings.deckboxMs = 0.2;
+  settings.link.latency = 2;
+  settings.link.loss = 0.01;
+  settings.link.rto = 50;
+  settings.link.drop = 0.002;
+  settings.link.seed = 5;
+  LoadResult result = runLoad(syntheticSdCard(300, 1), settings);
+  for (const std::unique_ptr<VirtualLogger> &logger : result.loggers)
+  {
+    EXPECT_TRUE(logger->failed.empty()) << logger->id << ": " << logger->failed;
+  }
+  EXPECT_EQ(result.expectedData.size(), 6u * 300);
+  EXPECT_EQ(result.processedData, result.expectedData);
+}
+
+TEST(DeckboxLoad, BatchesKeepEveryRecord)
+{
+  LoadSettings settings;
+  settings.loggers = 3;
+  settings.staggerMs = 50;
+  settings.window = 2;
+  settings.batchSize = 4032;
+  settings.deckboxMs = 0.2;
+  settings.link.latency = 2;
+  LoadResult result = runLoad(syntheticSdCard(500, 2), settings);
+  size_t records = 0;
+  for (const std::string &payload : result.processedData)
+  {
+    records += std::count(payload.begin(), payload.end(), '\n') - 1;
+  }
+  EXPECT_EQ(records, 3u * 500);
+  EXPECT_EQ(result.processedData, result.expectedData);
+}
+
+TEST(DeckboxLoad, Configured)
+{
+  const char *sd = getenv("HYFIVE_LOAD_SD");
+  if (sd == nullptr && getenv("HYFIVE_LOAD_RECORDS") == nullptr)
+  {
+    GTEST_SKIP() << "HYFIVE_LOAD_SD or HYFIVE_LOAD_RECORDS not set";
+  }
+  LoadSettings settings;
+  settings.loggers = environmentValue("HYFIVE_LOAD_LOGGERS", 10);
+  settings.staggerMs = environmentValue("HYFIVE_LOAD_STAGGER_MS", 500);
+  settings.window = std::min(environmentValue("HYFIVE_LOAD_WINDOW", 1), (double)MQTT_PIPELINE_MAX_WINDOW);
+  settings.batchSize = environmentValue("HYFIVE_LOAD_BATCH_SIZE", 0);
+  settings.deckboxMs = environmentValue("HYFIVE_LOAD_DECKBOX_MS", 1);
+  settings.link.latency = environmentValue("HYFIVE_LOAD_LATENCY_MS", 5);
+  settings.link.loss = environmentValue("HYFIVE_LOAD_LOSS", 0);
+  settings.link.rto = environmentValue("HYFIVE_LOAD_RTO_MS", 200);
+  settings.link.drop = environmentValue("HYFIVE_LOAD_DROP", 0);
+  SdCard card = sd ? readSdCard(sd) : syntheticSdCard(environmentValue("HYFIVE_LOAD_RECORDS", 2000), 1);
+  LoadResult result = runLoad(card, settings);
+  for (const std::unique_ptr<VirtualLogger> &logger : result.loggers)
+  {
+    EXPECT_TRUE(logger->failed.empty()) << logger->id << ": " << logger->failed;
+  }
+}
@@ -0,0 +1,167 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Host test of the double-buffered download writer in DownloadBuffer.cpp
+ *
+ * The test thread is the MQTT callback, the writer task runs as a thread of
+ * the FreeRTOS stand-in. The sink stands for the config file or the OTA
+ * partition: it must get every message in order and must not be called once
+ * finishDownloadBuffer() has returned, because the caller closes the file then.
+ */
+
+#include <atomic>
+#include <gtest/gtest.h>
+#include <random>
+#include <thread>
+
+#include "DownloadBuffer.h"
+#include "HostLog.h"
+
+static std::mutex sinkLock;
+static std::string sinkData;
+static std::atomic<unsigned> sinkDelay{0};     // ms per call
+static std::atomic<bool> sinkClosed{false};    // the caller has closed the destination
+static std::atomic<unsigned> callsAfterClose{0};
+
+static void collect(const uint8_t *data, size_t length)
+{
+  if (sinkClosed)
+  {
+    callsAfterClose++;
+  }
+  delay(sinkDelay);
+  std::lock_guard<std::mutex> guard(sinkLock);
+  sinkData.append((const char *)data, length);
+}
+
+static std::string otherSinkData;
+
+static void collectOther(const uint8_t *data, size_t length)
+{
+  std::lock_guard<std::mutex> guard(sinkLock);
+  otherSinkData.append((const char *)data, length);
+}
+
+class DownloadBufferTest : public ::testing::Test
+{
+protected:
+  void SetUp() override
+  {
+    hostClearLog();
+    sinkData.clear();
+    otherSinkData.clear();
+    sinkDelay = 0;
+    sinkClosed = false;
+    callsAfterClose = 0;
+  }
+
+  void TearDown() override
+  {
+    sinkDelay = 0;
+  }
+
+  static std::string message(size_t length, unsigned seed)
+  {
+    std::mt19937 random(seed);
+    std::string data(length, '\0');
+    for (char &byte : data)
+    {
+      byte = (char)random();
+    }
+    return data;
+  }
+};
+
+TEST_F(DownloadBufferTest, WritesEveryMessageInOrder)
+{
+  std::mt19937 random(1);
+  std::string expected;
+  beginDownloadBuffer(collect);
+  for (unsigned i = 0; i < 400; i++)
+  {
+    // Messages of the MQTT read buffer, some empty and some larger than a buffer
+    size_t length = i % 97 == 0 ? DOWNLOAD_BUFFER_SIZE + 100 : random() % 1100;
+    std::string data = message(length, i);
+    ASSERT_TRUE(appendDownloadBuffer((const uint8_t *)data.data(), data.size()));
+    expected += data;
+  }
+  EXPECT_TRUE(finishDownloadBuffer());
+  EXPECT_EQ(sinkData, expected);
+  EXPECT_TRUE(hostLogContains("kB/s | buffered"));
+}
+
+TEST_F(DownloadBufferTest, SlowSinkHoldsBackTheCallback)
+{
+  sinkDelay = 2;
+  std::string expected;
+  beginDownloadBuffer(collect);
+  unsigned long start = millis();
+  for (unsigned i = 0; i < 100; i++)
+  {
+    std::string data = message(1000, i);
+    ASSERT_TRUE(appendDownloadBuffer((const uint8_t *)data.data(), data.size()));
+    expected += data;
+  }
+  // Only two buffers are ahead of the writer
+  EXPECT_GE(millis() - start, (100u - 2 * DOWNLOAD_BUFFER_SIZE / 1004) * 2);
+  EXPECT_TRUE(finishDownloadBuffer());
+  EXPECT_EQ(sinkData, expected);
+}
+
+TEST_F(DownloadBufferTest, SinkIsNotCalledAfterFinishTimedOut)
+{
+  // The writer is stuck in the sink longer than DOWNLOAD_WRITER_TIMEOUT
+  sinkDelay = DOWNLOAD_WRITER_TIMEOUT + 300;
+  beginDownloadBuffer(collect);
+  for (unsigned i = 0; i < 12; i++)
+  {
+    std::string data = message(1000, i);
+    ASSERT_TRUE(appendDownloadBuffer((const uint8_t *)data.data(), data.size()));
+  }
+  EXPECT_FALSE(finishDownloadBuffer());
+  sinkClosed = true;
+  sinkDelay = 0;
+  delay(200);
+  EXPECT_EQ(callsAfterClose, 0u);
+  EXPECT_TRUE(hostLogContains("Download: "));
+
+  // The next download starts with free buffers
+  beginDownloadBuffer(collectOther);
+  std::string data = message(3000, 99);
+  ASSERT_TRUE(appendDownloadBuffer((const uint8_t *)data.data(), data.size()));
+  EXPECT_TRUE(finishDownloadBuffer());
+  EXPECT_EQ(otherSinkData, data);
+  EXPECT_EQ(callsAfterClose, 0u);
+}
+
+TEST_F(DownloadBufferTest, NextDownloadDropsTheUnfinishedOne)
+{
+  sinkDelay = 20;
+  beginDownloadBuffer(collect);
+  for (unsigned i = 0; i < 20; i++)
+  {
+    std::string data = message(1000, i);
+    ASSERT_TRUE(appendDownloadBuffer((const uint8_t *)data.data(), data.size()));
+  }
+  // Given up without finishDownloadBuffer(), its buffers must not reach the sink of the next download
+  beginDownloadBuffer(collectOther);
+  sinkClosed = true;
+  std::string data = message(5000, 42);
+  ASSERT_TRUE(appendDownloadBuffer((const uint8_t *)data.data(), data.size()));
+  EXPECT_TRUE(finishDownloadBuffer());
+  EXPECT_EQ(otherSinkData, data);
+  EXPECT_EQ(callsAfterClose, 0u);
+}
+
+TEST_F(DownloadBufferTest, AppendWithoutDownloadIsDropped)
+{
+  std::string data = message(100, 1);
+  EXPECT_FALSE(appendDownloadBuffer((const uint8_t *)data.data(), data.size()));
+  EXPECT_FALSE(finishDownloadBuffer());
+  EXPECT_TRUE(sinkData.empty());
+}
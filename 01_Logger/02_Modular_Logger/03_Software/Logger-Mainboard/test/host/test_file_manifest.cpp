@@ -0,0 +1,96 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Host test of the file manifest in FileManifest.cpp
+ */
+
+#include <SD.h>
+#include <gtest/gtest.h>
+#include <thread>
+
+#include "FileManifest.h"
+#include "HostLog.h"
+
+static void createFile(const char *path)
+{
+  File file = SD.open(path, FILE_WRITE);
+  file.print("{}");
+  file.close();
+}
+
+class FileManifestTest : public ::testing::Test
+{
+protected:
+  void SetUp() override
+  {
+    hostUseTemporarySd({"/measurements/mqtt_header", "/measurements/mqtt_measurements", "/log", "/loggerConfig", "/backup/header", "/backup/measurements", "/backup/log"});
+    invalidateFileManifest();
+  }
+};
+
+TEST_F(FileManifestTest, RebuildCountsFilesAndLatestConfig)
+{
+  createFile("/measurements/mqtt_header/a.json");
+  createFile("/measurements/mqtt_header/b.txt");
+  createFile("/log/log.txt");
+  createFile("/log/log_1.txt");
+  createFile("/loggerConfig/logger_7_config_1717243200.json");
+  createFile("/loggerConfig/logger_7_config_17172432000.json");
+  createFile("/loggerConfig/logger_7_config_1717243199.json");
+
+  EXPECT_EQ(manifestFileCount(ManifestMqttHeader), 1);
+  EXPECT_EQ(manifestFileCount(ManifestLogSegments), 1);
+  EXPECT_EQ(manifestFileCount(ManifestLoggerConfig), 3);
+  EXPECT_EQ(String("logger_7_config_17172432000.json"), manifestLatestConfigFile());
+}
+
+TEST_F(FileManifestTest, UpdatesWithoutScan)
+{
+  EXPECT_EQ(manifestFileCount(ManifestLoggerConfig), 0);
+
+  manifestFileAdded("/loggerConfig/", "logger_7_config_1717243200.json");
+  manifestFileAdded("/loggerConfig", "logger_7_config_1717243100.json");
+  EXPECT_EQ(manifestFileCount(ManifestLoggerConfig), 2);
+  EXPECT_EQ(String("logger_7_config_1717243200.json"), manifestLatestConfigFile());
+
+  manifestFileRemoved("/loggerConfig", "logger_7_config_1717243100.json");
+  EXPECT_EQ(manifestFileCount(ManifestLoggerConfig), 1);
+
+  manifestDirectoryCleared("/loggerConfig");
+  EXPECT_EQ(manifestFileCount(ManifestLoggerConfig), 0);
+  EXPECT_EQ(String(""), manifestLatestConfigFile());
+}
+
+// The log writer task (core 0) and the upload (core 1) update the manifest at the same time
+TEST_F(FileManifestTest, ConcurrentUpdatesKeepTheManifestValid)
+{
+  const int updates = 20000;
+  EXPECT_EQ(manifestFileCount(ManifestLogSegments), 0);
+
+  std::thread logWriter([&]()
+                        {
+    for (int i = 0; i < updates; i++)
+    {
+      manifestFileAdded("/log", "log_" + String(i) + ".txt");
+    } });
+  std::thread upload([&]()
+                     {
+    for (int i = 0; i < updates; i++)
+    {
+      manifestFileAdded("/measurements/mqtt_header", String(i) + ".json");
+      manifestFileRemoved("/measurements/mqtt_header", String(i) + ".json");
+      manifestFileAdded("/backup/header", String(i) + ".json");
+    } });
+  logWriter.join();
+  upload.join();
+
+  // A lost update or a torn checksum would trigger a rebuild, which finds no files on the card
+  EXPECT_EQ(manifestFileCount(ManifestLogSegments), updates);
+  EXPECT_EQ(manifestFileCount(ManifestMqttHeader), 0);
+  EXPECT_EQ(manifestFileCount(ManifestBackupHeader), updates);
+}
@@ -0,0 +1,325 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Host test of the firmware patches in FirmwareDelta.cpp
+ *
+ * The running firmware is a generated firmware.bin with an appended SHA-256
+ * in a larger, erased partition. Patches in the format of
+ * Tools/firmware_delta.py are applied in random chunk sizes and must
+ * reproduce the new firmware byte for byte.
+ */
+
+#include <gtest/gtest.h>
+#include <mbedtls/md.h>
+#include <random>
+
+#include "FirmwareDelta.h"
+#include "HostLog.h"
+#include "HostPartition.h"
+
+#define PARTITION_SIZE 0x60000
+
+static std::string sha256Of(const std::string &data, bool hex = true)
+{
+  mbedtls_md_context_t ctx;
+  unsigned char hash[32];
+  mbedtls_md_init(&ctx);
+  mbedtls_md_setup(&ctx, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 0);
+  mbedtls_md_starts(&ctx);
+  mbedtls_md_update(&ctx, (const unsigned char *)data.data(), data.size());
+  mbedtls_md_finish(&ctx, hash);
+  if (!hex)
+  {
+    return std::string((const char *)hash, 32);
+  }
+  char text[65];
+  for (int i = 0; i < 32; i++)
+  {
+    sprintf(text + 2 * i, "%02x", hash[i]);
+  }
+  return text;
+}
+
+// Image like the one of esptool: header byte 0xE9, segments and the SHA-256 of everything before it
+static std::string buildFirmware(size_t length, unsigned seed)
+{
+  std::mt19937 random(seed);
+  std::string image(length, '\0');
+  image[0] = '\xE9';
+  for (size_t i = 1; i < length; i++)
+  {
+    // Repeating structure with some noise, like code and constant tables
+    image[i] = (char)((i % 251) ^ (random() % 16 == 0 ? random() : 0));
+  }
+  return image + sha256Of(image, false);
+}
+
+static void writeVarint(std::string &patch, uint32_t value)
+{
+  while (value >= 0x80)
+  {
+    patch += (char)((value & 0x7F) | 0x80);
+    value >>= 7;
+  }
+  patch += (char)value;
+}
+
+static void writeValue(std::string &patch, uint32_t value)
+{
+  for (int i = 0; i < 4; i++)
+  {
+    patch += (char)(value >> (8 * i));
+  }
+}
+
+// Builds a patch like Tools/firmware_delta.py
+class PatchBuilder
+{
+public:
+  std::string target;
+
+  PatchBuilder(const std::string &base) : base(base) {}
+
+  void copy(int32_t seek, uint32_t length)
+  {
+    basePosition += seek;
+    writeVarint(commands, ((uint32_t)seek << 1) ^ (uint32_t)(seek >> 31));
+    writeVarint(commands, length);
+    // Commands outside the running firmware are only counted
+    target += basePosition + length <= base.size() ? base.substr(basePosition, length) : std::string(length, '\0');
+    basePosition += length;
+    pendingInsert = true;
+  }
+
+  void insert(const std::string &literal)
+  {
+    writeVarint(commands, literal.size());
+    commands += literal;
+    target += literal;
+    pendingInsert = false;
+  }
+
+  std::string patch(const std::string &baseSha256, const std::string &targetSha256)
+  {
+    if (pendingInsert)
+    {
+      insert("");
+    }
+    std::string patch = FIRMWARE_PATCH_MAGIC;
+    patch += (char)FIRMWARE_PATCH_VERSION;
+    writeValue(patch, base.size());
+    writeValue(patch, target.size());
+    return patch + baseSha256 + targetSha256 + commands;
+  }
+
+  std::string patch()
+  {
+    return patch(sha256Of(base, false), sha256Of(target, false));
+  }
+
+private:
+  const std::string &base;
+  std::string commands;
+  uint32_t basePosition = 0;
+  bool pendingInsert = false;
+};
+
+static std::string running;
+static std::string written;
+static size_t failWriteAt = SIZE_MAX;
+
+static bool collect(const uint8_t *data, size_t length)
+{
+  if (written.size() + length > failWriteAt)
+  {
+    return false;
+  }
+  written.append((const char *)data, length);
+  return true;
+}
+
+class FirmwareDeltaTest : public ::testing::Test
+{
+protected:
+  // The hash of the running firmware is kept for the whole run, like for a wake up
+  static void SetUpTestSuite()
+  {
+    running = buildFirmware(200000, 1);
+    hostSetRunningFirmware(running, PARTITION_SIZE);
+  }
+
+  void SetUp() override
+  {
+    written.clear();
+    failWriteAt = SIZE_MAX;
+    hostClearLog();
+  }
+
+  // New firmware with changed constants, an insertion that moves the rest and a new tail
+  PatchBuilder changedFirmware()
+  {
+    PatchBuilder builder(running);
+    builder.copy(0, 5000);
+    builder.insert(std::string(4, '\x42'));
+    builder.copy(4, 60000);
+    builder.insert(std::string(2048, '\x17'));
+    builder.copy(0, 80000);
+    builder.insert("\x01\x02");
+    builder.copy(-1000, 50000);
+    std::string tail = sha256Of(builder.target, false);
+    builder.insert(tail);
+    return builder;
+  }
+
+  FirmwarePatchResult apply(FirmwarePatchState &state, const std::string &patch, const std::string &targetSha256, unsigned seed)
+  {
+    std::mt19937 random(seed);
+    FirmwarePatchResult result = FirmwarePatchContinue;
+    for (size_t position = 0; position < patch.size() && result == FirmwarePatchContinue;)
+    {
+      size_t length = min((size_t)(1 + random() % 5000), patch.size() - position);
+      result = applyFirmwarePatch(state, (const uint8_t *)patch.data() + position, length, targetSha256.c_str(), PARTITION_SIZE, collect);
+      position += length;
+    }
+    return result;
+  }
+};
+
+TEST_F(FirmwareDeltaTest, RunningSha256CoversAppendedDigest)
+{
+  // The same as sha256sum firmware.bin, not the hash of the image without its digest or of the partition
+  EXPECT_EQ(std::string(runningFirmwareSha256().c_str()), sha256Of(running));
+  EXPECT_NE(std::string(runningFirmwareSha256().c_str()), sha256Of(running.substr(0, running.size() - 32)));
+}
+
+TEST_F(FirmwareDeltaTest, DetectsPatch)
+{
+  PatchBuilder builder = changedFirmware();
+  std::string patch = builder.patch();
+  EXPECT_TRUE(isFirmwarePatch((const uint8_t *)patch.data(), patch.size()));
+  EXPECT_FALSE(isFirmwarePatch((const uint8_t *)running.data(), running.size()));
+  EXPECT_LT(patch.size(), builder.target.size() / 50);
+}
+
+TEST_F(FirmwareDeltaTest, AppliesPatchInAnyChunkSize)
+{
+  PatchBuilder builder = changedFirmware();
+  std::string patch = builder.patch();
+  std::string targetSha256 = sha256Of(builder.target);
+  for (unsigned seed = 1; seed <= 20; seed++)
+  {
+    written.clear();
+    FirmwarePatchState state = {};
+    ASSERT_EQ(apply(state, patch, targetSha256, seed), FirmwarePatchComplete) << "seed " << seed;
+    ASSERT_EQ(written, builder.target) << "seed " << seed;
+  }
+
+  // Byte by byte
+  written.clear();
+  FirmwarePatchState state = {};
+  FirmwarePatchResult result = FirmwarePatchContinue;
+  for (size_t i = 0; i < patch.size(); i++)
+  {
+    result = applyFirmwarePatch(state, (const uint8_t *)patch.data() + i, 1, targetSha256.c_str(), PARTITION_SIZE, collect);
+    ASSERT_EQ(result, i + 1 == patch.size() ? FirmwarePatchComplete : FirmwarePatchContinue) << i;
+  }
+  EXPECT_EQ(written, builder.target);
+}
+
+TEST_F(FirmwareDeltaTest, ResumesWithStoredState)
+{
+  PatchBuilder builder = changedFirmware();
+  std::string patch = builder.patch();
+  std::string targetSha256 = sha256Of(builder.target);
+
+  // The state is kept in RTC memory over deep sleep, the download continues after the stored bytes
+  for (size_t split : {(size_t)10, (size_t)FIRMWARE_PATCH_HEADER_SIZE + 2, patch.size() / 2, patch.size() - 1})
+  {
+    written.clear();
+    FirmwarePatchState state = {};
+    ASSERT_EQ(apply(state, patch.substr(0, split), targetSha256, 3), FirmwarePatchContinue);
+    FirmwarePatchState stored;
+    memcpy(&stored, &state, sizeof(state));
+    ASSERT_EQ(apply(stored, patch.substr(split), targetSha256, 4), FirmwarePatchComplete) << "split " << split;
+    EXPECT_EQ(written, builder.target) << "split " << split;
+  }
+}
+
+TEST_F(FirmwareDeltaTest, IgnoresBytesAfterTheFirmware)
+{
+  PatchBuilder builder = changedFirmware();
+  std::string patch = builder.patch() + std::string(100, '\x7F');
+  FirmwarePatchState state = {};
+  ASSERT_EQ(apply(state, patch, sha256Of(builder.target), 5), FirmwarePatchComplete);
+  EXPECT_EQ(written, builder.target);
+}
+
+TEST_F(FirmwareDeltaTest, RejectsPatchForOtherRunningFirmware)
+{
+  PatchBuilder builder = changedFirmware();
+  std::string targetSha256 = sha256Of(builder.target, false);
+  std::string patch = builder.patch(sha256Of("other firmware", false), targetSha256);
+  FirmwarePatchState state = {};
+  EXPECT_EQ(apply(state, patch, sha256Of(builder.target), 6), FirmwarePatchRejected);
+  EXPECT_TRUE(written.empty());
+  EXPECT_TRUE(hostLogContains("Firmware patch: built for "));
+}
+
+TEST_F(FirmwareDeltaTest, RejectsPatchForOtherFirmware)
+{
+  PatchBuilder builder = changedFirmware();
+  FirmwarePatchState state = {};
+  EXPECT_EQ(apply(state, builder.patch(), sha256Of("expected firmware"), 7), FirmwarePatchRejected);
+  EXPECT_TRUE(written.empty());
+  EXPECT_TRUE(hostLogContains("Firmware patch: not for firmware"));
+}
+
+TEST_F(FirmwareDeltaTest, RejectsCommandsOutsideTheFirmware)
+{
+  {
+    PatchBuilder builder(running);
+    builder.copy(0, 1000);
+    builder.insert("x");
+    builder.copy(-5000, 10);
+    FirmwarePatchState state = {};
+    EXPECT_EQ(apply(state, builder.patch(), sha256Of(builder.target), 8), FirmwarePatchRejected);
+    EXPECT_TRUE(hostLogContains("seek outside the running firmware"));
+  }
+  {
+    // Copy beyond the end of the running firmware
+    PatchBuilder builder(running);
+    builder.copy(0, running.size() - 10);
+    std::string patch = builder.patch();
+    size_t lengthPosition = FIRMWARE_PATCH_HEADER_SIZE + 1;
+    std::string oversized;
+    writeVarint(oversized, running.size() + 10);
+    std::string original;
+    writeVarint(original, running.size() - 10);
+    patch.replace(lengthPosition, original.size(), oversized);
+    FirmwarePatchState state = {};
+    EXPECT_EQ(apply(state, patch, sha256Of(builder.target), 9), FirmwarePatchRejected);
+    EXPECT_TRUE(hostLogContains("copy outside the firmware"));
+  }
+  {
+    PatchBuilder builder(running);
+    builder.copy(0, 100);
+    std::string patch = builder.patch();
+    patch.replace(8, 4, std::string("\x00\x00\x10\x00", 4));
+    FirmwarePatchState state = {};
+    EXPECT_EQ(apply(state, patch, sha256Of(builder.target), 10), FirmwarePatchRejected);
+    EXPECT_TRUE(hostLogContains("Firmware patch: invalid header"));
+  }
+}
+
+TEST_F(FirmwareDeltaTest, RejectsOnWriteError)
+{
+  PatchBuilder builder = changedFirmware();
+  failWriteAt = 70000;
+  FirmwarePatchState state = {};
+  EXPECT_EQ(apply(state, builder.patch(), sha256Of(builder.target), 11), FirmwarePatchRejected);
+}
@@ -0,0 +1,606 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Host test of the HTTP upload in HttpUpload.cpp
+ *
+ * transmitFileHttp() uploads files of the SD card through a LinkProxy to a
+ * stand-in for the "HTTP upload" node of the Node-RED flow. The records
+ * forwarded by the deck box must match the file, and an interrupted upload
+ * must resume at the last segment the deck box has received.
+ *
+ * HYFIVE_HTTP_FILE=<measurement file> uploads a file of the SD card via
+ * HTTP and via MQTTPipeline.cpp (one QoS 1 message per line, window 1 and
+ * HYFIVE_HTTP_WINDOW, default 8) and prints wall time and radio energy per
+ * MB. HYFIVE_HTTP_LATENCY_MS (default 10), HYFIVE_HTTP_DROP (default 0) and
+ * HYFIVE_HTTP_RADIO_MW (default 450) set the link and the power of the radio.
+ */
+
+#include <MQTT.h>
+#include <SD.h>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <mbedtls/md.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "HostBroker.h"
+#include "HostLog.h"
+#include "HttpUpload.h"
+#include "LinkProxy.h"
+#include "MqttPipeline.h"
+#include "loggerConfig.h"
+
+// Calls of transmitChannelViaMqtt() until a file is uploaded
+#define UPLOAD_ATTEMPTS 20
+
+static std::string sha256Hex(const std::string &data)
+{
+  mbedtls_md_context_t ctx;
+  unsigned char hash[32];
+  mbedtls_md_init(&ctx);
+  mbedtls_md_setup(&ctx, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 0);
+  mbedtls_md_starts(&ctx);
+  mbedtls_md_update(&ctx, (const unsigned char *)data.data(), data.size());
+  mbedtls_md_finish(&ctx, hash);
+  char hex[65];
+  for (int i = 0; i < 32; i++)
+  {
+    sprintf(hex + 2 * i, "%02x", hash[i]);
+  }
+  return hex;
+}
+
+static std::vector<std::string> recordsOf(const std::string &data)
+{
+  std::vector<std::string> records;
+  std::istringstream stream(data);
+  std::string line;
+  while (std::getline(stream, line))
+  {
+    if (!line.empty() && line.back() == '\r')
+    {
+      line.pop_back();
+    }
+    if (line.find_first_not_of(" \t") != std::string::npos)
+    {
+      records.push_back(line);
+    }
+  }
+  return records;
+}
+
+static std::string queryValue(const std::string &target, const std::string &key)
+{
+  size_t position = target.find((target.find('?' + key + '=') != std::string::npos ? '?' : '&') + key + '=');
+  if (position == std::string::npos)
+  {
+    return "";
+  }
+  position += key.size() + 2;
+  return target.substr(position, target.find('&', position) - position);
+}
+
+// Same behaviour as the "HTTP upload" function node of the Node-RED flow
+class HttpDeckbox
+{
+public:
+  std::vector<std::string> forwarded;
+  std::atomic<unsigned> connections{0};
+  std::atomic<unsigned> requests{0};
+  // Closes the connection once this many body bytes have been received, 0 never
+  std::atomic<size_t> dropAfterBytes{0};
+  std::atomic<bool> corruptNextSegment{false};
+
+  HttpDeckbox()
+  {
+    listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(listenFd, (struct sockaddr *)&address, sizeof(address));
+    listen(listenFd, 16);
+    socklen_t length = sizeof(address);
+    getsockname(listenFd, (struct sockaddr *)&address, &length);
+    listenPort = ntohs(address.sin_port);
+    acceptThread = std::thread(&HttpDeckbox::acceptLoop, this);
+  }
+
+  ~HttpDeckbox()
+  {
+    stopping = true;
+    acceptThread.join();
+    for (std::thread &thread : threads)
+    {
+      thread.join();
+    }
+    ::close(listenFd);
+  }
+
+  uint16_t port() const { return listenPort; }
+
+private:
+  struct Upload
+  {
+    std::string file;
+    std::string sha256;
+    size_t size = 0;
+    std::string data;
+    bool done = false;
+  };
+
+  int listenFd;
+  uint16_t listenPort;
+  std::atomic<bool> stopping{false};
+  std::thread acceptThread;
+  std::vector<std::thread> threads;
+  std::mutex lock;
+  std::map<std::string, Upload> uploads;
+  size_t bodyBytes = 0;
+
+  void acceptLoop()
+  {
+    while (!stopping)
+    {
+      struct pollfd descriptor = {listenFd, POLLIN, 0};
+      if (poll(&descriptor, 1, 50) <= 0)
+      {
+        continue;
+      }
+      int fd = accept(listenFd, nullptr, nullptr);
+      if (fd >= 0)
+      {
+        connections++;
+        threads.emplace_back(&HttpDeckbox::serve, this, fd);
+      }
+    }
+  }
+
+  // Buffered reads of one connection
+  struct Reader
+  {
+    int fd;
+    const std::atomic<bool> &stopping;
+    std::string buffer;
+
+    bool fill()
+    {
+      while (!stopping)
+      {
+        struct pollfd descriptor = {fd, POLLIN, 0};
+        if (poll(&descriptor, 1, 50) <= 0)
+        {
+          continue;
+        }
+        char data[8192];
+        ssize_t length = recv(fd, data, sizeof(data), 0);
+        if (length <= 0)
+        {
+          return false;
+        }
+        buffer.append(data, length);
+        return true;
+      }
+      return false;
+    }
+
+    bool line(std::string &text)
+    {
+      size_t end;
+      while ((end = buffer.find("\r\n")) == std::string::npos)
+      {
+        if (!fill())
+        {
+          return false;
+        }
+      }
+      text = buffer.substr(0, end);
+      buffer.erase(0, end + 2);
+      return true;
+    }
+
+    bool bytes(size_t count, std::string &data)
+    {
+      while (buffer.size() < count)
+      {
+        if (!fill())
+        {
+          return false;
+        }
+      }
+      data += buffer.substr(0, count);
+      buffer.erase(0, count);
+      return true;
+    }
+  };
+
+  void serve(int fd)
+  {
+    Reader reader{fd, stopping, ""};
+    while (true)
+    {
+      std::string requestLine;
+      if (!reader.line(requestLine))
+      {
+        break;
+      }
+      std::map<std::string, std::string> headers;
+      std::string header;
+      while (reader.line(header) && !header.empty())
+      {
+        size_t colon = header.find(':');
+        std::string name = header.substr(0, colon);
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        headers[name] = header.substr(header.find_first_not_of(' ', colon + 1));
+      }
+
+      std::string body;
+      bool complete = true;
+      if (headers["transfer-encoding"] == "chunked")
+      {
+        std::string size;
+        while ((complete = reader.line(size)))
+        {
+          size_t length = strtoul(size.c_str(), nullptr, 16);
+          std::string crlf;
+          if (!(complete = reader.bytes(length, body) && reader.bytes(2, crlf)) || length == 0)
+          {
+            break;
+          }
+          if (dropBody(body.size()))
+          {
+            complete = false;
+            break;
+          }
+        }
+      }
+      else if (!headers["content-length"].empty())
+      {
+        complete = reader.bytes(strtoul(headers["content-length"].c_str(), nullptr, 10), body);
+      }
+      if (!complete)
+      {
+        break;
+      }
+      requests++;
+
+      std::string method = requestLine.substr(0, requestLine.find(' '));
+      std::string target = requestLine.substr(method.size() + 1, requestLine.rfind(' ') - method.size() - 1);
+      std::string response = handleUpload(target, method == "POST" ? &body : nullptr, headers["content-range"]);
+      bool close = headers["connection"] == "close";
+      response += close ? "Connection: close\r\n\r\n" : "\r\n";
+      if (::send(fd, response.data(), response.size(), MSG_NOSIGNAL) != (ssize_t)response.size() || close)
+      {
+        break;
+      }
+    }
+    ::close(fd);
+  }
+
+  bool dropBody(size_t received)
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    size_t limit = dropAfterBytes;
+    if (limit > 0 && bodyBytes + received >= limit)
+    {
+      dropAfterBytes = 0;
+      bodyBytes = 0;
+      return true;
+    }
+    return false;
+  }
+
+  std::string handleUpload(const std::string &target, const std::string *body, const std::string &contentRange)
+  {
+    if (target.compare(0, strlen(HTTP_UPLOAD_PATH) + 1, HTTP_UPLOAD_PATH "?") != 0)
+    {
+      return "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n";
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    if (body != nullptr)
+    {
+      bodyBytes += body->size();
+    }
+    Upload &upload = uploads[queryValue(target, "logger_id")];
+    size_t size = strtoul(queryValue(target, "size").c_str(), nullptr, 10);
+    if (upload.file != queryValue(target, "file") || upload.sha256 != queryValue(target, "sha256") || upload.size != size)
+    {
+      upload = Upload();
+      upload.file = queryValue(target, "file");
+      upload.sha256 = queryValue(target, "sha256");
+      upload.size = size;
+    }
+
+    int status = 308;
+    if (body != nullptr && !upload.done)
+    {
+      unsigned long first = 0;
+      unsigned long last = 0;
+      if (sscanf(contentRange.c_str(), "bytes %lu-%lu/", &first, &last) == 2 && first == upload.data.size() && last + 1 - first == body->size())
+      {
+        upload.data += *body;
+        if (corruptNextSegment.exchange(false))
+        {
+          upload.data[first] ^= 0x01;
+        }
+      }
+      if (upload.data.size() == upload.size)
+      {
+        if (sha256Hex(upload.data) == upload.sha256)
+        {
+          upload.done = true;
+          std::vector<std::string> records = recordsOf(upload.data);
+          forwarded.insert(forwarded.end(), records.begin(), records.end());
+        }
+        else
+        {
+          upload.data.clear();
+          status = 409;
+        }
+      }
+    }
+    if (upload.done)
+    {
+      status = 200;
+    }
+
+    std::string response = "HTTP/1.1 " + std::to_string(status) + (status == 200 ? " OK" : status == 409 ? " Conflict" : " Permanent Redirect") + "\r\n";
+    if (status == 308 && !upload.data.empty())
+    {
+      response += "Range: bytes=0-" + std::to_string(upload.data.size() - 1) + "\r\n";
+    }
+    return response + "Content-Length: 0\r\n";
+  }
+};
+
+static std::string buildMeasurementFile(int records)
+{
+  std::string content;
+  for (int i = 0; i < records; i++)
+  {
+    char line[200];
+    snprintf(line, sizeof(line), "{\"logger_id\":7,\"time\":%d,\"pressure\":%.2f,\"temperature\":%.3f,\"conductivity\":%.3f}\r\n", 1717243200 + i, 1.5 + i * 0.1, 12.0 + i * 0.001, 35.0 - i * 0.002);
+    content += line;
+  }
+  return content;
+}
+
+static void writeSdFile(const char *path, const std::string &content)
+{
+  File file = SD.open(path, FILE_WRITE);
+  file.write((const uint8_t *)content.data(), content.size());
+  file.close();
+}
+
+// Bytes sent by the last successful upload, from the log of transmitFileHttp()
+static size_t loggedBytesSent()
+{
+  size_t bytes = 0;
+  for (const std::string &line : hostLogLines())
+  {
+    size_t position = line.find(" bytes sent | ");
+    if (position != std::string::npos)
+    {
+      size_t start = line.rfind("| ", line.rfind('/', position)) + 2;
+      bytes = strtoul(line.c_str() + start, nullptr, 10);
+    }
+  }
+  return bytes;
+}
+
+class HttpUploadTest : public ::testing::Test
+{
+protected:
+  HttpDeckbox deckbox;
+
+  void SetUp() override
+  {
+    hostUseTemporarySd({"/measurements/mqtt_measurements"});
+    hostClearLog();
+    configRTC.logger_id = 7;
+  }
+
+  bool transmit(uint16_t port, const char *path)
+  {
+    File file = SD.open(path, FILE_READ);
+    bool complete = transmitFileHttp("127.0.0.1", port, file, "data");
+    file.close();
+    return complete;
+  }
+};
+
+TEST_F(HttpUploadTest, UploadsFileInSegments)
+{
+  std::string content = buildMeasurementFile(2500);
+  ASSERT_GT(content.size(), 2u * HTTP_UPLOAD_SEGMENT_SIZE);
+  writeSdFile("/measurements/mqtt_measurements/m.json", content);
+
+  ASSERT_TRUE(transmit(deckbox.port(), "/measurements/mqtt_measurements/m.json"));
+  EXPECT_EQ(deckbox.forwarded, recordsOf(content));
+  EXPECT_EQ(loggedBytesSent(), content.size());
+  // GET and one POST per segment on one keep-alive connection
+  EXPECT_EQ(deckbox.requests, 1 + (content.size() + HTTP_UPLOAD_SEGMENT_SIZE - 1) / HTTP_UPLOAD_SEGMENT_SIZE);
+  EXPECT_EQ(deckbox.connections, 1u);
+}
+
+TEST_F(HttpUploadTest, EmptyFile)
+{
+  writeSdFile("/measurements/mqtt_measurements/empty.json", "");
+  ASSERT_TRUE(transmit(deckbox.port(), "/measurements/mqtt_measurements/empty.json"));
+  EXPECT_TRUE(deckbox.forwarded.empty());
+}
+
+TEST_F(HttpUploadTest, InterruptedUploadResumesAtLastSegment)
+{
+  std::string content = buildMeasurementFile(2500);
+  writeSdFile("/measurements/mqtt_measurements/m.json", content);
+
+  // The connection is lost during the third segment
+  deckbox.dropAfterBytes = 2 * HTTP_UPLOAD_SEGMENT_SIZE + 1000;
+  ASSERT_FALSE(transmit(deckbox.port(), "/measurements/mqtt_measurements/m.json"));
+  EXPECT_TRUE(hostLogContains("interrupted at " + std::to_string(2 * HTTP_UPLOAD_SEGMENT_SIZE) + "/"));
+
+  ASSERT_TRUE(transmit(deckbox.port(), "/measurements/mqtt_measurements/m.json"));
+  EXPECT_EQ(loggedBytesSent(), content.size() - 2 * HTTP_UPLOAD_SEGMENT_SIZE);
+  EXPECT_EQ(deckbox.forwarded, recordsOf(content));
+}
+
+TEST_F(HttpUploadTest, HashMismatchStartsAgain)
+{
+  std::string content = buildMeasurementFile(1000);
+  writeSdFile("/measurements/mqtt_measurements/m.json", content);
+
+  deckbox.corruptNextSegment = true;
+  ASSERT_FALSE(transmit(deckbox.port(), "/measurements/mqtt_measurements/m.json"));
+  EXPECT_TRUE(hostLogContains("does not match at the deck box"));
+  EXPECT_TRUE(deckbox.forwarded.empty());
+
+  ASSERT_TRUE(transmit(deckbox.port(), "/measurements/mqtt_measurements/m.json"));
+  EXPECT_EQ(loggedBytesSent(), content.size());
+  EXPECT_EQ(deckbox.forwarded, recordsOf(content));
+}
+
+TEST_F(HttpUploadTest, NoDeckBox)
+{
+  writeSdFile("/measurements/mqtt_measurements/m.json", buildMeasurementFile(10));
+  uint16_t port;
+  {
+    // A port nobody listens on
+    HttpDeckbox closed;
+    port = closed.port();
+  }
+  EXPECT_FALSE(transmit(port, "/measurements/mqtt_measurements/m.json"));
+  EXPECT_TRUE(hostLogContains("HTTP upload: no response from the deck box"));
+}
+
+TEST_F(HttpUploadTest, DropsAndLossOnTheLink)
+{
+  std::string content = buildMeasurementFile(1500);
+  writeSdFile("/measurements/mqtt_measurements/m.json", content);
+  LinkConditions conditions;
+  conditions.latency = 2;
+  conditions.loss = 0.01;
+  conditions.rto = 50;
+  conditions.drop = 0.1;
+  conditions.seed = 3;
+  LinkProxy proxy(deckbox.port(), conditions);
+
+  int attempts = 1;
+  while (!transmit(proxy.port(), "/measurements/mqtt_measurements/m.json") && attempts < UPLOAD_ATTEMPTS)
+  {
+    attempts++;
+  }
+  EXPECT_LT(attempts, UPLOAD_ATTEMPTS);
+  EXPECT_GT(proxy.drops(), 0u);
+  EXPECT_EQ(deckbox.forwarded, recordsOf(content));
+}
+
+// Upload of the lines of a file with the MQTT pipeline, for the comparison
+struct LineUpload
+{
+  const std::string *content;
+  std::string payload;
+  MQTTClient *client;
+};
+
+static bool readLine(uint32_t byteOffset, long, UploadMessage &message, void *context)
+{
+  LineUpload *upload = (LineUpload *)context;
+  if (byteOffset >= upload->content->size())
+  {
+    return false;
+  }
+  size_t end = upload->content->find('\n', byteOffset);
+  end = end == std::string::npos ? upload->content->size() : end;
+  upload->payload = upload->content->substr(byteOffset, end - byteOffset);
+  message.topic = "hyfive/data";
+  message.payload = (const uint8_t *)upload->payload.data();
+  message.length = upload->payload.size();
+  message.nextOffset = min(end + 1, upload->content->size());
+  message.lineCount = upload->payload.find_first_not_of(" \t\r") == std::string::npos ? 0 : 1;
+  return true;
+}
+
+static void advanceLine(const UploadMessage &, void *)
+{
+}
+
+static bool reconnectLine(void *context)
+{
+  LineUpload *upload = (LineUpload *)context;
+  upload->client->disconnect();
+  return upload->client->connect("logger7");
+}
+
+static double environmentValue(const char *name, double fallback)
+{
+  const char *value = getenv(name);
+  return value ? strtod(value, nullptr) : fallback;
+}
+
+TEST_F(HttpUploadTest, RecordedFileComparedWithMqtt)
+{
+  const char *path = getenv("HYFIVE_HTTP_FILE");
+  if (path == nullptr)
+  {
+    GTEST_SKIP() << "HYFIVE_HTTP_FILE not set";
+  }
+  std::ifstream stream(path, std::ios::binary);
+  ASSERT_TRUE(stream.good()) << path;
+  std::string content((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+  writeSdFile("/measurements/mqtt_measurements/recorded.json", content);
+
+  LinkConditions conditions;
+  conditions.latency = environmentValue("HYFIVE_HTTP_LATENCY_MS", 10);
+  conditions.drop = environmentValue("HYFIVE_HTTP_DROP", 0);
+  double radioMilliwatts = environmentValue("HYFIVE_HTTP_RADIO_MW", 450);
+  uint8_t window = environmentValue("HYFIVE_HTTP_WINDOW", 8);
+  double megabytes = content.size() / 1e6;
+  auto report = [&](const std::string &name, double seconds, bool ok)
+  {
+    printf("%26s %9.2f %9.3f %9.2f  %s\n", name.c_str(), seconds, megabytes / seconds, seconds * radioMilliwatts / 1000 / megabytes, ok ? "ok" : "FAILED");
+  };
+  printf("%zu bytes, %zu lines, latency %lu ms, radio %.0f mW, drop %g\n", content.size(), recordsOf(content).size(), conditions.latency, radioMilliwatts, conditions.drop);
+  printf("%26s %9s %9s %9s  %s\n", "upload", "time s", "MB/s", "J/MB", "check");
+
+  {
+    LinkProxy proxy(deckbox.port(), conditions);
+    unsigned long start = millis();
+    int attempts = 0;
+    while (!transmit(proxy.port(), "/measurements/mqtt_measurements/recorded.json") && ++attempts < UPLOAD_ATTEMPTS)
+    {
+    }
+    bool ok = deckbox.forwarded == recordsOf(content);
+    EXPECT_TRUE(ok);
+    report("HTTP (" + std::to_string(attempts) + " resumes)", (millis() - start) / 1000.0, ok);
+  }
+
+  HostBroker broker;
+  for (uint8_t mqttWindow : {(uint8_t)1, window})
+  {
+    LinkProxy proxy(broker.port(), conditions);
+    WiFiClient network;
+    MQTTClient client(1024, 4096);
+    client.begin("127.0.0.1", proxy.port(), network);
+    LineUpload upload = {&content, "", &client};
+    broker.clearReceived();
+    unsigned long start = millis();
+    ASSERT_TRUE(client.connect("logger7"));
+    beginMqttPipeline(network, nullptr);
+    bool ok = pipelineTransmit(readLine, advanceLine, reconnectLine, &upload, 0, 0, mqttWindow);
+    double seconds = (millis() - start) / 1000.0;
+    ok = ok && broker.receivedCount("hyfive/data") >= recordsOf(content).size();
+    EXPECT_TRUE(ok);
+    report("MQTT per line window " + std::to_string(mqttWindow), seconds, ok);
+    client.disconnect();
+  }
+}
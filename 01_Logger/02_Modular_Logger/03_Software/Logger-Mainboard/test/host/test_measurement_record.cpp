@@ -0,0 +1,243 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Host test of the binary measurement records in MeasurementRecord.cpp
+ *
+ * The records must be converted into the same lines the logger wrote to
+ * measurement.json before the record file: one StaticJsonDocument per
+ * sample, serialized and appended with println(), see legacyLine().
+ */
+
+#include <SD.h>
+#include <gtest/gtest.h>
+
+#include "DS3231TimeNtp.h"
+#include "HostLog.h"
+#include "MeasurementRecord.h"
+#include "SystemVariables.h"
+
+#define SLOTS 3
+#define START_TIME 1717243200UL
+#define JSON_FILE "/measurements/measurement.json"
+
+struct Sample
+{
+  uint32_t time;
+  bool valid[SLOTS];
+  float values[SLOTS];
+  float rawValues[SLOTS];
+};
+
+static std::string readFile(const char *path)
+{
+  std::string content;
+  File file = SD.open(path, FILE_READ);
+  while (file && file.available())
+  {
+    content += (char)file.read();
+  }
+  return content;
+}
+
+class MeasurementRecordTest : public ::testing::Test
+{
+protected:
+  void SetUp() override
+  {
+    hostClearLog();
+    hostUseTemporarySd({"/measurements", "/backup/measurements"});
+    hostLimitSdWrites(-1);
+    hostSetRtcTime(START_TIME);
+    configRTC.logger_id = 7;
+    deployment_id = 12;
+    numberOfActiveSensors = SLOTS;
+    setSlotNames({"temperature", "conductivity", "pressure"});
+  }
+
+  void TearDown() override
+  {
+    hostLimitSdWrites(-1);
+    hostSetRtcTime(0);
+  }
+
+  static void setSlotNames(std::initializer_list<const char *> names)
+  {
+    int i = 0;
+    for (const char *name : names)
+    {
+      strlcpy(configRTC.sensor[i++].parameter, name, sizeof(configRTC.sensor[0].parameter));
+    }
+  }
+
+  // Logger line of configHeader.json with the record schema of the running deployment
+  static void writeHeaderLine()
+  {
+    StaticJsonDocument<2048> doc;
+    doc["logger_id"] = configRTC.logger_id;
+    doc["deployment_id"] = deployment_id;
+    addRecordSchemaToHeader(doc);
+    File file = SD.open("/measurements/configHeader.json", FILE_APPEND);
+    serializeJson(doc, file);
+    file.println();
+    file.close();
+  }
+
+  static Sample sample(uint32_t n)
+  {
+    Sample s = {(uint32_t)(START_TIME + 10 * n), {true, n % 3 != 0, n % 5 != 0}, {12.345f + n * 0.01f, 35.5f - n * 0.001f, -0.004f * n}, {(float)n * 100, 1.0f / 3, -0.0f}};
+    if (n % 7 == 6)
+    {
+      // A sample without successful measurement is not written
+      s.valid[0] = s.valid[1] = s.valid[2] = false;
+    }
+    return s;
+  }
+
+  // Line of the former per-sample JSON writer, empty for a sample without value
+  static std::string legacyLine(const Sample &s, uint32_t deploymentId)
+  {
+    StaticJsonDocument<1024> doc;
+    doc["time"] = formatUnixTimeAsISOString(s.time);
+    doc["logger_id"] = configRTC.logger_id;
+    doc["deployment_id"] = deploymentId;
+    bool valuePresent = false;
+    for (int i = 0; i < SLOTS; i++)
+    {
+      if (s.valid[i])
+      {
+        doc[configRTC.sensor[i].parameter] = String(s.values[i]);
+        doc[String(configRTC.sensor[i].parameter) + "_raw"] = String(s.rawValues[i]);
+        valuePresent = true;
+      }
+    }
+    if (!valuePresent)
+    {
+      return "";
+    }
+    String daten = "";
+    serializeJson(doc, daten);
+    return std::string(daten.c_str()) + "\r\n";
+  }
+
+  // Writes the samples first..first+count-1 in blocks like the sample buffer, returns the legacy lines
+  static std::string writeSamples(uint32_t first, uint32_t count, uint16_t blockSize = 16)
+  {
+    std::string lines;
+    std::vector<uint8_t> block;
+    uint16_t recordSize = measurementRecordSize(SLOTS);
+    for (uint32_t n = first; n < first + count; n++)
+    {
+      Sample s = sample(n);
+      block.resize(block.size() + recordSize);
+      encodeMeasurementRecord(block.data() + block.size() - recordSize, s.time, s.valid, s.values, s.rawValues, SLOTS);
+      lines += legacyLine(s, deployment_id);
+      if (block.size() == (size_t)blockSize * recordSize || n == first + count - 1)
+      {
+        EXPECT_TRUE(writeMeasurementRecords(block.data(), block.size() / recordSize, SLOTS, configRTC.logger_id, deployment_id));
+        block.clear();
+      }
+    }
+    return lines;
+  }
+};
+
+TEST_F(MeasurementRecordTest, ConvertsToTheLegacyLines)
+{
+  writeHeaderLine();
+  std::string expected = writeSamples(0, 100);
+  EXPECT_EQ(readFile(MEASUREMENT_RECORD_FILE).size(), sizeof(MeasurementFileHeader) + 100u * measurementRecordSize(SLOTS));
+
+  ASSERT_TRUE(convertMeasurementRecordsToJson(MEASUREMENT_RECORD_FILE, JSON_FILE));
+  EXPECT_EQ(readFile(JSON_FILE), expected);
+  EXPECT_FALSE(SD.exists(MEASUREMENT_RECORD_FILE));
+  EXPECT_FALSE(SD.exists(MEASUREMENT_INDEX_FILE));
+  EXPECT_TRUE(hostLogContains("Records converted: 100"));
+
+  // The format of the lines, independent of legacyLine()
+  EXPECT_EQ(expected.substr(0, expected.find('\n') + 1),
+            "{\"time\":\"2024-06-01T12:00:00Z\",\"logger_id\":7,\"deployment_id\":12,\"temperature\":\"12.35\",\"temperature_raw\":\"0.00\"}\r\n");
+}
+
+TEST_F(MeasurementRecordTest, IndexHasAnEntryEveryStride)
+{
+  writeSamples(0, 2 * MEASUREMENT_INDEX_STRIDE + 5, 10);
+  std::string index = readFile(MEASUREMENT_INDEX_FILE);
+  ASSERT_EQ(index.size(), 3 * sizeof(MeasurementIndexEntry));
+  for (uint32_t i = 0; i < 3; i++)
+  {
+    MeasurementIndexEntry entry;
+    memcpy(&entry, index.data() + i * sizeof(entry), sizeof(entry));
+    EXPECT_EQ(entry.recordNumber, i * MEASUREMENT_INDEX_STRIDE);
+    EXPECT_EQ(entry.time, START_TIME + 10 * entry.recordNumber);
+  }
+}
+
+TEST_F(MeasurementRecordTest, SchemaOfTheRecordsIsUsed)
+{
+  writeHeaderLine();
+  std::string expected = writeSamples(0, 20);
+
+  // The configuration changed after the records were written
+  setSlotNames({"temp", "cond", "pres"});
+  ASSERT_TRUE(convertMeasurementRecordsToJson(MEASUREMENT_RECORD_FILE, JSON_FILE));
+  EXPECT_EQ(readFile(JSON_FILE), expected);
+}
+
+TEST_F(MeasurementRecordTest, WithoutSchemaTheConfigurationIsUsed)
+{
+  std::string expected = writeSamples(0, 20);
+  ASSERT_TRUE(convertMeasurementRecordsToJson(MEASUREMENT_RECORD_FILE, JSON_FILE));
+  EXPECT_EQ(readFile(JSON_FILE), expected);
+  EXPECT_TRUE(hostLogContains("No record schema found, using current configuration"));
+}
+
+TEST_F(MeasurementRecordTest, NewDeploymentConvertsTheFormerRecords)
+{
+  writeHeaderLine();
+  std::string expected = writeSamples(0, 20);
+  deployment_id = 13;
+  writeHeaderLine();
+  expected += writeSamples(20, 5);
+
+  ASSERT_TRUE(convertMeasurementRecordsToJson(MEASUREMENT_RECORD_FILE, JSON_FILE));
+  EXPECT_EQ(readFile(JSON_FILE), expected);
+}
+
+TEST_F(MeasurementRecordTest, ShortWriteKeepsTheRecordFile)
+{
+  writeHeaderLine();
+  File file = SD.open(JSON_FILE, FILE_WRITE);
+  file.print("{\"earlier\":1}\r\n");
+  file.close();
+  std::string expected = writeSamples(0, 100);
+  std::string records = readFile(MEASUREMENT_RECORD_FILE);
+
+  // The card is full in the middle of a line
+  hostLimitSdWrites(expected.size() / 2 + 7);
+  EXPECT_FALSE(convertMeasurementRecordsToJson(MEASUREMENT_RECORD_FILE, JSON_FILE));
+  EXPECT_TRUE(hostLogContains("Short write to " JSON_FILE ", record file kept"));
+  EXPECT_EQ(readFile(JSON_FILE), "{\"earlier\":1}\r\n");
+  EXPECT_EQ(readFile(MEASUREMENT_RECORD_FILE), records);
+
+  // The next attempt writes every line once
+  hostLimitSdWrites(-1);
+  ASSERT_TRUE(convertMeasurementRecordsToJson(MEASUREMENT_RECORD_FILE, JSON_FILE));
+  EXPECT_EQ(readFile(JSON_FILE), "{\"earlier\":1}\r\n" + expected);
+}
+
+TEST_F(MeasurementRecordTest, InvalidRecordFileIsMovedToBackup)
+{
+  File file = SD.open(MEASUREMENT_RECORD_FILE, FILE_WRITE);
+  file.print("not a record file");
+  file.close();
+  EXPECT_FALSE(convertMeasurementRecordsToJson(MEASUREMENT_RECORD_FILE, JSON_FILE));
+  EXPECT_FALSE(SD.exists(MEASUREMENT_RECORD_FILE));
+  EXPECT_FALSE(SD.exists(JSON_FILE));
+  File backup = SD.open("/backup/measurements");
+  EXPECT_TRUE(String(backup.openNextFile().name()).endsWith("_measurement.bin"));
+}
@@ -0,0 +1,406 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Host test of the windowed QoS 1 upload in MqttPipeline.cpp
+ *
+ * The upload runs through a LinkProxy with latency, segment loss and
+ * connection drops against the HostBroker. Every record of the file must
+ * arrive at least once, and the cursor may only move past messages the
+ * broker has received. Messages of subscribed topics that arrive during the
+ * upload must reach the handler and be acknowledged.
+ *
+ * HYFIVE_UPLOAD_FILE=<measurement file> replays a file of the SD card with
+ * windows 1, 4 and 16, HYFIVE_UPLOAD_LATENCY_MS sets the one-way latency
+ * (default 20). The records/s are printed.
+ */
+
+#include <MQTT.h>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <set>
+#include <sstream>
+
+#include "HostBroker.h"
+#include "HostLog.h"
+#include "LinkProxy.h"
+#include "MqttPipeline.h"
+
+#define DATA_TOPIC "hyfive/data"
+
+// File of the upload with the cursor of the firmware
+struct PipelineFile
+{
+  std::string content;
+  uint32_t cursor = 0;
+  long lineNumber = 0;
+  std::string payload;
+  HostBroker *broker = nullptr;
+  WiFiClient *network = nullptr;
+  MQTTClient *client = nullptr;
+  size_t advancedBeyondBroker = 0;
+  unsigned reconnects = 0;
+};
+
+static std::vector<std::string> handledTopics;
+
+static bool readLine(uint32_t byteOffset, long lineNumber, UploadMessage &message, void *context)
+{
+  PipelineFile *file = (PipelineFile *)context;
+  if (byteOffset >= file->content.size())
+  {
+    return false;
+  }
+  size_t end = file->content.find('\n', byteOffset);
+  end = end == std::string::npos ? file->content.size() : end;
+  file->payload = file->content.substr(byteOffset, end - byteOffset);
+  message.topic = DATA_TOPIC;
+  message.payload = (const uint8_t *)file->payload.data();
+  message.length = file->payload.size();
+  message.nextOffset = min(end + 1, file->content.size());
+  message.lineCount = file->payload.empty() ? 0 : 1;
+  return true;
+}
+
+static void advanceLine(const UploadMessage &message, void *context)
+{
+  PipelineFile *file = (PipelineFile *)context;
+  if (message.lineCount > 0)
+  {
+    std::string line = file->content.substr(file->cursor, message.nextOffset - file->cursor);
+    if (!line.empty() && line.back() == '\n')
+    {
+      line.pop_back();
+    }
+    bool received = false;
+    for (const MqttPublish &publish : file->broker->received())
+    {
+      received = received || publish.payload == line;
+    }
+    file->advancedBeyondBroker += received ? 0 : 1;
+  }
+  file->cursor = message.nextOffset;
+  file->lineNumber += message.lineCount;
+}
+
+static void handleMessage(MQTTClient *, char *topic, char *, int)
+{
+  handledTopics.push_back(topic);
+}
+
+static void handlePipelineMessage(char *topic, char *, int)
+{
+  handledTopics.push_back(topic);
+}
+
+static bool connectClient(PipelineFile &file)
+{
+  if (!file.client->connect("logger7"))
+  {
+    return false;
+  }
+  return file.client->subscribe("hyfive/sessionStatus", 1) && file.client->subscribe("hyfive/updateConfig/7", 2);
+}
+
+static bool reconnect(void *context)
+{
+  PipelineFile *file = (PipelineFile *)context;
+  file->reconnects++;
+  file->client->disconnect();
+  if (!connectClient(*file))
+  {
+    return false;
+  }
+  file->client->loop();
+  return true;
+}
+
+static std::string buildFile(int records, int emptyEvery = 0)
+{
+  std::string content;
+  for (int i = 0; i < records; i++)
+  {
+    char line[160];
+    snprintf(line, sizeof(line), "{\"logger_id\":7,\"line\":%d,\"time\":%d,\"pressure\":%.2f,\"temperature\":%.3f}", i, 1717243200 + i, 1.5 + i * 0.1, 12.0 + i * 0.001);
+    content += line;
+    content += '\n';
+    if (emptyEvery > 0 && i % emptyEvery == 0)
+    {
+      content += '\n';
+    }
+  }
+  return content;
+}
+
+static std::set<std::string> fileRecords(const std::string &content)
+{
+  std::set<std::string> records;
+  std::istringstream stream(content);
+  std::string line;
+  while (std::getline(stream, line))
+  {
+    if (!line.empty())
+    {
+      records.insert(line);
+    }
+  }
+  return records;
+}
+
+static std::set<std::string> receivedRecords(HostBroker &broker)
+{
+  std::set<std::string> records;
+  for (const MqttPublish &publish : broker.received())
+  {
+    if (publish.topic == DATA_TOPIC)
+    {
+      records.insert(publish.payload);
+    }
+  }
+  return records;
+}
+
+class MqttPipelineTest : public ::testing::Test
+{
+protected:
+  HostBroker broker;
+  WiFiClient network;
+  MQTTClient client{1024, 4096};
+  std::unique_ptr<LinkProxy> proxy;
+
+  void SetUp() override
+  {
+    handledTopics.clear();
+    hostClearLog();
+  }
+
+  // Uploads the content through a proxy and returns the elapsed time in ms, -1 if the upload failed
+  long upload(PipelineFile &file, const LinkConditions &conditions, uint8_t window)
+  {
+    proxy.reset(new LinkProxy(broker.port(), conditions));
+    file.broker = &broker;
+    file.network = &network;
+    file.client = &client;
+    client.begin("127.0.0.1", proxy->port(), network);
+    client.onMessageAdvanced(handleMessage);
+    if (!connectClient(file))
+    {
+      return -1;
+    }
+    unsigned long start = millis();
+    client.loop();
+    beginMqttPipeline(network, handlePipelineMessage);
+    bool complete = pipelineTransmit(readLine, advanceLine, reconnect, &file, file.cursor, file.lineNumber, window);
+    unsigned long elapsed = millis() - start;
+    client.disconnect();
+    return complete ? (long)elapsed : -1;
+  }
+};
+
+TEST_F(MqttPipelineTest, WindowHidesLatency)
+{
+  LinkConditions conditions;
+  conditions.latency = 5;
+  std::string content = buildFile(150, 40);
+
+  long elapsed[3];
+  const uint8_t windows[] = {1, 4, 16};
+  for (int i = 0; i < 3; i++)
+  {
+    broker.clearReceived();
+    PipelineFile file;
+    file.content = content;
+    elapsed[i] = upload(file, conditions, windows[i]);
+    ASSERT_GE(elapsed[i], 0) << "window " << (int)windows[i];
+    EXPECT_EQ(file.cursor, content.size());
+    EXPECT_EQ(file.lineNumber, 150);
+    EXPECT_EQ(file.advancedBeyondBroker, 0u);
+    EXPECT_EQ(receivedRecords(broker), fileRecords(content));
+    printf("window %2d: %ld ms, %.0f records/s\n", windows[i], elapsed[i], 150000.0 / max(elapsed[i], 1L));
+  }
+  // Stop-and-wait needs at least one round trip per message
+  EXPECT_GE(elapsed[0], 150 * 2 * 5);
+  EXPECT_LT(elapsed[2] * 3, elapsed[0]);
+}
+
+TEST_F(MqttPipelineTest, LossAndDropsKeepEveryRecord)
+{
+  LinkConditions conditions;
+  conditions.latency = 2;
+  conditions.loss = 0.02;
+  conditions.rto = 100;
+  conditions.drop = 0.01;
+  conditions.seed = 11;
+  std::string content = buildFile(400);
+
+  // A drop during the reconnection ends the upload, the next wake resumes at the cursor
+  PipelineFile file;
+  file.content = content;
+  int attempts = 1;
+  while (upload(file, conditions, 8) < 0 && attempts < 5)
+  {
+    conditions.seed++;
+    attempts++;
+  }
+  EXPECT_EQ(file.cursor, content.size()) << attempts << " attempts";
+  EXPECT_EQ(file.lineNumber, 400);
+  EXPECT_EQ(file.advancedBeyondBroker, 0u);
+  EXPECT_EQ(receivedRecords(broker), fileRecords(content));
+}
+
+TEST_F(MqttPipelineTest, DropSendsUnacknowledgedMessagesAgain)
+{
+  // The connection is lost after the broker got line 100 but before its PUBACK
+  broker.onPublish([this](const MqttPublish &message)
+                   {
+    if (message.payload.find("\"line\":100,") != std::string::npos && proxy->drops() == 0)
+    {
+      proxy->disconnectAll();
+    } });
+  std::string content = buildFile(200);
+
+  PipelineFile file;
+  file.content = content;
+  ASSERT_GE(upload(file, LinkConditions(), 8), 0);
+  EXPECT_EQ(file.cursor, content.size());
+  EXPECT_EQ(file.reconnects, 1u);
+  EXPECT_EQ(file.advancedBeyondBroker, 0u);
+  EXPECT_EQ(receivedRecords(broker), fileRecords(content));
+  // At most the window is sent twice
+  EXPECT_GT(broker.receivedCount(DATA_TOPIC), 200u);
+  EXPECT_LE(broker.receivedCount(DATA_TOPIC), 200u + 8);
+  broker.onPublish(nullptr);
+}
+
+TEST_F(MqttPipelineTest, MessagesDuringUploadReachHandler)
+{
+  // Retained like the config manifest, it follows the SUBACK and is still unread when the pipeline takes over
+  broker.publish("hyfive/configManifest/7", "{\"config\":\"logger_7_config_1717243200.json\"}", 1, true);
+  broker.onPublish([this](const MqttPublish &message)
+                   {
+    if (message.topic == DATA_TOPIC && message.payload.find("\"line\":20,") != std::string::npos)
+    {
+      broker.publish("hyfive/sessionStatus", "7:granted:60", 1);
+      broker.publish("hyfive/updateConfig/7", "{\"logger_id\":7}", 2);
+      broker.publish("hyfive/sessionStatus", std::string(1500, 'x'), 1);
+    } });
+
+  PipelineFile file;
+  file.content = buildFile(60);
+  LinkProxy proxy(broker.port(), LinkConditions());
+  file.broker = &broker;
+  file.client = &client;
+  client.begin("127.0.0.1", proxy.port(), network);
+  client.onMessageAdvanced(handleMessage);
+  ASSERT_TRUE(connectClient(file));
+  ASSERT_TRUE(client.subscribe("hyfive/configManifest/7", 1));
+  beginMqttPipeline(network, handlePipelineMessage);
+  ASSERT_TRUE(pipelineTransmit(readLine, advanceLine, reconnect, &file, 0, 0, 8));
+  EXPECT_EQ(file.reconnects, 0u);
+
+  std::vector<std::string> expected = {"hyfive/configManifest/7", "hyfive/sessionStatus", "hyfive/updateConfig/7"};
+  EXPECT_EQ(handledTopics, expected);
+  EXPECT_TRUE(hostLogContains("Message too large during the upload"));
+
+  // PUBACK and PUBCOMP of the incoming messages reach the broker
+  for (int i = 0; i < 10; i++)
+  {
+    pipelineReadAck(20);
+  }
+  EXPECT_TRUE(broker.waitForDeliveries(1000));
+  client.disconnect();
+}
+
+// Answers a config update like handleReceivedMessage() with transmitUpdateMessage()
+static MQTTClient *replyClient = nullptr;
+static std::vector<std::string> directReplies;
+
+static void answerConfigUpdate(char *topic, char *payload, int length)
+{
+  handledTopics.push_back(topic);
+  if (strcmp(topic, "hyfive/updateConfig/7") == 0 && !pipelineDeferPublish("hyfive/updateConfigUpload", payload))
+  {
+    directReplies.push_back(payload);
+    replyClient->publish("hyfive/updateConfigUpload", payload, false, 2);
+  }
+}
+
+TEST_F(MqttPipelineTest, ConfigUpdateDuringUploadIsAnsweredAfterIt)
+{
+  directReplies.clear();
+  size_t repliesDuringUpload = 0;
+  broker.onPublish([this, &repliesDuringUpload](const MqttPublish &message)
+                   {
+    if (message.topic == DATA_TOPIC && message.payload.find("\"line\":20,") != std::string::npos)
+    {
+      broker.publish("hyfive/updateConfig/7", "7_1717243200", 2);
+    }
+    if (message.topic == DATA_TOPIC && message.payload.find("\"line\":199,") != std::string::npos)
+    {
+      repliesDuringUpload = broker.receivedCount("hyfive/updateConfigUpload");
+    } });
+
+  PipelineFile file;
+  file.content = buildFile(200);
+  file.broker = &broker;
+  file.client = &client;
+  replyClient = &client;
+  client.begin("127.0.0.1", broker.port(), network);
+  client.onMessageAdvanced(handleMessage);
+  ASSERT_TRUE(connectClient(file));
+  beginMqttPipeline(network, answerConfigUpdate);
+  ASSERT_TRUE(pipelineTransmit(readLine, advanceLine, reconnect, &file, 0, 0, 8));
+
+  // No QoS 2 exchange of the reply took PUBACKs of the upload
+  EXPECT_EQ(file.reconnects, 0u);
+  EXPECT_EQ(file.advancedBeyondBroker, 0u);
+  EXPECT_EQ(receivedRecords(broker), fileRecords(file.content));
+  EXPECT_TRUE(directReplies.empty());
+  EXPECT_EQ(repliesDuringUpload, 0u);
+  EXPECT_EQ(handledTopics, std::vector<std::string>{"hyfive/updateConfig/7"});
+
+  // The reply is sent once the upload has returned
+  String topic;
+  String payload;
+  ASSERT_TRUE(pipelineTakeDeferred(topic, payload));
+  EXPECT_EQ(topic, "hyfive/updateConfigUpload");
+  EXPECT_EQ(payload, "7_1717243200");
+  EXPECT_FALSE(pipelineTakeDeferred(topic, payload));
+  EXPECT_FALSE(pipelineDeferPublish("hyfive/updateConfigUpload", "7_1717243200"));
+  EXPECT_TRUE(client.publish(topic.c_str(), payload.c_str(), false, 2));
+  EXPECT_EQ(broker.receivedCount("hyfive/updateConfigUpload"), 1u);
+  EXPECT_TRUE(broker.waitForDeliveries(1000));
+  broker.onPublish(nullptr);
+  client.disconnect();
+}
+
+TEST_F(MqttPipelineTest, RecordedFile)
+{
+  const char *path = getenv("HYFIVE_UPLOAD_FILE");
+  if (path == nullptr)
+  {
+    GTEST_SKIP() << "HYFIVE_UPLOAD_FILE not set";
+  }
+  std::ifstream stream(path);
+  ASSERT_TRUE(stream.good()) << path;
+  std::string content((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+  std::set<std::string> records = fileRecords(content);
+
+  LinkConditions conditions;
+  const char *latency = getenv("HYFIVE_UPLOAD_LATENCY_MS");
+  conditions.latency = latency ? strtoul(latency, nullptr, 10) : 20;
+  for (uint8_t window : {1, 4, 16})
+  {
+    broker.clearReceived();
+    PipelineFile file;
+    file.content = content;
+    long elapsed = upload(file, conditions, window);
+    ASSERT_GE(elapsed, 0);
+    EXPECT_EQ(receivedRecords(broker), records);
+    printf("window %2d: %zu records in %ld ms, %.0f records/s\n", window, records.size(), elapsed, records.size() * 1000.0 / max(elapsed, 1L));
+  }
+}
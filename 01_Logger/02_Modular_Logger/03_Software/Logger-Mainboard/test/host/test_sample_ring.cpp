@@ -0,0 +1,205 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Host test of the RTC memory sample buffer in SampleRing.cpp
+ *
+ * The buffer is a global like in RTC memory. A reset is a call of
+ * recoverSampleRing() with the buffer as it is, a power loss leaves random
+ * content behind.
+ */
+
+#include <SD.h>
+#include <gtest/gtest.h>
+#include <random>
+
+#include "HostLog.h"
+#include "MeasurementRecord.h"
+#include "SampleRing.h"
+#include "SystemVariables.h"
+
+#define SLOTS 3
+#define START_TIME 1717243200UL
+
+extern SampleRing sampleRing;
+
+class SampleRingTest : public ::testing::Test
+{
+protected:
+  void SetUp() override
+  {
+    hostClearLog();
+    hostUseTemporarySd({"/measurements", "/backup/measurements"});
+    hostLimitSdWrites(-1);
+    configRTC.logger_id = 7;
+    deployment_id = 12;
+    // Power-on content of RTC_NOINIT memory
+    powerLoss(1);
+    recoverSampleRing();
+  }
+
+  void TearDown() override
+  {
+    hostLimitSdWrites(-1);
+  }
+
+  static void powerLoss(unsigned seed)
+  {
+    std::mt19937 random(seed);
+    uint8_t *memory = (uint8_t *)&sampleRing;
+    for (size_t i = 0; i < sizeof(sampleRing); i++)
+    {
+      memory[i] = (uint8_t)random();
+    }
+  }
+
+  static void push(uint32_t n)
+  {
+    bool valid[SLOTS] = {true, true, n % 2 == 0};
+    float values[SLOTS] = {10.0f + n * 0.01f, 35.0f, -1.5f};
+    float rawValues[SLOTS] = {(float)n, 2.0f, 3.0f};
+    pushSampleRecord(START_TIME + n, valid, values, rawValues, SLOTS);
+  }
+
+  static uint32_t recordsPerBuffer() { return SAMPLE_RING_SIZE / measurementRecordSize(SLOTS); }
+
+  // Times of the records in the record file
+  static std::vector<uint32_t> recordTimes()
+  {
+    std::vector<uint32_t> times;
+    File file = SD.open(MEASUREMENT_RECORD_FILE, FILE_READ);
+    if (!file)
+    {
+      return times;
+    }
+    MeasurementFileHeader header;
+    EXPECT_EQ(file.read((uint8_t *)&header, sizeof(header)), sizeof(header));
+    EXPECT_EQ(header.magic, (uint32_t)MEASUREMENT_RECORD_MAGIC);
+    EXPECT_EQ(header.slotCount, SLOTS);
+    EXPECT_EQ(header.deployment_id, 12u);
+    uint8_t record[MEASUREMENT_RECORD_MAX_SIZE];
+    while (file.read(record, header.recordSize) == header.recordSize)
+    {
+      uint32_t time;
+      memcpy(&time, record, sizeof(time));
+      times.push_back(time - START_TIME);
+    }
+    return times;
+  }
+
+  static std::vector<uint32_t> sequence(uint32_t first, uint32_t count)
+  {
+    std::vector<uint32_t> values;
+    for (uint32_t n = first; n < first + count; n++)
+    {
+      values.push_back(n);
+    }
+    return values;
+  }
+};
+
+TEST_F(SampleRingTest, FlushesWhenFull)
+{
+  uint32_t capacity = recordsPerBuffer();
+  for (uint32_t n = 0; n < capacity - 1; n++)
+  {
+    push(n);
+  }
+  EXPECT_FALSE(SD.exists(MEASUREMENT_RECORD_FILE));
+  EXPECT_EQ(sampleRingRecordCount(), capacity - 1);
+
+  push(capacity - 1);
+  EXPECT_EQ(sampleRingRecordCount(), 0);
+  EXPECT_EQ(recordTimes(), sequence(0, capacity));
+  EXPECT_TRUE(hostLogContains("Sample buffer flush"));
+
+  // The next buffer is appended
+  push(capacity);
+  EXPECT_TRUE(flushSampleRing());
+  EXPECT_EQ(recordTimes(), sequence(0, capacity + 1));
+}
+
+TEST_F(SampleRingTest, ResetWritesTheRemainingRecords)
+{
+  for (uint32_t n = 0; n < 10; n++)
+  {
+    push(n);
+  }
+  recoverSampleRing();
+  EXPECT_TRUE(hostLogContains("Replaying sample buffer after reset: 10 records of deployment 12"));
+  EXPECT_EQ(recordTimes(), sequence(0, 10));
+  EXPECT_EQ(sampleRingRecordCount(), 0);
+
+  // A second reset does not write them again
+  recoverSampleRing();
+  EXPECT_EQ(recordTimes(), sequence(0, 10));
+}
+
+TEST_F(SampleRingTest, PowerLossLeavesNothingToWrite)
+{
+  for (uint32_t n = 0; n < 10; n++)
+  {
+    push(n);
+  }
+  powerLoss(2);
+  recoverSampleRing();
+  EXPECT_FALSE(SD.exists(MEASUREMENT_RECORD_FILE));
+  EXPECT_EQ(sampleRingRecordCount(), 0);
+
+  push(20);
+  EXPECT_TRUE(flushSampleRing());
+  EXPECT_EQ(recordTimes(), sequence(20, 1));
+}
+
+TEST_F(SampleRingTest, ChecksumDiscardsDamagedRecords)
+{
+  for (uint32_t n = 0; n < 10; n++)
+  {
+    push(n);
+  }
+  sampleRing.data[5 * measurementRecordSize(SLOTS) + 9] ^= 0x10;
+  EXPECT_EQ(sampleRingRecordCount(), 0);
+  recoverSampleRing();
+  EXPECT_FALSE(SD.exists(MEASUREMENT_RECORD_FILE));
+
+  // A record count beyond the buffer is not trusted either
+  push(0);
+  sampleRing.recordCount = recordsPerBuffer() + 1;
+  EXPECT_EQ(sampleRingRecordCount(), 0);
+}
+
+TEST_F(SampleRingTest, FailedFlushKeepsTheRecords)
+{
+  for (uint32_t n = 0; n < 10; n++)
+  {
+    push(n);
+  }
+  hostLimitSdWrites(0);
+  EXPECT_FALSE(flushSampleRing());
+  EXPECT_EQ(sampleRingRecordCount(), 10);
+  EXPECT_TRUE(hostLogContains("Sample buffer flush failed, records kept: 10"));
+
+  hostLimitSdWrites(-1);
+  EXPECT_TRUE(flushSampleRing());
+  EXPECT_EQ(recordTimes(), sequence(0, 10));
+}
+
+TEST_F(SampleRingTest, FullBufferIsDroppedWhenTheCardFails)
+{
+  uint32_t capacity = recordsPerBuffer();
+  hostLimitSdWrites(0);
+  for (uint32_t n = 0; n < capacity + 1; n++)
+  {
+    push(n);
+  }
+  EXPECT_TRUE(hostLogContains("Sample buffer full, records discarded: " + std::to_string(capacity)));
+  EXPECT_EQ(sampleRingRecordCount(), 1);
+
+  hostLimitSdWrites(-1);
+  EXPECT_TRUE(flushSampleRing());
+  EXPECT_EQ(recordTimes(), sequence(capacity, 1));
+}
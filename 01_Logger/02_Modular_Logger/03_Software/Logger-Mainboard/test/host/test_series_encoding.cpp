@@ -0,0 +1,315 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Host test of the series encoding in SeriesEncoding.cpp against the reference decoder
+ *
+ * A measurement file is uploaded with the messages of readUploadMessage()
+ * with the series encoding accepted. The blocks are decoded by
+ * 03_Server/03_Python/hyfive_series.py, which must give back the lines of
+ * the file byte by byte, and encoded again by its encoder, which must give
+ * the same blocks. Lines that cannot be encoded (nan, -0.00) must be sent
+ * as JSON. Without Python, only the block of the golden vector is checked.
+ */
+
+#include <SD.h>
+#include <gtest/gtest.h>
+#include <sstream>
+#include <unistd.h>
+
+#include "DS3231TimeNtp.h"
+#include "HostLog.h"
+#include "SeriesEncoding.h"
+#include "SystemVariables.h"
+#include "UploadCursor.h"
+
+#define DIRECTORY "/measurements/mqtt_measurements"
+#define FILENAME "measurement.json"
+
+static TransmissionState rtcState;
+static bool channelError;
+static TransmissionChannel channel = {"data", DIRECTORY, "hyfive/data", "/backup/measurements", "/measurements/data.cursor", nullptr, "hyfive/dataBatch", "hyfive/dataSeries", &rtcState, &channelError};
+
+// One message of the upload with the lines of the file it covers
+struct SentMessage
+{
+  bool series;
+  long firstLine;
+  std::string payload;
+  std::vector<std::string> lines;
+};
+
+// Decodes and encodes the blocks given as "<first_line> <hex block> <hex lines>" lines
+static const char *REFERENCE_SCRIPT = R"(
+import sys
+sys.path.insert(0, sys.argv[1])
+import hyfive_series
+
+for message in open(sys.argv[2]):
+    first_line, block, lines = message.split()
+    first_line = int(first_line)
+    block = bytes.fromhex(block)
+    lines = bytes.fromhex(lines).decode().split('\n')
+    decoded = hyfive_series.decode_block(block)
+    if decoded['file'] != 'measurement.json' or decoded['first_line'] != first_line:
+        print('HEADER', decoded['file'], decoded['first_line'])
+    encoded, count = hyfive_series.encode_block(lines, 'measurement.json', first_line)
+    if encoded != block or count != len(lines):
+        print('ENCODED', count, encoded.hex() if encoded else None)
+    print('BLOCK', len(decoded['records']))
+    for line in hyfive_series.json_lines(block):
+        print(line)
+)";
+
+static std::string hex(const std::string &data)
+{
+  static const char digits[] = "0123456789abcdef";
+  std::string text;
+  for (unsigned char c : data)
+  {
+    text += digits[c >> 4];
+    text += digits[c & 0x0F];
+  }
+  return text;
+}
+
+class SeriesEncodingTest : public ::testing::Test
+{
+protected:
+  void SetUp() override
+  {
+    hostClearLog();
+    hostUseTemporarySd({"/measurements", DIRECTORY});
+    configRTC.logger_id = 7;
+  }
+
+  // Line of the measurement writer, values given as the strings of String(value, decimals)
+  static std::string line(uint32_t time, uint32_t deploymentId, std::initializer_list<std::pair<const char *, String>> values)
+  {
+    std::string text = "{\"time\":\"" + std::string(formatUnixTimeAsISOString(time).c_str()) + "\",\"logger_id\":7,\"deployment_id\":" + std::to_string(deploymentId);
+    for (const auto &value : values)
+    {
+      text += ",\"" + std::string(value.first) + "\":\"" + value.second.c_str() + "\"";
+    }
+    return text + "}";
+  }
+
+  static void writeFile(const std::vector<std::string> &lines)
+  {
+    File file = SD.open(DIRECTORY "/" FILENAME, FILE_WRITE);
+    for (const std::string &text : lines)
+    {
+      file.print((text + "\r\n").c_str());
+    }
+    file.close();
+  }
+
+  // Uploads the file like transmitFileStopAndWait() with the series encoding accepted
+  static std::vector<SentMessage> upload()
+  {
+    File file = SD.open(DIRECTORY "/" FILENAME);
+    TransmissionState state = {FILENAME, 0, (uint32_t)file.size(), 0};
+    std::vector<SentMessage> messages;
+    UploadMessage message;
+    while (readUploadMessage(channel, file, state, 0, true, message))
+    {
+      if (message.lineCount > 0)
+      {
+        SentMessage sent = {strcmp(message.topic, channel.seriesTopic) == 0, state.lineNumber, std::string((const char *)message.payload, message.length), {}};
+        // The lines covered by the message
+        file.seek(state.byteOffset);
+        while (file.position() < message.nextOffset)
+        {
+          String text = file.readStringUntil('\n');
+          text.trim();
+          if (text.length() > 0)
+          {
+            sent.lines.push_back(text.c_str());
+          }
+        }
+        EXPECT_EQ(sent.lines.size(), message.lineCount);
+        if (!sent.series)
+        {
+          EXPECT_STREQ(message.topic, channel.topic);
+        }
+        messages.push_back(sent);
+      }
+      advanceTransmissionState(channel, state, message.nextOffset, message.lineCount);
+    }
+    file.close();
+    return messages;
+  }
+
+  // Runs the reference decoder on the blocks, returns its output
+  static bool runReference(const std::vector<SentMessage> &messages, std::string &output)
+  {
+    // ctest runs the tests of this file in parallel processes
+    std::string directory = testing::TempDir() + "/series_" + std::to_string(getpid());
+    std::string scriptPath = directory + "_reference.py";
+    std::string inputPath = directory + "_blocks.txt";
+    FILE *script = fopen(scriptPath.c_str(), "w");
+    fputs(REFERENCE_SCRIPT, script);
+    fclose(script);
+    FILE *input = fopen(inputPath.c_str(), "w");
+    for (const SentMessage &message : messages)
+    {
+      if (message.series)
+      {
+        std::string lines;
+        for (const std::string &text : message.lines)
+        {
+          lines += (lines.empty() ? "" : "\n") + text;
+        }
+        fprintf(input, "%ld %s %s\n", message.firstLine, hex(message.payload).c_str(), hex(lines).c_str());
+      }
+    }
+    fclose(input);
+
+    std::string command = std::string(HYFIVE_PYTHON) + " " + scriptPath + " " + HYFIVE_SERIES_DIR + " " + inputPath + " 2>&1";
+    FILE *process = popen(command.c_str(), "r");
+    if (process == nullptr)
+    {
+      return false;
+    }
+    char buffer[4096];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), process)) > 0)
+    {
+      output.append(buffer, length);
+    }
+    bool success = pclose(process) == 0;
+    remove(scriptPath.c_str());
+    remove(inputPath.c_str());
+    return success;
+  }
+
+  // Decodes the upload with the reference decoder, returns the lines of the deck box
+  static std::vector<std::string> decode(const std::vector<SentMessage> &messages)
+  {
+    std::vector<std::string> lines;
+    std::string output;
+    bool success = runReference(messages, output);
+    EXPECT_TRUE(success) << output;
+    std::istringstream stream(output);
+    for (const SentMessage &message : messages)
+    {
+      if (!message.series)
+      {
+        lines.push_back(message.payload.substr(0, message.payload.find('\r')));
+        continue;
+      }
+      std::string text;
+      std::getline(stream, text);
+      EXPECT_EQ(text, "BLOCK " + std::to_string(message.lines.size())) << "block at line " << message.firstLine;
+      for (size_t i = 0; i < message.lines.size() && std::getline(stream, text); i++)
+      {
+        lines.push_back(text);
+      }
+    }
+    return lines;
+  }
+
+  static bool pythonAvailable()
+  {
+    return system((std::string(HYFIVE_PYTHON) + " -c 'import decimal' > /dev/null 2>&1").c_str()) == 0;
+  }
+
+  static size_t seriesLines(const std::vector<SentMessage> &messages)
+  {
+    size_t count = 0;
+    for (const SentMessage &message : messages)
+    {
+      count += message.series ? message.lines.size() : 0;
+    }
+    return count;
+  }
+};
+
+TEST_F(SeriesEncodingTest, GoldenVector)
+{
+  // Block of hyfive_series.encode_block() for these lines
+  writeFile({line(1717243200, 12, {{"temperature", "12.35"}, {"pressure", "1.500"}}),
+             line(1717243201, 12, {{"temperature", "12.36"}, {"pressure", "1.500"}}),
+             line(1717243203, 12, {{"temperature", "-0.01"}, {"pressure", "0.000"}})});
+  std::vector<SentMessage> messages = upload();
+  ASSERT_EQ(messages.size(), 1u);
+  ASSERT_TRUE(messages[0].series);
+  EXPECT_EQ(hex(messages[0].payload),
+            "48465301070c106d6561737572656d656e742e6a736f6e0003020b74656d706572617475726502087072657373757265"
+            "03c09aecb20602024145999ae2eb62b83ffacc2b0a3fc00000623ff8");
+}
+
+TEST_F(SeriesEncodingTest, MeasurementLinesDecodeToTheSameJson)
+{
+  if (!pythonAvailable())
+  {
+    GTEST_SKIP() << "python3 not found";
+  }
+  std::vector<std::string> lines;
+  for (uint32_t n = 0; n < 300; n++)
+  {
+    float temperature = 12.0f + 0.01f * (n % 40) - 0.003f * n;
+    float conductivity = 35.0f + 0.001f * n;
+    float pressure = n < 150 ? 0.1f * n : 30.0f - 0.1f * (n - 150);
+    lines.push_back(line(1717243200 + 2 * n, 12, {{"temperature", String(temperature)}, {"temperature_raw", String(temperature * 1000, 0)}, {"conductivity", String(conductivity, 3)}, {"pressure", String(pressure)}}));
+  }
+  writeFile(lines);
+  std::vector<SentMessage> messages = upload();
+  // 300 records in blocks of at most SERIES_MAX_RECORDS
+  EXPECT_EQ(seriesLines(messages), 300u);
+  EXPECT_EQ(messages.size(), 3u);
+  EXPECT_EQ(decode(messages), lines);
+}
+
+TEST_F(SeriesEncodingTest, EdgeCasesDecodeToTheSameJson)
+{
+  if (!pythonAvailable())
+  {
+    GTEST_SKIP() << "python3 not found";
+  }
+  uint32_t t = 1717243200;
+  std::vector<std::string> lines = {
+      line(t, 12, {{"temperature", "12.35"}, {"conductivity", "35.120"}, {"pressure", "1.50"}}),
+      line(t + 1, 12, {{"temperature", "12.35"}, {"conductivity", "35.120"}, {"pressure", "1.50"}}),
+      // nan is not a number, the line is sent as JSON
+      line(t + 2, 12, {{"temperature", String(NAN)}, {"conductivity", "35.121"}, {"pressure", "1.60"}}),
+      line(t + 3, 12, {{"temperature", "0.00"}, {"conductivity", "35.122"}, {"pressure", "1.70"}}),
+      // String(-0.0f) gives "0.00", a small negative value gives "-0.00", which is sent as JSON
+      line(t + 4, 12, {{"temperature", String(-0.0f)}, {"conductivity", "35.123"}, {"pressure", "1.80"}}),
+      line(t + 5, 12, {{"temperature", String(-0.001f)}, {"conductivity", "35.124"}, {"pressure", "1.90"}}),
+      line(t + 6, 12, {{"temperature", "-1.25"}, {"conductivity", "0.000"}, {"pressure", "2.00"}}),
+      // A missing channel starts a new block
+      line(t + 7, 12, {{"temperature", "-1.26"}, {"pressure", "2.10"}}),
+      line(t + 8, 12, {{"temperature", "-1.27"}, {"pressure", "2.20"}}),
+      // Large gaps of the time, also backwards after a clock correction
+      line(t + 86400, 12, {{"temperature", "-1.28"}, {"pressure", "2.30"}}),
+      line(t + 86400 + 10 * 365 * 86400u, 12, {{"temperature", "-1.29"}, {"pressure", "2.40"}}),
+      line(t - 3600, 12, {{"temperature", "-1.30"}, {"pressure", "2.50"}}),
+      line(t - 3600, 12, {{"temperature", "-1.31"}, {"pressure", "2.60"}}),
+      line(4070908800u, 12, {{"temperature", "-1.32"}, {"pressure", "2.70"}}),
+      // No decimals and the largest number of decimals
+      line(t + 9, 12, {{"counter", "3"}, {"oxygen", "0.1234567"}}),
+      line(t + 10, 12, {{"counter", "4"}, {"oxygen", String(1e-7f, 7)}}),
+      // A new deployment starts a new block
+      line(t + 11, 13, {{"counter", "5"}, {"oxygen", "0.0000002"}}),
+      line(t + 12, 13, {{"counter", "-6"}, {"oxygen", String(3.4e6f, 2)}}),
+  };
+  writeFile(lines);
+  std::vector<SentMessage> messages = upload();
+
+  std::vector<std::string> json;
+  for (const SentMessage &message : messages)
+  {
+    if (!message.series)
+    {
+      json.push_back(message.lines[0]);
+    }
+  }
+  EXPECT_EQ(json, std::vector<std::string>({lines[2], lines[5]}));
+  EXPECT_EQ(seriesLines(messages), lines.size() - 2);
+  EXPECT_EQ(decode(messages), lines);
+}
@@ -0,0 +1,334 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Host test of the batch upload of UploadCursor.cpp through the HostBroker
+ *
+ * A file of the SD card is sent with the messages of readUploadMessage(),
+ * one by one like transmitFileStopAndWait() or with a window like
+ * transmitFilePipelined(). The deck box stand-in takes the batches like the
+ * batch flow: envelope line, then the records, numbered from first_line.
+ * The connection is dropped after the broker got a batch but before its
+ * PUBACK, so the upload must resume at the first record of that batch.
+ */
+
+#include <MQTT.h>
+#include <SD.h>
+#include <gtest/gtest.h>
+#include <map>
+
+#include "HostBroker.h"
+#include "HostLog.h"
+#include "MQTTManager.h"
+#include "SystemVariables.h"
+#include "UploadCursor.h"
+
+#define DIRECTORY "/measurements/mqtt_header"
+#define CHECKPOINT "/measurements/header.cursor"
+
+static TransmissionState rtcState;
+static bool channelError;
+static TransmissionChannel channel = {"header", DIRECTORY, "hyfive/header", "/backup/header", CHECKPOINT, nullptr, "hyfive/headerBatch", nullptr, &rtcState, &channelError};
+
+// One batch as the deck box got it
+struct ReceivedBatch
+{
+  long firstLine;
+  std::vector<std::string> records;
+  std::string payload;
+};
+
+// Upload of one file by the pipeline, like PipelineUpload in MQTTManager.cpp
+struct BatchUpload
+{
+  File *file;
+  TransmissionState *state;
+  size_t batchSize;
+  MQTTClient *client;
+  std::vector<long> resumeLines; // cursor at each reconnection
+};
+
+static bool readBatch(uint32_t byteOffset, long lineNumber, UploadMessage &message, void *context)
+{
+  BatchUpload *upload = (BatchUpload *)context;
+  TransmissionState messageState = *upload->state;
+  messageState.byteOffset = byteOffset;
+  messageState.lineNumber = lineNumber;
+  return readUploadMessage(channel, *upload->file, messageState, upload->batchSize, false, message);
+}
+
+static void advanceBatch(const UploadMessage &message, void *context)
+{
+  BatchUpload *upload = (BatchUpload *)context;
+  advanceTransmissionState(channel, *upload->state, message.nextOffset, message.lineCount);
+}
+
+static bool reconnectBatch(void *context)
+{
+  BatchUpload *upload = (BatchUpload *)context;
+  upload->resumeLines.push_back(upload->state->lineNumber);
+  upload->client->disconnect();
+  return upload->client->connect("logger7");
+}
+
+static void ignoreMessage(char *, char *, int)
+{
+}
+
+class UploadBatchTest : public ::testing::Test
+{
+protected:
+  HostBroker broker;
+  WiFiClient network;
+  MQTTClient client{1024, MQTT_WRITE_BUFFER_SIZE};
+
+  std::mutex lock;
+  std::vector<ReceivedBatch> batches;
+  std::map<long, std::string> records; // by line number
+  long singleLines = 0;
+  long dropBatch = -1; // drop the connection when this batch arrives
+
+  void SetUp() override
+  {
+    hostClearLog();
+    hostUseTemporarySd({"/measurements", DIRECTORY});
+    memset(&rtcState, 0, sizeof(rtcState));
+    configRTC.logger_id = 7;
+    broker.onPublish([this](const MqttPublish &message)
+                     { receive(message); });
+    client.begin("127.0.0.1", broker.port(), network);
+    ASSERT_TRUE(client.connect("logger7"));
+  }
+
+  void TearDown() override
+  {
+    broker.onPublish(nullptr);
+    client.disconnect();
+  }
+
+  // Deck box stand-in, called by the broker before the PUBACK
+  void receive(const MqttPublish &message)
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    if (message.topic == channel.topic)
+    {
+      // A single line follows the records received so far
+      long lineNumber = records.empty() ? 0 : records.rbegin()->first + 1;
+      std::string line = message.payload;
+      if (!line.empty() && line.back() == '\r')
+      {
+        line.pop_back();
+      }
+      records[lineNumber] = line;
+      singleLines++;
+      return;
+    }
+    ASSERT_EQ(message.topic, channel.batchTopic);
+    ReceivedBatch batch;
+    batch.payload = message.payload;
+    size_t end = message.payload.find('\n');
+    std::string envelope = message.payload.substr(0, end);
+    ASSERT_EQ(envelope.rfind("{\"logger_id\":7,\"file\":\"", 0), 0u) << envelope;
+    batch.firstLine = atol(envelope.c_str() + envelope.find("\"first_line\":") + 13);
+    long count = atol(envelope.c_str() + envelope.find("\"count\":") + 8);
+    while (end + 1 < message.payload.size())
+    {
+      size_t next = message.payload.find('\n', end + 1);
+      batch.records.push_back(message.payload.substr(end + 1, next - end - 1));
+      end = next;
+    }
+    EXPECT_EQ((long)batch.records.size(), count);
+    for (size_t i = 0; i < batch.records.size(); i++)
+    {
+      auto it = records.find(batch.firstLine + i);
+      if (it != records.end())
+      {
+        EXPECT_EQ(it->second, batch.records[i]) << "line " << batch.firstLine + i << " sent again with other content";
+      }
+      records[batch.firstLine + i] = batch.records[i];
+    }
+    batches.push_back(batch);
+    if ((long)batches.size() - 1 == dropBatch)
+    {
+      broker.disconnectAll();
+    }
+  }
+
+  static std::string line(long n)
+  {
+    // Lengths from 60 to about 960 bytes, so the batch boundaries vary
+    return "{\"time\":\"2024-06-01T12:00:00Z\",\"logger_id\":7,\"line\":" + std::to_string(n) + ",\"note\":\"" + std::string((n * 37) % 900, 'a' + n % 26) + "\"}";
+  }
+
+  // Writes the lines of a header file with an empty line after every 13th, returns them
+  static std::vector<std::string> writeFile(const char *filename, long count)
+  {
+    std::vector<std::string> lines;
+    File file = SD.open(String(DIRECTORY "/") + filename, FILE_WRITE);
+    for (long n = 0; n < count; n++)
+    {
+      file.print((line(n) + "\r\n").c_str());
+      if (n % 13 == 12)
+      {
+        file.print("\r\n");
+      }
+      lines.push_back(line(n));
+    }
+    file.close();
+    return lines;
+  }
+
+  static File openAtCursor(const char *filename, TransmissionState &state)
+  {
+    if (loadTransmissionState(channel, state))
+    {
+      File file = SD.open(String(DIRECTORY "/") + state.filename);
+      checkTransmissionState(channel, file, state);
+      return file;
+    }
+    File file = SD.open(String(DIRECTORY "/") + filename);
+    strlcpy(state.filename, filename, sizeof(state.filename));
+    state.byteOffset = 0;
+    state.fileSize = file.size();
+    state.lineNumber = 0;
+    return file;
+  }
+
+  // Sends the file like transmitFileStopAndWait(), returns false after a failed publish
+  bool sendStopAndWait(const char *filename, size_t batchSize)
+  {
+    TransmissionState state;
+    File file = openAtCursor(filename, state);
+    UploadMessage message;
+    while (readUploadMessage(channel, file, state, batchSize, false, message))
+    {
+      if (message.lineCount > 0 && !client.publish(message.topic, (const char *)message.payload, message.length, false, 1))
+      {
+        saveTransmissionState(channel, state, true);
+        file.close();
+        return false;
+      }
+      advanceTransmissionState(channel, state, message.nextOffset, message.lineCount);
+    }
+    file.close();
+    clearTransmissionState(channel);
+    return true;
+  }
+
+  std::vector<std::string> receivedLines()
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    std::vector<std::string> lines;
+    long expected = 0;
+    for (const auto &entry : records)
+    {
+      EXPECT_EQ(entry.first, expected++) << "gap in the line numbers";
+      lines.push_back(entry.second);
+    }
+    return lines;
+  }
+
+  // Every batch starts where the one before ended, except after a resume
+  void expectContiguous(size_t from, size_t to)
+  {
+    for (size_t i = from + 1; i < to; i++)
+    {
+      EXPECT_EQ(batches[i].firstLine, batches[i - 1].firstLine + (long)batches[i - 1].records.size()) << "batch " << i;
+    }
+  }
+};
+
+TEST_F(UploadBatchTest, BatchesCarryTheirFirstLine)
+{
+  std::vector<std::string> lines = writeFile("header.json", 300);
+  ASSERT_TRUE(sendStopAndWait("header.json", MQTT_BATCH_MAX_PAYLOAD));
+  EXPECT_EQ(receivedLines(), lines);
+  EXPECT_EQ(singleLines, 0);
+  ASSERT_GT(batches.size(), 10u);
+  EXPECT_EQ(batches[0].firstLine, 0);
+  expectContiguous(0, batches.size());
+  for (const ReceivedBatch &batch : batches)
+  {
+    EXPECT_LE(batch.payload.size(), (size_t)MQTT_BATCH_MAX_PAYLOAD);
+  }
+}
+
+TEST_F(UploadBatchTest, LineThatDoesNotFitIsSentAlone)
+{
+  std::vector<std::string> lines = writeFile("header.json", 120);
+  ASSERT_TRUE(sendStopAndWait("header.json", 600));
+  EXPECT_EQ(receivedLines(), lines);
+  EXPECT_GT(singleLines, 0);
+  for (const ReceivedBatch &batch : batches)
+  {
+    EXPECT_LE(batch.payload.size(), 600u);
+  }
+}
+
+TEST_F(UploadBatchTest, LargestEnvelopeStaysWithinTheLimit)
+{
+  // Longest logger_id and file name of the envelope
+  configRTC.logger_id = 65535;
+  std::string filename(sizeof(rtcState.filename) - 1, 'h');
+  std::vector<std::string> lines = writeFile(filename.c_str(), 200);
+  size_t largest = 0;
+  broker.onPublish([&](const MqttPublish &message)
+                   { largest = max(largest, message.payload.size()); });
+  ASSERT_TRUE(sendStopAndWait(filename.c_str(), MQTT_BATCH_MAX_PAYLOAD));
+  EXPECT_LE(largest, (size_t)MQTT_BATCH_MAX_PAYLOAD);
+  EXPECT_GT(largest, (size_t)MQTT_BATCH_MAX_PAYLOAD - 1000);
+  // The whole packet fits into the write buffer of the client, which refuses larger packets
+  EXPECT_LE(mqttPublishPacket(channel.batchTopic, std::string(largest, 'x'), 1, false, 1).size(), (size_t)MQTT_WRITE_BUFFER_SIZE);
+}
+
+TEST_F(UploadBatchTest, InterruptedBatchIsSentAgainFromItsFirstLine)
+{
+  std::vector<std::string> lines = writeFile("header.json", 300);
+  dropBatch = 4;
+  EXPECT_FALSE(sendStopAndWait("header.json", 2000));
+  ASSERT_EQ(batches.size(), 5u);
+  ReceivedBatch dropped = batches[4];
+
+  // The checkpoint written on the failure points to the first record of the dropped batch
+  memset(&rtcState, 0, sizeof(rtcState));
+  ASSERT_TRUE(client.connect("logger7"));
+  ASSERT_TRUE(sendStopAndWait("header.json", 2000));
+  EXPECT_EQ(batches[5].firstLine, dropped.firstLine);
+  EXPECT_EQ(batches[5].payload, dropped.payload);
+  expectContiguous(0, 5);
+  expectContiguous(5, batches.size());
+  EXPECT_EQ(receivedLines(), lines);
+}
+
+TEST_F(UploadBatchTest, PipelineResumesAtTheFirstUnacknowledgedRecord)
+{
+  std::vector<std::string> lines = writeFile("header.json", 600);
+  dropBatch = 9;
+  TransmissionState state;
+  File file = openAtCursor("header.json", state);
+  BatchUpload upload = {&file, &state, 1500, &client, {}};
+  beginMqttPipeline(network, ignoreMessage);
+  ASSERT_TRUE(pipelineTransmit(readBatch, advanceBatch, reconnectBatch, &upload, state.byteOffset, state.lineNumber, 4));
+  file.close();
+
+  ASSERT_EQ(upload.resumeLines.size(), 1u);
+  // The batches up to the dropped one were sent before the drop, at most the window is sent again
+  ASSERT_GT(batches.size(), 10u);
+  EXPECT_LE(upload.resumeLines[0], batches[9].firstLine);
+  EXPECT_GE(upload.resumeLines[0], batches[9 - 3].firstLine);
+  size_t resumed = 10;
+  while (resumed < batches.size() && batches[resumed].firstLine > batches[resumed - 1].firstLine)
+  {
+    resumed++;
+  }
+  ASSERT_LT(resumed, batches.size());
+  EXPECT_EQ(batches[resumed].firstLine, upload.resumeLines[0]);
+  expectContiguous(0, resumed);
+  expectContiguous(resumed, batches.size());
+  EXPECT_EQ(state.lineNumber, 600);
+  EXPECT_EQ(receivedLines(), lines);
+}
@@ -0,0 +1,286 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Host test of the upload cursor in UploadCursor.cpp
+ *
+ * upload() sends a file like transmitFileStopAndWait() until the deck box has
+ * taken a number of messages. Then the upload ends with a failed publish
+ * (cursor saved, RTC memory kept over deep sleep) or with a reset that
+ * clears RTC memory, so only the checkpoint file on the SD card is left.
+ * The deck box keeps the lines by line number like the batch flow.
+ */
+
+#include <SD.h>
+#include <gtest/gtest.h>
+#include <map>
+
+#include "HostLog.h"
+#include "SystemVariables.h"
+#include "UploadCursor.h"
+
+#define DIRECTORY "/measurements/mqtt_measurements"
+#define FILENAME "measurement.json"
+#define CHECKPOINT "/measurements/data.cursor"
+
+static TransmissionState rtcState;
+static bool channelError;
+static TransmissionChannel channel = {"data", DIRECTORY, "hyfive/data", "/backup/measurements", CHECKPOINT, nullptr, "hyfive/dataBatch", nullptr, &rtcState, &channelError};
+
+enum class Interruption
+{
+  DeepSleep, // failed publish, the cursor is saved and RTC memory kept
+  Reset,     // RTC memory cleared, the checkpoint file is left
+};
+
+class UploadCursorTest : public ::testing::Test
+{
+protected:
+  void SetUp() override
+  {
+    hostClearLog();
+    hostUseTemporarySd({"/measurements", DIRECTORY});
+    memset(&rtcState, 0, sizeof(rtcState));
+    configRTC.logger_id = 7;
+    received.clear();
+    duplicates = 0;
+  }
+
+  std::map<long, std::string> received; // lines of the deck box by line number
+  unsigned duplicates = 0;
+
+  static std::string line(long n)
+  {
+    return "{\"time\":\"2024-06-01T12:00:" + std::to_string(10 + n % 50) + "Z\",\"logger_id\":7,\"temperature\":\"" + std::to_string(n) + ".00\"}";
+  }
+
+  // Writes lines first..first+count-1, an empty line after every 17th
+  static std::vector<std::string> writeLines(long first, long count)
+  {
+    std::vector<std::string> lines;
+    File file = SD.open(DIRECTORY "/" FILENAME, FILE_APPEND);
+    for (long n = first; n < first + count; n++)
+    {
+      file.print((line(n) + "\r\n").c_str());
+      if (n % 17 == 16)
+      {
+        file.print("\r\n");
+      }
+      lines.push_back(line(n));
+    }
+    file.close();
+    return lines;
+  }
+
+  void receive(long lineNumber, const std::string &text)
+  {
+    auto it = received.find(lineNumber);
+    if (it != received.end())
+    {
+      // Sent again, must be the same line
+      EXPECT_EQ(it->second, text) << "line " << lineNumber;
+      duplicates++;
+      return;
+    }
+    received[lineNumber] = text;
+  }
+
+  // Takes a message sent at the cursor state
+  void receive(const UploadMessage &message, const TransmissionState &state)
+  {
+    std::string payload((const char *)message.payload, message.length);
+    if (strcmp(message.topic, channel.topic) == 0)
+    {
+      // A single line is sent with its carriage return
+      EXPECT_EQ(payload.back(), '\r');
+      payload.pop_back();
+      receive(state.lineNumber, payload);
+      return;
+    }
+    ASSERT_STREQ(message.topic, channel.batchTopic);
+    size_t end = payload.find('\n');
+    long firstLine = atol(payload.c_str() + payload.find("\"first_line\":") + 13);
+    EXPECT_EQ(firstLine, state.lineNumber);
+    for (long n = firstLine; end + 1 < payload.size(); n++)
+    {
+      size_t next = payload.find('\n', end + 1);
+      receive(n, payload.substr(end + 1, next - end - 1));
+      end = next;
+    }
+  }
+
+  // Opens the file at the saved cursor like transmitChannelViaMqtt()
+  static File openAtCursor(TransmissionState &state)
+  {
+    File file;
+    if (loadTransmissionState(channel, state))
+    {
+      file = SD.open(String(DIRECTORY "/") + state.filename);
+      if (file)
+      {
+        checkTransmissionState(channel, file, state);
+      }
+      return file;
+    }
+    file = SD.open(DIRECTORY "/" FILENAME);
+    strlcpy(state.filename, FILENAME, sizeof(state.filename));
+    state.byteOffset = 0;
+    state.fileSize = file.size();
+    state.lineNumber = 0;
+    return file;
+  }
+
+  // Sends up to messageLimit messages, returns true at the end of the file
+  bool upload(unsigned messageLimit, Interruption interruption, size_t batchSize = 0)
+  {
+    TransmissionState state;
+    File file = openAtCursor(state);
+    EXPECT_TRUE(file);
+    UploadMessage message;
+    unsigned sent = 0;
+    while (readUploadMessage(channel, file, state, batchSize, false, message))
+    {
+      if (message.lineCount > 0)
+      {
+        if (sent == messageLimit)
+        {
+          file.close();
+          if (interruption == Interruption::DeepSleep)
+          {
+            saveTransmissionState(channel, state, true);
+          }
+          else
+          {
+            memset(&rtcState, 0, sizeof(rtcState));
+          }
+          return false;
+        }
+        receive(message, state);
+        sent++;
+      }
+      advanceTransmissionState(channel, state, message.nextOffset, message.lineCount);
+    }
+    file.close();
+    clearTransmissionState(channel);
+    return true;
+  }
+
+  std::vector<std::string> receivedLines() const
+  {
+    std::vector<std::string> lines;
+    long expected = 0;
+    for (const auto &entry : received)
+    {
+      EXPECT_EQ(entry.first, expected++) << "gap in the line numbers";
+      lines.push_back(entry.second);
+    }
+    return lines;
+  }
+};
+
+TEST_F(UploadCursorTest, DeepSleepResumesAtTheNextLine)
+{
+  std::vector<std::string> lines = writeLines(0, 200);
+  for (unsigned limit : {1u, 7u, 31u, 32u, 33u, 50u})
+  {
+    EXPECT_FALSE(upload(limit, Interruption::DeepSleep));
+  }
+  EXPECT_TRUE(upload(1000, Interruption::DeepSleep));
+  EXPECT_EQ(receivedLines(), lines);
+  EXPECT_EQ(duplicates, 0u);
+  EXPECT_FALSE(SD.exists(CHECKPOINT));
+}
+
+TEST_F(UploadCursorTest, ResetResendsOnlyTheLinesAfterTheCheckpoint)
+{
+  std::vector<std::string> lines = writeLines(0, 300);
+  unsigned expectedDuplicates = 0;
+  long sent = 0;
+  for (unsigned limit : {5u, 40u, 64u, 70u, 31u})
+  {
+    EXPECT_FALSE(upload(limit, Interruption::Reset));
+    // Lines after the last checkpoint are sent again
+    sent += limit;
+    unsigned lost = sent % TRANSMISSION_CHECKPOINT_INTERVAL;
+    expectedDuplicates += lost;
+    sent -= lost;
+  }
+  EXPECT_TRUE(upload(1000, Interruption::Reset));
+  EXPECT_EQ(receivedLines(), lines);
+  EXPECT_EQ(duplicates, expectedDuplicates);
+  EXPECT_TRUE(hostLogContains("Upload cursor restored from checkpoint"));
+}
+
+TEST_F(UploadCursorTest, ResetDuringBatchUpload)
+{
+  std::vector<std::string> lines = writeLines(0, 500);
+  for (unsigned limit : {1u, 3u, 2u, 5u})
+  {
+    EXPECT_FALSE(upload(limit, Interruption::Reset, 700));
+    EXPECT_FALSE(upload(limit, Interruption::DeepSleep, 700));
+  }
+  EXPECT_TRUE(upload(1000, Interruption::Reset, 700));
+  EXPECT_EQ(receivedLines(), lines);
+  EXPECT_GT(duplicates, 0u);
+  EXPECT_LT(duplicates, 4u * TRANSMISSION_CHECKPOINT_INTERVAL);
+}
+
+TEST_F(UploadCursorTest, LinesAppendedAfterTheStartAreNotLost)
+{
+  std::vector<std::string> lines = writeLines(0, 50);
+  EXPECT_FALSE(upload(40, Interruption::DeepSleep));
+  writeLines(50, 10);
+  EXPECT_TRUE(upload(1000, Interruption::DeepSleep));
+  // The cursor ends at the size of the file when the upload started, the file is moved with the rest
+  EXPECT_EQ(receivedLines(), lines);
+}
+
+TEST_F(UploadCursorTest, CheckpointBeyondATruncatedFile)
+{
+  std::vector<std::string> lines = writeLines(0, 100);
+  EXPECT_FALSE(upload(80, Interruption::Reset));
+  ASSERT_TRUE(SD.exists(CHECKPOINT));
+
+  // The card lost the end of the file after line 30, the checkpoint points beyond it
+  std::string content;
+  File file = SD.open(DIRECTORY "/" FILENAME);
+  while (file.available())
+  {
+    content += (char)file.read();
+  }
+  file.close();
+  size_t truncatedSize = content.find(line(30)) + line(30).size() + 2;
+  ASSERT_EQ(truncate("/sd" DIRECTORY "/" FILENAME, truncatedSize), 0);
+
+  received.clear();
+  duplicates = 0;
+  EXPECT_TRUE(upload(1000, Interruption::Reset));
+  EXPECT_TRUE(hostLogContains("Upload cursor not valid, file sent again"));
+  // Everything left in the file arrives, from line 0 on
+  EXPECT_EQ(receivedLines(), std::vector<std::string>(lines.begin(), lines.begin() + 31));
+}
+
+TEST_F(UploadCursorTest, CheckpointInsideALine)
+{
+  std::vector<std::string> lines = writeLines(0, 100);
+  EXPECT_FALSE(upload(64, Interruption::Reset));
+
+  // A checkpoint that does not point to the start of a line is not used
+  TransmissionState state;
+  File checkpoint = SD.open(CHECKPOINT, FILE_READ);
+  ASSERT_EQ(checkpoint.read((uint8_t *)&state, sizeof(state)), sizeof(state));
+  checkpoint.close();
+  state.byteOffset += 5;
+  checkpoint = SD.open(CHECKPOINT, FILE_WRITE);
+  checkpoint.write((const uint8_t *)&state, sizeof(state));
+  checkpoint.close();
+
+  EXPECT_TRUE(upload(1000, Interruption::Reset));
+  EXPECT_TRUE(hostLogContains("Upload cursor not valid, file sent again"));
+  EXPECT_EQ(receivedLines(), lines);
+  EXPECT_EQ(duplicates, 64u);
+}
@@ -0,0 +1,162 @@
+/*
+ * CopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Host test of the upload session in UploadSession.cpp
+ *
+ * The deck box answers hyfive/sessionRequest with a given status, like the
+ * "Upload session" node of the Node-RED flow. After the upload the logger
+ * sends "<logger_id>:done", also with a lease and nobody waiting, so the
+ * slot is free for the next logger at once. An interrupted upload keeps the
+ * lease for the next wake.
+ */
+
+#include <MQTT.h>
+#include <gtest/gtest.h>
+
+#include "HostBroker.h"
+#include "HostLog.h"
+#include "SystemVariables.h"
+#include "UploadSession.h"
+#include "loggerConfig.h"
+
+#define START_TIME 1717243200UL
+
+static void handleMessage(MQTTClient *, char *topic, char *payload, int length)
+{
+  handleSessionStatusMessage(topic, (const uint8_t *)payload, length);
+}
+
+class UploadSessionTest : public ::testing::Test
+{
+protected:
+  HostBroker broker;
+  WiFiClient network;
+  MQTTClient client{1024, 1024};
+  std::string answer;
+
+  void SetUp() override
+  {
+    hostClearLog();
+    hostSetRtcTime(START_TIME);
+    configRTC.logger_id = 7;
+    lastSuccessfulNetworkIndex = 0;
+    broker.onPublish([this](const MqttPublish &message)
+                     {
+      if (message.topic == SESSION_REQUEST_TOPIC && message.payload == "7" && !answer.empty())
+      {
+        broker.publish(SESSION_STATUS_TOPIC, answer, 1);
+      } });
+    client.begin("127.0.0.1", broker.port(), network);
+    client.onMessageAdvanced(handleMessage);
+    ASSERT_TRUE(client.connect("logger7"));
+    ASSERT_TRUE(client.subscribe(SESSION_STATUS_TOPIC, 1));
+  }
+
+  void TearDown() override
+  {
+    broker.onPublish(nullptr);
+    client.disconnect();
+    hostSetRtcTime(0);
+  }
+
+  // Status of the deck box seen by the connected logger, e.g. the answer to another logger
+  void receiveStatus(const std::string &status)
+  {
+    broker.publish(SESSION_STATUS_TOPIC, status, 1);
+    for (int i = 0; i < 20 && !broker.waitForDeliveries(10); i++)
+    {
+      client.loop();
+    }
+    client.loop();
+  }
+
+  bool doneSent()
+  {
+    for (int i = 0; i < 50; i++)
+    {
+      for (const MqttPublish &message : broker.received())
+      {
+        if (message.topic == SESSION_REQUEST_TOPIC && message.payload == "7:done")
+        {
+          return true;
+        }
+      }
+      delay(2);
+    }
+    return false;
+  }
+};
+
+TEST_F(UploadSessionTest, ReleasesWhileNobodyWaits)
+{
+  answer = "7:ready:60:0";
+  ASSERT_EQ(requestUploadSession(client), SessionReady);
+  releaseUploadSession(client);
+  EXPECT_TRUE(doneSent());
+  EXPECT_FALSE(uploadLeaseValid());
+}
+
+TEST_F(UploadSessionTest, InterruptedUploadKeepsLease)
+{
+  answer = "7:ready:60:0";
+  ASSERT_EQ(requestUploadSession(client), SessionReady);
+  // The next wake within the lease continues without handshake
+  hostSetRtcTime(START_TIME + 30);
+  EXPECT_TRUE(uploadLeaseValid());
+  releaseUploadSession(client);
+  EXPECT_TRUE(doneSent());
+  EXPECT_FALSE(uploadLeaseValid());
+}
+
+TEST_F(UploadSessionTest, ReleasesWhenAnotherLoggerIsQueued)
+{
+  answer = "7:ready:60:0";
+  ASSERT_EQ(requestUploadSession(client), SessionReady);
+  // Logger 9 is queued during the upload
+  receiveStatus("9:wait:40:1");
+  releaseUploadSession(client);
+  EXPECT_TRUE(doneSent());
+  EXPECT_FALSE(uploadLeaseValid());
+}
+
+TEST_F(UploadSessionTest, ReleasesAfterLeaseEnded)
+{
+  answer = "7:ready:60:0";
+  ASSERT_EQ(requestUploadSession(client), SessionReady);
+  hostSetRtcTime(START_TIME + 60);
+  releaseUploadSession(client);
+  EXPECT_TRUE(doneSent());
+}
+
+TEST_F(UploadSessionTest, ReleasesWithoutLease)
+{
+  // Granted while other loggers wait
+  answer = "7:ready:0:2";
+  ASSERT_EQ(requestUploadSession(client), SessionReady);
+  EXPECT_FALSE(uploadLeaseValid());
+  releaseUploadSession(client);
+  EXPECT_TRUE(doneSent());
+}
+
+TEST_F(UploadSessionTest, ReleasesForDeckBoxWithoutQueueLength)
+{
+  answer = "7:ready:60";
+  ASSERT_EQ(requestUploadSession(client), SessionReady);
+  EXPECT_TRUE(uploadLeaseValid());
+  releaseUploadSession(client);
+  EXPECT_TRUE(doneSent());
+  EXPECT_FALSE(uploadLeaseValid());
+}
+
+TEST_F(UploadSessionTest, StatusOfOtherLoggerIsNoAnswer)
+{
+  // A status for another logger carries the queue length but is no answer
+  answer = "";
+  receiveStatus("9:wait:40:1");
+  EXPECT_EQ(requestUploadSession(client), SessionNoAnswer);
+}
@@ -0,0 +1,246 @@
+'''
+ * SPDX-FileCopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Delta patches of the Logger-Mainboard firmware
+'''
+
+import argparse
+import hashlib
+import os
+import struct
+import sys
+
+'''
+    The logger asks for a patch against the SHA-256 of its running firmware on hyfive/updateFWRequest
+    ("<sha256>:<offset>:<running sha256>"). If the deck box has firmware/patches/<running sha256>.hfd it sends the
+    patch, else firmware/firmware.bin. The logger applies the patch while it arrives (FirmwareDelta.cpp) and checks
+    the SHA-256 of the result like a firmware image.
+
+    Patch (version 1), varints are unsigned LEB128:
+        "HFD" 0x01              magic and version
+        uint32 base size        size of the running firmware (little endian)
+        uint32 target size      size of the new firmware (little endian)
+        32 bytes                SHA-256 of the running firmware
+        32 bytes                SHA-256 of the new firmware
+        commands until the new firmware is complete:
+            zigzag varint seek  moves the read position in the running firmware
+            varint copy         bytes copied from the running firmware
+            varint insert       literal bytes that follow the command
+
+    Most of a new firmware is found in the old one, either moved (new index match) or at the same position
+    as the bytes before (changed addresses and constants only cost their own bytes).
+
+    usage:
+        python firmware_delta.py diff old/firmware.bin new/firmware.bin -o firmware/patches/
+        python firmware_delta.py apply old/firmware.bin patch.hfd -o firmware.bin
+        python firmware_delta.py check old/firmware.bin new/firmware.bin patch.hfd
+'''
+
+PATCH_MAGIC = b'HFD\x01'
+PATCH_EXTENSION = '.hfd'
+HEADER = struct.Struct('<4sII32s32s')
+
+# Shortest match at a new position (index) and after a change at the same position
+INDEX_KEY = 8
+MIN_INDEX_MATCH = 12
+MIN_ALIGNED_MATCH = 4
+
+
+def write_varint(out, value):
+    while value >= 0x80:
+        out.append((value & 0x7F) | 0x80)
+        value >>= 7
+    out.append(value)
+
+
+def read_varint(data, position):
+    value = 0
+    shift = 0
+    while True:
+        byte = data[position]
+        position += 1
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            return value, position
+
+
+def zigzag(value):
+    return (value << 1) ^ (value >> 63)
+
+
+def unzigzag(value):
+    return (value >> 1) ^ -(value & 1)
+
+
+def match_length(base, b, target, t):
+    '''Number of equal bytes of base from b and target from t.'''
+    length = 0
+    limit = min(len(base) - b, len(target) - t)
+    while length + 64 <= limit and base[b + length:b + length + 64] == target[t + length:t + length + 64]:
+        length += 64
+    while length < limit and base[b + length] == target[t + length]:
+        length += 1
+    return length
+
+
+def diff(base, target):
+    '''
+    :param base: running firmware
+    :param target: new firmware
+    :return: the patch
+    '''
+    index = {}
+    for position in range(len(base) - INDEX_KEY + 1):
+        index.setdefault(base[position:position + INDEX_KEY], position)
+
+    commands = [[0, 0]]     # seek, copy, literal bytes
+    base_position = 0       # read position after the last copy
+    literal_start = 0
+    t = 0
+    while t < len(target):
+        # Same position as before the literal bytes, e.g. behind a changed address
+        aligned = base_position + (t - literal_start)
+        length = match_length(base, aligned, target, t) if aligned < len(base) else 0
+        b = aligned
+        if length < MIN_ALIGNED_MATCH:
+            candidate = index.get(target[t:t + INDEX_KEY])
+            if candidate is not None:
+                candidate_length = match_length(base, candidate, target, t)
+                if candidate_length >= MIN_INDEX_MATCH:
+                    b, length = candidate, candidate_length
+        if length < MIN_ALIGNED_MATCH:
+            t += 1
+            continue
+        commands[-1].append(target[literal_start:t])
+        commands.append([b - base_position, length])
+        base_position = b + length
+        t += length
+        literal_start = t
+    commands[-1].append(target[literal_start:])
+
+    out = bytearray(HEADER.pack(PATCH_MAGIC, len(base), len(target), hashlib.sha256(base).digest(),
+                                hashlib.sha256(target).digest()))
+    for seek, copy, literal in commands:
+        write_varint(out, zigzag(seek))
+        write_varint(out, copy)
+        write_varint(out, len(literal))
+        out += literal
+    return bytes(out)
+
+
+def apply(base, patch):
+    '''
+    Mirror of applyFirmwarePatch() in FirmwareDelta.cpp.
+
+    :param base: running firmware
+    :param patch: the patch
+    :return: the new firmware
+    '''
+    if len(patch) < HEADER.size or patch[:4] != PATCH_MAGIC:
+        raise ValueError('not a firmware patch (version 1)')
+    _, base_size, target_size, base_sha256, target_sha256 = HEADER.unpack_from(patch)
+    if base_size != len(base) or hashlib.sha256(base).digest() != base_sha256:
+        raise ValueError('patch is built for the firmware {}'.format(base_sha256.hex()))
+    target = bytearray()
+    base_position = 0
+    position = HEADER.size
+    while len(target) < target_size:
+        seek, position = read_varint(patch, position)
+        copy, position = read_varint(patch, position)
+        base_position += unzigzag(seek)
+        if base_position < 0 or base_position + copy > base_size:
+            raise ValueError('copy outside the running firmware')
+        target += base[base_position:base_position + copy]
+        base_position += copy
+        insert, position = read_varint(patch, position)
+        target += patch[position:position + insert]
+        position += insert
+        if len(target) > target_size:
+            raise ValueError('patch is longer than the firmware')
+    if hashlib.sha256(target).digest() != target_sha256:
+        raise ValueError('SHA-256 of the result does not match')
+    return bytes(target)
+
+
+def read(path):
+    with open(path, 'rb') as f:
+        return f.read()
+
+
+def report(base, target, patch):
+    try:
+        ok = apply(base, patch) == target
+    except (ValueError, IndexError) as error:
+        print('FAILED: {}'.format(error))
+        return False
+    print('firmware {} -> {} bytes, patch {} bytes ({:.1f} % of the firmware, {} chunks of 480 bytes instead of {})'
+          .format(len(base), len(target), len(patch), 100 * len(patch) / len(target), (len(patch) + 479) // 480,
+                  (len(target) + 479) // 480))
+    print('running firmware {}'.format(hashlib.sha256(base).hexdigest()))
+    print('new firmware     {}'.format(hashlib.sha256(target).hexdigest()))
+    print('applied patch reproduces the new firmware' if ok else 'FAILED: applied patch differs')
+    return ok
+
+
+def diff_command(args):
+    base = read(args.base)
+    target = read(args.target)
+    patch = diff(base, target)
+    output = args.output
+    if output is None or os.path.isdir(output):
+        output = os.path.join(output or '.', hashlib.sha256(base).hexdigest() + PATCH_EXTENSION)
+    if not report(base, target, patch):
+        return 1
+    with open(output, 'wb') as f:
+        f.write(patch)
+    print('written to {}, the deck box sends it from firmware/patches/'.format(output))
+    return 0
+
+
+def apply_command(args):
+    target = apply(read(args.base), read(args.patch))
+    with open(args.output, 'wb') as f:
+        f.write(target)
+    print('{} bytes written to {}, SHA-256 {}'.format(len(target), args.output, hashlib.sha256(target).hexdigest()))
+    return 0
+
+
+def check_command(args):
+    return 0 if report(read(args.base), read(args.target), read(args.patch)) else 1
+
+
+def main():
+    parser = argparse.ArgumentParser(description='HyFiVe firmware delta patches')
+    sub = parser.add_subparsers(dest='command', required=True)
+
+    p = sub.add_parser('diff', help='create a patch from the running to the new firmware')
+    p.add_argument('base', help='firmware.bin running on the loggers')
+    p.add_argument('target', help='new firmware.bin')
+    p.add_argument('-o', '--output', help='patch file or directory, default <SHA-256 of base>.hfd')
+
+    p = sub.add_parser('apply', help='apply a patch like the logger')
+    p.add_argument('base')
+    p.add_argument('patch')
+    p.add_argument('-o', '--output', required=True)
+
+    p = sub.add_parser('check', help='check that a patch reproduces the new firmware exactly')
+    p.add_argument('base')
+    p.add_argument('target')
+    p.add_argument('patch')
+
+    args = parser.parse_args()
+    if args.command == 'diff':
+        return diff_command(args)
+    if args.command == 'apply':
+        return apply_command(args)
+    return check_command(args)
+
+
+if __name__ == '__main__':
+    sys.exit(main())
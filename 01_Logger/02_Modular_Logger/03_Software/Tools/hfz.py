@@ -0,0 +1,214 @@
+'''
+ * SPDX-FileCopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Compressor and decompressor for the .hfz streams of the Logger-Mainboard
+'''
+
+import argparse
+import struct
+import sys
+import time
+import zlib
+
+'''
+    Implements the LZSS stream of Compression.cpp. It decompresses the backups (*.hfz) copied from the
+    SD card. The benchmark reports the compression ratio and the time per MB of a file.
+
+    usage:
+        python hfz.py decompress logger_17_2025-06-01_measurement.json.hfz -o measurement.json
+        python hfz.py compress measurement.json -o measurement.json.hfz
+        python hfz.py benchmark measurement.json
+'''
+
+MAGIC = 0x315A4648  # "HFZ1"
+VERSION = 1
+WINDOW_BITS = 11
+LENGTH_BITS = 4
+MIN_MATCH = 3
+WINDOW_SIZE = 1 << WINDOW_BITS
+MAX_MATCH = MIN_MATCH + (1 << LENGTH_BITS) - 1
+HASH_BITS = 10
+MAX_CHAIN = 16
+
+HEADER = struct.Struct('<IBBBB')  # magic, version, window_bits, length_bits, reserved
+TRAILER = struct.Struct('<II')  # original_size, original_crc
+
+
+class BitWriter:
+    def __init__(self):
+        self.out = bytearray()
+        self.bits = 0
+        self.count = 0
+
+    def put(self, value, count):
+        self.bits = (self.bits << count) | value
+        self.count += count
+        while self.count >= 8:
+            self.count -= 8
+            self.out.append((self.bits >> self.count) & 0xFF)
+        self.bits &= (1 << self.count) - 1
+
+    def finish(self):
+        if self.count:
+            self.put(0, 8 - self.count)
+        return bytes(self.out)
+
+
+def hash_at(data, position):
+    value = (data[position] << 16) | (data[position + 1] << 8) | data[position + 2]
+    return ((value * 2654435761) & 0xFFFFFFFF) >> (32 - HASH_BITS)
+
+
+def compress(data):
+    # same match search and window sliding as Compression.cpp, which keeps 2 windows of the input
+    writer = BitWriter()
+    head = {}
+    chain = {}
+    base = 0
+    position = 0
+    while True:
+        fill = min(len(data), base + 2 * WINDOW_SIZE)
+        # the firmware only sees the end of the input once the window is not filled any more
+        end_of_input = len(data) - base < 2 * WINDOW_SIZE
+        while position < fill and (end_of_input or fill - position >= MAX_MATCH):
+            best_length = 0
+            best_distance = 0
+            max_length = min(MAX_MATCH, fill - position)
+            if max_length >= MIN_MATCH:
+                candidate = head.get(hash_at(data, position))
+                steps = 0
+                while candidate is not None and candidate >= base and steps < MAX_CHAIN:
+                    distance = position - candidate
+                    if distance > WINDOW_SIZE:
+                        break
+                    length = 0
+                    while length < max_length and data[candidate + length] == data[position + length]:
+                        length += 1
+                    if length > best_length:
+                        best_length = length
+                        best_distance = distance
+                        if length == max_length:
+                            break
+                    candidate = chain.get(candidate)
+                    steps += 1
+            advance = 1
+            if best_length >= MIN_MATCH:
+                writer.put(0, 1)
+                writer.put(best_distance - 1, WINDOW_BITS)
+                writer.put(best_length - MIN_MATCH, LENGTH_BITS)
+                advance = best_length
+            else:
+                writer.put(1, 1)
+                writer.put(data[position], 8)
+            for _ in range(advance):
+                if position + MIN_MATCH <= fill:
+                    h = hash_at(data, position)
+                    if h in head:
+                        chain[position] = head[h]
+                    else:
+                        chain.pop(position, None)
+                    head[h] = position
+                position += 1
+        if end_of_input and position >= fill:
+            break
+        # the firmware drops the first window, matches can not reach into it any more
+        if position - base >= WINDOW_SIZE:
+            base += WINDOW_SIZE
+    return (HEADER.pack(MAGIC, VERSION, WINDOW_BITS, LENGTH_BITS, 0) + writer.finish() +
+            TRAILER.pack(len(data), zlib.crc32(data) & 0xFFFFFFFF))
+
+
+def decompress(stream):
+    if len(stream) < HEADER.size + TRAILER.size:
+        raise ValueError('stream too short')
+    magic, version, window_bits, length_bits, _ = HEADER.unpack_from(stream, 0)
+    if magic != MAGIC or version != VERSION:
+        raise ValueError('not an hfz stream (version ' + str(VERSION) + ')')
+    original_size, original_crc = TRAILER.unpack_from(stream, len(stream) - TRAILER.size)
+    body = stream[HEADER.size:len(stream) - TRAILER.size]
+
+    out = bytearray()
+    bits = 0
+    count = 0
+    index = 0
+
+    def get(n):
+        nonlocal bits, count, index
+        while count < n:
+            if index >= len(body):
+                raise ValueError('stream truncated')
+            bits = (bits << 8) | body[index]
+            index += 1
+            count += 8
+        count -= n
+        value = (bits >> count) & ((1 << n) - 1)
+        bits &= (1 << count) - 1
+        return value
+
+    while len(out) < original_size:
+        if get(1):
+            out.append(get(8))
+        else:
+            distance = get(window_bits) + 1
+            length = get(length_bits) + MIN_MATCH
+            if distance > len(out) or len(out) + length > original_size:
+                raise ValueError('invalid match')
+            for _ in range(length):
+                out.append(out[-distance])
+    if zlib.crc32(out) & 0xFFFFFFFF != original_crc:
+        raise ValueError('CRC mismatch')
+    return bytes(out)
+
+
+def benchmark(path):
+    with open(path, 'rb') as f:
+        data = f.read()
+    start = time.perf_counter()
+    stream = compress(data)
+    compress_time = time.perf_counter() - start
+    start = time.perf_counter()
+    if decompress(stream) != data:
+        raise AssertionError('round trip failed')
+    decompress_time = time.perf_counter() - start
+
+    megabytes = len(data) / 1048576
+    print('file                     : ' + str(len(data)) + ' -> ' + str(len(stream)) + ' bytes')
+    print('ratio                    : {:.2f}'.format(len(data) / len(stream)))
+    print('host time per MB         : {:.0f} ms compress, {:.0f} ms decompress'.format(
+        compress_time * 1000 / megabytes, decompress_time * 1000 / megabytes))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='HyFiVe hfz compression')
+    sub = parser.add_subparsers(dest='command', required=True)
+
+    for name in ('compress', 'decompress'):
+        p = sub.add_parser(name)
+        p.add_argument('input', help='file or - for stdin')
+        p.add_argument('-o', '--output')
+
+    p = sub.add_parser('benchmark', help='compression ratio and time per MB of a file')
+    p.add_argument('input')
+
+    args = parser.parse_args()
+    if args.command == 'benchmark':
+        benchmark(args.input)
+        return 0
+
+    data = sys.stdin.buffer.read() if args.input == '-' else open(args.input, 'rb').read()
+    result = compress(data) if args.command == 'compress' else decompress(data)
+    if args.output:
+        with open(args.output, 'wb') as f:
+            f.write(result)
+    else:
+        sys.stdout.buffer.write(result)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
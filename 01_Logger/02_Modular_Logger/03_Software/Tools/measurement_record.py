@@ -0,0 +1,184 @@
+'''
+ * SPDX-FileCopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Converter for the binary measurement records of the Logger-Mainboard
+'''
+
+import argparse
+import json
+import struct
+import sys
+import time
+from datetime import datetime, timezone
+
+'''
+    Reads measurement.bin (and optionally measurement.idx) from the SD card of a logger and writes the
+    same JSON lines the logger uploads to hyfive/data. The slot names are taken from the "record_schema"
+    object of the logger line in configHeader.json.
+
+    usage:
+        python measurement_record.py convert measurement.bin configHeader.json -o measurement.json
+        python measurement_record.py index measurement.bin measurement.idx 2025-06-01T12:00:00Z
+        python measurement_record.py benchmark --sensors 6 --samples 3600
+'''
+
+RECORD_MAGIC = 0x42564648  # "HFVB"
+RECORD_VERSION = 1
+FILE_HEADER = struct.Struct('<IBBHHHI')  # magic, version, slot_count, record_size, logger_id, index_stride, deployment_id
+INDEX_ENTRY = struct.Struct('<II')  # record_number, time
+RECORD_BASE = struct.Struct('<II')  # time, valid_mask
+SLOT = struct.Struct('<ff')  # value, raw value
+
+
+def record_size(slot_count):
+    return RECORD_BASE.size + slot_count * SLOT.size
+
+
+def read_file_header(data):
+    magic, version, slot_count, size, logger_id, index_stride, deployment_id = FILE_HEADER.unpack_from(data, 0)
+    if magic != RECORD_MAGIC or version != RECORD_VERSION or size != record_size(slot_count):
+        raise ValueError('not a measurement record file (version ' + str(RECORD_VERSION) + ')')
+    return {'slot_count': slot_count, 'record_size': size, 'logger_id': logger_id,
+            'index_stride': index_stride, 'deployment_id': deployment_id}
+
+
+def load_schema(config_header_path, deployment_id):
+    # returns the slot names of the deployment from configHeader.json
+    with open(config_header_path, 'r') as f:
+        for line in f:
+            line = line.strip()
+            if not line:
+                continue
+            entry = json.loads(line)
+            schema = entry.get('record_schema')
+            if schema is not None and int(entry.get('deployment_id', -1)) == deployment_id:
+                return schema['slots']
+    raise ValueError('no record_schema for deployment ' + str(deployment_id))
+
+
+def iter_records(data, header):
+    # yields (time, {slot_index: (value, raw)}) for every complete record, a torn last record is ignored
+    size = header['record_size']
+    count = (len(data) - FILE_HEADER.size) // size
+    for n in range(count):
+        offset = FILE_HEADER.size + n * size
+        t, valid_mask = RECORD_BASE.unpack_from(data, offset)
+        slots = {}
+        for i in range(header['slot_count']):
+            if valid_mask & (1 << i):
+                slots[i] = SLOT.unpack_from(data, offset + RECORD_BASE.size + i * SLOT.size)
+        yield t, slots
+
+
+def iso_time(unix_time):
+    return datetime.fromtimestamp(unix_time, tz=timezone.utc).strftime('%Y-%m-%dT%H:%M:%SZ')
+
+
+def to_json_line(t, slots, names, logger_id, deployment_id):
+    # same key order and number format (Arduino String(float), 2 decimals) as the logger
+    line = {'time': iso_time(t), 'logger_id': logger_id, 'deployment_id': deployment_id}
+    for i, (value, raw) in slots.items():
+        line[names[i]] = '{:.2f}'.format(value)
+        line[names[i] + '_raw'] = '{:.2f}'.format(raw)
+    return json.dumps(line, separators=(',', ':'))
+
+
+def convert(record_path, config_header_path, out):
+    with open(record_path, 'rb') as f:
+        data = f.read()
+    header = read_file_header(data)
+    names = load_schema(config_header_path, header['deployment_id'])
+    count = 0
+    for t, slots in iter_records(data, header):
+        if slots:
+            out.write(to_json_line(t, slots, names, header['logger_id'], header['deployment_id']) + '\n')
+            count += 1
+    return count
+
+
+def find_record(record_path, index_path, iso):
+    # returns the number of the first record at or after the given time, using the sidecar index
+    target = int(datetime.strptime(iso, '%Y-%m-%dT%H:%M:%SZ').replace(tzinfo=timezone.utc).timestamp())
+    with open(record_path, 'rb') as f:
+        data = f.read()
+    header = read_file_header(data)
+    with open(index_path, 'rb') as f:
+        index = f.read()
+    start = 0
+    for n in range(len(index) // INDEX_ENTRY.size):
+        record_number, t = INDEX_ENTRY.unpack_from(index, n * INDEX_ENTRY.size)
+        if t > target:
+            break
+        start = record_number
+    for n, (t, _) in enumerate(iter_records(data[:FILE_HEADER.size] + data[FILE_HEADER.size + start * header['record_size']:], header)):
+        if t >= target:
+            return start + n
+    return None
+
+
+def benchmark(sensors, samples):
+    # compares bytes per sample and encode time of the JSON lines and the binary records
+    names = ['parameter_' + str(i) for i in range(sensors)]
+    t0 = 1717243200
+    values = [(t0 + n, {i: (10.0 + i + n * 0.01, 1000.0 + n) for i in range(sensors)}) for n in range(samples)]
+
+    start = time.perf_counter()
+    json_bytes = 0
+    for t, slots in values:
+        json_bytes += len(to_json_line(t, slots, names, 1, 1)) + 2  # println appends CR LF
+    json_time = time.perf_counter() - start
+
+    start = time.perf_counter()
+    record_bytes = FILE_HEADER.size
+    for t, slots in values:
+        record = bytearray(record_size(sensors))
+        RECORD_BASE.pack_into(record, 0, t, (1 << sensors) - 1)
+        for i, (value, raw) in slots.items():
+            SLOT.pack_into(record, RECORD_BASE.size + i * SLOT.size, value, raw)
+        record_bytes += len(record)
+    record_time = time.perf_counter() - start
+
+    print('sensors: ' + str(sensors) + ', samples: ' + str(samples))
+    print('json    : {:8.1f} bytes/sample {:8.2f} us/sample'.format(json_bytes / samples, json_time / samples * 1e6))
+    print('records : {:8.1f} bytes/sample {:8.2f} us/sample'.format(record_bytes / samples, record_time / samples * 1e6))
+    print('ratio   : {:8.2f}'.format(json_bytes / record_bytes))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='HyFiVe binary measurement records')
+    sub = parser.add_subparsers(dest='command', required=True)
+
+    p = sub.add_parser('convert', help='convert measurement.bin to JSON lines')
+    p.add_argument('records')
+    p.add_argument('config_header')
+    p.add_argument('-o', '--output')
+
+    p = sub.add_parser('index', help='find the first record at or after a time')
+    p.add_argument('records')
+    p.add_argument('index')
+    p.add_argument('time', help='YYYY-MM-DDThh:mm:ssZ')
+
+    p = sub.add_parser('benchmark', help='compare JSON lines and binary records')
+    p.add_argument('--sensors', type=int, default=6)
+    p.add_argument('--samples', type=int, default=3600)
+
+    args = parser.parse_args()
+    if args.command == 'convert':
+        out = open(args.output, 'w') if args.output else sys.stdout
+        count = convert(args.records, args.config_header, out)
+        if args.output:
+            out.close()
+        print(str(count) + ' records converted', file=sys.stderr)
+    elif args.command == 'index':
+        print(find_record(args.records, args.index, args.time))
+    else:
+        benchmark(args.sensors, args.samples)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,224 @@
+'''
+ * SPDX-FileCopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Batch messages of the MQTT upload of the Logger-Mainboard
+'''
+
+import argparse
+import json
+import socket
+import struct
+import sys
+import time
+
+'''
+    Builds and splits the batch messages sent to hyfive/headerBatch, hyfive/dataBatch and hyfive/LogBatch
+    when upload_batch_size is set in Config.json (packLineBatch() in MQTTManager.cpp). The first line of a
+    message is the envelope {"logger_id", "file", "first_line", "count"}, each following line is one record.
+
+    The benchmark compares records/s and radio-on time of the single line upload with batch messages of
+    different sizes. Without --broker it uses a link model (round trip per QoS 1 message and bit rate),
+    with --broker the messages are published to a real MQTT broker, e.g. the one of the deck box.
+
+    usage:
+        python mqtt_batch.py split payload.bin
+        python mqtt_batch.py benchmark measurement.json
+        python mqtt_batch.py benchmark measurement.json --sizes 0 1024 4032 --rtt-ms 25 --kbit 5000
+        python mqtt_batch.py benchmark measurement.json --broker 192.168.1.1 --topic-prefix test/
+'''
+
+# Limits of MQTTManager.h / MQTTManager.cpp
+MQTT_WRITE_BUFFER_SIZE = 4096
+MQTT_BATCH_MAX_PAYLOAD = MQTT_WRITE_BUFFER_SIZE - 64
+BATCH_ENVELOPE_SIZE = 128
+MMMS = 1024
+
+
+def pack(data, batch_size, logger_id=0, filename='measurement.json'):
+    '''Returns the messages of a file as (topic suffix, payload, records), like transmitChannelViaMqtt().'''
+    messages = []
+    offset = 0
+    line_number = 0
+    batch_size = min(batch_size, MQTT_BATCH_MAX_PAYLOAD)
+    while offset < len(data):
+        if batch_size > BATCH_ENVELOPE_SIZE:
+            chunk = data[offset:offset + batch_size - BATCH_ENVELOPE_SIZE]
+            end = chunk.rfind(b'\n') + 1
+            if end == 0 and offset + len(chunk) == len(data):
+                end = len(chunk)
+            records = [line.rstrip(b'\r') for line in chunk[:end].split(b'\n')]
+            records = [line for line in records if line]
+            if end > 0 and records:
+                envelope = json.dumps({'logger_id': logger_id, 'file': filename, 'first_line': line_number,
+                                       'count': len(records)}, separators=(',', ':')).encode()
+                messages.append(('Batch', envelope + b'\n' + b''.join(r + b'\n' for r in records), len(records)))
+                offset += end
+                line_number += len(records)
+                continue
+
+        # single line, as sent without batches
+        end = data.find(b'\n', offset)
+        end = len(data) if end < 0 else end + 1
+        line = data[offset:end].rstrip(b'\n')
+        offset = end
+        if line:
+            messages.append(('', line[:MMMS - 1], 1))
+            line_number += 1
+    return messages
+
+
+def split(payload):
+    '''Splits a batch message into envelope and records.'''
+    lines = [line for line in payload.split(b'\n') if line.strip()]
+    if not lines:
+        raise ValueError('empty batch')
+    envelope = json.loads(lines[0])
+    records = [line.decode() for line in lines[1:]]
+    if envelope.get('count') != len(records):
+        raise ValueError('envelope count ' + str(envelope.get('count')) + ' != ' + str(len(records)) + ' records')
+    return envelope, records
+
+
+def publish_packet_size(topic, payload):
+    # fixed header with remaining length, topic, packet identifier
+    remaining = 2 + len(topic) + 2 + len(payload)
+    length_bytes = 1 if remaining < 128 else 2 if remaining < 16384 else 3
+    return 1 + length_bytes + remaining
+
+
+def model_upload(messages, rtt_ms, kbit, connect_ms):
+    '''Radio-on time of an upload: connection, then one round trip per QoS 1 message plus transfer time.'''
+    total_bytes = 0
+    elapsed = connect_ms / 1000
+    for suffix, payload, _ in messages:
+        size = publish_packet_size('hyfive/data' + suffix, payload) + 4  # PUBACK
+        total_bytes += size
+        elapsed += rtt_ms / 1000 + size * 8 / (kbit * 1000)
+    return elapsed, total_bytes
+
+
+class MqttConnection:
+    '''Minimal MQTT 3.1.1 client, QoS 1 publish waits for the PUBACK like the logger.'''
+
+    def __init__(self, host, port, client_id):
+        self.sock = socket.create_connection((host, port), timeout=10)
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.packet_id = 0
+        client = client_id.encode()
+        variable = b'\x00\x04MQTT\x04\x02\x00\x3c' + struct.pack('>H', len(client)) + client
+        self.sock.sendall(b'\x10' + self.encode_length(len(variable)) + variable)
+        packet_type, body = self.read_packet()
+        if packet_type != 0x20 or body[1] != 0:
+            raise ConnectionError('connection refused')
+
+    @staticmethod
+    def encode_length(length):
+        out = bytearray()
+        while True:
+            byte = length % 128
+            length //= 128
+            out.append(byte | (0x80 if length else 0))
+            if not length:
+                return bytes(out)
+
+    def read_exact(self, count):
+        data = b''
+        while len(data) < count:
+            chunk = self.sock.recv(count - len(data))
+            if not chunk:
+                raise ConnectionError('connection closed')
+            data += chunk
+        return data
+
+    def read_packet(self):
+        header = self.read_exact(1)[0]
+        length = 0
+        shift = 0
+        while True:
+            byte = self.read_exact(1)[0]
+            length |= (byte & 0x7F) << shift
+            shift += 7
+            if not byte & 0x80:
+                break
+        return header & 0xF0, self.read_exact(length)
+
+    def publish(self, topic, payload):
+        self.packet_id = self.packet_id % 65535 + 1
+        topic = topic.encode()
+        variable = struct.pack('>H', len(topic)) + topic + struct.pack('>H', self.packet_id)
+        self.sock.sendall(b'\x32' + self.encode_length(len(variable) + len(payload)) + variable + payload)
+        while True:
+            packet_type, body = self.read_packet()
+            if packet_type == 0x40 and struct.unpack('>H', body[:2])[0] == self.packet_id:
+                return
+
+    def close(self):
+        self.sock.sendall(b'\xe0\x00')
+        self.sock.close()
+
+
+def live_upload(messages, host, port, topic_prefix):
+    start = time.perf_counter()
+    connection = MqttConnection(host, port, 'hyfive-batch-benchmark')
+    total_bytes = 0
+    for suffix, payload, _ in messages:
+        topic = topic_prefix + 'hyfive/data' + suffix
+        connection.publish(topic, payload)
+        total_bytes += publish_packet_size(topic, payload) + 4
+    connection.close()
+    return time.perf_counter() - start, total_bytes
+
+
+def benchmark(args):
+    with open(args.input, 'rb') as f:
+        data = f.read()
+    print('{:>10} {:>9} {:>9} {:>11} {:>12} {:>10}'.format('batch', 'messages', 'records', 'bytes', 'radio-on s', 'records/s'))
+    for size in args.sizes:
+        messages = pack(data, size)
+        records = sum(count for _, _, count in messages)
+        if args.broker:
+            elapsed, total_bytes = live_upload(messages, args.broker, args.port, args.topic_prefix)
+        else:
+            elapsed, total_bytes = model_upload(messages, args.rtt_ms, args.kbit, args.connect_ms)
+        print('{:>10} {:>9} {:>9} {:>11} {:>12.2f} {:>10.1f}'.format(
+            'single' if size == 0 else size, len(messages), records, total_bytes, elapsed, records / elapsed))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='HyFiVe MQTT batch messages')
+    sub = parser.add_subparsers(dest='command', required=True)
+
+    p = sub.add_parser('split', help='print envelope and records of a batch message')
+    p.add_argument('input', help='file or - for stdin')
+
+    p = sub.add_parser('benchmark', help='records/s and radio-on time of single line and batch upload')
+    p.add_argument('input', help='upload file, e.g. measurement.json')
+    p.add_argument('--sizes', type=int, nargs='+', default=[0, 512, 1024, 2048, MQTT_BATCH_MAX_PAYLOAD],
+                   help='upload_batch_size values, 0 is the single line upload')
+    p.add_argument('--rtt-ms', type=float, default=20.0, help='round trip of a QoS 1 message (model)')
+    p.add_argument('--kbit', type=float, default=6000.0, help='net bit rate of the Wi-Fi link (model)')
+    p.add_argument('--connect-ms', type=float, default=1500.0, help='Wi-Fi and MQTT connection time (model)')
+    p.add_argument('--broker', help='publish to this MQTT broker instead of using the model')
+    p.add_argument('--port', type=int, default=1883)
+    p.add_argument('--topic-prefix', default='benchmark/', help='prefix so the deck box flows ignore the messages')
+
+    args = parser.parse_args()
+    if args.command == 'benchmark':
+        benchmark(args)
+        return 0
+
+    payload = sys.stdin.buffer.read() if args.input == '-' else open(args.input, 'rb').read()
+    envelope, records = split(payload)
+    print(json.dumps(envelope))
+    for record in records:
+        print(record)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
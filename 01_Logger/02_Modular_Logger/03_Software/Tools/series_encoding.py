@@ -0,0 +1,161 @@
+'''
+ * SPDX-FileCopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Series encoding of the measurement data upload of the Logger-Mainboard
+'''
+
+import argparse
+import math
+import os
+import random
+import struct
+import sys
+import zlib
+
+from mqtt_batch import pack
+from measurement_record import to_json_line
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', '..', '..', '..', '03_Server', '03_Python'))
+from hyfive_series import encode_block, json_lines, decode_block  # noqa: E402
+
+'''
+    Encodes measurement files like readUploadMessage() with upload_series_encoding in Config.json: as many
+    lines as possible go into series blocks for hyfive/dataSeries (SeriesEncoding.cpp), the other lines are
+    sent as JSON. The format and the reference decoder are in 03_Server/03_Python/hyfive_series.py.
+
+    benchmark compares the bytes of the upload as JSON lines, batch messages (upload_batch_size) and series
+    blocks, and checks that the decoded blocks give back the same lines.
+    generate writes a synthetic cast (1 Hz, pressure, temperature, conductivity, oxygen) to test with.
+
+    usage:
+        python series_encoding.py benchmark measurement.json [more files]
+        python series_encoding.py generate -o cast.json --samples 3600
+        python series_encoding.py decode block.bin
+'''
+
+# Limits of MQTTManager.h
+MQTT_BATCH_MAX_PAYLOAD = 4032
+
+
+def series_messages(data, filename='measurement.json'):
+    '''Returns the messages of a file as (series block or None, lines), like transmitChannelViaMqtt().'''
+    lines = [line.rstrip(b'\r').decode() for line in data.split(b'\n')]
+    if lines and not lines[-1]:
+        lines.pop()
+    messages = []
+    line_number = 0
+    position = 0
+    while position < len(lines):
+        if not lines[position]:
+            position += 1
+            continue
+        block, count = encode_block(lines[position:], filename, line_number, MQTT_BATCH_MAX_PAYLOAD)
+        if block is None:
+            messages.append((None, [lines[position]]))
+            count = 1
+        else:
+            messages.append((block, lines[position:position + count]))
+        position += count
+        line_number += count
+    return messages
+
+
+def benchmark(args):
+    ok = True
+    print('{:>24} {:>7} {:>10} {:>10} {:>10} {:>10} {:>7}  {}'.format(
+        'file', 'lines', 'json', 'batch', 'series', 'zlib', 'ratio', 'check'))
+    for path in args.input:
+        with open(path, 'rb') as f:
+            data = f.read()
+        records = [line.rstrip(b'\r') for line in data.split(b'\n') if line.strip()]
+        json_bytes = sum(len(line) for line in records)
+        batch_bytes = sum(len(payload) for _, payload, _ in pack(data, MQTT_BATCH_MAX_PAYLOAD))
+
+        messages = series_messages(data, os.path.basename(path))
+        series_bytes = 0
+        decoded = []
+        for block, lines in messages:
+            if block is None:
+                series_bytes += len(lines[0].encode())
+                decoded += lines
+            else:
+                series_bytes += len(block)
+                decoded += json_lines(block)
+        check = decoded == [line.decode() for line in records]
+        ok &= check
+        fallback = sum(1 for block, _ in messages if block is None)
+        print('{:>24} {:>7} {:>10} {:>10} {:>10} {:>10} {:>7.1f}  {}'.format(
+            os.path.basename(path)[-24:], len(records), json_bytes, batch_bytes, series_bytes,
+            len(zlib.compress(data, 9)), json_bytes / max(series_bytes, 1),
+            ('ok' if check else 'FAILED') + ', {} blocks, {} JSON lines'.format(len(messages) - fallback, fallback)))
+    return 0 if ok else 1
+
+
+def generate(args):
+    '''A down and up cast with sensor noise, values as float32 like on the logger.'''
+    rng = random.Random(args.seed)
+    names = ['pressure', 'temperature', 'conductivity', 'oxygen']
+    t0 = 1717243200
+    with open(args.output, 'w', newline='') as f:
+        for n in range(args.samples):
+            depth = 60 * math.sin(math.pi * n / args.samples)
+            slots = {
+                0: (depth + rng.gauss(0, 0.02), 8000 + 130 * depth + rng.gauss(0, 3)),
+                1: (14 - 8 * (1 - math.exp(-depth / 15)) + rng.gauss(0, 0.005), 20000 + rng.gauss(0, 4)),
+                2: (42 - 3 * depth / 60 + rng.gauss(0, 0.01), 31000 + rng.gauss(0, 5)),
+                3: (260 - depth + rng.gauss(0, 0.3), 1.2 + rng.gauss(0, 0.001)),
+            }
+            slots = {i: tuple(round_float32(v) for v in values) for i, values in slots.items()}
+            f.write(to_json_line(t0 + n, slots, names, args.logger_id, args.deployment_id) + '\r\n')
+    print('{} samples written to {}'.format(args.samples, args.output))
+    return 0
+
+
+def round_float32(value):
+    return struct.unpack('<f', struct.pack('<f', value))[0]
+
+
+def decode(args):
+    with open(args.input, 'rb') as f:
+        block = f.read()
+    result = decode_block(block)
+    print('logger_id {}, deployment_id {}, file {}, first_line {}, {} records, {} bytes'.format(
+        result['logger_id'], result['deployment_id'], result['file'], result['first_line'], len(result['records']),
+        len(block)))
+    for line in json_lines(block):
+        print(line)
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description='HyFiVe series encoding')
+    sub = parser.add_subparsers(dest='command', required=True)
+
+    p = sub.add_parser('benchmark', help='upload bytes of measurement files as JSON, batches and series blocks')
+    p.add_argument('input', nargs='+', help='upload files, e.g. measurement.json')
+
+    p = sub.add_parser('generate', help='write a synthetic cast as JSON lines')
+    p.add_argument('-o', '--output', required=True)
+    p.add_argument('--samples', type=int, default=3600)
+    p.add_argument('--logger-id', type=int, default=1)
+    p.add_argument('--deployment-id', type=int, default=1)
+    p.add_argument('--seed', type=int, default=1)
+
+    p = sub.add_parser('decode', help='print the records of a hyfive/dataSeries payload')
+    p.add_argument('input')
+
+    args = parser.parse_args()
+    if args.command == 'benchmark':
+        return benchmark(args)
+    if args.command == 'generate':
+        return generate(args)
+    return decode(args)
+
+
+if __name__ == '__main__':
+    sys.exit(main())
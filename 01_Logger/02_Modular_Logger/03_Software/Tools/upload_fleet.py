@@ -0,0 +1,382 @@
+'''
+ * SPDX-FileCopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Upload of several loggers that surface together at one deck box
+'''
+
+import argparse
+import math
+import random
+import statistics
+import subprocess
+import sys
+import threading
+import time
+
+from upload_session import Client, publish_packet
+
+'''
+    N virtual loggers surface within a few seconds of each other and upload to one deck box over a broker. The
+    deck box answers like the "Upload session" and "function 3" nodes of the Node-RED flow, the loggers like
+    UploadSession.cpp. Reports the time until all data is uploaded and the time each logger has its radio on.
+
+        fixed       busy/not busy, retry after data_upload_retry_periode, the slot is freed 10 s after the
+                    last data ("> 10 sec")
+        backoff     busy/not busy, jittered exponential backoff (scheduleUploadBackoff()), "done" frees the slot
+        slots       the deck box queues the loggers and answers with the estimated start of their slot, the
+                    logger sleeps until then, backoff only without slot, "done" frees the slot
+        slots-lease like slots, but a logger with a lease only sends "done" once another logger waits,
+                    otherwise the slot is free GRACE_SEC after the lease. Not done by the firmware, the
+                    comparison for the kept lease
+
+    After its upload every logger wakes --wakes times more, --wake-interval after the end of the last upload,
+    and uploads --wake-upload seconds of data (status, log). A wake within a kept lease uploads without
+    handshake, the report counts these wakes.
+
+    Times are in simulated seconds, sleeps and uploads run --scale times faster. The MQTT round trips go over
+    a broker on a real port, the radio-on time of a wake is the WiFi model plus the measured time of
+    connection and handshake.
+
+    usage:
+        mosquitto -p 1883 &
+        python upload_fleet.py --loggers 20
+        python upload_fleet.py --host-broker ../Logger-Mainboard/build/host/host_broker --loggers 40 --spread 60
+'''
+
+LEASE_SEC = 60
+IDLE_SEC = 10
+GRACE_SEC = 30
+MARGIN_SEC = 2
+DEFAULT_UPLOAD_SEC = 30
+
+# UploadSession.h
+SESSION_TIMEOUT = 0.5
+SESSION_WAIT_MAX = 1800
+SESSION_BACKOFF_BASE = 15
+SESSION_BACKOFF_MAX = 600
+
+DATA_TOPIC = 'hyfive/fleetData'
+STRATEGIES = ('fixed', 'backoff', 'slots', 'slots-lease')
+
+
+class SimClock:
+    def __init__(self, scale):
+        self.scale = scale
+        self.start = time.perf_counter()
+
+    def now(self):
+        return (time.perf_counter() - self.start) / self.scale
+
+    def sleep(self, seconds):
+        if seconds > 0:
+            time.sleep(seconds * self.scale)
+
+
+class FleetDeckBox:
+    '''The upload slot of the Node-RED flow, with queue ("slots") or busy/not busy only.'''
+
+    def __init__(self, address, clock, slots):
+        self.clock = clock
+        self.slots = slots
+        self.lock = threading.Lock()
+        self.belegt = False
+        self.holder = ''
+        self.lease_until = 0.0
+        self.granted_at = 0.0
+        self.last_data = 0.0
+        self.upload_sec = DEFAULT_UPLOAD_SEC
+        self.queue = []     # [id, estimated start]
+        self.connection = Client(address[0], address[1], 'hyfive-deckbox')
+        for topic in ('hyfive/sessionRequest', DATA_TOPIC):
+            self.connection.subscribe(topic, 0)
+        self.running = True
+        threading.Thread(target=self.run, daemon=True).start()
+        threading.Thread(target=self.idle, daemon=True).start()
+
+    def grant(self, id, lease, now):
+        if not self.belegt:
+            self.granted_at = now
+        self.belegt = True
+        self.holder = id
+        self.last_data = now
+        self.lease_until = now + lease if lease > 0 else 0
+        return '{}:ready:{}:{}'.format(id, lease, len(self.queue))
+
+    def session_request(self, payload):
+        '''Mirror of the "Upload session" function, None without answer.'''
+        now = self.clock.now()
+        request = payload.split(':')
+        id = request[0]
+        self.queue = [entry for entry in self.queue if now <= entry[1] + GRACE_SEC]
+        if self.belegt and 0 < self.lease_until < now - GRACE_SEC:
+            self.belegt = False
+            self.lease_until = 0
+
+        if len(request) > 1 and request[1] == 'done':
+            if self.belegt and self.holder == id:
+                self.upload_sec = round(0.7 * self.upload_sec + 0.3 * max(now - self.granted_at, 1))
+                self.belegt = False
+                self.lease_until = 0
+            return None
+
+        if not self.slots:
+            # "function 3": the slot is free or taken
+            if self.belegt and self.holder != id:
+                return '{}:busy:0'.format(id)
+            return self.grant(id, 0, now)
+
+        position = next((i for i, entry in enumerate(self.queue) if entry[0] == id), -1)
+        if (not self.belegt and (not self.queue or position == 0)) or (self.belegt and self.holder == id):
+            if position >= 0:
+                self.queue.pop(position)
+            return self.grant(id, LEASE_SEC if not self.queue else 0, now)
+
+        free_at = now
+        if self.belegt:
+            free_at = max(now, self.granted_at + self.upload_sec, self.lease_until + GRACE_SEC if self.lease_until else 0)
+        if position < 0:
+            self.queue.append([id, 0])
+            position = len(self.queue) - 1
+        at = free_at + position * self.upload_sec
+        if position > 0:
+            at = max(at, self.queue[position - 1][1] + self.upload_sec)
+        self.queue[position][1] = at
+        return '{}:wait:{}:{}'.format(id, math.ceil(at - now) + MARGIN_SEC, len(self.queue))
+
+    def run(self):
+        while self.running:
+            try:
+                self.connection.next_packet(0.2)
+            except (ConnectionError, OSError):
+                return
+            while self.connection.messages:
+                topic, payload = self.connection.messages.pop(0)
+                with self.lock:
+                    if topic == DATA_TOPIC:
+                        self.last_data = self.clock.now()
+                        continue
+                    answer = self.session_request(payload)
+                if answer is not None:
+                    self.connection.sock.sendall(publish_packet('hyfive/sessionStatus', answer.encode()))
+
+    def idle(self):
+        '''"> 10 sec" and "function 3": the slot is freed 10 s after the last data, a lease keeps it.'''
+        while self.running:
+            self.clock.sleep(2)
+            with self.lock:
+                now = self.clock.now()
+                if self.belegt and now - self.last_data > IDLE_SEC and now >= self.lease_until:
+                    self.belegt = False
+                    self.lease_until = 0
+
+
+class VirtualLogger:
+    def __init__(self, number, address, clock, strategy, args, rng, fleet):
+        self.id = str(100 + number)
+        self.address = address
+        self.clock = clock
+        self.strategy = strategy
+        self.args = args
+        self.rng = rng
+        self.fleet = fleet
+        self.surface = rng.uniform(0, args.spread)
+        self.upload = rng.uniform(args.upload_min, args.upload_max)
+        self.uploaded = 0.0
+        self.radio = 0.0
+        self.wakes = 0
+        self.lease_wakes = 0
+        self.busy = 0
+        self.backoff_exponent = 0
+        self.lease_until = 0.0
+        self.waiting = None
+        self.done_at = None
+
+    def backoff(self):
+        '''Mirror of scheduleUploadBackoff().'''
+        window = min(SESSION_BACKOFF_BASE << min(self.backoff_exponent, 10), SESSION_BACKOFF_MAX)
+        self.backoff_exponent = min(self.backoff_exponent + 1, 10)
+        return window // 2 + self.rng.randint(0, window // 2)
+
+    def connect(self):
+        '''Connection of a wake with the subscription of the session status.'''
+        client = Client(self.address[0], self.address[1], 'HyFiVe-' + self.id)
+        client.subscribe('hyfive/sessionStatus', 1)
+        return client
+
+    def handshake(self):
+        '''One wake: connect and ask for the slot, returns the answer and the real time it took.'''
+        start = time.perf_counter()
+        client = self.connect()
+        client.send('hyfive/sessionRequest', self.id, 0)
+        answer = None
+        end = time.perf_counter() + SESSION_TIMEOUT
+        while answer is None and time.perf_counter() < end:
+            for topic, payload in client.messages:
+                if payload.split(':')[0] == self.id:
+                    answer = payload.split(':')
+            client.messages.clear()
+            if answer is None:
+                client.next_packet(end - time.perf_counter())
+        return client, answer, time.perf_counter() - start
+
+    def transmit(self, client, seconds):
+        '''Uploads, then frees the slot or keeps the lease like releaseUploadSession().'''
+        self.fleet.begin_upload()
+        end = self.clock.now() + seconds
+        while self.clock.now() < end:
+            client.send(DATA_TOPIC, self.id, 0)
+            # One second, the answers to other loggers carry the length of the queue
+            second = time.perf_counter() + self.clock.scale
+            while time.perf_counter() < second:
+                client.next_packet(second - time.perf_counter())
+            for topic, payload in client.messages:
+                status = payload.split(':')
+                if topic == 'hyfive/sessionStatus' and len(status) > 3:
+                    self.waiting = int(status[3])
+            client.messages.clear()
+        self.fleet.end_upload()
+        self.uploaded += seconds
+        keep = self.strategy == 'slots-lease' and self.waiting == 0 and self.clock.now() < self.lease_until
+        if self.strategy != 'fixed' and not keep:
+            client.send('hyfive/sessionRequest', self.id + ':done', 0)
+            self.lease_until = 0.0
+
+    def wake(self, seconds):
+        '''Wakes until the data of one upload is sent.'''
+        if self.clock.now() < self.lease_until:
+            # uploadLeaseValid(): no handshake within the lease
+            self.wakes += 1
+            self.lease_wakes += 1
+            start = time.perf_counter()
+            client = self.connect()
+            self.radio += self.args.wifi_s + time.perf_counter() - start + seconds
+            self.transmit(client, seconds)
+            client.close()
+            return
+        while True:
+            self.wakes += 1
+            client, answer, elapsed = self.handshake()
+            self.radio += self.args.wifi_s + elapsed
+            if answer is not None and answer[1] == 'ready':
+                lease = int(answer[2])
+                self.lease_until = self.clock.now() + lease - 1 if lease > 1 else 0.0
+                self.waiting = int(answer[3]) if len(answer) > 3 else None
+                self.backoff_exponent = 0
+                self.radio += seconds
+                self.transmit(client, seconds)
+                client.close()
+                return
+            client.close()
+            self.busy += 1
+            if self.strategy == 'fixed':
+                wait = self.args.retry
+            elif answer is not None and answer[1] == 'wait' and 0 < int(answer[2]) <= SESSION_WAIT_MAX:
+                self.backoff_exponent = 0
+                wait = int(answer[2])
+            else:
+                wait = self.backoff()
+            self.clock.sleep(wait)
+
+    def run(self):
+        self.clock.sleep(self.surface)
+        self.wake(self.upload)
+        for _ in range(self.args.wakes):
+            self.clock.sleep(self.args.wake_interval)
+            self.wake(self.args.wake_upload)
+        self.done_at = self.clock.now()
+
+
+class Fleet:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.active = 0
+        self.max_active = 0
+
+    def begin_upload(self):
+        with self.lock:
+            self.active += 1
+            self.max_active = max(self.max_active, self.active)
+
+    def end_upload(self):
+        with self.lock:
+            self.active -= 1
+
+
+def simulate(strategy, address, args):
+    clock = SimClock(args.scale)
+    deckbox = FleetDeckBox(address, clock, strategy in ('slots', 'slots-lease'))
+    rng = random.Random(args.seed)
+    fleet = Fleet()
+    loggers = [VirtualLogger(i, address, clock, strategy, args, random.Random(rng.random()), fleet)
+               for i in range(args.loggers)]
+    threads = [threading.Thread(target=logger.run, daemon=True) for logger in loggers]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    deckbox.running = False
+    deckbox.connection.close()
+    return loggers, fleet
+
+
+def main():
+    parser = argparse.ArgumentParser(description='HyFiVe upload of several loggers at one deck box')
+    parser.add_argument('--broker', default='127.0.0.1:1883', help='host:port of the broker, e.g. Mosquitto')
+    parser.add_argument('--host-broker', help='host_broker of the host build (test/host), started on a free port '
+                        'instead of --broker, the broker of test_deckbox_load')
+    parser.add_argument('--loggers', type=int, default=20)
+    parser.add_argument('--spread', type=float, default=20.0, help='loggers surface within this time (s)')
+    parser.add_argument('--upload-min', type=float, default=10.0, help='shortest upload of a logger (s)')
+    parser.add_argument('--upload-max', type=float, default=40.0, help='longest upload of a logger (s)')
+    parser.add_argument('--wakes', type=int, default=3, help='wakes of a logger after its upload')
+    parser.add_argument('--wake-interval', type=float, default=20.0, help='sleep between the wakes (s)')
+    parser.add_argument('--wake-upload', type=float, default=2.0, help='upload of a later wake (s)')
+    parser.add_argument('--retry', type=float, default=60.0, help='data_upload_retry_periode of "fixed" (s)')
+    parser.add_argument('--wifi-s', type=float, default=0.9, help='radio-on time of WiFi and NTP per wake (s)')
+    parser.add_argument('--scale', type=float, default=0.01, help='real seconds per simulated second')
+    parser.add_argument('--seed', type=int, default=1)
+    parser.add_argument('--strategy', choices=STRATEGIES, action='append',
+                        help='strategies to simulate, default all')
+    args = parser.parse_args()
+
+    broker = None
+    if args.host_broker:
+        broker = subprocess.Popen([args.host_broker], stdin=subprocess.PIPE, stdout=subprocess.PIPE, text=True)
+        address = ('127.0.0.1', int(broker.stdout.readline().split()[1]))
+    else:
+        host, port = args.broker.rsplit(':', 1)
+        address = (host, int(port))
+
+    print('{} loggers surface within {:.0f} s, uploads of {:.0f}..{:.0f} s, one at a time, then {} wakes '
+          'every {:.0f} s with {:.0f} s of data'.format(args.loggers, args.spread, args.upload_min, args.upload_max,
+                                                     args.wakes, args.wake_interval, args.wake_upload))
+    print('{:>11} {:>8} {:>8} {:>9} {:>9} {:>7} {:>7} {:>6} {:>9}'.format(
+        'strategy', 'drain s', 'radio s', 'radio max', 'overhead', 'wakes', 'lease', 'busy', 'parallel'))
+    failed = False
+    for strategy in args.strategy or STRATEGIES:
+        loggers, fleet = simulate(strategy, address, args)
+        drain = max(logger.done_at for logger in loggers) - min(logger.surface for logger in loggers)
+        radio = [logger.radio for logger in loggers]
+        overhead = [logger.radio - logger.uploaded for logger in loggers]
+        failed |= fleet.max_active > 1
+        print('{:>11} {:>8.0f} {:>8.1f} {:>9.1f} {:>9.1f} {:>7.1f} {:>7} {:>6} {:>9}'.format(
+            strategy, drain, statistics.mean(radio), max(radio), statistics.mean(overhead),
+            statistics.mean(logger.wakes for logger in loggers), sum(logger.lease_wakes for logger in loggers),
+            sum(logger.busy for logger in loggers), 'ok' if fleet.max_active <= 1 else 'FAILED: {}'.format(fleet.max_active)))
+    print('drain: first surfaced until the last wake is uploaded, radio: per logger on average and at most,')
+    print('overhead: radio-on time without the uploads, wakes: per logger, lease: wakes without handshake,')
+    print('parallel: never more than one upload at a time')
+
+    if broker is not None:
+        broker.stdin.close()
+        broker.wait()
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
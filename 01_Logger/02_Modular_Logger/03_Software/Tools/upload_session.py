@@ -0,0 +1,449 @@
+'''
+ * SPDX-FileCopyrightText: (C) 2024 Hensel Elektronik GmbH
+ *
+ * SPDX-License-Identifier: MPL-2.0
+ *
+ * Project: Hydrography on Fishing Vessels
+ * Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+ *
+ * Description: Time to first byte of the upload of the Logger-Mainboard
+'''
+
+import argparse
+import heapq
+import math
+import random
+import socket
+import statistics
+import struct
+import sys
+import threading
+import time
+
+from mqtt_batch import MqttConnection
+
+'''
+    Measures the time from a wake with WiFi to the first data byte of the upload, with the MQTT packets of
+    the firmware against a broker and a deck box that answers like the Node-RED flow. The link of the logger
+    goes through a proxy with the given one-way latency.
+
+        legacy      connect, 7 subscriptions, busy check and login (requestNodeRedBusyStatus(),
+                    requestNodeRedStatus(), requests with QoS 2)
+        combined    connect, 6 subscriptions, one hyfive/sessionRequest (QoS 0) and its answer (UploadSession.cpp)
+        lease       connect, 6 subscriptions, no handshake within the lease of an earlier wake
+
+    The WiFi part is a model: connectToWifiAndSyncNTP() checked the connection once per second, it now polls
+    every 50 ms and connects to the known channel and access point without scan.
+
+    usage:
+        mosquitto -p 1883 &
+        python upload_session.py --latency-ms 5
+        python upload_session.py --builtin-broker --latency-ms 20 --wakes 20
+'''
+
+LOGGER_ID = '7'
+LEASE = 60
+
+LEGACY_SUBSCRIPTIONS = [('hyfive/updateConfig', 2), ('hyfive/updateFirmwareSHA256', 2), ('hyfive/updateFW', 0),
+                        ('hyfive/nodeRedLogin', 2), ('hyfive/nodeRedBusyStatus', 2), ('hyfive/bulkStatus', 1),
+                        ('hyfive/encodingStatus', 1)]
+SESSION_SUBSCRIPTIONS = [('hyfive/updateConfig', 2), ('hyfive/updateFirmwareSHA256', 2), ('hyfive/updateFW', 0),
+                         ('hyfive/sessionStatus', 1), ('hyfive/bulkStatus', 1), ('hyfive/encodingStatus', 1)]
+
+# connectToWifiAndSyncNTP() before and after
+WIFI_POLL_BEFORE_MS = 1000
+WIFI_POLL_AFTER_MS = 50
+
+
+class LinkProxy:
+    '''TCP proxy with one-way latency, segment loss and connection drops.'''
+
+    def __init__(self, broker, latency, loss, rto, drop, seed):
+        self.broker = broker
+        self.latency = latency
+        self.loss = loss
+        self.rto = rto
+        self.drop = drop
+        self.random = random.Random(seed)
+        self.lock = threading.Lock()
+        self.server = socket.socket()
+        self.server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self.server.bind(('127.0.0.1', 0))
+        self.server.listen(4)
+        self.port = self.server.getsockname()[1]
+        self.drops = 0
+        threading.Thread(target=self.accept, daemon=True).start()
+
+    def chance(self, probability):
+        with self.lock:
+            return self.random.random() < probability
+
+    def accept(self):
+        while True:
+            client, _ = self.server.accept()
+            upstream = socket.create_connection(self.broker)
+            for sock in (client, upstream):
+                sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+            pair = [client, upstream]
+            threading.Thread(target=self.forward, args=(client, upstream, pair, True), daemon=True).start()
+            threading.Thread(target=self.forward, args=(upstream, client, pair, False), daemon=True).start()
+
+    def close(self, pair):
+        for sock in pair:
+            try:
+                sock.shutdown(socket.SHUT_RDWR)
+            except OSError:
+                pass
+            sock.close()
+
+    def forward(self, source, destination, pair, upstream):
+        queue = []
+        condition = threading.Condition()
+        state = {'last': 0.0, 'closed': False}
+
+        def deliver():
+            while True:
+                with condition:
+                    while not queue and not state['closed']:
+                        condition.wait()
+                    if not queue:
+                        return
+                    due, _, data = queue[0]
+                    wait = due - time.monotonic()
+                    if wait > 0:
+                        condition.wait(wait)
+                        continue
+                    heapq.heappop(queue)
+                try:
+                    destination.sendall(data)
+                except OSError:
+                    return
+
+        threading.Thread(target=deliver, daemon=True).start()
+        sequence = 0
+        while True:
+            try:
+                data = source.recv(65536)
+            except OSError:
+                data = b''
+            if not data:
+                break
+            # connection drops are injected on the way back, after the broker got the data
+            if not upstream and self.chance(self.drop):
+                self.drops += 1
+                self.close(pair)
+                break
+            due = time.monotonic() + self.latency
+            if self.chance(self.loss):
+                due += self.rto
+            with condition:
+                # TCP keeps the order, a delayed segment also delays the following ones
+                due = max(due, state['last'])
+                state['last'] = due
+                sequence += 1
+                heapq.heappush(queue, (due, sequence, data))
+                condition.notify()
+        with condition:
+            state['closed'] = True
+            condition.notify()
+
+
+def read_packet(sock):
+    header = sock.recv(1)
+    if not header:
+        raise ConnectionError('connection closed')
+    length = 0
+    shift = 0
+    while True:
+        byte = sock.recv(1)[0]
+        length |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            break
+    body = b''
+    while len(body) < length:
+        chunk = sock.recv(length - len(body))
+        if not chunk:
+            raise ConnectionError('connection closed')
+        body += chunk
+    return header[0], body
+
+
+def publish_packet(topic, payload, qos=0, packet_id=0):
+    topic = topic.encode()
+    variable = struct.pack('>H', len(topic)) + topic + (struct.pack('>H', packet_id) if qos else b'')
+    return bytes([0x30 | qos << 1]) + MqttConnection.encode_length(len(variable) + len(payload)) + variable + payload
+
+
+def parse_publish(header, body):
+    topic_length = struct.unpack('>H', body[:2])[0]
+    topic = body[2:2 + topic_length].decode()
+    offset = 2 + topic_length
+    packet_id = None
+    if header & 0x06:
+        packet_id = body[offset:offset + 2]
+        offset += 2
+    return topic, packet_id, body[offset:]
+
+
+class RoutingBroker:
+    '''Minimal broker for hosts without Mosquitto, QoS 2 messages are forwarded on PUBREL like Mosquitto.'''
+
+    def __init__(self):
+        self.server = socket.socket()
+        self.server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self.server.bind(('127.0.0.1', 0))
+        self.server.listen(8)
+        self.port = self.server.getsockname()[1]
+        self.lock = threading.Lock()
+        self.subscriptions = {}
+        threading.Thread(target=self.accept, daemon=True).start()
+
+    def accept(self):
+        while True:
+            sock, _ = self.server.accept()
+            sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+            threading.Thread(target=self.serve, args=(sock,), daemon=True).start()
+
+    def route(self, topic, payload):
+        with self.lock:
+            receivers = [sock for sock, topics in self.subscriptions.items() if topic in topics]
+        for sock in receivers:
+            try:
+                sock.sendall(publish_packet(topic, payload))
+            except OSError:
+                pass
+
+    def serve(self, sock):
+        pending = {}
+        with self.lock:
+            self.subscriptions[sock] = set()
+        try:
+            while True:
+                header, body = read_packet(sock)
+                kind = header & 0xF0
+                if kind == 0x10:
+                    sock.sendall(b'\x20\x02\x00\x00')
+                elif kind == 0x30:
+                    topic, packet_id, payload = parse_publish(header, body)
+                    qos = (header >> 1) & 3
+                    if qos == 0:
+                        self.route(topic, payload)
+                    elif qos == 1:
+                        sock.sendall(b'\x40\x02' + packet_id)
+                        self.route(topic, payload)
+                    else:
+                        pending[packet_id] = (topic, payload)
+                        sock.sendall(b'\x50\x02' + packet_id)
+                elif kind == 0x60:
+                    if body[:2] in pending:
+                        self.route(*pending.pop(body[:2]))
+                    sock.sendall(b'\x70\x02' + body[:2])
+                elif kind in (0x80, 0xA0):
+                    position = 2
+                    topics = []
+                    while position < len(body):
+                        length = struct.unpack('>H', body[position:position + 2])[0]
+                        topics.append(body[position + 2:position + 2 + length].decode())
+                        position += 2 + length + (1 if kind == 0x80 else 0)
+                    with self.lock:
+                        if kind == 0x80:
+                            self.subscriptions[sock].update(topics)
+                        else:
+                            self.subscriptions[sock].difference_update(topics)
+                    if kind == 0x80:
+                        sock.sendall(b'\x90' + bytes([2 + len(topics)]) + body[:2] + b'\x00' * len(topics))
+                    else:
+                        sock.sendall(b'\xb0\x02' + body[:2])
+                elif kind == 0xC0:
+                    sock.sendall(b'\xd0\x00')
+                elif kind == 0xE0:
+                    break
+        except (ConnectionError, OSError, IndexError):
+            pass
+        with self.lock:
+            self.subscriptions.pop(sock, None)
+        sock.close()
+
+
+class Client(MqttConnection):
+    '''The blocking calls of the MQTT client of the logger, every call waits for its acknowledgement.'''
+
+    def __init__(self, host, port, client_id):
+        super().__init__(host, port, client_id)
+        self.messages = []
+
+    def next_packet(self, timeout):
+        self.sock.settimeout(max(timeout, 0.001))
+        try:
+            header = self.read_exact(1)[0]
+        except socket.timeout:
+            return None, None
+        self.sock.settimeout(None)
+        length = 0
+        shift = 0
+        while True:
+            byte = self.read_exact(1)[0]
+            length |= (byte & 0x7F) << shift
+            shift += 7
+            if not byte & 0x80:
+                break
+        body = self.read_exact(length)
+        if header & 0xF0 == 0x30:
+            topic, packet_id, payload = parse_publish(header, body)
+            if header & 0x06 == 0x02:
+                self.sock.sendall(b'\x40\x02' + packet_id)
+            elif header & 0x06 == 0x04:
+                self.sock.sendall(b'\x50\x02' + packet_id)
+            self.messages.append((topic, payload.decode()))
+            return None, None
+        return header & 0xF0, body
+
+    def wait_for(self, packet_type, timeout=3.0):
+        end = time.perf_counter() + timeout
+        while time.perf_counter() < end:
+            kind, body = self.next_packet(end - time.perf_counter())
+            if kind == packet_type:
+                return body
+        raise TimeoutError('no acknowledgement')
+
+    def subscribe(self, topic, qos):
+        self.packet_id = self.packet_id % 65535 + 1
+        topic = topic.encode()
+        body = struct.pack('>H', self.packet_id) + struct.pack('>H', len(topic)) + topic + bytes([qos])
+        self.sock.sendall(b'\x82' + self.encode_length(len(body)) + body)
+        self.wait_for(0x90)
+
+    def unsubscribe(self, topic):
+        self.packet_id = self.packet_id % 65535 + 1
+        topic = topic.encode()
+        body = struct.pack('>H', self.packet_id) + struct.pack('>H', len(topic)) + topic
+        self.sock.sendall(b'\xa2' + self.encode_length(len(body)) + body)
+        self.wait_for(0xB0)
+
+    def send(self, topic, payload, qos):
+        self.packet_id = self.packet_id % 65535 + 1
+        self.sock.sendall(publish_packet(topic, payload.encode(), qos, self.packet_id))
+        if qos == 1:
+            self.wait_for(0x40)
+        elif qos == 2:
+            self.wait_for(0x50)
+            self.sock.sendall(b'\x62\x02' + struct.pack('>H', self.packet_id))
+            self.wait_for(0x70)
+
+    def wait_message(self, topic, payload, timeout):
+        end = time.perf_counter() + timeout
+        while True:
+            for message in self.messages:
+                if message == (topic, payload):
+                    self.messages.remove(message)
+                    return True
+            if time.perf_counter() >= end:
+                return False
+            self.next_packet(end - time.perf_counter())
+
+
+class DeckBox:
+    '''Answers the handshakes like the Node-RED flow, after a processing time.'''
+
+    def __init__(self, host, port, processing):
+        self.connection = Client(host, port, 'hyfive-deckbox')
+        for topic in ('hyfive/sessionRequest', 'hyfive/nodeRedRequest', 'hyfive/nodeRedBusyRequest'):
+            self.connection.subscribe(topic, 2)
+        self.processing = processing
+        threading.Thread(target=self.run, daemon=True).start()
+
+    def run(self):
+        answers = {
+            'hyfive/sessionRequest': lambda id: ('hyfive/sessionStatus', '{}:ready:{}:0'.format(id, LEASE)),
+            'hyfive/nodeRedRequest': lambda id: ('hyfive/nodeRedLogin', id),
+            'hyfive/nodeRedBusyRequest': lambda id: ('hyfive/nodeRedBusyStatus', id + '_0'),
+        }
+        while True:
+            try:
+                self.connection.next_packet(1.0)
+            except (ConnectionError, OSError):
+                return
+            while self.connection.messages:
+                topic, payload = self.connection.messages.pop(0)
+                time.sleep(self.processing)
+                answer_topic, answer = answers[topic](payload)
+                self.connection.sock.sendall(publish_packet(answer_topic, answer.encode()))
+
+
+def wake(kind, address):
+    '''One wake from the MQTT connection to the first data byte, in seconds.'''
+    start = time.perf_counter()
+    client = Client(address[0], address[1], 'HyFiVe')
+    if kind == 'legacy':
+        for topic, qos in LEGACY_SUBSCRIPTIONS:
+            client.subscribe(topic, qos)
+        client.send('hyfive/nodeRedBusyRequest', LOGGER_ID, 2)
+        ok = client.wait_message('hyfive/nodeRedBusyStatus', LOGGER_ID + '_0', 0.5)
+        client.unsubscribe('hyfive/nodeRedBusyStatus')
+        client.send('hyfive/nodeRedRequest', LOGGER_ID, 2)
+        ok &= client.wait_message('hyfive/nodeRedLogin', LOGGER_ID, 0.5)
+    else:
+        for topic, qos in SESSION_SUBSCRIPTIONS:
+            client.subscribe(topic, qos)
+        ok = True
+        if kind == 'combined':
+            client.send('hyfive/sessionRequest', LOGGER_ID, 0)
+            ok = client.wait_message('hyfive/sessionStatus', '{}:ready:{}:0'.format(LOGGER_ID, LEASE), 0.5)
+    elapsed = time.perf_counter() - start
+    client.close()
+    return elapsed, ok
+
+
+def wifi_model(association_ms, scan_ms, poll_ms, cached):
+    '''Time until the first check that sees the connection.'''
+    connected = association_ms - (scan_ms if cached else 0)
+    return math.ceil(connected / poll_ms) * poll_ms
+
+
+def main():
+    parser = argparse.ArgumentParser(description='HyFiVe time to first byte of the upload')
+    parser.add_argument('--broker', default='127.0.0.1:1883', help='host:port of the broker, e.g. Mosquitto')
+    parser.add_argument('--builtin-broker', action='store_true', help='use a minimal broker instead of --broker')
+    parser.add_argument('--latency-ms', type=float, default=5.0, help='one-way latency of the WiFi link')
+    parser.add_argument('--deckbox-ms', type=float, default=2.0, help='processing time of Node-RED')
+    parser.add_argument('--wakes', type=int, default=10)
+    parser.add_argument('--wifi-association-ms', type=float, default=650.0,
+                        help='scan, association and DHCP of the WiFi model')
+    parser.add_argument('--wifi-scan-ms', type=float, default=250.0,
+                        help='part of the association that is saved with known channel and access point')
+    args = parser.parse_args()
+
+    if args.builtin_broker:
+        broker = RoutingBroker()
+        address = ('127.0.0.1', broker.port)
+    else:
+        host, port = args.broker.rsplit(':', 1)
+        address = (host, int(port))
+    DeckBox(address[0], address[1], args.deckbox_ms / 1000)
+    proxy = LinkProxy(address, args.latency_ms / 1000, 0.0, 0.0, 0.0, 1)
+    logger = ('127.0.0.1', proxy.port)
+
+    wifi_before = wifi_model(args.wifi_association_ms, args.wifi_scan_ms, WIFI_POLL_BEFORE_MS, False)
+    wifi_after = wifi_model(args.wifi_association_ms, args.wifi_scan_ms, WIFI_POLL_AFTER_MS, True)
+    print('latency {} ms one way, WiFi model: {:.0f} ms before, {:.0f} ms after'.format(
+        args.latency_ms, wifi_before, wifi_after))
+    print('{:>9} {:>11} {:>11} {:>11} {:>13}  {}'.format('handshake', 'MQTT ms', 'min ms', 'max ms', 'with WiFi ms',
+                                                        'check'))
+    failed = False
+    for kind, wifi in (('legacy', wifi_before), ('combined', wifi_after), ('lease', wifi_after)):
+        times = []
+        ok = True
+        for _ in range(args.wakes):
+            elapsed, answered = wake(kind, logger)
+            times.append(elapsed * 1000)
+            ok &= answered
+        failed |= not ok
+        print('{:>9} {:>11.1f} {:>11.1f} {:>11.1f} {:>13.0f}  {}'.format(
+            kind, statistics.median(times), min(times), max(times), wifi + statistics.median(times),
+            'ok' if ok else 'FAILED: no answer'))
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
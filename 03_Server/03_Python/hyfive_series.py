@@ -0,0 +1,313 @@
+'''
+   SPDX-FileCopyrightText: (C) 2024 Hensel Elektronik GmbH
+
+   SPDX-License-Identifier: MPL-2.0
+
+   Project: Hydrography on Fishing Vessels
+   Project URL: <https://github.com/HyFiVeUser/HyFiVe>, <https://hyfive.info>
+
+   Description: Reference decoder (and encoder) of the series encoding of the logger data upload
+ '''
+
+import json
+import re
+import struct
+from datetime import datetime, timezone
+from decimal import ROUND_HALF_UP, Decimal
+
+"""
+    With upload_series_encoding in Config.json, and if the deck box accepts it at the start of an upload session,
+    the logger sends its measurement lines as series blocks to hyfive/dataSeries instead of one JSON line per
+    message to hyfive/data (SeriesEncoding.cpp). decode_block() returns the same records, json_lines() the same
+    JSON lines the logger would have sent.
+
+    Block (version 1), varints are unsigned LEB128, zigzag varints hold signed values:
+        "HFS" 0x01                  magic and version
+        varint logger_id
+        varint deployment_id
+        varint name length, name    upload file (UTF-8)
+        varint first_line           line number of the first record in the upload file
+        varint record count n
+        varint channel count c
+        c times: varint name length, name (UTF-8), uint8 decimals of the value strings
+        varint time of record 0 (unix seconds), then n - 1 zigzag varints: delta of delta of the time
+        c times: Gorilla XOR bit stream of the n float32 values (MSB first), padded to a whole byte
+
+    Gorilla XOR stream: the first value as 32 bits, then for each value the XOR with the previous one:
+        '0'                         same value
+        '10' + bits                 meaningful bits fit into the window of the previous value
+        '11' + 5 bits leading zeros + 5 bits (meaningful bits - 1) + meaningful bits
+"""
+
+SERIES_MAGIC = b'HFS\x01'
+SERIES_MAX_RECORDS = 128
+SERIES_VALUE_CAPACITY = 4096
+SERIES_MAX_PAYLOAD = 4032
+SERIES_MAX_CHANNELS = 64
+SERIES_MAX_DECIMALS = 7
+FIXED_KEYS = ['time', 'logger_id', 'deployment_id']
+NUMBER = re.compile(r'^-?[0-9]+(\.[0-9]+)?$')
+
+
+def write_varint(out, value):
+    while value >= 0x80:
+        out.append((value & 0x7F) | 0x80)
+        value >>= 7
+    out.append(value)
+
+
+def read_varint(data, position):
+    value = 0
+    shift = 0
+    while True:
+        byte = data[position]
+        position += 1
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            return value, position
+
+
+def zigzag(value):
+    return (value << 1) ^ (value >> 63)
+
+
+def unzigzag(value):
+    return (value >> 1) ^ -(value & 1)
+
+
+def float_bits(value):
+    return struct.unpack('<I', struct.pack('<f', value))[0]
+
+
+def bits_float(bits):
+    return struct.unpack('<f', struct.pack('<I', bits))[0]
+
+
+class BitWriter:
+    def __init__(self):
+        self.out = bytearray()
+        self.bits = 0
+
+    def write(self, value, count):
+        for i in range(count - 1, -1, -1):
+            if self.bits % 8 == 0:
+                self.out.append(0)
+            if (value >> i) & 1:
+                self.out[-1] |= 0x80 >> (self.bits % 8)
+            self.bits += 1
+
+
+class BitReader:
+    def __init__(self, data, position):
+        self.data = data
+        self.bit = position * 8
+
+    def read(self, count):
+        value = 0
+        for _ in range(count):
+            value = (value << 1) | ((self.data[self.bit // 8] >> (7 - self.bit % 8)) & 1)
+            self.bit += 1
+        return value
+
+    def position(self):
+        return (self.bit + 7) // 8
+
+
+def encode_values(values):
+    writer = BitWriter()
+    previous = float_bits(values[0])
+    writer.write(previous, 32)
+    leading = trailing = -1
+    for value in values[1:]:
+        bits = float_bits(value)
+        xor = bits ^ previous
+        previous = bits
+        if xor == 0:
+            writer.write(0, 1)
+            continue
+        writer.write(1, 1)
+        new_leading = min(32 - xor.bit_length(), 31)
+        new_trailing = (xor & -xor).bit_length() - 1
+        if leading >= 0 and new_leading >= leading and new_trailing >= trailing:
+            writer.write(0, 1)
+            writer.write(xor >> trailing, 32 - leading - trailing)
+        else:
+            leading, trailing = new_leading, new_trailing
+            meaningful = 32 - leading - trailing
+            writer.write(1, 1)
+            writer.write(leading, 5)
+            writer.write(meaningful - 1, 5)
+            writer.write(xor >> trailing, meaningful)
+    return bytes(writer.out)
+
+
+def decode_values(data, position, count):
+    reader = BitReader(data, position)
+    previous = reader.read(32)
+    values = [bits_float(previous)]
+    leading = trailing = 0
+    for _ in range(count - 1):
+        if reader.read(1):
+            if reader.read(1):
+                leading = reader.read(5)
+                meaningful = reader.read(5) + 1
+                trailing = 32 - leading - meaningful
+            previous ^= reader.read(32 - leading - trailing) << trailing
+        values.append(bits_float(previous))
+    return values, reader.position()
+
+
+def iso_time(unix_time):
+    return datetime.fromtimestamp(unix_time, tz=timezone.utc).strftime('%Y-%m-%dT%H:%M:%SZ')
+
+
+def parse_record(line):
+    """
+    :param line: JSON line of the data upload
+    :return: (time, logger_id, deployment_id, [(name, decimals, value)]) or None if it cannot be encoded
+    """
+    try:
+        record = json.loads(line, object_pairs_hook=list)
+    except ValueError:
+        return None
+    if [key for key, _ in record[:3]] != FIXED_KEYS or len(record) < 4:
+        return None
+    (_, time_text), (_, logger_id), (_, deployment_id) = record[:3]
+    try:
+        unix_time = int(datetime.strptime(time_text, '%Y-%m-%dT%H:%M:%SZ').replace(tzinfo=timezone.utc).timestamp())
+    except (TypeError, ValueError):
+        return None
+    if iso_time(unix_time) != time_text or not isinstance(logger_id, int) or not isinstance(deployment_id, int):
+        return None
+    channels = []
+    for name, text in record[3:]:
+        if not isinstance(text, str) or not NUMBER.match(text):
+            return None
+        decimals = len(text) - text.index('.') - 1 if '.' in text else 0
+        if decimals > SERIES_MAX_DECIMALS or len(channels) == SERIES_MAX_CHANNELS:
+            return None
+        value = bits_float(float_bits(float(text)))
+        if format_value(value, decimals) != text:
+            return None
+        channels.append((name, decimals, value))
+    return unix_time, logger_id, deployment_id, channels
+
+
+def format_value(value, decimals):
+    """Same string as String(value, decimals) on the logger: rounded half away from zero, no '-' for -0.0."""
+    text = format(abs(Decimal(value)).quantize(Decimal(1).scaleb(-decimals), rounding=ROUND_HALF_UP), 'f')
+    return '-' + text if value < 0 else text
+
+
+def write_name(out, name):
+    encoded = name.encode()
+    write_varint(out, len(encoded))
+    out += encoded
+
+
+def read_name(data, position):
+    length, position = read_varint(data, position)
+    return data[position:position + length].decode(), position + length
+
+
+def encode_records(records, filename, first_line):
+    first = records[0]
+    out = bytearray(SERIES_MAGIC)
+    write_varint(out, first[1])
+    write_varint(out, first[2])
+    write_name(out, filename)
+    for value in (first_line, len(records), len(first[3])):
+        write_varint(out, value)
+    for name, decimals, _ in first[3]:
+        write_name(out, name)
+        out.append(decimals)
+    write_varint(out, records[0][0])
+    delta = 0
+    for previous, record in zip(records, records[1:]):
+        write_varint(out, zigzag((record[0] - previous[0]) - delta))
+        delta = record[0] - previous[0]
+    for channel in range(len(first[3])):
+        out += encode_values([record[3][channel][2] for record in records])
+    return bytes(out)
+
+
+def encode_block(lines, filename='measurement.json', first_line=0, max_size=SERIES_MAX_PAYLOAD):
+    """
+    Mirror of encodeSeriesBatch() in SeriesEncoding.cpp.
+
+    :param lines: JSON lines starting at the upload cursor, without line ends
+    :param filename: name of the upload file
+    :param first_line: line number of the first line
+    :param max_size: largest block
+    :return: (block, number of lines in the block), (None, 0) if the first line cannot be encoded
+    """
+    records = []
+    for line in lines:
+        record = parse_record(line)
+        if record is None or len(records) == SERIES_MAX_RECORDS or \
+                (len(records) + 1) * len(record[3]) > SERIES_VALUE_CAPACITY:
+            break
+        if records and (record[1:3] != records[0][1:3] or
+                        [c[:2] for c in record[3]] != [c[:2] for c in records[0][3]]):
+            break
+        records.append(record)
+    while records:
+        block = encode_records(records, filename, first_line)
+        if len(block) <= max_size:
+            return block, len(records)
+        records = records[:len(records) // 2]
+    return None, 0
+
+
+def decode_block(block):
+    """
+    :param block: payload of a hyfive/dataSeries message
+    :return: dict with logger_id, deployment_id, file, first_line and records (dicts in the key order of the logger)
+    """
+    if block[:4] != SERIES_MAGIC:
+        raise ValueError('not a series block (version 1)')
+    position = 4
+    logger_id, position = read_varint(block, position)
+    deployment_id, position = read_varint(block, position)
+    filename, position = read_name(block, position)
+    first_line, position = read_varint(block, position)
+    count, position = read_varint(block, position)
+    channel_count, position = read_varint(block, position)
+    channels = []
+    for _ in range(channel_count):
+        name, position = read_name(block, position)
+        channels.append((name, block[position]))
+        position += 1
+
+    times = []
+    if count > 0:
+        t, position = read_varint(block, position)
+        times.append(t)
+        delta = 0
+        for _ in range(count - 1):
+            value, position = read_varint(block, position)
+            delta += unzigzag(value)
+            times.append(times[-1] + delta)
+
+    columns = []
+    for _ in channels:
+        values, position = decode_values(block, position, count)
+        columns.append(values)
+
+    records = []
+    for n in range(count):
+        record = {'time': iso_time(times[n]), 'logger_id': logger_id, 'deployment_id': deployment_id}
+        for (name, decimals), values in zip(channels, columns):
+            record[name] = format_value(values[n], decimals)
+        records.append(record)
+    return {'logger_id': logger_id, 'deployment_id': deployment_id, 'file': filename, 'first_line': first_line,
+            'records': records}
+
+
+def json_lines(block):
+    """
+    :param block: payload of a hyfive/dataSeries message
+    :return: the JSON lines as the logger writes them to measurement.json
+    """
+    return [json.dumps(record, separators=(',', ':')) for record in decode_block(block)['records']]